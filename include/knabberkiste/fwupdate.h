@@ -0,0 +1,116 @@
+/**
+ * @file fwupdate.h
+ * @author Gabriel Heinzer
+ * @brief Firmware updates over knabberCAN.
+ * 
+ * @section fwupdate-usage Usage
+ * 
+ * The flash memory is split into a bootloader, the application and a staging region, which is
+ * at least one page larger than the application. The application starts the update service,
+ * which receives new images into the staging region while the application keeps running:
+ * 
+ * @code{.c}
+ * flash_backend_declare(staging, 0x08020000, 0x20000);
+ * 
+ * fw_update_service_start(&kc_default_context, &staging);
+ * @endcode
+ * 
+ * The bootloader is a separate, small firmware at the start of the flash memory. It installs
+ * a complete image from the staging region, if there is one, and then boots the application:
+ * 
+ * @code{.c}
+ * flash_backend_declare(application, 0x08004000, 0x1C000);
+ * flash_backend_declare(staging, 0x08020000, 0x20000);
+ * 
+ * int main() {
+ *     fw_update_install(&staging, &application);
+ *     fw_update_boot(0x08004000);
+ * }
+ * @endcode
+ * 
+ * The image is broadcasted to all nodes at once, so many identical nodes are updated in the
+ * time it takes to update a single one. See the knabberCAN documentation for the protocol.
+ */
+
+#pragma once
+
+#include <knabberkiste/knabbercan.h>
+#include <knabberkiste/util/flash_writer.h>
+
+/**
+ * @brief Command which starts receiving an image.
+ */
+#define KC_COMMAND_FWUPDATE_BEGIN 0x30
+/**
+ * @brief Command which reads the chunks of the image which are missing.
+ */
+#define KC_COMMAND_FWUPDATE_STATUS 0x31
+/**
+ * @brief Command which verifies the received image and marks it for installation.
+ */
+#define KC_COMMAND_FWUPDATE_FINISH 0x32
+/**
+ * @brief Event carrying a chunk of the image.
+ */
+#define KC_EVENT_FWUPDATE_DATA 0x30
+
+/**
+ * @brief Size of the chunks of the image in bytes.
+ */
+#define FW_CHUNK_SIZE 62
+
+/**
+ * @brief Maximum number of missing chunks reported by @ref KC_COMMAND_FWUPDATE_STATUS.
+ */
+#define FW_STATUS_MISSING_COUNT 30
+
+/**
+ * @brief Status of an update, which is sent in the responses of the update commands.
+ */
+typedef enum {
+    /// @brief The command succeeded.
+    FW_STATUS_OK = 0,
+    /// @brief The image doesn't fit into the staging region.
+    FW_STATUS_TOO_LARGE,
+    /// @brief The state of the update couldn't be allocated.
+    FW_STATUS_NO_MEMORY,
+    /// @brief No update has been started.
+    FW_STATUS_NOT_STARTED,
+    /// @brief Chunks of the image are still missing.
+    FW_STATUS_INCOMPLETE,
+    /// @brief The checksum of the received image doesn't match.
+    FW_STATUS_CORRUPT
+} FW_Status_t;
+
+/**
+ * @brief Starts the update service, which receives images into the @p staging region.
+ * 
+ * The service defines the update commands and events on the context, so there can only be one
+ * update service per node.
+ * 
+ * @param ctx knabberCAN context which receives the updates.
+ * @param staging Backend of the staging region, which must remain valid while the service is running.
+ */
+void fw_update_service_start(KC_Context_t* ctx, const FlashBackend_t* staging);
+
+/**
+ * @brief Installs the image from the @p staging region to the @p application region if a complete
+ * image has been received. Call this from the bootloader before booting the application.
+ * 
+ * The image stays in the staging region until it has been installed and verified, so an
+ * installation which has been interrupted by a reset is repeated on the next boot.
+ * 
+ * @param staging Backend of the staging region.
+ * @param application Backend of the application region.
+ * 
+ * @return Whether an image has been installed.
+ */
+bool fw_update_install(const FlashBackend_t* staging, const FlashBackend_t* application);
+
+/**
+ * @brief Boots the application at @p address, whose vector table is placed at the start of the
+ * application. Call this from the bootloader before any interrupts have been enabled.
+ * 
+ * @param address Address of the application, which must be aligned to 512 bytes.
+ */
+void fw_update_boot(uint32_t address) __attribute__((noreturn));
\ No newline at end of file
@@ -21,13 +21,27 @@
  * Use @ref can_transmit_frame() to schedule a frame for tranmission. Messages are buffered
  * internally in a queue when they can't be transmitted immediately. Then, they are
  * immediately (and automatically) transmitted when the next transmit mailbox becomes
- * available.
+ * available. All three transmit mailboxes are kept filled, and the frames are transmitted
+ * in the order in which they were scheduled.
+ * 
+ * Alternatively, you can feed the transmit mailboxes yourself, without going through the
+ * internal queue. Check @ref can_tx_mailbox_available() before calling @ref can_transmit_frame(),
+ * and refill the mailboxes from @ref can_tx_callback(), which is called from the transmit
+ * interrupt every time a mailbox becomes free.
  * 
  * @section bxcan_frame_reception Frame reception
- * Received frames are automatically converted in a @ref CAN_Frame_t structure and then passed
- * to @ref can_recv_callback(). This function should be defined by your application. It is called
- * for every frame in an interrupt context. Don't perform any lengthy processing in this callback,
- * as this blocks the whole microcontroller (because it's executed inside the ISR).
+ * The header of received frames is automatically converted in a @ref CAN_ReceivedFrame_t structure
+ * and then passed to @ref can_recv_callback(). This function should be defined by your application.
+ * It is called for every frame in an interrupt context. Don't perform any lengthy processing in this
+ * callback, as this blocks the whole microcontroller (because it's executed inside the ISR).
+ * 
+ * The data of the frame is not copied into the structure. Instead, the callback reads it straight
+ * from the receive mailbox into its own buffer using @ref can_read_frame_data(). The mailbox is
+ * released once the callback returns.
+ * 
+ * Each receive interrupt reads all the frames pending in its FIFO before returning, so bursts of
+ * frames only cause a single interrupt entry. The number of frames per interrupt and the number
+ * of overruns can be checked using @ref can_get_fifo_statistics().
  * 
  * @section bxcan_error_handling Error handling
  * When an error occurs during transmission, @ref can_error_callback() is called. Note that this
@@ -91,6 +105,8 @@ typedef enum {
     CAN_FILTERBANK_5,
     /// @brief bxCAN filter bank 6
     CAN_FILTERBANK_6,
+    /// @brief bxCAN filter bank 7
+    CAN_FILTERBANK_7,
     /// @brief bxCAN filter bank 8
     CAN_FILTERBANK_8,
     /// @brief bxCAN filter bank 9
@@ -102,7 +118,9 @@ typedef enum {
     /// @brief bxCAN filter bank 12
     CAN_FILTERBANK_12,
     /// @brief bxCAN filter bank 13
-    CAN_FILTERBANK_13
+    CAN_FILTERBANK_13,
+    /// @brief Number of bxCAN filter banks
+    CAN_FILTERBANK_COUNT
 } CAN_FilterBank_t;
 
 /**
@@ -146,7 +164,7 @@ typedef enum{
  * this has some additional data members compared to CAN_Frame_t.
  */
 typedef struct {
-    /// @brief CAN frame which was received.
+    /// @brief CAN frame which was received. The data isn't filled in, see @ref can_read_frame_data().
     CAN_Frame_t frame;
     /// @brief FIFO in which the CAN frame was stored.
     CAN_FIFO_t fifo;
@@ -154,6 +172,20 @@ typedef struct {
     CAN_FilterBank_t filter_match;
 } CAN_ReceivedFrame_t;
 
+/**
+ * @brief Structure holding the receive statistics of a single FIFO.
+ */
+typedef struct {
+    /// @brief Number of receive interrupts which have been handled.
+    uint32_t irq_count;
+    /// @brief Number of frames which have been read from the FIFO.
+    uint32_t frame_count;
+    /// @brief Highest number of frames which have been read in a single interrupt.
+    uint32_t max_frames_per_irq;
+    /// @brief Number of times the FIFO has been overrun.
+    uint32_t overrun_count;
+} CAN_FIFOStatistics_t;
+
 /**
  * @brief Enumerator for all possible CAN errors codes.
  */
@@ -213,21 +245,85 @@ void can_configure_filter_bank(
     uint32_t FxR2_val
 );
 
+/**
+ * @brief Deactivates the specified filter bank. Frames are no longer accepted by this filter bank.
+ * 
+ * @param filter The filter bank to deactivate.
+ */
+void can_disable_filter_bank(CAN_FilterBank_t filter);
+
+/**
+ * @brief Sets the NVIC priority of the receive interrupt of the given FIFO. Lower values
+ * mean higher priorities. By assigning different priorities, frames in one FIFO can be
+ * received while the other FIFO is being handled.
+ * 
+ * @param fifo The FIFO of which to set the interrupt priority.
+ * @param priority NVIC priority of the interrupt.
+ */
+void can_set_fifo_priority(CAN_FIFO_t fifo, uint32_t priority);
+
+/**
+ * @brief Sets the NVIC priority of the transmit interrupt, which calls @ref can_tx_callback.
+ * Lower values mean higher priorities. The interrupt keeps priority 0 if this isn't called,
+ * so set it if the callback uses the FreeRTOS API.
+ * 
+ * @param priority NVIC priority of the interrupt.
+ */
+void can_set_tx_priority(uint32_t priority);
+
+/**
+ * @brief Gets the receive statistics of the given FIFO. Every receive interrupt reads
+ * all the pending frames of its FIFO, so the average number of frames per interrupt is
+ * frame_count / irq_count.
+ * 
+ * @param fifo The FIFO of which to get the statistics.
+ * @return The receive statistics of the FIFO.
+ */
+CAN_FIFOStatistics_t can_get_fifo_statistics(CAN_FIFO_t fifo);
+
 /**
  * @brief Transmit a single CAN frame. The CAN frame may be buffered internally
- * if the no transmit mailbox is available.
+ * if the no transmit mailbox is available. If the internal queue is full, this waits a
+ * bounded time for a mailbox to make room for the frame, also with the interrupts masked.
  * 
  * @param frame The frame to send.
+ * @return Whether the frame has been queued. If not, no frame has left the mailboxes while waiting,
+ * e.g. because no other node acknowledges them.
  */
-void can_transmit_frame(CAN_Frame_t* frame);
+bool can_transmit_frame(CAN_Frame_t* frame);
 
 /**
  * @brief Callback function called when a frame has been received. This function is 
  * bound weakly internally, i.e. can, or should, be implemented by the application.
  * 
- * @param frame Frame which was received.
+ * @param frame Frame which was received. Only the header is filled in, use
+ * @ref can_read_frame_data() to read the data. The pointer is only valid during the callback.
+ */
+void can_recv_callback(CAN_ReceivedFrame_t* frame) __attribute__((weak));
+
+/**
+ * @brief Reads the data of a received frame straight from its receive mailbox. This may only
+ * be called from within @ref can_recv_callback().
+ * 
+ * @param frame Frame passed to @ref can_recv_callback().
+ * @param dest Destination buffer, which must be able to hold ``frame->frame.dlc`` bytes.
+ */
+void can_read_frame_data(const CAN_ReceivedFrame_t* frame, void* dest);
+
+/**
+ * @brief Callback function called from the transmit interrupt after a transmit mailbox
+ * has become free. This function is bound weakly internally, i.e. can be implemented by
+ * the application.
+ */
+void can_tx_callback() __attribute__((weak));
+
+/**
+ * @brief Checks if a frame passed to @ref can_transmit_frame() would be loaded into a transmit
+ * mailbox immediately, i.e. if a mailbox is free and no frames are waiting in the internal queue.
+ * 
+ * @return Whether a transmit mailbox is available.
  */
-void can_recv_callback(CAN_ReceivedFrame_t frame) __attribute__((weak));
+bool can_tx_mailbox_available();
 
 /**
  * @brief Callback function called when an error occurred in the CAN peripheral.
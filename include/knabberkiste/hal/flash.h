@@ -0,0 +1,90 @@
+/**
+ * @file flash.h
+ * @author Gabriel Heinzer
+ * @brief HAL for erasing and programming the internal flash memory.
+ * 
+ * The flash memory can't be read while it is being erased or programmed. As this includes
+ * fetching instructions and interrupt vectors, the CPU stalls for up to a page erase time when
+ * it accesses the flash during an erase.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <knabberkiste/util/flash_writer.h>
+
+/**
+ * @brief Size of a flash page in bytes.
+ */
+#define FLASH_PAGE_BYTES 2048
+
+/**
+ * @brief Unlocks the flash memory for erasing and programming.
+ */
+void flash_unlock();
+
+/**
+ * @brief Locks the flash memory again after all operations are done.
+ */
+void flash_lock();
+
+/**
+ * @brief Starts erasing the page at @p address without waiting for it to be erased.
+ * 
+ * @param address Address of the page, which must be aligned to @ref FLASH_PAGE_BYTES.
+ * 
+ * @throws ERR_IMPOSSIBLE The address isn't aligned to a page.
+ */
+void flash_erase_start(uint32_t address);
+
+/**
+ * @brief Checks if an erase or programming operation is in progress.
+ * 
+ * @return Whether the flash memory is busy.
+ */
+bool flash_busy();
+
+/**
+ * @brief Programs @p size bytes at @p address. Blocks until the data is programmed.
+ * 
+ * @param address Address to program, which must be a multiple of 2.
+ * @param data Data to program, which may be unaligned.
+ * @param size Number of bytes to program, which must be a multiple of 2.
+ * 
+ * @throws ERR_IMPOSSIBLE The address or the size is odd.
+ * @throws ERR_RUNTIME_GENERIC The flash memory wasn't erased or is write protected.
+ */
+void flash_program(uint32_t address, const uint8_t* data, size_t size);
+
+/**
+ * @brief Declares a flash backend with the given @p name, which accesses the region of the internal
+ * flash memory at @p address.
+ * 
+ * @param name Name under which the backend can be accessed.
+ * @param address Start address of the region, which must be aligned to @ref FLASH_PAGE_BYTES.
+ * @param size Size of the region in bytes, which must be a multiple of @ref FLASH_PAGE_BYTES.
+ */
+#define flash_backend_declare(name, address, size) \
+    const FlashBackend_t name = { \
+        .page_size = FLASH_PAGE_BYTES, \
+        .size = (size), \
+        .erase_start = _flash_backend_erase_start, \
+        .busy = _flash_backend_busy, \
+        .program = _flash_backend_program, \
+        .read = _flash_backend_read, \
+        .context = (void*)(address) \
+    }
+
+/**
+ * @internal
+ * @brief Internal functions of the backend declared by @ref flash_backend_declare(). Do not use directly.
+ */
+void _flash_backend_erase_start(size_t page, void* context);
+/// @internal
+bool _flash_backend_busy(void* context);
+/// @internal
+void _flash_backend_program(size_t offset, const uint8_t* data, size_t size, void* context);
+/// @internal
+void _flash_backend_read(size_t offset, uint8_t* data, size_t size, void* context);
\ No newline at end of file
@@ -99,6 +99,54 @@ typedef enum {
  */
 void gpio_enable_port_clocks();
 
+/**
+ * @brief Enumeration of GPIO external interrupt trigger edges.
+ */
+typedef enum {
+    /// @brief Trigger on the rising edge.
+    GPIO_EXTI_TRIGGER_RISING = 0b01,
+    /// @brief Trigger on the falling edge.
+    GPIO_EXTI_TRIGGER_FALLING = 0b10,
+    /// @brief Trigger on both edges.
+    GPIO_EXTI_TRIGGER_BOTH = 0b11
+} GPIO_ExtiTrigger_t;
+
+/**
+ * @brief Type for a callback which is called from the interrupt context when the
+ * external interrupt of a pin has been triggered.
+ * 
+ * @param pin_number Number of the pin (0-15) which triggered the interrupt.
+ */
+typedef void (*GPIO_ExtiCallback_t)(uint8_t pin_number);
+
+/**
+ * @internal
+ * @brief Internal function which enables the external interrupt of a pin.
+ * 
+ * @param port_index Index of the port, i.e. 0 for port A, 1 for port B, ...
+ * @param pin_number Number of the pin.
+ * @param trigger Edges on which the interrupt is triggered.
+ * @param callback Callback which is called when the interrupt is triggered.
+ */
+void _gpio_exti_enable(uint8_t port_index, uint8_t pin_number, GPIO_ExtiTrigger_t trigger, GPIO_ExtiCallback_t callback);
+
+/**
+ * @internal
+ * @brief Internal function which disables the external interrupt of a pin.
+ * 
+ * @param pin_number Number of the pin.
+ */
+void _gpio_exti_disable(uint8_t pin_number);
+
+/**
+ * @internal
+ * @brief Internal function which sets the NVIC priority of the external interrupt of a pin.
+ * 
+ * @param pin_number Number of the pin.
+ * @param priority NVIC priority of the interrupt.
+ */
+void _gpio_exti_set_priority(uint8_t pin_number, uint32_t priority);
+
 // GPIO pin definitions
 #define __GPIO_PIN_TYPE_DEFINITION(pin_id) \
     struct __attribute__((packed)) __GPIO_PinType##pin_id { \
@@ -159,4 +207,52 @@ __GPIO_SINGLE_PORT_DEFINITION(E, 4);
 __GPIO_SINGLE_PORT_DEFINITION(F, 5);
 
 #undef __GPIO_SINGLE_PIN_DEFINITON
-#undef __GPIO_SINGLE_PORT_DEFINITION
\ No newline at end of file
+#undef __GPIO_SINGLE_PORT_DEFINITION
+
+/**
+ * @brief Gets the number (0-15) of a pin, e.g. 7 for ``PA7``.
+ * 
+ * @param pin The pin, e.g. ``PA7``.
+ */
+#define gpio_pin_number(pin) _Generic((pin), \
+    struct __GPIO_PinType0*: 0, struct __GPIO_PinType1*: 1, struct __GPIO_PinType2*: 2, struct __GPIO_PinType3*: 3, \
+    struct __GPIO_PinType4*: 4, struct __GPIO_PinType5*: 5, struct __GPIO_PinType6*: 6, struct __GPIO_PinType7*: 7, \
+    struct __GPIO_PinType8*: 8, struct __GPIO_PinType9*: 9, struct __GPIO_PinType10*: 10, struct __GPIO_PinType11*: 11, \
+    struct __GPIO_PinType12*: 12, struct __GPIO_PinType13*: 13, struct __GPIO_PinType14*: 14, struct __GPIO_PinType15*: 15)
+
+/**
+ * @brief Gets the index of the port of a pin, i.e. 0 for port A, 1 for port B, ...
+ * 
+ * @param pin The pin, e.g. ``PA7``.
+ */
+#define gpio_port_index(pin) ((uint8_t)(((uintptr_t)(pin) - GPIOA_BASE) / (GPIOB_BASE - GPIOA_BASE)))
+
+/**
+ * @brief Enables the external interrupt (EXTI) of a pin. Only one pin per pin number can
+ * use the external interrupt at a time, i.e. ``PA7`` and ``PB7`` can't be used simultaneously.
+ * Pending interrupts of the pin are cleared.
+ * 
+ * @param pin The pin, e.g. ``PA7``.
+ * @param trigger Edges on which the interrupt is triggered, see @ref GPIO_ExtiTrigger_t.
+ * @param callback Callback which is called from the interrupt context when the interrupt is
+ * triggered, see @ref GPIO_ExtiCallback_t.
+ */
+#define gpio_exti_enable(pin, trigger, callback) _gpio_exti_enable(gpio_port_index(pin), gpio_pin_number(pin), (trigger), (callback))
+
+/**
+ * @brief Disables the external interrupt (EXTI) of a pin.
+ * 
+ * @param pin The pin, e.g. ``PA7``.
+ */
+#define gpio_exti_disable(pin) _gpio_exti_disable(gpio_pin_number(pin))
+
+/**
+ * @brief Sets the NVIC priority of the external interrupt (EXTI) of a pin. Lower values mean
+ * higher priorities. The interrupt keeps priority 0 if this isn't called, so set it if the
+ * callback uses the FreeRTOS API. Pins 5-9 and 10-15 share one interrupt each, so this also
+ * sets the priority of the other pins in the same group.
+ * 
+ * @param pin The pin, e.g. ``PA7``.
+ * @param priority NVIC priority of the interrupt.
+ */
+#define gpio_exti_set_priority(pin, priority) _gpio_exti_set_priority(gpio_pin_number(pin), (priority))
\ No newline at end of file
@@ -3,11 +3,21 @@
  * @author Gabriel Heinzer
  * @brief Provides the CMSIS include header for the used chip (STM32F303xC). This
  * also provides some Cortex- and STM32-specific macros.
+ * 
+ * If a header named knabberkiste_device.h can be found, it is included instead of the
+ * CMSIS header. This allows building the library against a software model of the
+ * peripherals, e.g. to run the HALs on the host. Such a header must provide the same
+ * register definitions (CAN, RCC, NVIC functions, ...) as the CMSIS header, and calls the
+ * interrupt handlers (e.g. USB_LP_CAN_RX0_IRQHandler) itself.
  */
 
 #pragma once
 
-#include <stm32f303xc.h>
+#if __has_include("knabberkiste_device.h")
+    #include "knabberkiste_device.h"
+#else
+    #include <stm32f303xc.h>
+#endif
 #include <knabberkiste/util/bit_manipulation.h>
 
 /**
@@ -2,12 +2,35 @@
  * @file knabbercan.h
  * @author Gabriel Heinzer
  * @brief knabberCAN protocol implementation.
+ * 
+ * The bitrate, the GPIO pins and the settle delay used while addressing (KC_BITRATE, KC_*_PIN,
+ * KC_SETTLE_DELAY()) can be overridden by providing a header named knabbercan_config.h, e.g.
+ * to map the DAISY and CONN signals to simulated pins.
+ * 
+ * Commands and events are best attached using a handler table declared with
+ * @ref kc_handler_table_declare(), which is stored in flash. Handlers defined at runtime
+ * using @ref kc_command_define() or @ref kc_event_define() take up one of the
+ * KC_OVERFLOW_HANDLER_COUNT slots of the context, which can also be overridden by
+ * knabbercan_config.h. The RAM used by a context is given by @ref KC_CONTEXT_RAM_SIZE.
+ * 
+ * C++ code can use the typed front end of knabbercan.hpp instead of decoding payloads by hand.
  */
 
 #pragma once
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <knabberkiste/util/fifo.h>
+#include <knabberkiste/util/ring.h>
+#include <knabberkiste/util/slab.h>
+
+/* Configuration, which may be overridden by knabbercan_config.h */
+#if __has_include("knabbercan_config.h")
+    #include "knabbercan_config.h"
+#endif
 
 /* Global variables */
 /**
@@ -25,6 +48,13 @@ typedef uint8_t KC_TransactionID_t;
  */
 typedef uint8_t KC_Address_t;
 
+/**
+ * @brief Opaque type for a knabberCAN context. A context holds the complete state of a
+ * single knabberCAN node, i.e. its address, its commands and events and its buffers.
+ * Declare contexts using @ref kc_context_declare().
+ */
+typedef struct _KC_Context KC_Context_t;
+
 /**
  * @brief KnabberCAN state machine enumerator.
  */
@@ -57,13 +87,16 @@ typedef enum {
  * @brief Struct representing an event frame which was received from the knabberCAN bus.
  */
 typedef struct {
+    /// @brief knabberCAN context which received the frame.
+    KC_Context_t* kc_context;
     /// @brief Address of the node which emitted the event.
     KC_Address_t sender_address;
     /// @brief Unique identifier of the event.
     KC_TransactionID_t event_id;
     /// @brief Size of the payload which is stored in @ref payload.
     size_t payload_size;
-    /// @brief Pointer to a buffer storing the payload. This is allocated using @ref varbuf.h.
+    /// @brief Pointer to a buffer storing the payload, or a null pointer if the payload is empty. The buffer
+    /// is taken from a static pool and returned to it after the callback, so don't keep a reference to it.
     void* payload;
 } KC_Received_EventFrame_t;
 
@@ -71,6 +104,8 @@ typedef struct {
  * @brief Struct representing a command frame which was received from the knabberCAN bus.
  */
 typedef struct {
+    /// @brief knabberCAN context which received the frame.
+    KC_Context_t* kc_context;
     /// @brief Address of the node which sent the command.
     KC_Address_t sender_address;
     /// @brief Address of the node which received the command. This should either be the receiver address, or the broadcast address.
@@ -79,7 +114,8 @@ typedef struct {
     KC_TransactionID_t command_id;
     /// @brief Size of the payload which is stored in @ref payload.
     size_t payload_size;
-    /// @brief Pointer to a buffer storing the payload. This is allocated using @ref varbuf.h.
+    /// @brief Pointer to a buffer storing the payload, or a null pointer if the payload is empty. The buffer
+    /// is taken from a static pool and returned to it after the callback, so don't keep a reference to it.
     uint8_t* payload;
 } KC_Received_CommandFrame_t;
 
@@ -98,24 +134,605 @@ typedef struct {
 } KC_Response_t;
 
 /**
- * @brief Struct representing an error frome received from the knabberCAN bus.
- * 
+ * @brief Outcome of a command sent using @ref kc_command_send().
+ */
+typedef enum {
+    /// @brief The response has been received.
+    KC_RESPONSE_RECEIVED = 0,
+    /// @brief No response has been received before the timeout expired.
+    KC_RESPONSE_TIMEOUT
+} KC_ResponseStatus_t;
+
+/**
+ * @brief Struct representing a response frame which was received from the knabberCAN bus.
  */
 typedef struct {
+    /// @brief knabberCAN context which received the frame.
+    KC_Context_t* kc_context;
+    /// @brief Whether the response has been received or the command timed out.
+    KC_ResponseStatus_t status;
+    /// @brief Address of the node which sent the response, i.e. which received the command.
+    KC_Address_t sender_address;
+    /// @brief Unique identifier of the command.
+    KC_TransactionID_t command_id;
+    /// @brief Size of the payload which is stored in @ref payload. This is 0 on a timeout.
+    size_t payload_size;
+    /// @brief Pointer to a buffer storing the payload, or a null pointer if the payload is empty. The buffer
+    /// is taken from a static pool and returned to it after the callback, so don't keep a reference to it.
+    uint8_t* payload;
+} KC_Received_ResponseFrame_t;
+
+/**
+ * @brief Struct representing an error frame received from the knabberCAN bus, see @ref kc_error_listen().
+ */
+typedef struct {
+    /// @brief knabberCAN context which received the frame.
+    KC_Context_t* kc_context;
     /// @brief Address from which the error was sent.
     KC_Address_t sender_address;
     /// @brief Address which should receive the error. This should either be the receiver address, or the broadcast address.
     KC_Address_t receiver_address;
-    /// @brief Error code received with the error.
+    /// @brief Error code received with the error, i.e. an @ref error_code_t.
     KC_TransactionID_t error_code;
-    /// @brief Error message received with the error.
+    /// @brief Null-terminated error message received with the error, which is only valid during the callback.
     const char* error_message;
 } KC_Received_ErrorFrame_t;
 
+/**
+ * @brief Struct representing a chunk of a stream received from the knabberCAN bus, see @ref kc_stream_listen().
+ * The chunks of a stream are passed in order, the last chunk ends at @ref total_size.
+ */
+typedef struct {
+    /// @brief knabberCAN context which received the chunk.
+    KC_Context_t* kc_context;
+    /// @brief Address of the node which sends the stream.
+    KC_Address_t sender_address;
+    /// @brief Application-defined identifier of the stream, as passed to @ref kc_stream_send().
+    uint8_t stream_id;
+    /// @brief Total size of the stream in bytes.
+    uint32_t total_size;
+    /// @brief Offset of the chunk within the stream.
+    uint32_t offset;
+    /// @brief Size of the chunk.
+    size_t size;
+    /// @brief Pointer to the data of the chunk, which is only valid during the callback.
+    const uint8_t* data;
+    /// @brief Whether the stream has been abandoned by the sender. No data is passed in this case.
+    bool aborted;
+} KC_Received_StreamChunk_t;
+
 /// @brief Type for a callback which may be assigned to an event.
 typedef void (*KC_EventCallback_t)(KC_Received_EventFrame_t);
 /// @brief Type for a callback which may be assigned to handle a command.
 typedef KC_Response_t (*KC_CommandCallback_t)(KC_Received_CommandFrame_t);
+/// @brief Type for a callback which is called when the response to a command sent using @ref kc_command_send()
+/// has been received or has timed out.
+typedef void (*KC_ResponseCallback_t)(KC_Received_ResponseFrame_t response, void* context);
+/// @brief Type for a callback which is called for every error frame received, see @ref kc_error_listen().
+typedef void (*KC_ErrorCallback_t)(KC_Received_ErrorFrame_t error, void* context);
+/// @brief Type for a callback which is called once a message passed to @ref kc_frame_transmit_async() has been
+/// handed to the CAN hardware. This may be called from an interrupt context, but never from within a critical section.
+typedef void (*KC_TransmitCallback_t)(void* context);
+/// @brief Type for a callback which consumes the chunks of received streams, see @ref kc_stream_listen(). Returning
+/// false aborts the stream.
+typedef bool (*KC_StreamCallback_t)(KC_Received_StreamChunk_t chunk, void* context);
+/// @brief Type for a callback which provides the @p size bytes of a stream at @p offset, see @ref kc_stream_send().
+/// The same range may be requested again if it has to be retransmitted. Returning false aborts the stream.
+typedef bool (*KC_StreamReadCallback_t)(uint32_t offset, uint8_t* buffer, size_t size, void* context);
+
+/**
+ * @brief Entry of a handler table, which attaches a callback to an event or a command.
+ * Create entries using @ref KC_EVENT_HANDLER() and @ref KC_COMMAND_HANDLER().
+ */
+typedef struct {
+    /// @brief Frame type handled by the entry, either @ref KC_FRAMETYPE_EVENT or @ref KC_FRAMETYPE_COMMAND.
+    uint8_t frame_type;
+    /// @brief Event ID or command ID handled by the entry.
+    KC_TransactionID_t transaction_id;
+    union {
+        /// @brief Callback of an event entry.
+        KC_EventCallback_t event;
+        /// @brief Callback of a command entry.
+        KC_CommandCallback_t command;
+    };
+} KC_Handler_t;
+
+/**
+ * @brief Table of handlers which is attached to a context at compile time, see
+ * @ref kc_handler_table_declare().
+ */
+typedef struct {
+    /// @brief Entries of the table, ordered by frame type and transaction ID.
+    const KC_Handler_t* handlers;
+    /// @brief Number of entries of the table.
+    size_t count;
+} KC_HandlerTable_t;
+
+/**
+ * @brief Handler table entry attaching @p callback to the event @p event_id.
+ */
+#define KC_EVENT_HANDLER(event_id, callback) { .frame_type = KC_FRAMETYPE_EVENT, .transaction_id = (event_id), .event = (callback) }
+
+/**
+ * @brief Handler table entry attaching @p callback to the command @p command_id.
+ */
+#define KC_COMMAND_HANDLER(command_id, callback) { .frame_type = KC_FRAMETYPE_COMMAND, .transaction_id = (command_id), .command = (callback) }
+
+/**
+ * @brief Declares a new handler table with the given @p name, which is placed in flash. You can
+ * specify additional qualifiers for the table variable, e.g. static.
+ * 
+ * All the events must be listed before the commands, and both must be listed by ascending
+ * ID, as the handlers are looked up using a binary search. This is checked by @ref kc_init().
+ * 
+ * @code{.c}
+ * kc_handler_table_declare(kc_default_handler_table,
+ *     KC_EVENT_HANDLER(0x20, on_temperature),
+ *     KC_EVENT_HANDLER(0x21, on_humidity),
+ *     KC_COMMAND_HANDLER(0x20, read_temperature)
+ * );
+ * @endcode
+ * 
+ * @param name Name under which the table can be accessed.
+ * @param qualifiers Additional qualifiers which will be placed before the type of the table.
+ * @param ... Entries of the table.
+ */
+#define kc_handler_table_declare_qualifier(name, qualifiers, ...) \
+    static const KC_Handler_t TOKEN_CONCAT(__INTERNAL_KC_HANDLERS_, name)[] = { __VA_ARGS__ }; \
+    qualifiers const KC_HandlerTable_t name = { \
+        .handlers = TOKEN_CONCAT(__INTERNAL_KC_HANDLERS_, name), \
+        .count = sizeof(TOKEN_CONCAT(__INTERNAL_KC_HANDLERS_, name)) / sizeof(KC_Handler_t) \
+    }
+
+/**
+ * @brief Declares a new handler table with the given @p name, which is placed in flash.
+ * 
+ * @param name Name under which the table can be accessed.
+ * @param ... Entries of the table.
+ */
+#define kc_handler_table_declare(name, ...) kc_handler_table_declare_qualifier(name,, __VA_ARGS__)
+
+/**
+ * @brief Latency statistics of the received frames, see @ref kc_get_dispatch_statistics().
+ */
+typedef struct {
+    /// @brief Number of CPU cycles between the reception and the dispatch of the last frame.
+    uint32_t last_latency_cycles;
+    /// @brief Maximum number of CPU cycles between the reception and the dispatch of a frame.
+    uint32_t max_latency_cycles;
+    /// @brief Number of frames which have been dispatched.
+    uint32_t dispatched_frames;
+} KC_DispatchStatistics_t;
+
+/**
+ * @brief Statistics of the receive interrupt, see @ref kc_get_receive_statistics(). Broken CAN
+ * frames are dropped and counted instead of throwing an error, so a noisy bus never takes the
+ * node offline. A broken transaction is discarded as a whole and counted once.
+ */
+typedef struct {
+    /// @brief Number of messages which have been received completely.
+    uint32_t received_messages;
+    /// @brief Number of CAN frames dropped because of a standard identifier or the RTR bit.
+    uint32_t invalid_identifiers;
+    /// @brief Number of transactions discarded because their sender started a new transaction before their last frame.
+    uint32_t incomplete_transactions;
+    /// @brief Number of transactions discarded because of a wrong frame counter, i.e. a lost frame.
+    uint32_t counter_errors;
+    /// @brief Number of CAN frames dropped because the first frame of their transaction is missing.
+    uint32_t missing_first_frames;
+    /// @brief Number of transactions dropped because the reassembly table was full.
+    uint32_t reassembly_overflows;
+    /// @brief Number of transactions discarded because the payload pool was exhausted.
+    uint32_t payload_pool_exhausted;
+    /// @brief Number of transactions discarded because their payload exceeds KC_MAX_PAYLOAD_SIZE.
+    uint32_t oversized_payloads;
+    /// @brief Number of complete messages dropped because the receive FIFO was full.
+    uint32_t receive_fifo_overruns;
+} KC_ReceiveStatistics_t;
+
+/* Context internals */
+#ifndef KC_REASSEMBLY_TABLE_SIZE
+/**
+ * @internal
+ * @brief Number of slots of a reassembly table. Must be a power of two. With one slot per
+ * 7-bit sender address, all 127 senders can transmit to each receive FIFO at the same time.
+ */
+#define KC_REASSEMBLY_TABLE_SIZE 128
+#endif
+#ifndef KC_PENDING_TABLE_SIZE
+/**
+ * @internal
+ * @brief Number of slots of the pending command table, i.e. of commands which can wait for
+ * their response at the same time. Must be a power of two. A master which polls more nodes
+ * in one round can raise it in knabbercan_config.h.
+ */
+#define KC_PENDING_TABLE_SIZE 32
+#endif
+#ifndef KC_RECV_FIFO_SIZE
+/**
+ * @internal
+ * @brief Number of complete frames which can wait for their dispatch. Must be a power of two.
+ * Messages with a payload hold at least one block of the payload pool until their dispatch,
+ * so a larger FIFO only helps with bursts of messages without a payload.
+ */
+#define KC_RECV_FIFO_SIZE 64
+#endif
+#ifndef KC_PRIORITY_RECV_FIFO_SIZE
+/**
+ * @internal
+ * @brief Number of complete commands and responses which can wait for their dispatch. Must be a power of two.
+ */
+#define KC_PRIORITY_RECV_FIFO_SIZE 16
+#endif
+#ifndef KC_PAYLOAD_BLOCK_SIZE
+/**
+ * @internal
+ * @brief Size of a block of the payload pool. Larger payloads are received into a chain of blocks.
+ */
+#define KC_PAYLOAD_BLOCK_SIZE 64
+#endif
+#ifndef KC_PAYLOAD_POOL_SIZE
+/**
+ * @internal
+ * @brief Number of payload blocks which can exist at the same time.
+ */
+#define KC_PAYLOAD_POOL_SIZE 32
+#endif
+/**
+ * @brief Maximum payload size of a knabberCAN frame. Larger frames are refused by the sender
+ * and discarded by the receivers. Send larger amounts of data as a stream, see @ref kc_stream_send().
+ */
+#define KC_MAX_PAYLOAD_SIZE 256
+#ifndef KC_TRANSMIT_FIFO_SIZE
+/**
+ * @internal
+ * @brief Number of messages which can wait for their transmission.
+ */
+#define KC_TRANSMIT_FIFO_SIZE 16
+#endif
+/**
+ * @brief Number of bytes of a stream which are transmitted in a single knabberCAN frame.
+ */
+#define KC_STREAM_CHUNK_SIZE (KC_PAYLOAD_BLOCK_SIZE - sizeof(uint16_t))
+#ifndef KC_STREAM_WINDOW
+/**
+ * @brief Number of chunks a stream sender may transmit before waiting for their acknowledgement.
+ * The receiver holds back up to one window of chunks from the payload pool, so this must be at most 16.
+ */
+#define KC_STREAM_WINDOW 8
+#endif
+#ifndef KC_STREAM_RECEIVE_COUNT
+/**
+ * @brief Number of streams which can be received at the same time.
+ */
+#define KC_STREAM_RECEIVE_COUNT 2
+#endif
+#if !_RING_SIZE_VALID(KC_RECV_FIFO_SIZE) || !_RING_SIZE_VALID(KC_PRIORITY_RECV_FIFO_SIZE)
+    #error The sizes of the knabberCAN receive FIFOs must be powers of two.
+#endif
+#if !_RING_SIZE_VALID(KC_REASSEMBLY_TABLE_SIZE) || !_RING_SIZE_VALID(KC_PENDING_TABLE_SIZE)
+    #error The sizes of the knabberCAN reassembly and pending command tables must be powers of two.
+#endif
+#if KC_STREAM_WINDOW > 16 || (KC_STREAM_WINDOW - 1) * KC_STREAM_RECEIVE_COUNT >= KC_PAYLOAD_POOL_SIZE
+    #error KC_STREAM_WINDOW is too large for the payload pool.
+#endif
+#if KC_PAYLOAD_BLOCK_SIZE < 8 || KC_PAYLOAD_BLOCK_SIZE * KC_PAYLOAD_POOL_SIZE < KC_MAX_PAYLOAD_SIZE
+    #error The payload pool is too small for a message of KC_MAX_PAYLOAD_SIZE bytes.
+#endif
+#ifndef KC_ERROR_CALLBACK_COUNT
+/**
+ * @brief Number of callbacks which can be registered using @ref kc_error_listen().
+ */
+#define KC_ERROR_CALLBACK_COUNT 4
+#endif
+/**
+ * @brief Maximum length of the message sent with an error frame. Longer messages are truncated.
+ * The three CAN frames of such a message fit into the transmit mailboxes, so they still reach
+ * the bus if the MCU is blocked right after an error in an interrupt.
+ */
+#define KC_ERROR_MESSAGE_SIZE 24
+#ifndef KC_ERROR_REPORT_COUNT
+/**
+ * @brief Number of uncaught errors which can be broadcasted at the same time. Further errors
+ * are not reported until one of the earlier reports has left the transmit FIFO.
+ */
+#define KC_ERROR_REPORT_COUNT 2
+#endif
+#ifndef KC_OVERFLOW_HANDLER_COUNT
+/**
+ * @brief Number of commands and events which can be defined at runtime, in addition to
+ * the ones of the handler table.
+ */
+#define KC_OVERFLOW_HANDLER_COUNT 8
+#endif
+
+/**
+ * @internal
+ * @brief knabberCAN identifier bit-field. Do not use directly.
+ */
+typedef union __attribute__((__packed__)) {
+    uint32_t value;
+    struct __attribute__((packed)) {
+        KC_Address_t receiver_address : 7;
+        KC_Address_t sender_address : 7;
+        KC_TransactionID_t transaction_id : 8;
+        uint8_t counter : 3;
+        bool last : 1;
+        bool first : 1;
+        KC_FrameType_t frame_type : 2;
+    } components;
+} KC_Identifier_t;
+
+/**
+ * @internal
+ * @brief Complete frame waiting for its dispatch. Do not use directly.
+ */
+typedef struct {
+    /// @brief Frame type as a KC_FrameType_t, stored in a byte to keep the receive rings small.
+    uint8_t frame_type;
+    KC_Address_t sender_address;
+    KC_Address_t receiver_address;
+    KC_TransactionID_t transaction_id;
+    uint16_t payload_size;
+    uint8_t* payload;
+    uint32_t receive_timestamp;
+} KC_Received_Frame_t;
+
+/**
+ * @internal
+ * @brief Block of the payload pool. The data comes first, so a pointer to the data of a block
+ * is also a pointer to the block. Do not use directly.
+ */
+typedef struct _KC_Payload_Block {
+    uint8_t data[KC_PAYLOAD_BLOCK_SIZE];
+    /// @brief Block holding the continuation of a payload larger than a block, or a null pointer.
+    struct _KC_Payload_Block* next;
+} KC_Payload_Block_t;
+
+/**
+ * @internal
+ * @brief Reassembly table slot, keyed on the identifier without the FIRST, LAST and counter bits.
+ * Do not use directly.
+ */
+typedef struct {
+    KC_Identifier_t key;
+    uint16_t payload_size;
+    uint8_t previous_counter_value : 3;
+    bool occupied : 1;
+    bool discarded : 1;
+    KC_Payload_Block_t* payload;
+    KC_Payload_Block_t* payload_tail;
+} KC_Reassembly_Slot_t;
+
+/**
+ * @internal
+ * @brief Reassembly table of a single receive FIFO. Do not use directly.
+ */
+typedef struct {
+    KC_Reassembly_Slot_t slots[KC_REASSEMBLY_TABLE_SIZE];
+    size_t count;
+} KC_Reassembly_Table_t;
+
+/**
+ * @internal
+ * @brief Queue of the messages completed by a receive interrupt, which are read by the
+ * dispatcher. Do not use directly.
+ */
+typedef ring_type(KC_Received_Frame_t) KC_Receive_Ring_t;
+
+/**
+ * @internal
+ * @brief Message which is queued for transmission. Do not use directly.
+ */
+typedef struct {
+    KC_Identifier_t identifier;
+    const uint8_t* payload;
+    size_t payload_size;
+    size_t payload_offset;
+    KC_TransmitCallback_t callback;
+    void* context;
+} KC_Transmit_Request_t;
+
+/**
+ * @internal
+ * @brief Message of an uncaught error which is being broadcasted. Do not use directly.
+ */
+typedef struct {
+    volatile bool busy;
+    char message[KC_ERROR_MESSAGE_SIZE];
+} KC_Error_Report_t;
+
+/**
+ * @internal
+ * @brief Command sent by this node which is waiting for its response. Do not use directly.
+ */
+typedef struct {
+    bool occupied;
+    KC_Address_t receiver_address;
+    KC_TransactionID_t command_id;
+    TickType_t deadline;
+    KC_ResponseCallback_t callback;
+    void* context;
+} KC_Pending_Command_t;
+
+/**
+ * @internal
+ * @brief Stream which is being received by this node. Chunks which arrive ahead of a missing
+ * chunk are kept in their payload blocks until they can be passed on. Do not use directly.
+ */
+typedef struct {
+    bool occupied;
+    bool complete;
+    KC_Address_t sender_address;
+    uint8_t stream_id;
+    uint8_t window;
+    uint32_t total_size;
+    uint16_t chunk_count;
+    uint16_t next_sequence;
+    uint16_t unacknowledged_count;
+    TickType_t last_activity_tick;
+    uint8_t* chunks[KC_STREAM_WINDOW];
+    uint8_t chunk_sizes[KC_STREAM_WINDOW];
+} KC_Stream_Receiver_t;
+
+/**
+ * @internal
+ * @brief Acknowledgement state of the stream which is being sent by this node. Do not use directly.
+ */
+typedef struct {
+    volatile bool active;
+    volatile bool opened;
+    volatile bool rejected;
+    KC_Address_t receiver_address;
+    TaskHandle_t task;
+    volatile uint8_t window;
+    volatile uint16_t acknowledged_sequence;
+    volatile uint16_t received_chunks;
+    volatile uint32_t acknowledgement_count;
+} KC_Stream_Sender_t;
+
+/**
+ * @internal
+ * @brief Internal knabberCAN context structure. Do not use directly.
+ */
+struct _KC_Context {
+    KC_Address_t _node_address;
+    KC_Address_t _bus_size;
+    volatile KC_State_t _state;
+
+    // Handlers, see kc_handler_find
+    const KC_HandlerTable_t* _handler_table;
+    KC_Handler_t _overflow_handlers[KC_OVERFLOW_HANDLER_COUNT];
+    volatile size_t _overflow_handler_count;
+
+    // Reception, see can_recv_callback
+    KC_Reassembly_Table_t _reassembly_tables[2];
+    KC_Receive_Ring_t _recv_ring;
+    KC_Receive_Ring_t _priority_recv_ring;
+    volatile _Slab_t _payload_pool;
+    KC_ReceiveStatistics_t _receive_statistics[2];
+    uint8_t _payload_buffer[KC_MAX_PAYLOAD_SIZE];
+
+    // Transmission, see kc_transmit_pump
+    volatile _FIFO_t _transmit_fifo;
+    KC_Transmit_Request_t _transmit_current;
+    bool _transmit_active;
+
+    // Commands sent by this node, see kc_command_send
+    KC_Pending_Command_t _pending_table[KC_PENDING_TABLE_SIZE];
+    size_t _pending_table_count;
+    TickType_t _pending_next_deadline;
+
+    // Streams, see kc_stream_send and kc_stream_receive
+    KC_Stream_Receiver_t _stream_receivers[KC_STREAM_RECEIVE_COUNT];
+    KC_Stream_Sender_t _stream_sender;
+    KC_StreamCallback_t _stream_callback;
+    void* _stream_callback_context;
+
+    // Error frames, see kc_error_listen and kc_report_uncaught_error
+    KC_ErrorCallback_t _error_callbacks[KC_ERROR_CALLBACK_COUNT];
+    void* _error_callback_contexts[KC_ERROR_CALLBACK_COUNT];
+    volatile size_t _error_callback_count;
+    KC_Error_Report_t _error_reports[KC_ERROR_REPORT_COUNT];
+
+    // Dispatcher task, see kc_dispatcher_start
+    TaskHandle_t volatile _dispatcher_task_handle;
+    KC_DispatchStatistics_t _dispatch_statistics;
+    volatile bool _dispatching;
+
+    // Addressing and connectors
+    bool _waiting_for_next_node_to_be_addressed;
+    bool _already_addressed;
+    volatile bool _conn_change_pending;
+    volatile TickType_t _conn_change_tick;
+    bool _conn_in_state;
+    bool _conn_out_state;
+    bool _filters_enabled;
+
+    // Indicators
+    bool _send_flag;
+    bool _indicators_active;
+    TickType_t _last_send_tick;
+    TickType_t _last_recv_tick;
+};
+
+/**
+ * @brief Number of bytes of RAM used by a context, including all of its buffers.
+ */
+#define KC_CONTEXT_RAM_SIZE ( \
+    sizeof(KC_Context_t) + \
+    sizeof(KC_Received_Frame_t) * (KC_RECV_FIFO_SIZE + KC_PRIORITY_RECV_FIFO_SIZE) + \
+    sizeof(KC_Transmit_Request_t) * KC_TRANSMIT_FIFO_SIZE + \
+    _SLAB_BUFFER_SIZE(sizeof(KC_Payload_Block_t), KC_PAYLOAD_POOL_SIZE) \
+)
+
+#ifndef KC_CONTEXT_RAM_BUDGET
+/**
+ * @brief Upper bound of @ref KC_CONTEXT_RAM_SIZE, which is checked when knabbercan.c is compiled.
+ * The default configuration takes about 9 KB of the 40 KB of SRAM of the STM32F303. The bound
+ * scales with the size of a pointer, so it also holds for 64-bit host builds. A configuration
+ * with larger tables can raise it in knabbercan_config.h.
+ */
+#define KC_CONTEXT_RAM_BUDGET (10 * 1024 / 4 * sizeof(void*))
+#endif
+
+/**
+ * @brief Declares a new knabberCAN context with the given @p name, whose commands and events
+ * are handled by @p handler_table. All the buffers of the context are reserved at compile
+ * time. You can specify additional qualifiers for the context variable, e.g. static.
+ * 
+ * @code{.c}
+ * kc_handler_table_declare(my_handlers,
+ *     KC_COMMAND_HANDLER(0x20, read_temperature)
+ * );
+ * kc_context_declare_handlers(my_node, &my_handlers);
+ * 
+ * kc_init(&my_node);
+ * @endcode
+ * 
+ * @param name Name under which the context can be accessed.
+ * @param handler_table Pointer to the handler table of the context, or a null pointer.
+ * @param qualifiers Additional qualifiers which will be placed before the type of the context.
+ */
+#define kc_context_declare_handlers_qualifier(name, handler_table, qualifiers) \
+    static KC_Received_Frame_t TOKEN_CONCAT(__INTERNAL_KC_RECVBUF_, name)[KC_RECV_FIFO_SIZE]; \
+    static KC_Received_Frame_t TOKEN_CONCAT(__INTERNAL_KC_PRIORITYRECVBUF_, name)[KC_PRIORITY_RECV_FIFO_SIZE]; \
+    static volatile KC_Transmit_Request_t TOKEN_CONCAT(__INTERNAL_KC_TRANSMITBUF_, name)[KC_TRANSMIT_FIFO_SIZE]; \
+    static uint8_t __attribute__((aligned(sizeof(void*)))) TOKEN_CONCAT(__INTERNAL_KC_PAYLOADBUF_, name)[_SLAB_BUFFER_SIZE(sizeof(KC_Payload_Block_t), KC_PAYLOAD_POOL_SIZE)]; \
+    qualifiers KC_Context_t name = { \
+        ._state = KC_STATE_UNINITIALIZED, \
+        ._handler_table = (handler_table), \
+        ._recv_ring = _RING_INITIALIZER(KC_RECV_FIFO_SIZE, TOKEN_CONCAT(__INTERNAL_KC_RECVBUF_, name)), \
+        ._priority_recv_ring = _RING_INITIALIZER(KC_PRIORITY_RECV_FIFO_SIZE, TOKEN_CONCAT(__INTERNAL_KC_PRIORITYRECVBUF_, name)), \
+        ._payload_pool = _SLAB_INITIALIZER(sizeof(KC_Payload_Block_t), KC_PAYLOAD_POOL_SIZE, TOKEN_CONCAT(__INTERNAL_KC_PAYLOADBUF_, name)), \
+        ._transmit_fifo = _FIFO_INITIALIZER(KC_Transmit_Request_t, KC_TRANSMIT_FIFO_SIZE, TOKEN_CONCAT(__INTERNAL_KC_TRANSMITBUF_, name)), \
+        ._indicators_active = true \
+    }
+
+/**
+ * @brief Declares a new knabberCAN context with the given @p name, whose commands and events
+ * are handled by @p handler_table.
+ * 
+ * @param name Name under which the context can be accessed.
+ * @param handler_table Pointer to the handler table of the context, or a null pointer.
+ */
+#define kc_context_declare_handlers(name, handler_table) kc_context_declare_handlers_qualifier(name, handler_table,)
+
+/**
+ * @brief Declares a new knabberCAN context with the given @p name and without a handler table.
+ * You can specify additional qualifiers for the context variable, e.g. static.
+ * 
+ * @param name Name under which the context can be accessed.
+ * @param qualifiers Additional qualifiers which will be placed before the type of the context.
+ */
+#define kc_context_declare_qualifier(name, qualifiers) kc_context_declare_handlers_qualifier(name, 0, qualifiers)
+
+/**
+ * @brief Declares a new knabberCAN context with the given @p name and without a handler table.
+ * 
+ * @param name Name under which the context can be accessed.
+ */
+#define kc_context_declare(name) kc_context_declare_qualifier(name,)
 
 /* Event definitions */
 /**
@@ -156,6 +773,18 @@ typedef KC_Response_t (*KC_CommandCallback_t)(KC_Received_CommandFrame_t);
  * @brief KnabberCAN ``READ FWR NAME`` command.
  */
 #define KC_COMMAND_READ_FWR_NAME 0x11
+/**
+ * @brief KnabberCAN ``READ RECEIVE STATISTICS`` command.
+ */
+#define KC_COMMAND_READ_RECEIVE_STATISTICS 0x12
+/**
+ * @brief KnabberCAN ``STREAM OPEN`` command, which is handled by the stream layer, see @ref kc_stream_send().
+ */
+#define KC_COMMAND_STREAM_OPEN 0x20
+/**
+ * @brief KnabberCAN ``STREAM DATA`` command, which is handled by the stream layer, see @ref kc_stream_send().
+ */
+#define KC_COMMAND_STREAM_DATA 0x21
 
 /* Special addresses */
 /**
@@ -164,81 +793,318 @@ typedef KC_Response_t (*KC_CommandCallback_t)(KC_Received_CommandFrame_t);
 #define KC_ADDRESS_BROADCAST 0
 
 /**
- * @brief Node address assigned to the knabberCAN node.
+ * @brief knabberCAN context of this node, which is initialized by @ref sys_init().
  */
-extern KC_Address_t kc_node_address;
+extern KC_Context_t kc_default_context;
 
 /**
- * @brief Current size of the knabberCAN bus.
+ * @brief Handler table of @ref kc_default_context. This is optional and may be declared
+ * by the application using @ref kc_handler_table_declare().
  */
-extern KC_Address_t kc_bus_size;
+extern const KC_HandlerTable_t kc_default_handler_table __attribute__((weak));
 
 /**
  * @brief Initializes the knabberCAN hardware resources and performs addressing. Blocks
  * until addressing is finished.
+ * 
+ * The context is bound to the bxCAN peripheral and to the knabberCAN GPIO pins, so only
+ * a single context can be initialized.
+ * 
+ * @param ctx Context of the node.
+ * 
+ * @throws ERR_RUNTIME_GENERIC Another context has already been initialized.
+ * @throws ERR_IMPOSSIBLE The handler table of the context isn't ordered, contains duplicates
+ * or redefines a pre-defined command or event.
+ */
+void kc_init(KC_Context_t* ctx);
+
+/**
+ * @brief Gets the node address which has been assigned to the node by the addressing procedure.
+ * 
+ * @param ctx Context of the node.
+ * @return The node address, or 0 if the node hasn't been addressed yet.
+ */
+KC_Address_t kc_get_node_address(KC_Context_t* ctx);
+
+/**
+ * @brief Gets the current size of the knabberCAN bus, i.e. the number of addressed nodes.
+ * 
+ * @param ctx Context of the node.
+ * @return The bus size.
  */
-void kc_init();
+KC_Address_t kc_get_bus_size(KC_Context_t* ctx);
 
 /**
  * @brief Emits an event with the given parameters.
  * 
+ * @param ctx Context of the node.
  * @param event_id Event ID of the event to emit.
  * @param payload Pointer to the payload sent with the event.
  * @param payload_size Size of the payload to be sent with the event.
+ * 
+ * @throws ERR_RANGE The payload is larger than KC_MAX_PAYLOAD_SIZE.
  */
-void kc_event_emit(KC_TransactionID_t event_id, void* payload, size_t payload_size);
+void kc_event_emit(KC_Context_t* ctx, KC_TransactionID_t event_id, void* payload, size_t payload_size);
 
 /**
  * @brief Defines a command with the given command ID and attaches the specified
  * callback to the command.
  * 
+ * Broadcast commands are only accepted by the CAN acceptance filters if they are
+ * defined. The filters are recomputed by every call.
+ * 
+ * The callback is stored in RAM, so callbacks known at compile time should rather be
+ * listed in the handler table of the context.
+ * 
+ * @param ctx Context of the node.
  * @param command_id Command ID to which the command corresponds.
  * @param callback Callback which will be called when the command is received.
  * 
  * @throws ERR_RUNTIME_GENERAL The specified command ID has already been defined.
+ * @throws ERR_BUFFER_FULL All KC_OVERFLOW_HANDLER_COUNT runtime definitions are in use.
  */
-void kc_command_define(KC_TransactionID_t command_id, KC_CommandCallback_t callback);
+void kc_command_define(KC_Context_t* ctx, KC_TransactionID_t command_id, KC_CommandCallback_t callback);
 
 
 /**
  * @brief Defines an event with the given event ID and attaches the specified
  * callback to the event.
  * 
+ * Only defined events are accepted by the CAN acceptance filters, so events which
+ * aren't defined never reach the software. The filters are recomputed by every call.
+ * 
+ * The callback is stored in RAM, so callbacks known at compile time should rather be
+ * listed in the handler table of the context.
+ * 
+ * @param ctx Context of the node.
  * @param event_id Event ID to which the command corresponds.
  * @param callback Callback which will be called when the event is received.
  * 
  * @throws ERR_RUNTIME_GENERAL The specified event ID has already been defined.
+ * @throws ERR_BUFFER_FULL All KC_OVERFLOW_HANDLER_COUNT runtime definitions are in use.
  */
-void kc_event_define(KC_TransactionID_t event_id, KC_EventCallback_t callback);
+void kc_event_define(KC_Context_t* ctx, KC_TransactionID_t event_id, KC_EventCallback_t callback);
+
+/**
+ * @brief Sends a command to another node without waiting for the response. Once the response
+ * has been received or @p timeout has expired, @p callback is called from @ref kc_process_incoming().
+ * 
+ * Any number of commands may be pending at the same time, as long as no two of them are sent
+ * to the same node with the same command ID.
+ * 
+ * @param ctx Context of the node.
+ * @param receiver Address of the node which should execute the command. This must not be the broadcast address.
+ * @param command_id Command ID of the command to send.
+ * @param payload Pointer to the payload sent with the command.
+ * @param payload_size Size of the payload to be sent with the command.
+ * @param timeout Time in ticks to wait for the response.
+ * @param callback Callback which will be called with the response or the timeout.
+ * @param context Pointer passed to @p callback.
+ * 
+ * @throws ERR_RUNTIME_GENERIC The same command is already pending for the receiver.
+ * @throws ERR_BUFFER_FULL Too many commands are pending.
+ * @throws ERR_IMPOSSIBLE The receiver is the broadcast address or the callback is missing.
+ * @throws ERR_RANGE The payload is larger than KC_MAX_PAYLOAD_SIZE.
+ */
+void kc_command_send(
+    KC_Context_t* ctx,
+    KC_Address_t receiver,
+    KC_TransactionID_t command_id,
+    const void* payload,
+    size_t payload_size,
+    TickType_t timeout,
+    KC_ResponseCallback_t callback,
+    void* context
+);
+
+/**
+ * @brief Gets the number of commands sent using @ref kc_command_send() which are still waiting for their response.
+ * 
+ * @param ctx Context of the node.
+ * 
+ * @return The number of pending commands.
+ */
+size_t kc_command_pending_count(KC_Context_t* ctx);
+
+/**
+ * @brief Sets the callback which consumes the streams sent to this node. The chunks are passed
+ * in order as soon as they arrive, so the stream never has to be held in memory as a whole. Streams
+ * are rejected as long as no callback is set.
+ * 
+ * @param ctx Context of the node.
+ * @param callback Callback called from @ref kc_process_incoming() for every chunk, or a null pointer.
+ * @param context Pointer passed to @p callback.
+ */
+void kc_stream_listen(KC_Context_t* ctx, KC_StreamCallback_t callback, void* context);
+
+/**
+ * @brief Sends @p total_size bytes to another node as a stream. The data is requested from @p read
+ * chunk by chunk, so it never has to be held in memory as a whole. Up to KC_STREAM_WINDOW chunks
+ * are in flight at the same time, and only the chunks which the receiver reports as missing are
+ * retransmitted. Blocks until the receiver has acknowledged the whole stream.
+ * 
+ * The acknowledgements are dispatched by the dispatcher task if it is running, otherwise
+ * @ref kc_process_incoming() is called while waiting for them. In this case, send the stream
+ * from the task which calls @ref kc_process_incoming(), but not from a handler, as the frames
+ * would be dispatched again while the handler is running.
+ * 
+ * @param ctx Context of the node.
+ * @param receiver Address of the node which receives the stream. This must not be the broadcast address.
+ * @param stream_id Application-defined identifier of the stream.
+ * @param total_size Size of the stream in bytes.
+ * @param read Callback which provides the data of the stream.
+ * @param context Pointer passed to @p read.
+ * @return Whether the stream has been received completely. This is false if the receiver rejected
+ * or aborted the stream, stopped responding, or @p read failed.
+ * 
+ * @throws ERR_RUNTIME_GENERIC Another stream is already being sent by this context.
+ * @throws ERR_RANGE The stream is too large.
+ * @throws ERR_IMPOSSIBLE The receiver is the broadcast address, the callback is missing or the
+ * function is called from the dispatcher task or a handler.
+ */
+bool kc_stream_send(
+    KC_Context_t* ctx,
+    KC_Address_t receiver,
+    uint8_t stream_id,
+    uint32_t total_size,
+    KC_StreamReadCallback_t read,
+    void* context
+);
+
+/**
+ * @brief Sends an error frame with the given @p error_code to another node or to the whole bus.
+ * The message is truncated to KC_ERROR_MESSAGE_SIZE characters.
+ * 
+ * Errors are sent automatically in the following cases:
+ * - An uncaught error is broadcasted by the context bound to the hardware, once it has been addressed.
+ * - An error thrown by a command handler is sent to the node which sent the command, instead of the response.
+ * - An error thrown by an event handler is broadcasted.
+ * 
+ * @param ctx Context of the node.
+ * @param receiver Address of the node which should receive the error, or the broadcast address.
+ * @param error_code Error code, which is an @ref error_code_t or an application-defined error code.
+ * @param error_message Null-terminated message sent with the error, or a null pointer.
+ */
+void kc_error_send(KC_Context_t* ctx, KC_Address_t receiver, KC_TransactionID_t error_code, const char* error_message);
+
+/**
+ * @brief Registers a @p callback which is called for every error frame sent to this node or broadcasted
+ * by any node. This allows a master to collect the errors of the whole bus without polling the nodes.
+ * Broadcasted errors are only accepted by the filters while a callback is registered.
+ * 
+ * @param ctx Context of the node.
+ * @param callback Callback called from @ref kc_process_incoming() for every error frame.
+ * @param context Pointer passed to @p callback.
+ * 
+ * @throws ERR_BUFFER_FULL KC_ERROR_CALLBACK_COUNT callbacks are already registered.
+ */
+void kc_error_listen(KC_Context_t* ctx, KC_ErrorCallback_t callback, void* context);
 
 /**
  * @brief Gets the current state of the knabber CAN initialization.
  * 
+ * @param ctx Context of the node.
+ * 
  * @return The state the library is currently in.
  */
-KC_State_t kc_get_state();
+KC_State_t kc_get_state(KC_Context_t* ctx);
 
 /**
  * @brief Processes all incoming frames. Call this regularly to avoid an
  * overrun of frames.
  * 
  * This calls all callbacks for commands and events.
+ * 
+ * @param ctx Context of the node.
+ */
+void kc_process_incoming(KC_Context_t* ctx);
+
+/**
+ * @brief Starts a FreeRTOS task which processes the incoming frames. The task sleeps until
+ * the receive interrupt wakes it up, so it doesn't use any CPU time while the bus is idle.
+ * Once the dispatcher is running, don't call @ref kc_process_incoming() yourself.
+ * 
+ * This also enables the DWT cycle counter, which is used to measure the dispatch latency.
+ * 
+ * @param ctx Context of the node.
+ * @param priority FreeRTOS priority of the dispatcher task.
+ * 
+ * @throws ERR_RUNTIME_GENERIC The dispatcher has already been started.
+ * @throws ERR_ALLOCATION The task couldn't be created.
+ */
+void kc_dispatcher_start(KC_Context_t* ctx, UBaseType_t priority);
+
+/**
+ * @brief Gets the latency between the reception of a frame in the receive interrupt and the call to
+ * its callback. The measurement requires the DWT cycle counter, which is enabled by
+ * @ref kc_dispatcher_start().
+ * 
+ * @param ctx Context of the node.
+ * 
+ * @return The dispatch latency statistics.
+ */
+KC_DispatchStatistics_t kc_get_dispatch_statistics(KC_Context_t* ctx);
+
+/**
+ * @brief Gets the number of messages received and the number of CAN frames dropped by the receive
+ * interrupt, by cause. Other nodes can read these using the ``READ RECEIVE STATISTICS`` command.
+ * 
+ * @param ctx Context of the node.
+ * 
+ * @return The receive statistics.
  */
-void kc_process_incoming();
+KC_ReceiveStatistics_t kc_get_receive_statistics(KC_Context_t* ctx);
 
 /**
- * @brief Transmits a single frame on the bus.
+ * @brief Transmits a single frame on the bus. Blocks until the whole frame has been loaded
+ * into the transmit mailboxes, i.e. until @p payload is no longer needed. When the FreeRTOS
+ * scheduler is running, the calling task sleeps on its notification value in the meantime.
  * 
+ * @param ctx Context of the node.
  * @param frame_type Type of the frame to transmit.
  * @param tid Transaction ID to transmit.
  * @param receiver Address of the receiving node.
- * @param payload_size Size of the payload.
+ * @param payload_size Size of the payload, at most KC_MAX_PAYLOAD_SIZE bytes.
  * @param payload Pointer to a payload buffer, if size > 0.
+ * 
+ * @throws ERR_RANGE The payload is too large.
  */
 void kc_frame_transmit(
+    KC_Context_t* ctx,
     KC_FrameType_t frame_type,
     KC_TransactionID_t tid,
     KC_Address_t receiver,
     size_t payload_size,
     void* payload
+);
+
+/**
+ * @brief Queues a single frame for transmission on the bus and returns immediately. The frame
+ * is split into CAN frames from the transmit interrupt, keeping all transmit mailboxes busy.
+ * 
+ * If the transmit queue is full, this blocks until a queued frame has been started.
+ * 
+ * @param ctx Context of the node.
+ * @param frame_type Type of the frame to transmit.
+ * @param tid Transaction ID to transmit.
+ * @param receiver Address of the receiving node.
+ * @param payload_size Size of the payload, at most KC_MAX_PAYLOAD_SIZE bytes.
+ * @param payload Pointer to a payload buffer, if size > 0. This must stay valid until @p callback
+ * has been called.
+ * @param callback Callback which is called once the whole frame has been handed to the CAN hardware,
+ * or a null pointer. Note that this may be called from an interrupt context. From there, you can
+ * e.g. notify a task using ``vTaskNotifyGiveFromISR``.
+ * @param context Pointer passed to @p callback.
+ * 
+ * @throws ERR_RANGE The payload is too large.
+ */
+void kc_frame_transmit_async(
+    KC_Context_t* ctx,
+    KC_FrameType_t frame_type,
+    KC_TransactionID_t tid,
+    KC_Address_t receiver,
+    size_t payload_size,
+    const void* payload,
+    KC_TransmitCallback_t callback,
+    void* context
 );
\ No newline at end of file
@@ -0,0 +1,278 @@
+/**
+ * @file knabbercan.hpp
+ * @author Gabriel Heinzer
+ * @brief Typed C++17 front end for knabberCAN commands and events.
+ *
+ * @section kc-cpp-usage Usage
+ *
+ * Commands and events are declared as types over the structs carried as their payloads.
+ * The handlers receive the decoded payloads instead of raw buffers, and the payload
+ * sizes are checked at compile time. Everything is resolved at compile time, so the
+ * decoding and encoding inline into the generated callbacks.
+ *
+ * @code{.cpp}
+ * struct __attribute__((packed)) TemperatureRequest { uint8_t sensor; };
+ * struct __attribute__((packed)) Temperature { int16_t centi_celsius; };
+ *
+ * using ReadTemperature = kc::Command<0x20, TemperatureRequest, Temperature>;
+ * using TemperatureChanged = kc::Event<0x20, Temperature>;
+ *
+ * static Temperature read_temperature(const KC_Received_CommandFrame_t& frame, const TemperatureRequest& request) {
+ *     return Temperature{ sensor_read(request.sensor) };
+ * }
+ *
+ * static void on_temperature(const KC_Received_EventFrame_t& frame, const Temperature& temperature) {
+ *     // ...
+ * }
+ *
+ * kc_handler_table_declare(kc_default_handler_table,
+ *     kc::event_handler<TemperatureChanged, on_temperature>(),
+ *     kc::command_handler<ReadTemperature, read_temperature>()
+ * );
+ *
+ * kc::emit<TemperatureChanged>(&kc_default_context, Temperature{ 2150 });
+ * @endcode
+ *
+ * Payloads are transmitted as the raw bytes of their structs, so they should be packed and
+ * only consist of fixed-size integers. Payloads which are shorter than their struct are
+ * dropped, longer payloads are accepted so that fields can be appended to a struct later on.
+ */
+
+#pragma once
+
+extern "C" {
+#include <knabberkiste/knabbercan.h>
+#include <knabberkiste/util/varbuf.h>
+}
+
+#include <cstring>
+#include <type_traits>
+
+namespace kc {
+
+/**
+ * @internal
+ * @brief Implementation details of the typed front end. Do not use directly.
+ */
+namespace detail {
+    template<typename T>
+    struct payload_size : std::integral_constant<size_t, sizeof(T)> {};
+    template<>
+    struct payload_size<void> : std::integral_constant<size_t, 0> {};
+
+    template<typename T>
+    constexpr bool check_payload() {
+        if constexpr(!std::is_void_v<T>) {
+            static_assert(std::is_trivially_copyable_v<T>, "knabberCAN payloads must be trivially copyable.");
+            static_assert(std::is_standard_layout_v<T>, "knabberCAN payloads must have a standard layout.");
+        }
+        static_assert(payload_size<T>::value <= KC_PAYLOAD_BLOCK_SIZE, "knabberCAN payloads must fit into a payload block.");
+        return true;
+    }
+
+    template<typename T>
+    inline bool unpack(const void* payload, size_t payload_size, T& value) {
+        if(payload_size < sizeof(T)) return false;
+
+        // The size is a constant, so this compiles to plain loads
+        std::memcpy(&value, payload, sizeof(T));
+        return true;
+    }
+
+    template<typename C, auto Handler>
+    KC_Response_t command_trampoline(KC_Received_CommandFrame_t frame) {
+        using Request = typename C::request_type;
+        using Response = typename C::response_type;
+        KC_Response_t response = {};
+
+        auto respond = [&](const auto&... request) {
+            if constexpr(std::is_void_v<Response>) {
+                Handler(frame, request...);
+            } else {
+                Response value = Handler(frame, request...);
+                // varbuf_push_chunk() relies on the implicit conversions of C
+                _varbuf_push_chunk(reinterpret_cast<void**>(&response.payload), &value, 1, sizeof(Response));
+                response.payload_size = sizeof(Response);
+            }
+        };
+
+        if constexpr(std::is_void_v<Request>) {
+            respond();
+        } else {
+            // Malformed commands are answered with an empty response
+            Request request;
+            if(unpack(frame.payload, frame.payload_size, request)) {
+                respond(request);
+            }
+        }
+
+        return response;
+    }
+
+    template<typename E, auto Handler>
+    void event_trampoline(KC_Received_EventFrame_t frame) {
+        using Payload = typename E::payload_type;
+
+        if constexpr(std::is_void_v<Payload>) {
+            Handler(frame);
+        } else {
+            // Malformed events are dropped
+            Payload payload;
+            if(unpack(frame.payload, frame.payload_size, payload)) {
+                Handler(frame, payload);
+            }
+        }
+    }
+
+    template<typename C, auto Callback>
+    void response_trampoline(KC_Received_ResponseFrame_t frame, void* context) {
+        using Response = typename C::response_type;
+
+        if constexpr(std::is_void_v<Response>) {
+            Callback(frame, context);
+        } else {
+            // Timeouts and malformed responses are passed as a null pointer
+            Response response;
+            bool valid = frame.status == KC_RESPONSE_RECEIVED && unpack(frame.payload, frame.payload_size, response);
+            Callback(frame, valid ? &response : nullptr, context);
+        }
+    }
+}
+
+/**
+ * @brief knabberCAN command carrying a @p Request and answered with a @p Response. Use
+ * `void` for commands or responses without a payload.
+ *
+ * @tparam Id Command ID.
+ * @tparam Request Struct sent as the payload of the command.
+ * @tparam Response Struct sent as the payload of the response.
+ */
+template<KC_TransactionID_t Id, typename Request = void, typename Response = void>
+struct Command {
+    static_assert(detail::check_payload<Request>() && detail::check_payload<Response>());
+
+    /// @brief Command ID.
+    static constexpr KC_TransactionID_t id = Id;
+    /// @brief Struct sent as the payload of the command.
+    using request_type = Request;
+    /// @brief Struct sent as the payload of the response.
+    using response_type = Response;
+};
+
+/**
+ * @brief knabberCAN event carrying a @p Payload. Use `void` for events without a payload.
+ *
+ * @tparam Id Event ID.
+ * @tparam Payload Struct sent as the payload of the event.
+ */
+template<KC_TransactionID_t Id, typename Payload = void>
+struct Event {
+    static_assert(detail::check_payload<Payload>());
+
+    /// @brief Event ID.
+    static constexpr KC_TransactionID_t id = Id;
+    /// @brief Struct sent as the payload of the event.
+    using payload_type = Payload;
+};
+
+/**
+ * @brief Creates a handler table entry for the command @p C, see @ref kc_handler_table_declare().
+ *
+ * @tparam C Command type.
+ * @tparam Handler Function called with the received frame and the decoded request, i.e.
+ * `Response handler(const KC_Received_CommandFrame_t& frame, const Request& request)`. The
+ * request parameter is omitted for commands without a payload.
+ */
+template<typename C, auto Handler>
+constexpr KC_Handler_t command_handler() {
+    return KC_COMMAND_HANDLER(C::id, (&detail::command_trampoline<C, Handler>));
+}
+
+/**
+ * @brief Creates a handler table entry for the event @p E, see @ref kc_handler_table_declare().
+ *
+ * @tparam E Event type.
+ * @tparam Handler Function called with the received frame and the decoded payload, i.e.
+ * `void handler(const KC_Received_EventFrame_t& frame, const Payload& payload)`. The
+ * payload parameter is omitted for events without a payload.
+ */
+template<typename E, auto Handler>
+constexpr KC_Handler_t event_handler() {
+    return KC_EVENT_HANDLER(E::id, (&detail::event_trampoline<E, Handler>));
+}
+
+/**
+ * @brief Defines the command @p C at runtime, see @ref kc_command_define().
+ *
+ * @param ctx Context of the node.
+ */
+template<typename C, auto Handler>
+inline void command_define(KC_Context_t* ctx) {
+    kc_command_define(ctx, C::id, &detail::command_trampoline<C, Handler>);
+}
+
+/**
+ * @brief Defines the event @p E at runtime, see @ref kc_event_define().
+ *
+ * @param ctx Context of the node.
+ */
+template<typename E, auto Handler>
+inline void event_define(KC_Context_t* ctx) {
+    kc_event_define(ctx, E::id, &detail::event_trampoline<E, Handler>);
+}
+
+/**
+ * @brief Emits the event @p E with the given @p payload, see @ref kc_event_emit().
+ *
+ * @param ctx Context of the node.
+ * @param payload Payload sent with the event.
+ */
+template<typename E>
+inline void emit(KC_Context_t* ctx, const typename E::payload_type& payload) {
+    kc_event_emit(ctx, E::id, const_cast<typename E::payload_type*>(&payload), sizeof(payload));
+}
+
+/**
+ * @brief Emits the event @p E, which doesn't carry a payload, see @ref kc_event_emit().
+ *
+ * @param ctx Context of the node.
+ */
+template<typename E>
+inline std::enable_if_t<std::is_void_v<typename E::payload_type>> emit(KC_Context_t* ctx) {
+    kc_event_emit(ctx, E::id, nullptr, 0);
+}
+
+/**
+ * @brief Sends the command @p C with the given @p request, see @ref kc_command_send().
+ *
+ * @tparam C Command type.
+ * @tparam Callback Function called with the response, i.e.
+ * `void callback(const KC_Received_ResponseFrame_t& frame, const Response* response, void* context)`.
+ * @p response is a null pointer if the command timed out or the response is malformed. It
+ * is omitted for commands without a response payload.
+ *
+ * @param ctx Context of the node.
+ * @param receiver Address of the node which should execute the command.
+ * @param request Payload sent with the command.
+ * @param timeout Time in ticks to wait for the response.
+ * @param context Pointer passed to @p Callback.
+ */
+template<typename C, auto Callback>
+inline void send(KC_Context_t* ctx, KC_Address_t receiver, const typename C::request_type& request, TickType_t timeout, void* context = nullptr) {
+    kc_command_send(ctx, receiver, C::id, &request, sizeof(request), timeout, &detail::response_trampoline<C, Callback>, context);
+}
+
+/**
+ * @brief Sends the command @p C, which doesn't carry a payload, see @ref kc_command_send().
+ *
+ * @param ctx Context of the node.
+ * @param receiver Address of the node which should execute the command.
+ * @param timeout Time in ticks to wait for the response.
+ * @param context Pointer passed to @p Callback.
+ */
+template<typename C, auto Callback>
+inline std::enable_if_t<std::is_void_v<typename C::request_type>> send(KC_Context_t* ctx, KC_Address_t receiver, TickType_t timeout, void* context = nullptr) {
+    kc_command_send(ctx, receiver, C::id, nullptr, 0, timeout, &detail::response_trampoline<C, Callback>, context);
+}
+
+}
\ No newline at end of file
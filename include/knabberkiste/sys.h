@@ -14,6 +14,6 @@
  * 1. Set SYSCLK to 64 MHz
  * 2. Enable all GPIO port clocks
  * 3. Initialize the VCP interface to 921600 baud
- * 4. Initialize the CAN bus
+ * 4. Initialize knabberCAN using @ref kc_default_context
  */
 void sys_init();
\ No newline at end of file
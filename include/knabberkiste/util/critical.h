@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 /**
  * @brief Enters a critical block. This means that interrupts are blocked
  * until @ref critical_exit() is called.
@@ -18,8 +20,22 @@ void critical_enter();
  * critical block, re-enabled interrupts.
  */
 void critical_exit();
+
+/**
+ * @internal
+ * @brief Gets the number of nested critical blocks which are currently entered.
+ */
+uint32_t _critical_get_depth();
+
+/**
+ * @internal
+ * @brief Restores the number of nested critical blocks, which is used by the error library
+ * when an error is thrown out of critical blocks. Disables the interrupts if @p depth isn't 0.
+ */
+void _critical_set_depth(uint32_t depth);
+
 /**
  * @brief Shorthand for wrapping a code block in
  * @ref critical_enter and @ref critical_exit. Use curly braces as a delimeter.
  */
-#define critical_block for(uint8_t __critical_dummy = 2; --__critical_dummy; critical_exit())
\ No newline at end of file
+#define critical_block for(uint8_t __critical_dummy = (critical_enter(), 2); --__critical_dummy; critical_exit())
\ No newline at end of file
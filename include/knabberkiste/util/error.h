@@ -116,6 +116,13 @@ typedef struct {
     error_t current_error;
     /// @brief Whether an error has occurred.
     bool error_occurred;
+    /// @brief Depth of the critical blocks when the ``try`` block was entered, which is
+    /// restored if an error is thrown out of critical blocks.
+    uint32_t critical_depth;
+    /// @brief Error which has been thrown out of the ``try`` block and is passed to its ``catch`` block.
+    error_t caught_error;
+    /// @brief Whether @ref caught_error hasn't been taken by its ``catch`` block yet.
+    bool error_caught;
 } __error_manager_state_t;
 
 /**
@@ -126,15 +133,13 @@ extern volatile __error_manager_state_t __error_manager_state;
 
 /**
  * @internal
- * @brief Error manager state of the default task.
- */
-extern volatile __error_manager_state_t __previous_error_manager_state_global;
-
-/**
- * @internal
- * @brief Internal pointer to the current error manager state.
+ * @brief Internal function which takes the error caught by the ``try`` block which has just been
+ * closed in the current task or interrupt, see @ref error_catch.
+ * 
+ * @param error Destination to which the caught error is copied.
+ * @return @p error if an error has been caught, otherwise a null pointer.
  */
-extern volatile __error_manager_state_t* volatile __em_ptr_global;
+error_t* _error_catch_take(error_t* error);
 
 /**
  * @internal
@@ -155,6 +160,20 @@ void _error_throw(error_code_t error_code, const char* error_name, const char* e
  */
 void uncaught_error_handler(error_t* error);
 
+/**
+ * @brief Type for a function which forwards uncaught errors, see @ref error_set_reporter().
+ */
+typedef void (*error_reporter_t)(error_t* error);
+
+/**
+ * @brief Sets a function which is called with every uncaught error after @ref uncaught_error_handler(),
+ * e.g. to forward it to another device. The reporter may be called from an interrupt context and
+ * must not block or throw.
+ * 
+ * @param reporter Function forwarding the error, or a null pointer.
+ */
+void error_set_reporter(error_reporter_t reporter);
+
 /**
  * @brief Throws an error with the given error information.
  * 
@@ -183,6 +202,7 @@ void uncaught_error_handler(error_t* error);
                 __em_ptr = pvPortMalloc(sizeof(__error_manager_state_t)); \
                 vTaskSetThreadLocalStoragePointer(NULL, __THREAD_LOCAL_ERROR_MANAGER_STATE_INDEX, __em_ptr); \
                 __em_ptr->error_occurred = false; \
+                __em_ptr->error_caught = false; \
             } \
         } else { \
             /* FreeRTOS scheduler is not running */ \
@@ -210,16 +230,28 @@ void uncaught_error_handler(error_t* error);
         __error_manager_state_t __previous_error_manager_state = *__em_ptr; \
         \
         /* Set the current state */ \
-        __disable_irq(); \
+        critical_enter(); \
         __em_ptr->try_active = true; \
+        __em_ptr->critical_depth = _critical_get_depth(); \
         __setjmp_result = setjmp(__em_ptr->try_buf); \
-        __enable_irq(); \
+        if(__setjmp_result != 0) { \
+            /* Critical blocks which have been left by throwing were never exited. */ \
+            _critical_set_depth(__em_ptr->critical_depth); \
+        } \
+        critical_exit(); \
         if(__setjmp_result == 0)
 
 #define __close_try \
-        __disable_irq(); \
-        __em_ptr_global = __em_ptr; \
-        memcpy(&__previous_error_manager_state_global, &__previous_error_manager_state, sizeof(__previous_error_manager_state)); \
+        critical_enter(); \
+        bool __error_caught = __em_ptr->error_occurred; \
+        error_t __caught_error = __em_ptr->current_error; \
+        /* Restore the previous state before the catch block, which runs with the interrupts enabled. */ \
+        memcpy((void*)__em_ptr, (const void*)&__previous_error_manager_state, sizeof(__previous_error_manager_state)); \
+        if(__error_caught) { \
+            __em_ptr->caught_error = __caught_error; \
+            __em_ptr->error_caught = true; \
+        } \
+        critical_exit(); \
     }
 
 /**
@@ -229,15 +261,14 @@ void uncaught_error_handler(error_t* error);
  * @param error_variable A variable name or declaration which will be set to the
  * current error. Note that the scope of declarations in @p error_variable is
  * limited to the ``error_catch`` block.
+ * 
+ * The state of the enclosing ``try`` block is restored before the ``catch`` block runs, and the
+ * interrupts are enabled, so it may block, throw or return like any other code.
  */
 #define error_catch(error_variable) \
     __close_try \
-    for( \
-        error_variable = __em_ptr_global->current_error; \
-        __em_ptr_global->error_occurred; \
-        __em_ptr_global->error_occurred = false, \
-        memcpy(__em_ptr_global, &__previous_error_manager_state_global, sizeof(__previous_error_manager_state_global)), __enable_irq() \
-    )
+    for(error_t __caught_error, *__caught = _error_catch_take(&__caught_error); __caught != 0; __caught = 0) \
+        for(error_variable = __caught_error; __caught != 0; __caught = 0)
 
 /**
  * @brief Catch block of the error library. Same as @ref error_catch, but this does not
@@ -246,10 +277,5 @@ void uncaught_error_handler(error_t* error);
  */
 #define error_catch_any \
     __close_try \
-    for( \
-        ; \
-        __em_ptr_global->error_occurred; \
-        __em_ptr_global->error_occurred = false, \
-        memcpy(__em_ptr_global, &__previous_error_manager_state_global, sizeof(__previous_error_manager_state_global)), __enable_irq() \
-    )
+    for(error_t __caught_error, *__caught = _error_catch_take(&__caught_error); __caught != 0; __caught = 0)
 
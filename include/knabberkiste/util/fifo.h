@@ -2,12 +2,28 @@
  * @file fifo.h
  * @author Gabriel Heinzer
  * @brief Generic, thread-safe FIFO queuing library.
+ * 
+ * Every operation disables the interrupts. Queues with a single producer and a single
+ * consumer, e.g. between an interrupt and a task, should use the lock-free @ref util/ring.h.
+ * 
+ * FIFOs declared with @ref fifo_declare_overwrite() drop their oldest element instead of
+ * rejecting a new one when they are full, so putting into them never blocks. This suits
+ * telemetry and traces, where the newest samples matter most. The dropped elements are
+ * counted, see @ref fifo_get_overwritten_count().
  */
 
 #pragma once
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 #include <knabberkiste/util/macro_util.h>
+#include <knabberkiste/util/critical.h>
+
+#if __has_include("FreeRTOS.h")
+    #include <FreeRTOS.h>
+#endif
 
 /**
  * @internal
@@ -17,8 +33,10 @@ typedef struct {
     size_t _start;
     size_t _end;
     size_t _count;
+    size_t _overwritten_count;
     const size_t _element_size;
     const size_t _fifo_size;
+    const bool _overwrite;
     volatile void* _buf;
 } _FIFO_t;
 
@@ -30,21 +48,135 @@ typedef _FIFO_t FIFO_t;
 
 /**
  * @internal
- * @brief Internal function which puts the @p element into the @p fifo.
+ * @brief Internal function which advances the @p index of a FIFO with @p fifo_size slots,
+ * wrapping to the start of the buffer without a division.
+ */
+static inline size_t _fifo_next_index(size_t index, size_t fifo_size) {
+    index++;
+    return index == fifo_size ? 0 : index;
+}
+
+/**
+ * @internal
+ * @brief Internal function which copies an element of @p element_size bytes, which is a constant
+ * in the inlined FIFO operations, so the copy compiles to plain loads and stores. Elements of
+ * another size than the @p fifo_element_size are copied with the size of the FIFO, as they were
+ * before the operations were inlined.
+ */
+static inline void _fifo_copy(void* dest, const void* source, size_t element_size, size_t fifo_element_size) {
+    if(element_size == fifo_element_size) {
+        memcpy(dest, source, element_size);
+    } else {
+        memcpy(dest, source, fifo_element_size);
+    }
+}
+
+/**
+ * @internal
+ * @brief Internal function which puts the @p element into the @p fifo if there is space. This
+ * is inlined, so the copy of the constant @p element_size compiles to plain loads and stores.
  * 
  * @param fifo FIFO in which the element will be inserted.
  * @param element Pointer to the element to insert.
+ * @param element_size Size of the element, which should equal the element size of the FIFO.
+ * @return Whether the element has been put, i.e. false if the FIFO is full and doesn't overwrite.
  */
-void _fifo_put(volatile _FIFO_t* fifo, void* element);
+static inline bool _fifo_try_put(volatile _FIFO_t* fifo, const void* element, size_t element_size) {
+    bool put = false;
+    critical_enter();
+    if(fifo->_count == fifo->_fifo_size && fifo->_overwrite) {
+        // Drop the oldest element to make space
+        fifo->_start = _fifo_next_index(fifo->_start, fifo->_fifo_size);
+        fifo->_count--;
+        fifo->_overwritten_count++;
+    }
+    if(fifo->_count < fifo->_fifo_size) {
+        size_t end = _fifo_next_index(fifo->_end, fifo->_fifo_size);
+        _fifo_copy((uint8_t*)fifo->_buf + fifo->_element_size * end, element, element_size, fifo->_element_size);
+        fifo->_end = end;
+        fifo->_count++;
+        put = true;
+    }
+    critical_exit();
+    return put;
+}
+
 /**
  * @internal
- * @brief Internal function which gets the @p element from the @p fifo.
+ * @brief Internal function which gets the @p element from the @p fifo if there is one. This
+ * is inlined, so the copy of the constant @p element_size compiles to plain loads and stores.
  * 
  * @param fifo FIFO from which to get the element.
  * @param element Pointer to the destination where the element
  * will be copied.
+ * @param element_size Size of the element, which should equal the element size of the FIFO.
+ * @return Whether an element has been taken, i.e. false if the FIFO is empty.
+ */
+static inline bool _fifo_try_get(volatile _FIFO_t* fifo, void* element, size_t element_size) {
+    bool taken = false;
+    critical_enter();
+    if(fifo->_count > 0) {
+        size_t start = _fifo_next_index(fifo->_start, fifo->_fifo_size);
+        _fifo_copy(element, (const uint8_t*)fifo->_buf + fifo->_element_size * start, element_size, fifo->_element_size);
+        fifo->_start = start;
+        fifo->_count--;
+        taken = true;
+    }
+    critical_exit();
+    return taken;
+}
+
+/**
+ * @internal
+ * @brief Internal function which puts the @p element into the @p fifo, waiting for space.
+ */
+static inline void _fifo_put(volatile _FIFO_t* fifo, const void* element, size_t element_size) {
+    while(!_fifo_try_put(fifo, element, element_size));
+}
+
+/**
+ * @internal
+ * @brief Internal function which gets the @p element from the @p fifo, waiting for an element.
  */
-void _fifo_get(volatile _FIFO_t* fifo, void* element);
+static inline void _fifo_get(volatile _FIFO_t* fifo, void* element, size_t element_size) {
+    while(!_fifo_try_get(fifo, element, element_size));
+}
+
+/**
+ * @internal
+ * @brief Internal function which puts up to @p count elements into the @p fifo. FIFOs
+ * which overwrite take all the elements, dropping the oldest ones.
+ * 
+ * @return The number of elements which have been put.
+ */
+size_t _fifo_put_n(volatile _FIFO_t* fifo, const void* elements, size_t count);
+
+/**
+ * @internal
+ * @brief Internal function which gets up to @p count elements from the @p fifo.
+ * 
+ * @return The number of elements which have been taken.
+ */
+size_t _fifo_get_n(volatile _FIFO_t* fifo, void* elements, size_t count);
+
+#if __has_include("FreeRTOS.h")
+    /**
+     * @internal
+     * @brief Internal function which puts the @p element into the @p fifo, waiting for up to @p timeout ticks.
+     * 
+     * @return Whether the element has been put before the timeout expired.
+     */
+    bool _fifo_put_timeout(volatile _FIFO_t* fifo, const void* element, size_t element_size, TickType_t timeout);
+
+    /**
+     * @internal
+     * @brief Internal function which gets the @p element from the @p fifo, waiting for up to @p timeout ticks.
+     * 
+     * @return Whether an element has been taken before the timeout expired.
+     */
+    bool _fifo_get_timeout(volatile _FIFO_t* fifo, void* element, size_t element_size, TickType_t timeout);
+#endif
+
 /**
  * @internal
  * @brief Internal function which gets the pointer to the @p element from the @p fifo.
@@ -54,6 +186,42 @@ void _fifo_get(volatile _FIFO_t* fifo, void* element);
  */
 volatile void* _fifo_get_direct(volatile _FIFO_t* fifo);
 
+/**
+ * @internal
+ * @brief Internal initializer for a FIFO using the given buffer. This allows embedding
+ * FIFOs into other structures. Do not use directly.
+ * 
+ * @param type Element type which the FIFO will contain.
+ * @param fifo_size Size of the FIFO.
+ * @param buf Buffer holding @p fifo_size elements of @p type.
+ */
+#define _FIFO_INITIALIZER(type, fifo_size, buf) _FIFO_INITIALIZER_MODE(type, fifo_size, buf, false)
+
+/**
+ * @internal
+ * @brief Internal initializer for a FIFO, which drops the oldest element when it's full
+ * if @p overwrite is true. Do not use directly.
+ */
+#define _FIFO_INITIALIZER_MODE(type, fifo_size, buf, overwrite) { \
+        ._start = 0, \
+        ._end = 0, \
+        ._count = 0, \
+        ._overwritten_count = 0, \
+        ._element_size = sizeof(type), \
+        ._fifo_size = (fifo_size), \
+        ._overwrite = (overwrite), \
+        ._buf = (buf) \
+    }
+
+/**
+ * @internal
+ * @brief Internal macro which declares a FIFO in the given mode. Do not use directly.
+ */
+#define _fifo_declare_mode(type, name, fifo_size, qualifiers, overwrite) \
+    qualifiers volatile type TOKEN_CONCAT(__INTERNAL_FIFOBUF_, __LINE__)[fifo_size]; \
+    typedef type TOKEN_CONCAT(__INTERNAL_FIFO_CLIENT_TYPE_, name); \
+    qualifiers volatile _FIFO_t name = _FIFO_INITIALIZER_MODE(type, fifo_size, TOKEN_CONCAT(__INTERNAL_FIFOBUF_, __LINE__), overwrite)
+
 /**
  * @brief Declares a new FIFO with the given @p type, @p name and @p size. You can
  * specify additional qualifiers for the FIFO variable, e.g. static.
@@ -71,17 +239,7 @@ volatile void* _fifo_get_direct(volatile _FIFO_t* fifo);
  * @param qualifiers Additional qualifiers which will be placed before the
  * type of the FIFO.
  */
-#define fifo_declare_qualifier(type, name, fifo_size, qualifiers) \
-    qualifiers volatile type TOKEN_CONCAT(__INTERNAL_FIFOBUF_, __LINE__)[fifo_size]; \
-    typedef type TOKEN_CONCAT(__INTERNAL_FIFO_CLIENT_TYPE_, name); \
-    qualifiers volatile _FIFO_t name = { \
-        ._start = 0, \
-        ._end = 0, \
-        ._count = 0, \
-        ._element_size = sizeof(type), \
-        ._fifo_size = fifo_size, \
-        ._buf = TOKEN_CONCAT(__INTERNAL_FIFOBUF_, __LINE__) \
-    }
+#define fifo_declare_qualifier(type, name, fifo_size, qualifiers) _fifo_declare_mode(type, name, fifo_size, qualifiers, false)
 
 /**
  * @brief Declares a new FIFO with the given @p type, @p name and @p size.
@@ -99,20 +257,74 @@ volatile void* _fifo_get_direct(volatile _FIFO_t* fifo);
  */
 #define fifo_declare(type, name, fifo_size) fifo_declare_qualifier(type, name, fifo_size,)
 
+/**
+ * @brief Declares a FIFO which is defined in another file using @ref fifo_declare(), along with
+ * its element type, which @ref fifo_put_literal() and @ref fifo_get_direct() require. The other
+ * FIFO macros also work with a plain `extern volatile FIFO_t` declaration.
+ * 
+ * @code{.c}
+ * // In the header
+ * fifo_declare_extern(Sample_t, samples);
+ * 
+ * // In exactly one source file
+ * fifo_declare(Sample_t, samples, 32);
+ * @endcode
+ * 
+ * @param type Element type which the FIFO contains.
+ * @param name Name under which the FIFO can be accessed.
+ */
+#define fifo_declare_extern(type, name) \
+    extern volatile _FIFO_t name; \
+    typedef type TOKEN_CONCAT(__INTERNAL_FIFO_CLIENT_TYPE_, name)
+
+/**
+ * @brief Declares a new FIFO like @ref fifo_declare_qualifier(), which drops its oldest element
+ * when an element is put while it's full. Putting into it never blocks and always succeeds,
+ * so it can be used from interrupts at any rate.
+ * 
+ * @param type Element type which the FIFO will contain.
+ * @param name Name under which the FIFO can be accessed.
+ * @param fifo_size Size of the FIFO.
+ * @param qualifiers Additional qualifiers which will be placed before the
+ * type of the FIFO.
+ */
+#define fifo_declare_overwrite_qualifier(type, name, fifo_size, qualifiers) _fifo_declare_mode(type, name, fifo_size, qualifiers, true)
+
+/**
+ * @brief Declares a new FIFO like @ref fifo_declare(), which drops its oldest element when an
+ * element is put while it's full.
+ * 
+ * @code{.c}
+ * fifo_declare_overwrite(TraceEntry_t, trace, 64);
+ * 
+ * // In an interrupt, never blocks
+ * fifo_put(trace, entry);
+ * @endcode
+ * 
+ * @param type Element type which the FIFO will contain.
+ * @param name Name under which the FIFO can be accessed.
+ * @param fifo_size Size of the FIFO.
+ */
+#define fifo_declare_overwrite(type, name, fifo_size) fifo_declare_overwrite_qualifier(type, name, fifo_size,)
+
 /**
  * @brief Puts the given @p element to the end of the @p fifo.
  * 
- * If the FIFO is already full, this blocks until space is available.
+ * If the FIFO is already full, this blocks until space is available, unless the FIFO overwrites
+ * its oldest element. This deadlocks if the consumer can't run meanwhile, e.g. in an interrupt,
+ * so use @ref fifo_try_put() there.
  * 
  * @param fifo FIFO to which the element should be appended.
  * @param element Element which will be appended to the FIFO.
  */
-#define fifo_put(fifo, element) _fifo_put((_FIFO_t*)(&(fifo)), (void*)(&(element)))
+#define fifo_put(fifo, element) _fifo_put((_FIFO_t*)(&(fifo)), (const void*)(&(element)), sizeof(element))
 
 /**
  * @brief Puts the given @p element, which may be a lliteral, to the end of the @p fifo.
  * 
- * If the FIFO is already full, this blocks until space is available.
+ * If the FIFO is already full, this blocks until space is available, unless the FIFO overwrites
+ * its oldest element. This deadlocks if the consumer can't run meanwhile, e.g. in an interrupt,
+ * so use @ref fifo_try_put() there.
  * 
  * @param fifo FIFO to which the element should be appended.
  * @param element Element which will be appended to the FIFO.
@@ -125,17 +337,94 @@ volatile void* _fifo_get_direct(volatile _FIFO_t* fifo);
 /**
  * @brief Gets an element from the @p fifo and writes it ot the variable @p element.
  * 
- * If the FIFO is already empty, this blocks until an element becomes available.
+ * If the FIFO is already empty, this blocks until an element becomes available. This deadlocks if
+ * the producer can't run meanwhile, e.g. in an interrupt, so use @ref fifo_try_get() there.
  * 
  * @param fifo FIFO from which to get the element.
  * @param element Variable to which the element will be written to.
  */
-#define fifo_get(fifo, element) _fifo_get((_FIFO_t*)(&(fifo)), (void*)(&(element)))
+#define fifo_get(fifo, element) _fifo_get((_FIFO_t*)(&(fifo)), (void*)(&(element)), sizeof(element))
+
+/**
+ * @brief Puts the given @p element to the end of the @p fifo if there is space. This never
+ * blocks, so it can be used from interrupts.
+ * 
+ * @param fifo FIFO to which the element should be appended.
+ * @param element Element which will be appended to the FIFO.
+ * 
+ * @returns Whether the element has been put, i.e. false if the FIFO is full and doesn't overwrite.
+ */
+#define fifo_try_put(fifo, element) _fifo_try_put((_FIFO_t*)(&(fifo)), (const void*)(&(element)), sizeof(element))
+
+/**
+ * @brief Gets an element from the @p fifo and writes it to the variable @p element if the FIFO
+ * isn't empty. This never blocks, so it can be used from interrupts.
+ * 
+ * @param fifo FIFO from which to get the element.
+ * @param element Variable to which the element will be written to.
+ * 
+ * @returns Whether an element has been taken, i.e. false if the FIFO is empty.
+ */
+#define fifo_try_get(fifo, element) _fifo_try_get((_FIFO_t*)(&(fifo)), (void*)(&(element)), sizeof(element))
+
+/**
+ * @brief Puts up to @p count elements from the array @p elements to the end of the @p fifo. The
+ * elements are copied with at most two copies in a single critical section. This never blocks.
+ * 
+ * @param fifo FIFO to which the elements should be appended.
+ * @param elements Array of the elements.
+ * @param count Number of elements in @p elements.
+ * 
+ * @returns The number of elements which have been put, which is less than @p count if the FIFO is full
+ * and doesn't overwrite.
+ */
+#define fifo_put_n(fifo, elements, count) _fifo_put_n((_FIFO_t*)(&(fifo)), (const void*)(elements), (count))
+
+/**
+ * @brief Gets up to @p count elements from the @p fifo and writes them to the array @p elements. The
+ * elements are copied with at most two copies in a single critical section. This never blocks.
+ * 
+ * @param fifo FIFO from which to get the elements.
+ * @param elements Array to which the elements will be written to.
+ * @param count Number of elements which fit into @p elements.
+ * 
+ * @returns The number of elements which have been taken, which is less than @p count if the FIFO runs empty.
+ */
+#define fifo_get_n(fifo, elements, count) _fifo_get_n((_FIFO_t*)(&(fifo)), (void*)(elements), (count))
+
+#if __has_include("FreeRTOS.h")
+    /**
+     * @brief Puts the given @p element to the end of the @p fifo, waiting for up to @p timeout ticks
+     * for space. The task sleeps while waiting, so the consumer can run. Don't use this from interrupts.
+     * 
+     * @param fifo FIFO to which the element should be appended.
+     * @param element Element which will be appended to the FIFO.
+     * @param timeout Time in ticks to wait for space, or portMAX_DELAY to wait forever.
+     * 
+     * @returns Whether the element has been put before the timeout expired.
+     */
+    #define fifo_put_timeout(fifo, element, timeout) _fifo_put_timeout((_FIFO_t*)(&(fifo)), (const void*)(&(element)), sizeof(element), (timeout))
+
+    /**
+     * @brief Gets an element from the @p fifo, waiting for up to @p timeout ticks for an element.
+     * The task sleeps while waiting, so the producer can run. Don't use this from interrupts.
+     * 
+     * @param fifo FIFO from which to get the element.
+     * @param element Variable to which the element will be written to.
+     * @param timeout Time in ticks to wait for an element, or portMAX_DELAY to wait forever.
+     * 
+     * @returns Whether an element has been taken before the timeout expired.
+     */
+    #define fifo_get_timeout(fifo, element, timeout) _fifo_get_timeout((_FIFO_t*)(&(fifo)), (void*)(&(element)), sizeof(element), (timeout))
+#endif
 
 /**
  * @brief Gets an element from the @p fifo and returns it. Of course, you can only
  * use this macro, if you can assign the type directly. If not, use @ref fifo_get().
  * 
+ * The element is read in place after it has been removed, so don't use this on FIFOs which
+ * overwrite and are put into from interrupts, as the element could be overwritten meanwhile.
+ * 
  * @param fifo FIFO from which to get the element.
  * 
  * @returns Returns the value of the element.
@@ -160,6 +449,13 @@ volatile void* _fifo_get_direct(volatile _FIFO_t* fifo);
  * @param fifo The FIFO queue you want to access.
  */
 #define fifo_get_element_count(fifo) ((fifo)._count)
+/**
+ * @brief Gets the number of elements which have been dropped because they were overwritten,
+ * see @ref fifo_declare_overwrite().
+ * 
+ * @param fifo The FIFO queue you want to access.
+ */
+#define fifo_get_overwritten_count(fifo) ((fifo)._overwritten_count)
 /**
  * @brief Checks if the given FIFO queue is empty, i.e. none of the slots in the queue are occupied.
  * 
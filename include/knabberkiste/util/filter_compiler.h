@@ -0,0 +1,65 @@
+/**
+ * @file filter_compiler.h
+ * @author Gabriel Heinzer
+ * @brief Compiles a set of identifiers into a limited number of mask filters.
+ * 
+ * Acceptance filters like the ones of the bxCAN peripheral match an identifier when all bits
+ * set in the mask are equal to the value. Given a set of keys which must be accepted, @ref filter_compile()
+ * finds a small set of such mask filters covering all the keys, while accepting as few other keys
+ * as possible.
+ * 
+ * This doesn't access any hardware, so it can be used and tested on any platform.
+ * 
+ * @code{.c}
+ * FilterPattern_t patterns[] = {
+ *     { .value = 0x10, .mask = 0xFF },
+ *     { .value = 0x11, .mask = 0xFF },
+ *     { .value = 0x12, .mask = 0xFF },
+ *     { .value = 0x40, .mask = 0xFF }
+ * };
+ * 
+ * // Cover the keys with at most 2 filters
+ * size_t pattern_count = filter_compile(patterns, 4, 0xFF, 2);
+ * @endcode
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/**
+ * @brief Structure representing a single mask filter.
+ */
+typedef struct {
+    /// @brief Value which the key must match. Only the bits set in @ref mask are relevant.
+    uint32_t value;
+    /// @brief Mask of the bits which must match. All other bits are "don't care".
+    uint32_t mask;
+} FilterPattern_t;
+
+/**
+ * @brief Checks if the given @p key is accepted by the @p pattern.
+ */
+#define filter_pattern_matches(pattern, key) ((((key) ^ (pattern).value) & (pattern).mask) == 0)
+
+/**
+ * @brief Compiles the given filters into at most @p max_patterns filters which accept
+ * at least every key accepted by the given filters. The filters are compiled in place: the
+ * caller initializes @p patterns with one filter per key, usually exact ones, and the filters whose
+ * combination accepts the fewest additional keys are merged until the limit is met.
+ * 
+ * @param patterns Filters to compile. The compiled filters are written to the start of this buffer.
+ * @param pattern_count Number of filters in @p patterns. Duplicates are allowed.
+ * @param key_mask Mask of the bits which make up the keys. Bits outside of this mask must never
+ * be set in the masks of the filters.
+ * @param max_patterns Maximum number of filters. Must be at least 1 if @p pattern_count is not 0.
+ * 
+ * @return The number of compiled filters at the start of @p patterns.
+ */
+size_t filter_compile(
+    FilterPattern_t* patterns,
+    size_t pattern_count,
+    uint32_t key_mask,
+    size_t max_patterns
+);
\ No newline at end of file
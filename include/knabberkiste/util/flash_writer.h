@@ -0,0 +1,109 @@
+/**
+ * @file flash_writer.h
+ * @author Gabriel Heinzer
+ * @brief Writes an image to a flash region page by page, erasing the next page in the background.
+ *
+ * The flash is accessed through a @ref FlashBackend_t, so this doesn't access any hardware
+ * and can be used and tested on any platform, e.g. against a simulated flash. The backend of
+ * the internal flash is declared using @ref flash_backend_declare().
+ *
+ * Pages are erased in order, at most one page ahead of the highest page which has been
+ * written. While the data of page N is being received and programmed, page N + 1 is
+ * therefore already being erased. The data may be written in any order, as long as every
+ * byte is only written once.
+ *
+ * @code{.c}
+ * FlashWriter_t writer;
+ * flash_writer_begin(&writer, &backend, image_size);
+ *
+ * while(...) {
+ *     flash_writer_write(&writer, offset, chunk, chunk_size);
+ * }
+ *
+ * flash_writer_finish(&writer);
+ * @endcode
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Interface to a flash region which is organized in pages.
+ */
+typedef struct {
+    /// @brief Size of a page in bytes.
+    size_t page_size;
+    /// @brief Size of the region in bytes, which is a multiple of the page size.
+    size_t size;
+    /// @brief Starts erasing the @p page without waiting for it to be erased.
+    void (*erase_start)(size_t page, void* context);
+    /// @brief Checks if an erase started by @ref erase_start is still in progress.
+    bool (*busy)(void* context);
+    /// @brief Programs @p size bytes at @p offset, which are both multiples of 2. Blocks until
+    /// the data is programmed, including while an erase is in progress.
+    void (*program)(size_t offset, const uint8_t* data, size_t size, void* context);
+    /// @brief Reads @p size bytes at @p offset.
+    void (*read)(size_t offset, uint8_t* data, size_t size, void* context);
+    /// @brief Pointer passed to all functions of the backend.
+    void* context;
+} FlashBackend_t;
+
+/**
+ * @brief State of an image which is being written to a flash region.
+ */
+typedef struct {
+    /// @internal
+    const FlashBackend_t* _backend;
+    /// @internal
+    size_t _page_count;
+    /// @internal
+    size_t _erased_pages;
+    /// @internal
+    bool _erase_pending;
+    /// @internal
+    size_t _lookahead_page;
+} FlashWriter_t;
+
+/**
+ * @brief Starts writing an image of @p image_size bytes to the region of the @p backend.
+ * Starts erasing the first page.
+ *
+ * @param writer Writer to initialize.
+ * @param backend Backend of the flash region.
+ * @param image_size Size of the image in bytes.
+ *
+ * @throws ERR_RANGE The image doesn't fit into the region.
+ */
+void flash_writer_begin(FlashWriter_t* writer, const FlashBackend_t* backend, size_t image_size);
+
+/**
+ * @brief Writes @p size bytes of the image at @p offset. Blocks until the page has been erased
+ * if this hasn't happened yet. An odd number of bytes is padded with 0xFF, so this must
+ * be the last part of the image in this case.
+ *
+ * @param writer Writer of the image.
+ * @param offset Offset of the data within the image, which must be a multiple of 2.
+ * @param data Data to write.
+ * @param size Number of bytes to write.
+ *
+ * @throws ERR_RANGE The data is outside of the image.
+ * @throws ERR_IMPOSSIBLE The offset is odd.
+ */
+void flash_writer_write(FlashWriter_t* writer, size_t offset, const uint8_t* data, size_t size);
+
+/**
+ * @brief Advances the background erase. Call this regularly while waiting for data.
+ *
+ * @param writer Writer of the image.
+ */
+void flash_writer_poll(FlashWriter_t* writer);
+
+/**
+ * @brief Erases the pages which haven't been written and waits until all erases are done.
+ *
+ * @param writer Writer of the image.
+ */
+void flash_writer_finish(FlashWriter_t* writer);
\ No newline at end of file
@@ -0,0 +1,223 @@
+/**
+ * @file ring.h
+ * @author Gabriel Heinzer
+ * @brief Lock-free ring buffer for a single producer and a single consumer.
+ * 
+ * @section ring-usage Usage
+ * 
+ * A ring is the replacement of a FIFO for queues which are written by exactly one
+ * context and read by exactly one other context, e.g. by an interrupt and a task. The
+ * producer only writes the head index and the consumer only writes the tail index, so
+ * neither side ever has to disable interrupts. The capacity is a power of two, so the
+ * indices wrap using a mask instead of a division.
+ * 
+ * @code{.c}
+ * ring_declare(CAN_Frame_t, myring, 16);
+ * 
+ * // Producer, e.g. an interrupt
+ * if(!ring_put(myring, frame)) {
+ *     // The ring is full
+ * }
+ * 
+ * // Consumer, e.g. a task
+ * CAN_Frame_t frame;
+ * while(ring_get(myring, frame)) {
+ *     // ...
+ * }
+ * @endcode
+ * 
+ * Every ring records the type of its elements, so @ref ring_put() and @ref ring_get() fail to
+ * compile if they're passed an element of another size. Use @ref ring_type() to embed a ring
+ * into another structure.
+ * 
+ * The element size is a compile-time constant at every call site, so the copies inline to
+ * plain loads and stores. This doesn't access any hardware, so it can be used and tested on
+ * any platform.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <knabberkiste/util/macro_util.h>
+
+/**
+ * @internal
+ * @brief Internal ring structure. Do not use directly.
+ */
+typedef struct {
+    /// Number of elements ever put, only written by the producer
+    volatile size_t _head;
+    /// Number of elements ever taken, only written by the consumer
+    volatile size_t _tail;
+    const size_t _mask;
+    uint8_t* const _buf;
+} _Ring_t;
+
+/**
+ * @brief Opaque type for a ring.
+ */
+typedef _Ring_t Ring_t;
+
+/**
+ * @brief Type of a ring of elements of the given @p type, e.g. for embedding a ring into another
+ * structure. Initialize it with @ref _RING_INITIALIZER().
+ * 
+ * @code{.c}
+ * typedef struct {
+ *     ring_type(CAN_Frame_t) frames;
+ * } Receiver_t;
+ * @endcode
+ */
+#define ring_type(type) union { \
+        _Ring_t _ring; \
+        /* Never accessed, only records the element type for the checks of the ring macros */ \
+        type* _client; \
+    }
+
+/**
+ * @internal
+ * @brief Internal function which copies the @p element of @p element_size bytes into the @p ring.
+ * 
+ * @return Whether the element has been put, i.e. false if the ring is full.
+ */
+static inline bool _ring_put(_Ring_t* ring, const void* element, size_t element_size) {
+    size_t head = ring->_head;
+
+    // Acquire the tail, so the consumer is done reading the slot before it is overwritten
+    size_t tail = __atomic_load_n(&ring->_tail, __ATOMIC_ACQUIRE);
+    if(head - tail > ring->_mask) return false;
+
+    memcpy(ring->_buf + (head & ring->_mask) * element_size, element, element_size);
+
+    // Release the head, so the element is written before the consumer sees it
+    __atomic_store_n(&ring->_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @internal
+ * @brief Internal function which copies the oldest element of @p element_size bytes out of the @p ring.
+ * 
+ * @return Whether an element has been taken, i.e. false if the ring is empty.
+ */
+static inline bool _ring_get(_Ring_t* ring, void* element, size_t element_size) {
+    size_t tail = ring->_tail;
+
+    // Acquire the head, so the element is read after the producer has written it
+    size_t head = __atomic_load_n(&ring->_head, __ATOMIC_ACQUIRE);
+    if(head == tail) return false;
+
+    memcpy(element, ring->_buf + (tail & ring->_mask) * element_size, element_size);
+
+    // Release the tail, so the slot is read before the producer overwrites it
+    __atomic_store_n(&ring->_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @internal
+ * @brief Internal initializer for a @ref ring_type() using the given buffer. This allows embedding
+ * rings into other structures. Do not use directly.
+ * 
+ * @param ring_size Capacity of the ring, which must be a power of two.
+ * @param buf Buffer holding @p ring_size elements.
+ */
+#define _RING_INITIALIZER(ring_size, buf) { \
+        ._ring = { \
+            ._head = 0, \
+            ._tail = 0, \
+            ._mask = (ring_size) - 1, \
+            ._buf = (uint8_t*)(buf) \
+        } \
+    }
+
+/**
+ * @internal
+ * @brief Checks at compile time that @p ring_size is a power of two.
+ */
+#define _RING_SIZE_VALID(ring_size) ((ring_size) > 0 && ((ring_size) & ((ring_size) - 1)) == 0)
+
+/**
+ * @internal
+ * @brief Internal macro which fails to compile if the @p element doesn't have the size of the
+ * elements of the @p ring, as the element is copied with its own size. Do not use directly.
+ */
+#define _RING_CHECK_ELEMENT(ring, element) \
+    ((void)sizeof(struct { \
+        _Static_assert(sizeof(element) == sizeof(*(ring)._client), "The element doesn't have the size of the elements of the ring."); \
+        char _unused; \
+    }))
+
+/**
+ * @brief Declares a new ring with the given @p type, @p name and @p ring_size. You can
+ * specify additional qualifiers for the ring variable, e.g. static.
+ * 
+ * @param type Element type which the ring will contain.
+ * @param name Name under which the ring can be accessed.
+ * @param ring_size Capacity of the ring, which must be a power of two.
+ * @param qualifiers Additional qualifiers which will be placed before the
+ * type of the ring.
+ */
+#define ring_declare_qualifier(type, name, ring_size, qualifiers) \
+    _Static_assert(_RING_SIZE_VALID(ring_size), "The size of a ring must be a power of two."); \
+    qualifiers type TOKEN_CONCAT(__INTERNAL_RINGBUF_, __LINE__)[ring_size]; \
+    qualifiers ring_type(type) name = _RING_INITIALIZER(ring_size, TOKEN_CONCAT(__INTERNAL_RINGBUF_, __LINE__))
+
+/**
+ * @brief Declares a new ring with the given @p type, @p name and @p ring_size.
+ * 
+ * @param type Element type which the ring will contain.
+ * @param name Name under which the ring can be accessed.
+ * @param ring_size Capacity of the ring, which must be a power of two.
+ */
+#define ring_declare(type, name, ring_size) ring_declare_qualifier(type, name, ring_size,)
+
+/**
+ * @brief Puts the given @p element to the end of the @p ring. Only call this from the producer.
+ * This never blocks.
+ * 
+ * @param ring Ring to which the element should be appended.
+ * @param element Element which will be appended to the ring.
+ * 
+ * @returns Whether the element has been put, i.e. false if the ring is full.
+ */
+#define ring_put(ring, element) (_RING_CHECK_ELEMENT(ring, element), _ring_put(&(ring)._ring, &(element), sizeof(element)))
+
+/**
+ * @brief Gets the oldest element from the @p ring and writes it to the variable @p element. Only
+ * call this from the consumer. This never blocks.
+ * 
+ * @param ring Ring from which to get the element.
+ * @param element Variable to which the element will be written to.
+ * 
+ * @returns Whether an element has been taken, i.e. false if the ring is empty.
+ */
+#define ring_get(ring, element) (_RING_CHECK_ELEMENT(ring, element), _ring_get(&(ring)._ring, &(element), sizeof(element)))
+
+/**
+ * @brief Gets the capacity of the ring, i.e. the max. number of elements.
+ * 
+ * @param ring The ring you want to access.
+ */
+#define ring_get_size(ring) ((ring)._ring._mask + 1)
+/**
+ * @brief Gets the number of elements currently in the ring.
+ * 
+ * @param ring The ring you want to access.
+ */
+#define ring_get_element_count(ring) ((size_t)((ring)._ring._head - (ring)._ring._tail))
+/**
+ * @brief Checks if the given ring is empty.
+ * 
+ * @param ring The ring you want to access.
+ */
+#define ring_empty(ring) ((ring)._ring._head == (ring)._ring._tail)
+/**
+ * @brief Checks if the given ring is full.
+ * 
+ * @param ring The ring you want to access.
+ */
+#define ring_full(ring) (ring_get_element_count(ring) > (ring)._ring._mask)
\ No newline at end of file
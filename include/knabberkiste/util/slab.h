@@ -0,0 +1,167 @@
+/**
+ * @file slab.h
+ * @author Gabriel Heinzer
+ * @brief Statically-sized, thread- and ISR-safe pool allocator for fixed-size blocks.
+ *
+ * @section slab-usage Usage
+ *
+ * A slab is declared with the size and the number of its blocks. All the memory is
+ * reserved at compile time, so allocating and freeing never touches the heap and
+ * always takes constant time. This makes it safe to use from interrupt handlers.
+ *
+ * @code{.c}
+ * slab_declare(mypool, 64, 16);
+ *
+ * uint8_t* block = slab_alloc(mypool);
+ * if(block == 0) {
+ *     // The slab is exhausted
+ * }
+ *
+ * // ...
+ *
+ * slab_free(mypool, block);
+ * @endcode
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <knabberkiste/util/macro_util.h>
+
+/**
+ * @internal
+ * @brief Internal slab structure. Do not use directly.
+ */
+typedef struct {
+    void* _free_list;
+    size_t _next_unused;
+    size_t _used_count;
+    size_t _exhausted_count;
+    const size_t _block_size;
+    const size_t _block_count;
+    uint8_t* const _buf;
+} _Slab_t;
+
+/**
+ * @brief Opaque type for a slab.
+ */
+typedef _Slab_t Slab_t;
+
+/**
+ * @internal
+ * @brief Internal function which allocates a block from the @p slab.
+ *
+ * @param slab Slab from which to allocate the block.
+ * @return Pointer to the block, or a null pointer if the slab is exhausted.
+ */
+void* _slab_alloc(volatile _Slab_t* slab);
+
+/**
+ * @internal
+ * @brief Internal function which returns the @p block to the @p slab.
+ *
+ * @param slab Slab to which the block belongs.
+ * @param block Pointer to the block. Null pointers are ignored.
+ */
+void _slab_free(volatile _Slab_t* slab, void* block);
+
+/**
+ * @internal
+ * @brief Size of a single block, rounded up so that every block is pointer-aligned.
+ */
+#define _SLAB_ALIGNED_BLOCK_SIZE(block_size) (((block_size) + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*))
+
+/**
+ * @internal
+ * @brief Size of the buffer required by a slab with the given geometry.
+ */
+#define _SLAB_BUFFER_SIZE(block_size, block_count) ((block_count) * _SLAB_ALIGNED_BLOCK_SIZE(block_size))
+
+/**
+ * @internal
+ * @brief Internal initializer for a slab using the given pointer-aligned buffer of
+ * @ref _SLAB_BUFFER_SIZE bytes. This allows embedding slabs into other structures. Do not use directly.
+ */
+#define _SLAB_INITIALIZER(block_size, block_count, buf) { \
+        ._free_list = 0, \
+        ._next_unused = 0, \
+        ._used_count = 0, \
+        ._exhausted_count = 0, \
+        ._block_size = _SLAB_ALIGNED_BLOCK_SIZE(block_size), \
+        ._block_count = (block_count), \
+        ._buf = (buf) \
+    }
+
+/**
+ * @brief Declares a new slab with the given @p name, holding @p block_count blocks
+ * of @p block_size bytes each. You can specify additional qualifiers for the slab
+ * variable, e.g. static.
+ *
+ * @param name Name under which the slab can be accessed.
+ * @param block_size Size of a single block in bytes.
+ * @param block_count Number of blocks in the slab.
+ * @param qualifiers Additional qualifiers which will be placed before the
+ * type of the slab.
+ */
+#define slab_declare_qualifier(name, block_size, block_count, qualifiers) \
+    qualifiers uint8_t __attribute__((aligned(sizeof(void*)))) TOKEN_CONCAT(__INTERNAL_SLABBUF_, __LINE__)[_SLAB_BUFFER_SIZE(block_size, block_count)]; \
+    qualifiers volatile _Slab_t name = _SLAB_INITIALIZER(block_size, block_count, TOKEN_CONCAT(__INTERNAL_SLABBUF_, __LINE__))
+
+/**
+ * @brief Declares a new slab with the given @p name, holding @p block_count blocks
+ * of @p block_size bytes each.
+ *
+ * @param name Name under which the slab can be accessed.
+ * @param block_size Size of a single block in bytes.
+ * @param block_count Number of blocks in the slab.
+ */
+#define slab_declare(name, block_size, block_count) slab_declare_qualifier(name, block_size, block_count,)
+
+/**
+ * @brief Allocates a single block from the @p slab. This never blocks.
+ *
+ * @param slab The slab you want to allocate from.
+ *
+ * @returns A pointer to the block, or a null pointer if all blocks are in use.
+ */
+#define slab_alloc(slab) _slab_alloc((_Slab_t*)(&(slab)))
+
+/**
+ * @brief Returns a block previously allocated with @ref slab_alloc() to the @p slab.
+ *
+ * @param slab The slab the block was allocated from.
+ * @param block Pointer to the block. Null pointers are ignored.
+ */
+#define slab_free(slab, block) _slab_free((_Slab_t*)(&(slab)), (void*)(block))
+
+/**
+ * @brief Gets the size of a single block of the slab in bytes.
+ *
+ * @param slab The slab you want to access.
+ */
+#define slab_get_block_size(slab) ((slab)._block_size)
+/**
+ * @brief Gets the total number of blocks of the slab.
+ *
+ * @param slab The slab you want to access.
+ */
+#define slab_get_block_count(slab) ((slab)._block_count)
+/**
+ * @brief Gets the number of blocks which are currently allocated.
+ *
+ * @param slab The slab you want to access.
+ */
+#define slab_get_used_count(slab) ((slab)._used_count)
+/**
+ * @brief Gets the number of allocations which failed because the slab was exhausted.
+ *
+ * @param slab The slab you want to access.
+ */
+#define slab_get_exhausted_count(slab) ((slab)._exhausted_count)
+/**
+ * @brief Checks if all the blocks of the slab are currently allocated.
+ *
+ * @param slab The slab you want to access.
+ */
+#define slab_exhausted(slab) ((slab)._used_count == (slab)._block_count)
\ No newline at end of file
@@ -29,9 +29,18 @@
  * printf(mybuf[7]);
  * @endcode
  * 
+ * @subsection varbuf-capacity Capacity
+ * 
+ * The capacity of a varbuf grows geometrically when elements are pushed, so building a
+ * buffer element by element takes amortized constant time per element. It only shrinks
+ * once at most a quarter of it is used, and an empty varbuf is freed. If you know the final
+ * length in advance, reserve it with @ref varbuf_reserve, and release unused capacity with
+ * @ref varbuf_shrink_to_fit.
+ * 
  * @section varbuf-internal Internal structure
  * The `varbuf` is allocated in heap at the position the pointer points to minus the size of
- * `size_t`. This is done so that the size of the buffer can be stored in heap as well.
+ * two `size_t`. This is done so that the length and the capacity of the buffer can be stored
+ * in heap as well.
  * 
  * `varbuf` can work with a pointer to any type and can therefore store a list of any arbitrary
  * type.
@@ -44,6 +53,9 @@
 /* Internal function declarations */
 
 size_t _varbuf_get_length(void** buf);
+size_t _varbuf_get_capacity(void** buf);
+void _varbuf_reserve(void** buf, size_t capacity, size_t element_size);
+void _varbuf_shrink_to_fit(void** buf, size_t element_size);
 void _varbuf_push_chunk(void** buf, void* element, size_t element_size, size_t number_of_elements);
 
 void _varbuf_pop_chunk(void** buf, void* dest, size_t start_idx, size_t elements, size_t element_size);
@@ -69,6 +81,40 @@ void _varbuf_clear(void** buf);
  */
 #define varbuf_length(buf) _varbuf_get_length((void*)&(buf))
 
+/**
+ * @brief Gets the capacity of the varbuf as in the number of elements it can store without
+ * being reallocated.
+ * 
+ * @param buf The varbuf to use for the capacity. This must not be a pointer to
+ * the buffer, but just the buffer directly.
+ * 
+ * @returns The varbuf's capacity as in the number of elements.
+ */
+#define varbuf_capacity(buf) _varbuf_get_capacity((void*)&(buf))
+
+/**
+ * @brief Makes sure that the varbuf can store at least @p capacity elements without
+ * being reallocated. This allocates the varbuf if it hasn't been yet.
+ * 
+ * @param buf The varbuf to reserve the capacity for. This must not be a pointer to
+ * the buffer, but just the buffer directly.
+ * @param capacity The number of elements to reserve.
+ * 
+ * @returns Nothing.
+ */
+#define varbuf_reserve(buf, capacity) _varbuf_reserve((void*)&(buf), (capacity), varbuf_element_size(buf))
+
+/**
+ * @brief Reduces the capacity of the varbuf to its length, releasing the unused memory.
+ * An empty varbuf is freed.
+ * 
+ * @param buf The varbuf to shrink. This must not be a pointer to
+ * the buffer, but just the buffer directly.
+ * 
+ * @returns Nothing.
+ */
+#define varbuf_shrink_to_fit(buf) _varbuf_shrink_to_fit((void*)&(buf), varbuf_element_size(buf))
+
 /**
  * @brief Appends a single element to the buffer. Note that the element must be of the same
  * type as the buffer itself is.
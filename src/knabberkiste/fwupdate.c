@@ -0,0 +1,258 @@
+#include <knabberkiste/fwupdate.h>
+#include <knabberkiste/io.h>
+#include <knabberkiste/util/bit_manipulation.h>
+#include <knabberkiste/util/varbuf.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FW_TRAILER_MAGIC 0x4B465755
+#define FW_CRC32_POLYNOMIAL 0xEDB88320
+#define FW_COPY_BLOCK_SIZE 64
+
+/**
+ * @brief Payload of @ref KC_COMMAND_FWUPDATE_BEGIN.
+ */
+typedef struct __attribute__((__packed__)) {
+    uint32_t size;
+    uint32_t crc;
+} FW_Begin_t;
+
+/**
+ * @brief Payload of @ref KC_EVENT_FWUPDATE_DATA.
+ */
+typedef struct __attribute__((__packed__)) {
+    uint16_t sequence;
+    uint8_t data[FW_CHUNK_SIZE];
+} FW_Data_t;
+
+/**
+ * @brief Response of @ref KC_COMMAND_FWUPDATE_STATUS.
+ */
+typedef struct __attribute__((__packed__)) {
+    uint8_t status;
+    uint16_t missing_count;
+    uint16_t missing[FW_STATUS_MISSING_COUNT];
+} FW_StatusResponse_t;
+
+/**
+ * @brief Trailer written to the last page of the staging region once a complete image has been received.
+ */
+typedef struct __attribute__((__packed__)) {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t crc;
+} FW_Trailer_t;
+
+/* State of the update service, the handlers are all run by the dispatcher */
+static struct {
+    const FlashBackend_t* staging;
+    FlashWriter_t writer;
+    bool active;
+    uint32_t size;
+    uint32_t crc;
+    uint16_t chunk_count;
+    uint16_t received_count;
+    uint8_t* received;
+} fw_update;
+
+static inline size_t fw_trailer_offset(const FlashBackend_t* backend) {
+    return backend->size - backend->page_size;
+}
+
+static void fw_erase_page(const FlashBackend_t* backend, size_t page) {
+    backend->erase_start(page, backend->context);
+    while(backend->busy(backend->context));
+}
+
+static uint32_t fw_crc32(const FlashBackend_t* backend, size_t size) {
+    uint8_t block[FW_COPY_BLOCK_SIZE];
+    uint32_t crc = 0xFFFFFFFF;
+
+    for(size_t offset = 0; offset < size; offset += sizeof(block)) {
+        size_t length = size - offset < sizeof(block) ? size - offset : sizeof(block);
+        backend->read(offset, block, length, backend->context);
+
+        for(size_t i = 0; i < length; i++) {
+            crc ^= block[i];
+            for(int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (FW_CRC32_POLYNOMIAL & -(crc & 1));
+            }
+        }
+    }
+
+    return ~crc;
+}
+
+static KC_Response_t fw_respond(const void* payload, size_t payload_size) {
+    KC_Response_t response = { .payload = 0 };
+    varbuf_push_chunk(response.payload, payload, payload_size);
+    response.payload_size = payload_size;
+    return response;
+}
+
+static KC_Response_t fw_respond_status(FW_Status_t status) {
+    uint8_t payload = status;
+    return fw_respond(&payload, sizeof(payload));
+}
+
+static void fw_update_reset() {
+    free(fw_update.received);
+    fw_update.received = 0;
+    fw_update.active = false;
+}
+
+static KC_Response_t fw_begin_handler(KC_Received_CommandFrame_t command_frame) {
+    const FlashBackend_t* staging = fw_update.staging;
+    FW_Begin_t begin;
+
+    if(command_frame.payload_size < sizeof(begin)) {
+        return (KC_Response_t){ .payload = 0 };
+    }
+    memcpy(&begin, command_frame.payload, sizeof(begin));
+
+    // A new image replaces the one which is being received
+    fw_update_reset();
+
+    size_t chunk_count = (begin.size + FW_CHUNK_SIZE - 1) / FW_CHUNK_SIZE;
+    if(begin.size > fw_trailer_offset(staging) || chunk_count > UINT16_MAX) {
+        return fw_respond_status(FW_STATUS_TOO_LARGE);
+    }
+
+    fw_update.received = calloc(chunk_count / 8 + 1, 1);
+    if(fw_update.received == 0) {
+        return fw_respond_status(FW_STATUS_NO_MEMORY);
+    }
+
+    // Invalidate the previous image before overwriting it
+    fw_erase_page(staging, fw_trailer_offset(staging) / staging->page_size);
+    flash_writer_begin(&fw_update.writer, staging, begin.size);
+
+    fw_update.size = begin.size;
+    fw_update.crc = begin.crc;
+    fw_update.chunk_count = chunk_count;
+    fw_update.received_count = 0;
+    fw_update.active = true;
+
+    return fw_respond_status(FW_STATUS_OK);
+}
+
+static void fw_data_handler(KC_Received_EventFrame_t event_frame) {
+    FW_Data_t* data = event_frame.payload;
+
+    if(!fw_update.active || event_frame.payload_size < sizeof(data->sequence)) return;
+
+    uint16_t sequence;
+    memcpy(&sequence, &data->sequence, sizeof(sequence));
+    size_t offset = (size_t)sequence * FW_CHUNK_SIZE;
+    size_t size = fw_update.size - offset < FW_CHUNK_SIZE ? fw_update.size - offset : FW_CHUNK_SIZE;
+
+    // Chunks which are repeated for other nodes are ignored
+    if(sequence >= fw_update.chunk_count || READ_BIT(fw_update.received[sequence / 8], sequence % 8)) return;
+    if(event_frame.payload_size != sizeof(data->sequence) + size) return;
+
+    flash_writer_write(&fw_update.writer, offset, data->data, size);
+    SET_BIT(fw_update.received[sequence / 8], sequence % 8);
+    fw_update.received_count++;
+}
+
+static KC_Response_t fw_status_handler(KC_Received_CommandFrame_t command_frame) {
+    (void)command_frame;
+    FW_StatusResponse_t response = { .status = FW_STATUS_NOT_STARTED, .missing_count = 0 };
+
+    if(fw_update.active) {
+        flash_writer_poll(&fw_update.writer);
+
+        for(size_t i = 0; i < fw_update.chunk_count && response.missing_count < FW_STATUS_MISSING_COUNT; i++) {
+            if(!READ_BIT(fw_update.received[i / 8], i % 8)) {
+                response.missing[response.missing_count++] = i;
+            }
+        }
+
+        response.status = fw_update.received_count == fw_update.chunk_count ? FW_STATUS_OK : FW_STATUS_INCOMPLETE;
+    }
+
+    return fw_respond(&response, offsetof(FW_StatusResponse_t, missing) + response.missing_count * sizeof(uint16_t));
+}
+
+static KC_Response_t fw_finish_handler(KC_Received_CommandFrame_t command_frame) {
+    (void)command_frame;
+    const FlashBackend_t* staging = fw_update.staging;
+
+    if(!fw_update.active) {
+        return fw_respond_status(FW_STATUS_NOT_STARTED);
+    }
+    if(fw_update.received_count != fw_update.chunk_count) {
+        return fw_respond_status(FW_STATUS_INCOMPLETE);
+    }
+
+    flash_writer_finish(&fw_update.writer);
+    fw_update_reset();
+
+    if(fw_crc32(staging, fw_update.size) != fw_update.crc) {
+        return fw_respond_status(FW_STATUS_CORRUPT);
+    }
+
+    // The trailer marks the image as complete for the bootloader
+    FW_Trailer_t trailer = { .magic = FW_TRAILER_MAGIC, .size = fw_update.size, .crc = fw_update.crc };
+    staging->program(fw_trailer_offset(staging), (const uint8_t*)&trailer, sizeof(trailer), staging->context);
+
+    return fw_respond_status(FW_STATUS_OK);
+}
+
+void fw_update_service_start(KC_Context_t* ctx, const FlashBackend_t* staging) {
+    fw_update.staging = staging;
+
+    kc_command_define(ctx, KC_COMMAND_FWUPDATE_BEGIN, fw_begin_handler);
+    kc_command_define(ctx, KC_COMMAND_FWUPDATE_STATUS, fw_status_handler);
+    kc_command_define(ctx, KC_COMMAND_FWUPDATE_FINISH, fw_finish_handler);
+    kc_event_define(ctx, KC_EVENT_FWUPDATE_DATA, fw_data_handler);
+}
+
+bool fw_update_install(const FlashBackend_t* staging, const FlashBackend_t* application) {
+    FW_Trailer_t trailer;
+    staging->read(fw_trailer_offset(staging), (uint8_t*)&trailer, sizeof(trailer), staging->context);
+
+    if(trailer.magic != FW_TRAILER_MAGIC || trailer.size > fw_trailer_offset(staging) || trailer.size > application->size) {
+        return false;
+    }
+    if(fw_crc32(staging, trailer.size) != trailer.crc) {
+        return false;
+    }
+
+    FlashWriter_t writer;
+    uint8_t block[FW_COPY_BLOCK_SIZE];
+    flash_writer_begin(&writer, application, trailer.size);
+
+    for(size_t offset = 0; offset < trailer.size; offset += sizeof(block)) {
+        size_t length = trailer.size - offset < sizeof(block) ? trailer.size - offset : sizeof(block);
+        staging->read(offset, block, length, staging->context);
+        flash_writer_write(&writer, offset, block, length);
+    }
+
+    flash_writer_finish(&writer);
+
+    // Keep the trailer if the copy is corrupt, so the installation is repeated
+    if(fw_crc32(application, trailer.size) != trailer.crc) {
+        return false;
+    }
+
+    fw_erase_page(staging, fw_trailer_offset(staging) / staging->page_size);
+    return true;
+}
+
+void fw_update_boot(uint32_t address) {
+    // Addresses are 32 bits wide on the target only, host builds go through uintptr_t
+    const volatile uint32_t* vectors = (const volatile uint32_t*)(uintptr_t)address;
+    uint32_t stack_pointer = vectors[0];
+    void (*reset_handler)() = (void (*)())(uintptr_t)vectors[1];
+
+    __disable_irq();
+    SCB->VTOR = address;
+    __set_MSP(stack_pointer);
+    __ISB();
+    __enable_irq();
+
+    reset_handler();
+    while(1);
+}
\ No newline at end of file
@@ -10,13 +10,19 @@
 #include <math.h>
 
 #define BXCAN_TX_QUEUE_SIZE 32
+// Each attempt takes a few dozen cycles, so this waits at least several frames at 125 kbit/s
+#define BXCAN_TX_WAIT_ATTEMPTS UINT16_MAX
 
+// Any task and the transmit interrupt put frames, so this isn't a single-producer ring
 fifo_declare_qualifier(CAN_Frame_t, bxcan_tx_queue, BXCAN_TX_QUEUE_SIZE, static);
+static CAN_FIFOStatistics_t bxcan_fifo_statistics[2] = { 0 };
 
 // Internal functions
-CAN_ReceivedFrame_t can_read_frame_from_fifo(CAN_FIFO_t fifo);
+void can_read_frame_from_fifo(CAN_FIFO_t fifo, CAN_ReceivedFrame_t* recv_frame);
+static void can_release_fifo_mailbox(CAN_FIFO_t fifo);
+static void can_drain_fifo(CAN_FIFO_t fifo);
 static void can_transmit_frame_direct(CAN_Frame_t* frame);
-static void can_transmit_next_if_possible();
+static void can_load_tx_mailboxes();
 
 // Interrupt handlers
 void USB_HP_CAN_TX_IRQHandler() {
@@ -26,12 +32,15 @@ void USB_HP_CAN_TX_IRQHandler() {
     //  - TSR -> RQCP2 (Request completed mailbox 2)
     // Of course, this is dependent on the enabled interrupts
 
-    // Clear the RQCPx and TXOKx bits
-    CLEAR_MASK(CAN->TSR, CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2);
-    CLEAR_MASK(CAN->TSR, CAN_TSR_TXOK0 | CAN_TSR_TXOK1 | CAN_TSR_TXOK2);
+    // Clear the RQCPx bits, which also clears the TXOKx, ALSTx and TERRx bits.
+    // These bits are cleared by writing 1, writing 0 has no effect.
+    CAN->TSR = CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2;
 
-    // Transmit the next message in the transmit queue
-    can_transmit_next_if_possible();
+    // Refill all the free mailboxes from the transmit queue
+    can_load_tx_mailboxes();
+
+    // Let the application refill the remaining mailboxes
+    if(can_tx_callback) can_tx_callback();
 }
 
 void USB_LP_CAN_RX0_IRQHandler() {
@@ -42,16 +51,7 @@ void USB_LP_CAN_RX0_IRQHandler() {
     // Of course, this is dependent on the enabled interrupts. See can_init
     // for more information.
 
-    if(READ_MASK(CAN->RF0R, CAN_RF0R_FMP0)) {
-        CAN_ReceivedFrame_t frame = can_read_frame_from_fifo(CAN_FIFO_0);
-
-        can_recv_callback(frame);
-
-        // Clear the FMP1 bit
-        CLEAR_MASK(CAN->RF0R, CAN_RF0R_FMP0);
-    } else if(READ_MASK(CAN->RF0R, CAN_RF0R_FOVR0)) {
-        can_error_callback(CAN_ERR_FIFO0_OVERRUN);
-    }
+    can_drain_fifo(CAN_FIFO_0);
 }
 
 void CAN_RX1_IRQHandler() {
@@ -62,16 +62,7 @@ void CAN_RX1_IRQHandler() {
     // Of course, this is dependent on the enabled interrupts. See can_init
     // for more information.
     
-    if(READ_MASK(CAN->RF1R, CAN_RF1R_FMP1)) {
-        CAN_ReceivedFrame_t frame = can_read_frame_from_fifo(CAN_FIFO_1);
-
-        can_recv_callback(frame);
-
-        // Clear the FMP1 bit
-        CLEAR_MASK(CAN->RF1R, CAN_RF1R_FMP1);
-    } else if(READ_MASK(CAN->RF1R, CAN_RF1R_FOVR1)) {
-        can_error_callback(CAN_ERR_FIFO1_OVERRUN);
-    }
+    can_drain_fifo(CAN_FIFO_1);
 }
 
 void CAN_SCE_IRQHandler() {
@@ -199,16 +190,50 @@ void can_configure_filter_bank(
     CLEAR_MASK(CAN->FMR, CAN_FMR_FINIT); 
 }
 
-void can_transmit_frame(CAN_Frame_t* frame) {
-    // Check if a mailbox is free
-    bool mailbox_free = READ_MASK(CAN->TSR, CAN_TSR_TME);
+void can_disable_filter_bank(CAN_FilterBank_t filter) {
+    // Enter filter initialization mode
+    SET_MASK(CAN->FMR, CAN_FMR_FINIT);
 
-    if(mailbox_free) {
-        can_transmit_frame_direct(frame);
-    } else {
-        // Append the frame to the transmit queue
-        fifo_put(bxcan_tx_queue, *frame);
+    // Deactivate the filter
+    CLEAR_BIT(CAN->FA1R, filter);
+
+    // Leave filter initialization mode
+    CLEAR_MASK(CAN->FMR, CAN_FMR_FINIT); 
+}
+
+bool can_tx_mailbox_available() {
+    return READ_MASK(CAN->TSR, CAN_TSR_TME) && fifo_empty(bxcan_tx_queue);
+}
+
+bool can_transmit_frame(CAN_Frame_t* frame) {
+    // The transmit interrupt must not load a mailbox between checking and writing,
+    // otherwise frames may overtake each other
+    for(uint32_t attempt = 0; attempt < BXCAN_TX_WAIT_ATTEMPTS; attempt++) {
+        bool queued = false;
+
+        critical_block {
+            // Mailboxes freed while the interrupts are masked are refilled here instead
+            can_load_tx_mailboxes();
+
+            if(fifo_empty(bxcan_tx_queue) && READ_MASK(CAN->TSR, CAN_TSR_TME)) {
+                // Nothing is waiting, so the frame can go straight into a mailbox
+                can_transmit_frame_direct(frame);
+                queued = true;
+            } else if(!fifo_full(bxcan_tx_queue)) {
+                // Queue the frame behind the waiting ones
+                fifo_put(bxcan_tx_queue, *frame);
+                queued = true;
+                can_load_tx_mailboxes();
+            }
+        }
+
+        if(queued) return true;
+
+        // If the queue is full, wait for a mailbox to free some space
     }
+
+    // No frame has left in all this time, e.g. because nobody acknowledges them
+    return false;
 }
 
 static void can_transmit_frame_direct(CAN_Frame_t* frame) {
@@ -231,19 +256,22 @@ static void can_transmit_frame_direct(CAN_Frame_t* frame) {
         // Set the data length control register
         WRITE_MASK_OFFSET(mailbox->TDTR, 0xF, frame->dlc, CAN_TDT0R_DLC_Pos);
 
-        // Set the data low register
-        mailbox->TDLR = ((uint32_t*)(frame->data))[0];
-        mailbox->TDHR = ((uint32_t*)(frame->data))[1];
+        // Set the data registers. The data isn't word-aligned within the frame
+        uint32_t data[2];
+        memcpy(data, frame->data, sizeof(data));
+        mailbox->TDLR = data[0];
+        mailbox->TDHR = data[1];
 
         // Set the transmit request bit
         SET_MASK(mailbox->TIR, CAN_TI0R_TXRQ);
     }
 }
 
-static void can_transmit_next_if_possible() {
+static void can_load_tx_mailboxes() {
     critical_block {
-        bool mailbox_free = READ_MASK(CAN->TSR, CAN_TSR_TME);
-        if(!fifo_empty(bxcan_tx_queue) && mailbox_free) {
+        // The mailboxes are transmitted in request order (TXFP), so filling all
+        // of them at once keeps the order of the queue
+        while(!fifo_empty(bxcan_tx_queue) && READ_MASK(CAN->TSR, CAN_TSR_TME)) {
             CAN_Frame_t nextFrame;
             fifo_get(bxcan_tx_queue, nextFrame);
             can_transmit_frame_direct(&nextFrame);
@@ -257,36 +285,86 @@ void can_flush_tx_buffer() {
     }
 }
 
-CAN_ReceivedFrame_t can_read_frame_from_fifo(CAN_FIFO_t fifo) {
+void can_read_frame_from_fifo(CAN_FIFO_t fifo, CAN_ReceivedFrame_t* recv_frame) {
     CAN_FIFOMailBox_TypeDef* mailbox = &(CAN->sFIFOMailBox[fifo]);
 
-    // Read the CAN frame
-    CAN_ReceivedFrame_t recv_frame;
-
     // Read the receiving information
-    recv_frame.fifo = fifo;
-    recv_frame.filter_match = READ_MASK_OFFSET(mailbox->RDTR, 0xFF, CAN_RDT0R_FMI_Pos);
+    recv_frame->fifo = fifo;
+    recv_frame->filter_match = READ_MASK_OFFSET(mailbox->RDTR, 0xFF, CAN_RDT0R_FMI_Pos);
 
-    // Read the CAN frame itself
-    recv_frame.frame.dlc = READ_MASK_OFFSET(mailbox->RDTR, 0b1111, CAN_RDT0R_DLC_Pos);
+    // Read the CAN frame header, the data is read by can_read_frame_data
+    recv_frame->frame.dlc = READ_MASK_OFFSET(mailbox->RDTR, 0b1111, CAN_RDT0R_DLC_Pos);
 
-    recv_frame.frame.rtr = READ_MASK_OFFSET(mailbox->RIR, 0b1, CAN_RI0R_RTR_Pos);
-    recv_frame.frame.id_extended = READ_MASK_OFFSET(mailbox->RIR, 0b1, CAN_RI0R_IDE_Pos);
-    if(recv_frame.frame.id_extended) {
-        recv_frame.frame.id = READ_MASK_OFFSET(mailbox->RIR, 0x3FFFFFFF, CAN_RI0R_EXID_Pos);
+    recv_frame->frame.rtr = READ_MASK_OFFSET(mailbox->RIR, 0b1, CAN_RI0R_RTR_Pos);
+    recv_frame->frame.id_extended = READ_MASK_OFFSET(mailbox->RIR, 0b1, CAN_RI0R_IDE_Pos);
+    if(recv_frame->frame.id_extended) {
+        recv_frame->frame.id = READ_MASK_OFFSET(mailbox->RIR, 0x3FFFFFFF, CAN_RI0R_EXID_Pos);
     } else {
-        recv_frame.frame.id = READ_MASK_OFFSET(mailbox->RIR, 0x7FF, CAN_RI0R_STID_Pos);
+        recv_frame->frame.id = READ_MASK_OFFSET(mailbox->RIR, 0x7FF, CAN_RI0R_STID_Pos);
     }
+}
+
+void can_read_frame_data(const CAN_ReceivedFrame_t* frame, void* dest) {
+    CAN_FIFOMailBox_TypeDef* mailbox = &(CAN->sFIFOMailBox[frame->fifo]);
+    uint8_t dlc = frame->frame.dlc > 8 ? 8 : frame->frame.dlc;
+    uint32_t data[2] = { mailbox->RDLR, mailbox->RDHR };
 
-    ((uint32_t*)(recv_frame.frame.data))[0] = mailbox->RDLR;
-    ((uint32_t*)(recv_frame.frame.data))[1] = mailbox->RDHR;
+    if(dlc == 8) {
+        // The destination may be unaligned, a copy of constant size still compiles to plain stores
+        memcpy(dest, data, 8);
+    } else {
+        memcpy(dest, data, dlc);
+    }
+}
 
-    // Release the mailbox
+static void can_release_fifo_mailbox(CAN_FIFO_t fifo) {
+    // FULL and FOVR are cleared by writing 1, so they must not be written back
     if(fifo == CAN_FIFO_0) {
-        SET_MASK(CAN->RF0R, CAN_RF0R_RFOM0);
+        CAN->RF0R = CAN_RF0R_RFOM0;
     } else {
-        SET_MASK(CAN->RF1R, CAN_RF1R_RFOM1);
+        CAN->RF1R = CAN_RF1R_RFOM1;
+    }
+}
+
+static void can_drain_fifo(CAN_FIFO_t fifo) {
+    // RF0R and RF1R share the same layout
+    volatile uint32_t* RFxR = (fifo == CAN_FIFO_0) ? &(CAN->RF0R) : &(CAN->RF1R);
+    CAN_FIFOStatistics_t* statistics = &bxcan_fifo_statistics[fifo];
+    uint32_t frames = 0;
+
+    // Read frames until the FIFO is empty, as more frames may arrive while reading
+    while(READ_MASK(*RFxR, CAN_RF0R_FMP0)) {
+        CAN_ReceivedFrame_t frame;
+        can_read_frame_from_fifo(fifo, &frame);
+
+        can_recv_callback(&frame);
+        can_release_fifo_mailbox(fifo);
+        frames++;
     }
 
-    return recv_frame;
+    statistics->irq_count++;
+    statistics->frame_count += frames;
+    if(frames > statistics->max_frames_per_irq) {
+        statistics->max_frames_per_irq = frames;
+    }
+
+    if(READ_MASK(*RFxR, CAN_RF0R_FOVR0)) {
+        // Clear the overrun flag
+        *RFxR = CAN_RF0R_FOVR0;
+        statistics->overrun_count++;
+
+        can_error_callback(fifo == CAN_FIFO_0 ? CAN_ERR_FIFO0_OVERRUN : CAN_ERR_FIFO1_OVERRUN);
+    }
+}
+
+void can_set_fifo_priority(CAN_FIFO_t fifo, uint32_t priority) {
+    NVIC_SetPriority(fifo == CAN_FIFO_0 ? CAN_RX0_IRQn : CAN_RX1_IRQn, priority);
+}
+
+void can_set_tx_priority(uint32_t priority) {
+    NVIC_SetPriority(CAN_TX_IRQn, priority);
+}
+
+CAN_FIFOStatistics_t can_get_fifo_statistics(CAN_FIFO_t fifo) {
+    return bxcan_fifo_statistics[fifo];
 }
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include <knabberkiste/io.h>
+#include <knabberkiste/hal/flash.h>
+#include <knabberkiste/util/bit_manipulation.h>
+#include <knabberkiste/util/error.h>
+#include <string.h>
+
+#define FLASH_UNLOCK_KEY1 0x45670123
+#define FLASH_UNLOCK_KEY2 0xCDEF89AB
+
+void flash_unlock() {
+    if(READ_MASK(FLASH->CR, FLASH_CR_LOCK)) {
+        FLASH->KEYR = FLASH_UNLOCK_KEY1;
+        FLASH->KEYR = FLASH_UNLOCK_KEY2;
+    }
+}
+
+void flash_lock() {
+    while(flash_busy());
+    SET_MASK(FLASH->CR, FLASH_CR_LOCK);
+}
+
+void flash_erase_start(uint32_t address) {
+    if(address % FLASH_PAGE_BYTES != 0) {
+        error_throw(ERR_IMPOSSIBLE, "Flash address isn't aligned to a page.");
+    }
+
+    while(flash_busy());
+    SET_MASK(FLASH->CR, FLASH_CR_PER);
+    FLASH->AR = address;
+    SET_MASK(FLASH->CR, FLASH_CR_STRT);
+}
+
+bool flash_busy() {
+    if(READ_MASK(FLASH->SR, FLASH_SR_BSY)) return true;
+
+    // Leave the erase mode of a finished erase, the flags are cleared by writing 1
+    CLEAR_MASK(FLASH->CR, FLASH_CR_PER);
+    FLASH->SR = FLASH_SR_EOP;
+    return false;
+}
+
+void flash_program(uint32_t address, const uint8_t* data, size_t size) {
+    if(address % 2 != 0 || size % 2 != 0) {
+        error_throw(ERR_IMPOSSIBLE, "Flash is programmed in half-words.");
+    }
+
+    while(flash_busy());
+    SET_MASK(FLASH->CR, FLASH_CR_PG);
+
+    bool failed = false;
+    for(size_t i = 0; i < size && !failed; i += 2) {
+        *((volatile uint16_t*)(address + i)) = data[i] | (data[i + 1] << 8);
+        while(READ_MASK(FLASH->SR, FLASH_SR_BSY));
+
+        failed = READ_MASK(FLASH->SR, FLASH_SR_PGERR | FLASH_SR_WRPERR);
+    }
+
+    CLEAR_MASK(FLASH->CR, FLASH_CR_PG);
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+
+    if(failed) {
+        error_throw(ERR_RUNTIME_GENERIC, "Flash programming failed.");
+    }
+}
+
+/* Backend of the internal flash, the context is the start address of the region */
+void _flash_backend_erase_start(size_t page, void* context) {
+    flash_unlock();
+    flash_erase_start((uint32_t)(uintptr_t)context + page * FLASH_PAGE_BYTES);
+}
+
+bool _flash_backend_busy(void* context) {
+    (void)context;
+    return flash_busy();
+}
+
+void _flash_backend_program(size_t offset, const uint8_t* data, size_t size, void* context) {
+    flash_unlock();
+    flash_program((uint32_t)(uintptr_t)context + offset, data, size);
+}
+
+void _flash_backend_read(size_t offset, uint8_t* data, size_t size, void* context) {
+    memcpy(data, (const uint8_t*)context + offset, size);
+}
\ No newline at end of file
@@ -1,5 +1,23 @@
 #include <knabberkiste/hal/gpio.h>
 #include <knabberkiste/util/bit_manipulation.h>
+
+#define GPIO_EXTI_LINES 16
+
+static GPIO_ExtiCallback_t volatile gpio_exti_callbacks[GPIO_EXTI_LINES] = { 0 };
+
+// Internal functions
+static IRQn_Type gpio_exti_irqn(uint8_t pin_number);
+static void gpio_exti_handle(uint8_t first_pin, uint8_t last_pin);
+
+// Interrupt handlers
+void EXTI0_IRQHandler() { gpio_exti_handle(0, 0); }
+void EXTI1_IRQHandler() { gpio_exti_handle(1, 1); }
+void EXTI2_TSC_IRQHandler() { gpio_exti_handle(2, 2); }
+void EXTI3_IRQHandler() { gpio_exti_handle(3, 3); }
+void EXTI4_IRQHandler() { gpio_exti_handle(4, 4); }
+void EXTI9_5_IRQHandler() { gpio_exti_handle(5, 9); }
+void EXTI15_10_IRQHandler() { gpio_exti_handle(10, 15); }
+
 void gpio_enable_port_clocks() {
     SET_MASK(RCC->AHBENR, 
         RCC_AHBENR_GPIOAEN | 
@@ -11,6 +29,60 @@ void gpio_enable_port_clocks() {
     );
 }
 
+void _gpio_exti_enable(uint8_t port_index, uint8_t pin_number, GPIO_ExtiTrigger_t trigger, GPIO_ExtiCallback_t callback) {
+    // The SYSCFG peripheral selects the port of each EXTI line
+    SET_MASK(RCC->APB2ENR, RCC_APB2ENR_SYSCFGEN);
+    WRITE_MASK_OFFSET(SYSCFG->EXTICR[pin_number / 4], 0xF, port_index, (pin_number % 4) * 4);
+
+    gpio_exti_callbacks[pin_number] = callback;
+
+    // Configure the trigger edges
+    WRITE_BIT(EXTI->RTSR, pin_number, (trigger & GPIO_EXTI_TRIGGER_RISING) != 0);
+    WRITE_BIT(EXTI->FTSR, pin_number, (trigger & GPIO_EXTI_TRIGGER_FALLING) != 0);
+
+    // Clear a pending interrupt (write 1 to clear) and unmask the line
+    EXTI->PR = 1UL << pin_number;
+    SET_BIT(EXTI->IMR, pin_number);
+
+    NVIC_EnableIRQ(gpio_exti_irqn(pin_number));
+}
+
+void _gpio_exti_disable(uint8_t pin_number) {
+    // The NVIC interrupt may be shared with other lines, so only mask the line
+    CLEAR_BIT(EXTI->IMR, pin_number);
+    EXTI->PR = 1UL << pin_number;
+}
+
+void _gpio_exti_set_priority(uint8_t pin_number, uint32_t priority) {
+    NVIC_SetPriority(gpio_exti_irqn(pin_number), priority);
+}
+
+static IRQn_Type gpio_exti_irqn(uint8_t pin_number) {
+    switch(pin_number) {
+        case 0: return EXTI0_IRQn;
+        case 1: return EXTI1_IRQn;
+        case 2: return EXTI2_TSC_IRQn;
+        case 3: return EXTI3_IRQn;
+        case 4: return EXTI4_IRQn;
+        default:
+            if(pin_number <= 9) return EXTI9_5_IRQn;
+            return EXTI15_10_IRQn;
+    }
+}
+
+static void gpio_exti_handle(uint8_t first_pin, uint8_t last_pin) {
+    for(uint8_t pin_number = first_pin; pin_number <= last_pin; pin_number++) {
+        if(READ_BIT(EXTI->PR, pin_number)) {
+            // Clear the pending bit (write 1 to clear)
+            EXTI->PR = 1UL << pin_number;
+
+            if(gpio_exti_callbacks[pin_number] != 0) {
+                gpio_exti_callbacks[pin_number](pin_number);
+            }
+        }
+    }
+}
+
 #define __GPIO_SINGLE_PIN_DEFINITON(portLetter, portOffset, pin) struct __GPIO_PinType##pin* const P##portLetter##pin = (void*)GPIO##portLetter##_BASE;
 #define __GPIO_SINGLE_PORT_DEFINITION(portLetter, portOffset) \
     __GPIO_SINGLE_PIN_DEFINITON(portLetter, portOffset, 0); \
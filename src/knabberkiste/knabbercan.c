@@ -4,155 +4,946 @@
 #include <knabberkiste/util/fifo.h>
 #include <knabberkiste/util/error.h>
 #include <knabberkiste/util/varbuf.h>
+#include <knabberkiste/util/slab.h>
+#include <knabberkiste/util/filter_compiler.h>
 #include <string.h>
 
 /* Constants */
-#define KC_NUMBER_OF_TRANSACTION_IDS 256
 #define KC_INTERNAL_EVENT_FIFO_SIZE 2
-#define KC_RECV_FIFO_SIZE 128
 #define KC_FRAME_COUNTER_MAX 7
 #define KC_LED_FLASH_TICKS 1
-
-/* Identifier bit-field struct */
-typedef union __attribute__((__packed__)) {
-    uint32_t value;
-    struct __attribute__((packed)) {
-        KC_Address_t receiver_address : 7;
-        KC_Address_t sender_address : 7;
-        KC_TransactionID_t transaction_id : 8;
-        uint8_t counter : 3;
-        bool last : 1;
-        bool first : 1;
-        KC_FrameType_t frame_type : 2;
-    } components;
-} KC_Identifier_t;
-
+#define KC_REASSEMBLY_TABLE_MASK (KC_REASSEMBLY_TABLE_SIZE - 1)
+#define KC_PENDING_TABLE_MASK (KC_PENDING_TABLE_SIZE - 1)
+#define KC_DISPATCHER_STACK_SIZE (configMINIMAL_STACK_SIZE * 4)
+#define KC_DISPATCHER_HOUSEKEEPING_TICKS 10
+#define KC_CONN_DEBOUNCE_TICKS 50
+#define KC_FILTERBANK_NODE CAN_FILTERBANK_0
+#define KC_FILTERBANK_BROADCAST_FIRST CAN_FILTERBANK_1
+#define KC_FILTERBANK_BROADCAST_COUNT (CAN_FILTERBANK_COUNT - KC_FILTERBANK_BROADCAST_FIRST)
+#define KC_FILTER_PATTERN_BUFFER_SIZE (2 * KC_FILTERBANK_BROADCAST_COUNT)
+#define KC_FILTER_IDE 0b00000000000000000000000000000100
+#define KC_FILTER_RECEIVER_MASK 0b00000000000000000000001111111110 // Receiver address, IDE and RTR
+#define KC_EVENT_FIFO CAN_FIFO_0
+#define KC_COMMAND_FIFO CAN_FIFO_1
+#ifdef configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+// The CAN interrupts use the FreeRTOS API, so they must not be above this priority
+#define KC_COMMAND_IRQ_PRIORITY configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+#else
+#define KC_COMMAND_IRQ_PRIORITY 5
+#endif
+#define KC_EVENT_IRQ_PRIORITY (KC_COMMAND_IRQ_PRIORITY + 1)
+#define KC_TX_IRQ_PRIORITY KC_COMMAND_IRQ_PRIORITY
+#define KC_CONN_IRQ_PRIORITY KC_EVENT_IRQ_PRIORITY
+#define KC_HANDLER_KEY(frame_type, transaction_id) (((uint16_t)(frame_type) << 8) | (transaction_id))
+#define KC_STREAM_TRANSACTION(transaction_id) ((transaction_id) == KC_COMMAND_STREAM_OPEN || (transaction_id) == KC_COMMAND_STREAM_DATA)
+#define KC_STREAM_MAX_SIZE ((uint32_t)UINT16_MAX * KC_STREAM_CHUNK_SIZE)
+#define KC_STREAM_CHUNK_COUNT(total_size) ((total_size) == 0 ? 1 : ((total_size) + KC_STREAM_CHUNK_SIZE - 1) / KC_STREAM_CHUNK_SIZE)
+#define KC_STREAM_RETRANSMIT_TICKS 50
+#define KC_STREAM_RETRIES 5
+#define KC_STREAM_TIMEOUT_TICKS 1000
+
+_Static_assert(KC_CONTEXT_RAM_SIZE <= KC_CONTEXT_RAM_BUDGET, "The knabberCAN context takes more than KC_CONTEXT_RAM_BUDGET bytes of RAM.");
+
+/* State of a task waiting in kc_frame_transmit */
 typedef struct {
-    KC_FrameType_t frame_type;
-    KC_Address_t sender_address;
-    KC_Address_t receiver_address;
-    KC_TransactionID_t transaction_id;
-    size_t payload_size;
-    uint8_t* payload;
-    uint8_t previous_counter_value;
-} KC_Received_Frame_t;
+    volatile bool done;
+    TaskHandle_t task;
+} KC_Transmit_Waiter_t;
+
+/* Payloads of the stream commands and their responses */
+typedef struct __attribute__((packed)) {
+    uint8_t stream_id;
+    uint32_t total_size;
+    uint8_t window;
+} KC_Stream_Open_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t next_sequence;
+    uint16_t received_chunks;
+} KC_Stream_Acknowledgement_t;
+
+/* Default configuration, knabbercan_config.h is included by knabbercan.h */
+#ifndef KC_BITRATE
+    #define KC_BITRATE 1000000
+#endif
+
+#ifndef KC_SETTLE_DELAY
+    // Busy-waits for signals on the bus and the connectors to settle
+    #define KC_SETTLE_DELAY() for(uint16_t i = 0; i < UINT16_MAX; i++) __asm("NOP")
+#endif
 
 /* GPIO pin definitions */
-#define KC_RXD_PIN PA11
-#define KC_TXD_PIN PA12
-#define KC_RXD_AF GPIO_AF9
-#define KC_TXD_AF GPIO_AF9
-
-#define KC_OUTLED_GREEN_PIN PA0
-#define KC_INLED_GREEN_PIN PA1
-#define KC_OUTLED_YELLOW_PIN PA2
-#define KC_INLED_YELLOW_PIN PA3
-
-#define KC_CONN_IN_PIN PA8
-#define KC_CONN_OUT_PIN PA7
-
-#define KC_DAISY_IN_PIN PA6
-#define KC_DAISY_OUT_PIN PA4
-
-#define KC_STBY_PIN PA5
+#ifndef KC_RXD_PIN
+    #define KC_RXD_PIN PA11
+#endif
+#ifndef KC_TXD_PIN
+    #define KC_TXD_PIN PA12
+#endif
+#ifndef KC_RXD_AF
+    #define KC_RXD_AF GPIO_AF9
+#endif
+#ifndef KC_TXD_AF
+    #define KC_TXD_AF GPIO_AF9
+#endif
+
+#ifndef KC_OUTLED_GREEN_PIN
+    #define KC_OUTLED_GREEN_PIN PA0
+#endif
+#ifndef KC_INLED_GREEN_PIN
+    #define KC_INLED_GREEN_PIN PA1
+#endif
+#ifndef KC_OUTLED_YELLOW_PIN
+    #define KC_OUTLED_YELLOW_PIN PA2
+#endif
+#ifndef KC_INLED_YELLOW_PIN
+    #define KC_INLED_YELLOW_PIN PA3
+#endif
+
+#ifndef KC_CONN_IN_PIN
+    #define KC_CONN_IN_PIN PA8
+#endif
+#ifndef KC_CONN_OUT_PIN
+    #define KC_CONN_OUT_PIN PA7
+#endif
+
+#ifndef KC_DAISY_IN_PIN
+    #define KC_DAISY_IN_PIN PA6
+#endif
+#ifndef KC_DAISY_OUT_PIN
+    #define KC_DAISY_OUT_PIN PA4
+#endif
+
+#ifndef KC_STBY_PIN
+    #define KC_STBY_PIN PA5
+#endif
 
 /* Internal variables */
-KC_Address_t kc_node_address = 0;
-KC_Address_t kc_bus_size = 0;
-static KC_CommandCallback_t volatile kc_command_callbacks[KC_NUMBER_OF_TRANSACTION_IDS] = { 0 };
-static KC_EventCallback_t volatile kc_event_callbacks[KC_NUMBER_OF_TRANSACTION_IDS] = { 0 };
-static volatile KC_State_t kc_state = KC_STATE_UNINITIALIZED;
-static KC_Received_Frame_t* kc_incomplete_frames = 0;
-static bool send_flag = false;
-static bool indicators_active = true;
-static bool waiting_for_next_node_to_be_addressed = false;
-static bool already_addressed = false;
 const char* kcan_fwr_name = "<unknown>";
+kc_context_declare_handlers(kc_default_context, &kc_default_handler_table);
 
-fifo_declare_qualifier(KC_Received_Frame_t, kc_recv_fifo, KC_RECV_FIFO_SIZE, static);
+// Context which is bound to the bxCAN peripheral and the GPIO pins
+static KC_Context_t* volatile kc_hardware_context = 0;
 
 /* Internal functions */
-static void kc_check_if_addressing_required();
+static void kc_check_if_addressing_required(KC_Context_t* ctx);
 static bool kc_in_connected();
 static bool kc_out_connected();
-static void kc_request_addressing();
-static void kc_address_next();
-static void kc_address_end();
+static void kc_conn_edge_callback(uint8_t pin_number);
+static void kc_conn_mark_changed(bool changed);
+static void kc_request_addressing(KC_Context_t* ctx);
+static void kc_address_next(KC_Context_t* ctx);
+static void kc_address_end(KC_Context_t* ctx);
+static KC_Reassembly_Slot_t* kc_reassembly_find(KC_Reassembly_Table_t* table, KC_Identifier_t key);
+static KC_Reassembly_Slot_t* kc_reassembly_insert(KC_Reassembly_Table_t* table, KC_Identifier_t key);
+static void kc_reassembly_remove(KC_Reassembly_Table_t* table, KC_Reassembly_Slot_t* slot);
+static void kc_payload_free(KC_Context_t* ctx, KC_Payload_Block_t* block);
+static bool kc_reassembly_grow(KC_Context_t* ctx, KC_Reassembly_Slot_t* slot);
+static bool kc_reassembly_append(KC_Context_t* ctx, KC_Reassembly_Slot_t* slot, CAN_ReceivedFrame_t* frame, size_t data_size);
+static void kc_reassembly_discard(KC_Context_t* ctx, KC_Reassembly_Slot_t* slot);
+static size_t kc_reassembly_evict_sender(KC_Context_t* ctx, KC_Reassembly_Table_t* table, KC_Identifier_t key);
+static void kc_transmit_pump(KC_Context_t* ctx);
+static KC_Pending_Command_t* kc_pending_find(KC_Context_t* ctx, KC_Address_t receiver_address, KC_TransactionID_t command_id);
+static void kc_pending_remove(KC_Context_t* ctx, KC_Pending_Command_t* entry);
+static void kc_pending_check_timeouts(KC_Context_t* ctx);
+static bool kc_stream_receive(KC_Context_t* ctx, KC_Received_Frame_t* frame);
+static void kc_stream_acknowledge(KC_Context_t* ctx, KC_Received_Frame_t* frame);
+static void kc_stream_check_timeouts(KC_Context_t* ctx);
+static bool kc_dispatch_received_frames(KC_Context_t* ctx);
+static void kc_dispatch_event(KC_Context_t* ctx, const KC_Handler_t* handler, KC_Received_Frame_t* frame);
+static void kc_dispatch_command(KC_Context_t* ctx, const KC_Handler_t* handler, KC_Received_Frame_t* frame);
+static void kc_dispatch_error(KC_Context_t* ctx, KC_Received_Frame_t* frame);
+static void kc_report_uncaught_error(error_t* error);
+static void kc_update_indicators(KC_Context_t* ctx, bool received);
+static void kc_update_filters(KC_Context_t* ctx);
+static void kc_internal_event_handler(KC_Received_EventFrame_t event_frame);
+static KC_Response_t kc_internal_command_handler(KC_Received_CommandFrame_t command_frame);
+
+/* Pre-defined commands and events, ordered like a handler table */
+kc_handler_table_declare_qualifier(kc_internal_handler_table, static,
+    KC_EVENT_HANDLER(KC_EVENT_ADDRESSING_START, kc_internal_event_handler),
+    KC_EVENT_HANDLER(KC_EVENT_ADDRESSING_SUCCESS, kc_internal_event_handler),
+    KC_EVENT_HANDLER(KC_EVENT_ADDRESSING_NEXT, kc_internal_event_handler),
+    KC_EVENT_HANDLER(KC_EVENT_ADDRESSING_FINISHED, kc_internal_event_handler),
+    KC_EVENT_HANDLER(KC_EVENT_ADDRESSING_REQUIRED, kc_internal_event_handler),
+    KC_COMMAND_HANDLER(KC_COMMAND_RESET, kc_internal_command_handler),
+    KC_COMMAND_HANDLER(KC_COMMAND_SET_INDICATORS_ACTIVE, kc_internal_command_handler),
+    KC_COMMAND_HANDLER(KC_COMMAND_READ_FWR_NAME, kc_internal_command_handler),
+    KC_COMMAND_HANDLER(KC_COMMAND_READ_RECEIVE_STATISTICS, kc_internal_command_handler)
+);
+
+/* Handlers */
+static const KC_Handler_t* kc_handler_table_find(const KC_HandlerTable_t* table, uint16_t key) {
+    // The entries are ordered by their key, see kc_handler_table_validate
+    size_t low = 0;
+    size_t high = table->count;
+
+    while(low < high) {
+        size_t middle = (low + high) / 2;
+        const KC_Handler_t* handler = &table->handlers[middle];
+        uint16_t middle_key = KC_HANDLER_KEY(handler->frame_type, handler->transaction_id);
+
+        if(middle_key == key) return handler;
+        if(middle_key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
 
-/* CAN bus callbacks*/
-void can_recv_callback(CAN_ReceivedFrame_t frame) {
-    // Validate the identifier
-    if(frame.frame.rtr || !frame.frame.id_extended) {
-        error_throw(ERR_KC_INVALID_FRAME, "Identifier invalid.");
+    return 0;
+}
+
+static const KC_Handler_t* kc_handler_find(KC_Context_t* ctx, KC_FrameType_t frame_type, KC_TransactionID_t transaction_id) {
+    uint16_t key = KC_HANDLER_KEY(frame_type, transaction_id);
+
+    const KC_Handler_t* handler = kc_handler_table_find(&kc_internal_handler_table, key);
+    if(handler == 0 && ctx->_handler_table != 0) {
+        handler = kc_handler_table_find(ctx->_handler_table, key);
     }
 
-    KC_Identifier_t identifier;
-    identifier.value = frame.frame.id;
+    if(handler == 0) {
+        // Runtime definitions are only ever appended, so the count is read once
+        size_t count = ctx->_overflow_handler_count;
+        for(size_t i = 0; i < count; i++) {
+            if(KC_HANDLER_KEY(ctx->_overflow_handlers[i].frame_type, ctx->_overflow_handlers[i].transaction_id) == key) {
+                return &ctx->_overflow_handlers[i];
+            }
+        }
+    }
+
+    return handler;
+}
+
+static void kc_handler_table_validate(const KC_HandlerTable_t* table) {
+    for(size_t i = 0; i < table->count; i++) {
+        const KC_Handler_t* handler = &table->handlers[i];
+        uint16_t key = KC_HANDLER_KEY(handler->frame_type, handler->transaction_id);
+
+        bool valid = handler->frame_type == KC_FRAMETYPE_EVENT || handler->frame_type == KC_FRAMETYPE_COMMAND;
+        valid = valid && kc_handler_table_find(&kc_internal_handler_table, key) == 0;
+        valid = valid && !(handler->frame_type == KC_FRAMETYPE_COMMAND && KC_STREAM_TRANSACTION(handler->transaction_id));
+        if(i > 0) {
+            const KC_Handler_t* previous = &table->handlers[i - 1];
+            valid = valid && KC_HANDLER_KEY(previous->frame_type, previous->transaction_id) < key;
+        }
+
+        if(!valid) {
+            error_throw(ERR_IMPOSSIBLE, "The knabberCAN handler table is invalid.");
+        }
+    }
+}
+
+static void kc_handler_define(KC_Context_t* ctx, KC_Handler_t handler) {
+    bool full = false;
+
+    critical_block {
+        size_t count = ctx->_overflow_handler_count;
+        if(count < KC_OVERFLOW_HANDLER_COUNT) {
+            // The entry is written before it is published to the dispatcher
+            ctx->_overflow_handlers[count] = handler;
+            ctx->_overflow_handler_count = count + 1;
+        } else {
+            full = true;
+        }
+    }
+
+    if(full) {
+        error_throw(ERR_BUFFER_FULL, "Too many knabberCAN handlers are defined at runtime.");
+    }
+
+    kc_update_filters(ctx);
+}
+
+/* Reassembly table */
+static inline size_t kc_reassembly_home_index(KC_Identifier_t key) {
+    // Every node transmits its messages one after the other, so the sender
+    // address alone spreads concurrent transactions with few collisions.
+    return key.components.sender_address & KC_REASSEMBLY_TABLE_MASK;
+}
+
+static KC_Reassembly_Slot_t* kc_reassembly_find(KC_Reassembly_Table_t* table, KC_Identifier_t key) {
+    size_t index = kc_reassembly_home_index(key);
+
+    // Linear probing, stops at the first free slot
+    while(table->slots[index].occupied) {
+        if(table->slots[index].key.value == key.value) {
+            return &(table->slots[index]);
+        }
+        index = (index + 1) & KC_REASSEMBLY_TABLE_MASK;
+    }
+    return 0;
+}
+
+static KC_Reassembly_Slot_t* kc_reassembly_insert(KC_Reassembly_Table_t* table, KC_Identifier_t key) {
+    // Keep one slot free so that probing always terminates
+    if(table->count >= KC_REASSEMBLY_TABLE_SIZE - 1) {
+        return 0;
+    }
+
+    size_t index = kc_reassembly_home_index(key);
+    while(table->slots[index].occupied) {
+        index = (index + 1) & KC_REASSEMBLY_TABLE_MASK;
+    }
+
+    KC_Reassembly_Slot_t* slot = &(table->slots[index]);
+    slot->occupied = true;
+    slot->discarded = false;
+    slot->key = key;
+    slot->payload_size = 0;
+    slot->payload = 0;
+    slot->payload_tail = 0;
+    table->count++;
+    return slot;
+}
+
+static void kc_reassembly_remove(KC_Reassembly_Table_t* table, KC_Reassembly_Slot_t* slot) {
+    size_t hole = slot - table->slots;
+    size_t index = hole;
+
+    // Shift the following entries of the probe sequence back into the hole,
+    // so no tombstones are required and lookups stay short.
+    while(true) {
+        index = (index + 1) & KC_REASSEMBLY_TABLE_MASK;
+        if(!table->slots[index].occupied) break;
+
+        size_t home = kc_reassembly_home_index(table->slots[index].key);
+        size_t distance_to_home = (index - home) & KC_REASSEMBLY_TABLE_MASK;
+        size_t distance_to_hole = (index - hole) & KC_REASSEMBLY_TABLE_MASK;
+        if(distance_to_home >= distance_to_hole) {
+            table->slots[hole] = table->slots[index];
+            hole = index;
+        }
+    }
+
+    table->slots[hole].occupied = false;
+    table->count--;
+}
+
+static void kc_payload_free(KC_Context_t* ctx, KC_Payload_Block_t* block) {
+    while(block != 0) {
+        KC_Payload_Block_t* next = block->next;
+        slab_free(ctx->_payload_pool, block);
+        block = next;
+    }
+}
+
+static bool kc_reassembly_grow(KC_Context_t* ctx, KC_Reassembly_Slot_t* slot) {
+    KC_Payload_Block_t* block = slab_alloc(ctx->_payload_pool);
+    if(block == 0) return false;
+
+    block->next = 0;
+    if(slot->payload == 0) {
+        slot->payload = block;
+    } else {
+        slot->payload_tail->next = block;
+    }
+    slot->payload_tail = block;
+    return true;
+}
+
+static bool kc_reassembly_append(KC_Context_t* ctx, KC_Reassembly_Slot_t* slot, CAN_ReceivedFrame_t* frame, size_t data_size) {
+    size_t offset = slot->payload_size % KC_PAYLOAD_BLOCK_SIZE;
+    if(offset == 0 && !kc_reassembly_grow(ctx, slot)) return false;
+
+    if(offset + data_size <= KC_PAYLOAD_BLOCK_SIZE) {
+        // Read the data straight into the payload block
+        can_read_frame_data(frame, slot->payload_tail->data + offset);
+    } else {
+        // Only a sender which splits its frames unevenly makes a frame span two blocks
+        uint8_t data[8];
+        size_t head_size = KC_PAYLOAD_BLOCK_SIZE - offset;
+        can_read_frame_data(frame, data);
+        memcpy(slot->payload_tail->data + offset, data, head_size);
+        if(!kc_reassembly_grow(ctx, slot)) return false;
+        memcpy(slot->payload_tail->data, data + head_size, data_size - head_size);
+    }
+
+    slot->payload_size += data_size;
+    return true;
+}
+
+static void kc_reassembly_discard(KC_Context_t* ctx, KC_Reassembly_Slot_t* slot) {
+    // The slot stays occupied, so the remaining frames of the transaction are consumed silently
+    kc_payload_free(ctx, slot->payload);
+    slot->payload = 0;
+    slot->payload_tail = 0;
+    slot->payload_size = 0;
+    slot->discarded = true;
+}
+
+static size_t kc_reassembly_evict_sender(KC_Context_t* ctx, KC_Reassembly_Table_t* table, KC_Identifier_t key) {
+    size_t evicted = 0;
+    size_t index = kc_reassembly_home_index(key);
+
+    // All the slots of the sender are in the probe sequence of its home index
+    while(table->slots[index].occupied) {
+        KC_Reassembly_Slot_t* slot = &(table->slots[index]);
+        if(slot->key.components.sender_address != key.components.sender_address) {
+            index = (index + 1) & KC_REASSEMBLY_TABLE_MASK;
+            continue;
+        }
+
+        // Discarded transactions have already been counted
+        if(!slot->discarded) evicted++;
+        kc_reassembly_discard(ctx, slot);
+
+        // The following slots are shifted back into this one, so it's checked again
+        kc_reassembly_remove(table, slot);
+    }
+    return evicted;
+}
+
+/* Pending command table */
+static inline size_t kc_pending_home_index(KC_Address_t receiver_address) {
+    return receiver_address & KC_PENDING_TABLE_MASK;
+}
+
+static inline bool kc_tick_reached(TickType_t now, TickType_t deadline) {
+    return (TickType_t)(now - deadline) < (TickType_t)(portMAX_DELAY / 2);
+}
 
-    // Search for an incomplete frame from that address
-    for(size_t i = 0; i < varbuf_length(kc_incomplete_frames); i++) {
-        KC_Received_Frame_t* incomplete_frame = &(kc_incomplete_frames[i]);
+static KC_Pending_Command_t* kc_pending_find(KC_Context_t* ctx, KC_Address_t receiver_address, KC_TransactionID_t command_id) {
+    size_t index = kc_pending_home_index(receiver_address);
+
+    while(ctx->_pending_table[index].occupied) {
         if(
-            identifier.components.receiver_address == incomplete_frame->receiver_address &&
-            identifier.components.frame_type == incomplete_frame->frame_type &&
-            identifier.components.sender_address == incomplete_frame->sender_address &&
-            identifier.components.transaction_id == incomplete_frame->transaction_id
+            ctx->_pending_table[index].receiver_address == receiver_address &&
+            ctx->_pending_table[index].command_id == command_id
         ) {
-            // An incomplete frame exists
+            return &(ctx->_pending_table[index]);
+        }
+        index = (index + 1) & KC_PENDING_TABLE_MASK;
+    }
+    return 0;
+}
 
-            // Check if this can be the case
-            if(identifier.components.first) error_throw(ERR_KC_INVALID_FRAME, "Previous frame incomplete.");
+static void kc_pending_remove(KC_Context_t* ctx, KC_Pending_Command_t* entry) {
+    size_t hole = entry - ctx->_pending_table;
+    size_t index = hole;
+
+    // Backward-shift deletion, same as for the reassembly table
+    while(true) {
+        index = (index + 1) & KC_PENDING_TABLE_MASK;
+        if(!ctx->_pending_table[index].occupied) break;
+
+        size_t home = kc_pending_home_index(ctx->_pending_table[index].receiver_address);
+        size_t distance_to_home = (index - home) & KC_PENDING_TABLE_MASK;
+        size_t distance_to_hole = (index - hole) & KC_PENDING_TABLE_MASK;
+        if(distance_to_home >= distance_to_hole) {
+            ctx->_pending_table[hole] = ctx->_pending_table[index];
+            hole = index;
+        }
+    }
 
-            // Check the frame counter
-            uint8_t expected_frame_counter = (incomplete_frame->previous_counter_value + 1) % (KC_FRAME_COUNTER_MAX + 1);
-            if(expected_frame_counter != identifier.components.counter) {
-                error_throw(ERR_KC_INVALID_FRAME, "Frame counter error.");
+    ctx->_pending_table[hole].occupied = false;
+    ctx->_pending_table_count--;
+}
+
+static void kc_pending_check_timeouts(KC_Context_t* ctx) {
+    TickType_t now = xTaskGetTickCount();
+    if(ctx->_pending_table_count == 0 || !kc_tick_reached(now, ctx->_pending_next_deadline)) return;
+
+    // Only scan the table once the earliest deadline has passed
+    bool next_deadline_valid = false;
+    size_t i = 0;
+    while(i < KC_PENDING_TABLE_SIZE) {
+        KC_Pending_Command_t entry;
+        bool timed_out = false;
+
+        critical_block {
+            entry = ctx->_pending_table[i];
+            if(entry.occupied && kc_tick_reached(now, entry.deadline)) {
+                kc_pending_remove(ctx, &(ctx->_pending_table[i]));
+                timed_out = true;
+            }
+        }
+
+        if(!timed_out) {
+            if(entry.occupied && (!next_deadline_valid || !kc_tick_reached(entry.deadline, ctx->_pending_next_deadline))) {
+                ctx->_pending_next_deadline = entry.deadline;
+                next_deadline_valid = true;
             }
-            incomplete_frame->previous_counter_value = expected_frame_counter;
-
-            // Append the data to the incomplete frame
-            varbuf_push_chunk(incomplete_frame->payload, &(frame.frame.data), frame.frame.dlc);
-            incomplete_frame->payload_size += frame.frame.dlc;
-
-            // Pop the frame if it's complete
-            if(identifier.components.last) {
-                KC_Received_Frame_t complete_frame;
-                varbuf_pop_index(kc_incomplete_frames, i, &complete_frame);
-                if(fifo_full(kc_recv_fifo)) {
-                    error_throw(ERR_OVERRUN, "knabberCAN receive FIFO overrun.");
+            i++;
+        } else {
+            // Removal may have shifted another entry into this slot, so i isn't advanced
+            KC_Received_ResponseFrame_t response = { 0 };
+            response.kc_context = ctx;
+            response.status = KC_RESPONSE_TIMEOUT;
+            response.sender_address = entry.receiver_address;
+            response.command_id = entry.command_id;
+            entry.callback(response, entry.context);
+        }
+    }
+}
+
+/* Streams */
+static inline size_t kc_stream_chunk_size(uint32_t total_size, uint16_t sequence) {
+    uint32_t offset = (uint32_t)sequence * KC_STREAM_CHUNK_SIZE;
+    return total_size - offset < KC_STREAM_CHUNK_SIZE ? total_size - offset : KC_STREAM_CHUNK_SIZE;
+}
+
+static KC_Stream_Receiver_t* kc_stream_receiver_find(KC_Context_t* ctx, KC_Address_t sender_address) {
+    for(size_t i = 0; i < KC_STREAM_RECEIVE_COUNT; i++) {
+        KC_Stream_Receiver_t* receiver = &(ctx->_stream_receivers[i]);
+        if(receiver->occupied && receiver->sender_address == sender_address) return receiver;
+    }
+    return 0;
+}
+
+static void kc_stream_receiver_close(KC_Context_t* ctx, KC_Stream_Receiver_t* receiver, bool notify) {
+    // Return the chunks which have been held back to the pool
+    for(size_t i = 0; i < KC_STREAM_WINDOW; i++) {
+        slab_free(ctx->_payload_pool, receiver->chunks[i]);
+        receiver->chunks[i] = 0;
+    }
+
+    if(notify && !receiver->complete && ctx->_stream_callback != 0) {
+        KC_Received_StreamChunk_t chunk = {
+            .kc_context = ctx,
+            .sender_address = receiver->sender_address,
+            .stream_id = receiver->stream_id,
+            .total_size = receiver->total_size,
+            .offset = (uint32_t)receiver->next_sequence * KC_STREAM_CHUNK_SIZE,
+            .size = 0,
+            .data = 0,
+            .aborted = true
+        };
+        ctx->_stream_callback(chunk, ctx->_stream_callback_context);
+    }
+
+    receiver->occupied = false;
+}
+
+static void kc_stream_send_acknowledgement(KC_Context_t* ctx, KC_Stream_Receiver_t* receiver) {
+    // Bit n reports the chunk n + 1 places after the next expected one
+    KC_Stream_Acknowledgement_t acknowledgement = { .next_sequence = receiver->next_sequence, .received_chunks = 0 };
+    for(size_t i = 1; i < KC_STREAM_WINDOW; i++) {
+        if(receiver->chunks[(receiver->next_sequence + i) % KC_STREAM_WINDOW] != 0) {
+            acknowledgement.received_chunks |= 1 << (i - 1);
+        }
+    }
+
+    receiver->unacknowledged_count = 0;
+    kc_frame_transmit(ctx, KC_FRAMETYPE_RESPONSE, KC_COMMAND_STREAM_DATA, receiver->sender_address, sizeof(acknowledgement), &acknowledgement);
+}
+
+static bool kc_stream_deliver(KC_Context_t* ctx, KC_Stream_Receiver_t* receiver, const uint8_t* data, size_t size) {
+    if(ctx->_stream_callback == 0) return false;
+
+    KC_Received_StreamChunk_t chunk = {
+        .kc_context = ctx,
+        .sender_address = receiver->sender_address,
+        .stream_id = receiver->stream_id,
+        .total_size = receiver->total_size,
+        .offset = (uint32_t)receiver->next_sequence * KC_STREAM_CHUNK_SIZE,
+        .size = size,
+        .data = data,
+        .aborted = false
+    };
+    bool accepted = ctx->_stream_callback(chunk, ctx->_stream_callback_context);
+
+    receiver->next_sequence++;
+    receiver->unacknowledged_count++;
+    if(accepted && receiver->next_sequence == receiver->chunk_count) {
+        receiver->complete = true;
+    }
+    return accepted;
+}
+
+static bool kc_stream_receive(KC_Context_t* ctx, KC_Received_Frame_t* frame) {
+    // Streams are only ever sent to a single node
+    if(frame->receiver_address != ctx->_node_address) return false;
+
+    KC_Stream_Receiver_t* receiver = kc_stream_receiver_find(ctx, frame->sender_address);
+
+    if(frame->transaction_id == KC_COMMAND_STREAM_OPEN) {
+        KC_Stream_Open_t open;
+        if(frame->payload_size < sizeof(open)) return false;
+        memcpy(&open, frame->payload, sizeof(open));
+
+        // The sender repeats the request if the response got lost
+        bool repeated = receiver != 0 && receiver->next_sequence == 0 &&
+            receiver->stream_id == open.stream_id && receiver->total_size == open.total_size;
+
+        if(!repeated) {
+            if(receiver != 0) {
+                // The sender has given up on the previous stream
+                kc_stream_receiver_close(ctx, receiver, true);
+            } else {
+                // Completed streams only linger to repeat their last acknowledgement
+                for(size_t i = 0; i < KC_STREAM_RECEIVE_COUNT && receiver == 0; i++) {
+                    if(!ctx->_stream_receivers[i].occupied || ctx->_stream_receivers[i].complete) {
+                        receiver = &(ctx->_stream_receivers[i]);
+                    }
                 }
-                fifo_put(kc_recv_fifo, complete_frame);
             }
 
-            return;
+            if(receiver == 0 || ctx->_stream_callback == 0 || open.total_size > KC_STREAM_MAX_SIZE) {
+                kc_frame_transmit(ctx, KC_FRAMETYPE_RESPONSE, KC_COMMAND_STREAM_OPEN, frame->sender_address, 0, 0);
+                return false;
+            }
+
+            *receiver = (KC_Stream_Receiver_t){
+                .occupied = true,
+                .sender_address = frame->sender_address,
+                .stream_id = open.stream_id,
+                .window = open.window < KC_STREAM_WINDOW ? open.window : KC_STREAM_WINDOW,
+                .total_size = open.total_size,
+                .chunk_count = KC_STREAM_CHUNK_COUNT(open.total_size)
+            };
         }
+
+        receiver->last_activity_tick = xTaskGetTickCount();
+        kc_frame_transmit(ctx, KC_FRAMETYPE_RESPONSE, KC_COMMAND_STREAM_OPEN, frame->sender_address, sizeof(receiver->window), &(receiver->window));
+        return false;
     }
-    // No incomplete frame was found
 
-    // Check if this can be the case
-    if(!identifier.components.first) {
-        error_throw(ERR_KC_INVALID_FRAME, "First packed seems to have been dropped.");
+    if(receiver == 0) {
+        // Unknown stream, e.g. because it has timed out
+        kc_frame_transmit(ctx, KC_FRAMETYPE_RESPONSE, KC_COMMAND_STREAM_DATA, frame->sender_address, 0, 0);
+        return false;
     }
+    if(frame->payload_size < sizeof(uint16_t)) return false;
 
-    KC_Received_Frame_t kc_frame = { 0 };
-    kc_frame.frame_type = identifier.components.frame_type;
-    kc_frame.sender_address = identifier.components.sender_address;
-    kc_frame.receiver_address = identifier.components.receiver_address;
-    kc_frame.transaction_id = identifier.components.transaction_id;
-    kc_frame.previous_counter_value = identifier.components.counter;
-    kc_frame.payload = 0;
-    
-    varbuf_push_chunk(kc_frame.payload, &(frame.frame.data), frame.frame.dlc);
-    kc_frame.payload_size = frame.frame.dlc;
-    
-    if(identifier.components.last) {
-        if(fifo_full(kc_recv_fifo)) {
-            error_throw(ERR_OVERRUN, "knabberCAN receive FIFO overrun.");
+    uint16_t sequence;
+    memcpy(&sequence, frame->payload, sizeof(sequence));
+    size_t size = frame->payload_size - sizeof(sequence);
+    receiver->last_activity_tick = xTaskGetTickCount();
+
+    if(receiver->complete || sequence < receiver->next_sequence) {
+        // The acknowledgement got lost, repeat it
+        kc_stream_send_acknowledgement(ctx, receiver);
+        return false;
+    }
+    if(
+        sequence >= receiver->chunk_count ||
+        sequence - receiver->next_sequence >= receiver->window ||
+        size != kc_stream_chunk_size(receiver->total_size, sequence)
+    ) {
+        return false;
+    }
+
+    if(sequence != receiver->next_sequence) {
+        // Hold back chunks which overtook a missing one, and report the gap right away
+        bool retained = false;
+        size_t index = sequence % KC_STREAM_WINDOW;
+        if(receiver->chunks[index] == 0) {
+            receiver->chunks[index] = frame->payload;
+            receiver->chunk_sizes[index] = size;
+            retained = true;
+        }
+        kc_stream_send_acknowledgement(ctx, receiver);
+        return retained;
+    }
+
+    // Pass on the chunk, followed by the chunks which have been held back for it
+    bool accepted = kc_stream_deliver(ctx, receiver, frame->payload + sizeof(sequence), size);
+    bool held_back = false;
+    while(accepted && !receiver->complete) {
+        size_t index = receiver->next_sequence % KC_STREAM_WINDOW;
+        uint8_t* payload = receiver->chunks[index];
+        if(payload == 0) break;
+
+        receiver->chunks[index] = 0;
+        accepted = kc_stream_deliver(ctx, receiver, payload + sizeof(sequence), receiver->chunk_sizes[index]);
+        slab_free(ctx->_payload_pool, payload);
+    }
+    for(size_t i = 0; i < KC_STREAM_WINDOW; i++) {
+        if(receiver->chunks[i] != 0) held_back = true;
+    }
+
+    if(!accepted) {
+        // The consumer aborted the stream
+        KC_Address_t sender_address = receiver->sender_address;
+        kc_stream_receiver_close(ctx, receiver, false);
+        kc_frame_transmit(ctx, KC_FRAMETYPE_RESPONSE, KC_COMMAND_STREAM_DATA, sender_address, 0, 0);
+    } else if(receiver->complete || held_back || receiver->unacknowledged_count * 2 >= receiver->window) {
+        // Acknowledge every half window, so the sender never runs dry
+        kc_stream_send_acknowledgement(ctx, receiver);
+    }
+
+    return false;
+}
+
+static void kc_stream_acknowledge(KC_Context_t* ctx, KC_Received_Frame_t* frame) {
+    KC_Stream_Sender_t* sender = &(ctx->_stream_sender);
+    if(!sender->active || frame->sender_address != sender->receiver_address) return;
+
+    if(frame->payload_size == 0) {
+        // The receiver rejected or aborted the stream
+        sender->rejected = true;
+    } else if(frame->transaction_id == KC_COMMAND_STREAM_OPEN) {
+        sender->window = frame->payload[0];
+        sender->opened = true;
+    } else if(frame->payload_size >= sizeof(KC_Stream_Acknowledgement_t)) {
+        KC_Stream_Acknowledgement_t acknowledgement;
+        memcpy(&acknowledgement, frame->payload, sizeof(acknowledgement));
+
+        critical_block {
+            if(acknowledgement.next_sequence >= sender->acknowledged_sequence) {
+                sender->acknowledged_sequence = acknowledgement.next_sequence;
+                sender->received_chunks = acknowledgement.received_chunks;
+            }
+        }
+    }
+
+    sender->acknowledgement_count++;
+    if(sender->task != 0) {
+        xTaskNotifyGive(sender->task);
+    }
+}
+
+static void kc_stream_check_timeouts(KC_Context_t* ctx) {
+    TickType_t now = xTaskGetTickCount();
+    for(size_t i = 0; i < KC_STREAM_RECEIVE_COUNT; i++) {
+        KC_Stream_Receiver_t* receiver = &(ctx->_stream_receivers[i]);
+        if(receiver->occupied && now - receiver->last_activity_tick >= KC_STREAM_TIMEOUT_TICKS) {
+            kc_stream_receiver_close(ctx, receiver, true);
+        }
+    }
+}
+
+static bool kc_stream_wait(KC_Context_t* ctx, uint32_t acknowledgement_count, TickType_t timeout) {
+    TickType_t start = xTaskGetTickCount();
+
+    while(ctx->_stream_sender.acknowledgement_count == acknowledgement_count) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if(elapsed >= timeout) return false;
+
+        if(ctx->_dispatcher_task_handle == 0) {
+            // Nobody else dispatches the acknowledgements
+            kc_process_incoming(ctx);
+            vTaskDelay(1);
+        } else {
+            // Notifications of kc_frame_transmit may wake the task early, so the count is checked again
+            ulTaskNotifyTake(pdTRUE, timeout - elapsed);
+        }
+    }
+
+    return true;
+}
+
+static bool kc_stream_transmit_chunk(
+    KC_Context_t* ctx,
+    uint16_t sequence,
+    uint32_t total_size,
+    KC_StreamReadCallback_t read,
+    void* context
+) {
+    uint8_t payload[KC_PAYLOAD_BLOCK_SIZE];
+    size_t size = kc_stream_chunk_size(total_size, sequence);
+
+    memcpy(payload, &sequence, sizeof(sequence));
+    if(size > 0 && !read((uint32_t)sequence * KC_STREAM_CHUNK_SIZE, payload + sizeof(sequence), size, context)) {
+        return false;
+    }
+
+    kc_frame_transmit(
+        ctx,
+        KC_FRAMETYPE_COMMAND,
+        KC_COMMAND_STREAM_DATA,
+        ctx->_stream_sender.receiver_address,
+        sizeof(sequence) + size,
+        payload
+    );
+    return true;
+}
+
+static bool kc_stream_transfer(KC_Context_t* ctx, uint8_t stream_id, uint32_t total_size, KC_StreamReadCallback_t read, void* context) {
+    KC_Stream_Sender_t* sender = &(ctx->_stream_sender);
+
+    // Open the stream, repeating the request until the receiver answers
+    KC_Stream_Open_t open = { .stream_id = stream_id, .total_size = total_size, .window = KC_STREAM_WINDOW };
+    size_t attempts = 0;
+    while(!sender->opened) {
+        if(sender->rejected || attempts++ > KC_STREAM_RETRIES) return false;
+
+        uint32_t acknowledgement_count = sender->acknowledgement_count;
+        kc_frame_transmit(ctx, KC_FRAMETYPE_COMMAND, KC_COMMAND_STREAM_OPEN, sender->receiver_address, sizeof(open), &open);
+        kc_stream_wait(ctx, acknowledgement_count, KC_STREAM_RETRANSMIT_TICKS);
+    }
+
+    uint16_t window = sender->window < KC_STREAM_WINDOW ? sender->window : KC_STREAM_WINDOW;
+    if(window == 0) return false;
+
+    uint16_t chunk_count = KC_STREAM_CHUNK_COUNT(total_size);
+    uint16_t base = 0; // Oldest chunk which hasn't been acknowledged
+    uint16_t next = 0; // Next chunk which has never been sent
+    uint32_t transmissions = 0;
+    uint32_t sent_order[KC_STREAM_WINDOW];
+    TickType_t sent_tick[KC_STREAM_WINDOW];
+    size_t stalls = 0;
+
+    while(base < chunk_count) {
+        uint16_t acknowledged_sequence;
+        uint16_t received_chunks;
+        uint32_t acknowledgement_count;
+        critical_block {
+            acknowledged_sequence = sender->acknowledged_sequence;
+            received_chunks = sender->received_chunks;
+            acknowledgement_count = sender->acknowledgement_count;
+        }
+
+        if(sender->rejected) return false;
+        if(acknowledged_sequence > next) {
+            // Acknowledgement of chunks which haven't been sent, ignore it
+            received_chunks = 0;
+        } else if(acknowledged_sequence > base) {
+            base = acknowledged_sequence;
+            stalls = 0;
+        }
+        if(base == chunk_count) break;
+
+        // CAN keeps the order of the frames, so a chunk was lost if a chunk which was sent
+        // after it has been received
+        uint32_t latest_received = 0;
+        for(uint16_t sequence = base + 1; sequence < next; sequence++) {
+            size_t index = sequence % KC_STREAM_WINDOW;
+            if((received_chunks >> (sequence - base - 1)) & 1 && sent_order[index] > latest_received) {
+                latest_received = sent_order[index];
+            }
+        }
+
+        // Retransmit the chunks which have been lost or have timed out
+        for(uint16_t sequence = base; sequence < next; sequence++) {
+            if(sequence != base && (received_chunks >> (sequence - base - 1)) & 1) continue;
+
+            size_t index = sequence % KC_STREAM_WINDOW;
+            if(sent_order[index] < latest_received || xTaskGetTickCount() - sent_tick[index] >= KC_STREAM_RETRANSMIT_TICKS) {
+                if(!kc_stream_transmit_chunk(ctx, sequence, total_size, read, context)) return false;
+                sent_order[index] = ++transmissions;
+                sent_tick[index] = xTaskGetTickCount();
+            }
+        }
+
+        // Fill up the window with new chunks
+        while(next < chunk_count && next - base < window) {
+            size_t index = next % KC_STREAM_WINDOW;
+            if(!kc_stream_transmit_chunk(ctx, next, total_size, read, context)) return false;
+            sent_order[index] = ++transmissions;
+            sent_tick[index] = xTaskGetTickCount();
+            next++;
+        }
+
+        if(!kc_stream_wait(ctx, acknowledgement_count, KC_STREAM_RETRANSMIT_TICKS) && ++stalls > KC_STREAM_RETRIES) {
+            return false;
         }
-        fifo_put(kc_recv_fifo, kc_frame);
+    }
+
+    return true;
+}
+
+/* CAN bus callbacks*/
+void can_recv_callback(CAN_ReceivedFrame_t* frame) {
+    KC_Context_t* ctx = kc_hardware_context;
+    if(ctx == 0) return;
+
+    // Broken frames are dropped and counted, throwing would block the MCU in the interrupt.
+    // Every FIFO has its own counters, as the command FIFO interrupt preempts the event FIFO one.
+    KC_ReceiveStatistics_t* statistics = &ctx->_receive_statistics[frame->fifo];
+
+    // Validate the identifier
+    if(frame->frame.rtr || !frame->frame.id_extended) {
+        statistics->invalid_identifiers++;
+        return;
+    }
+
+    KC_Identifier_t identifier;
+    identifier.value = frame->frame.id;
+
+    // Strip the per-frame bits to get the transaction key
+    KC_Identifier_t key = identifier;
+    key.components.counter = 0;
+    key.components.first = false;
+    key.components.last = false;
+
+    KC_Reassembly_Table_t* table = &ctx->_reassembly_tables[frame->fifo];
+    KC_Reassembly_Slot_t* slot = 0;
+
+    if(identifier.components.first) {
+        // Every node transmits its messages one after the other, so the open transactions of
+        // the sender have lost their last frame. Evicting them keeps them from holding their
+        // slot and payload block forever.
+        statistics->incomplete_transactions += kc_reassembly_evict_sender(ctx, table, key);
     } else {
-        varbuf_push(kc_incomplete_frames, kc_frame);
+        slot = kc_reassembly_find(table, key);
+    }
+
+    if(slot != 0) {
+        // An incomplete frame exists, check the frame counter
+        uint8_t expected_frame_counter = (slot->previous_counter_value + 1) % (KC_FRAME_COUNTER_MAX + 1);
+        if(!slot->discarded && expected_frame_counter != identifier.components.counter) {
+            statistics->counter_errors++;
+            kc_reassembly_discard(ctx, slot);
+        }
+        slot->previous_counter_value = identifier.components.counter;
+    } else {
+        // No incomplete frame was found, so this must be the first frame
+        if(!identifier.components.first) {
+            statistics->missing_first_frames++;
+            return;
+        }
+
+        slot = kc_reassembly_insert(table, key);
+        if(slot == 0) {
+            statistics->reassembly_overflows++;
+            return;
+        }
+        slot->previous_counter_value = identifier.components.counter;
+    }
+
+    // DLC values from 9 to 15 still carry 8 data bytes
+    uint8_t data_size = frame->frame.dlc > 8 ? 8 : frame->frame.dlc;
+
+    // Payloads larger than a block are received into a chain of blocks
+    if(data_size > 0 && !slot->discarded) {
+        if(slot->payload_size + data_size > KC_MAX_PAYLOAD_SIZE) {
+            statistics->oversized_payloads++;
+            kc_reassembly_discard(ctx, slot);
+        } else if(!kc_reassembly_append(ctx, slot, frame, data_size)) {
+            statistics->payload_pool_exhausted++;
+            kc_reassembly_discard(ctx, slot);
+        }
+    }
+
+    if(!identifier.components.last) return;
+
+    // The transaction is over, pass the message on if it's complete
+    if(slot->discarded) {
+        kc_reassembly_remove(table, slot);
+        return;
+    }
+
+    KC_Received_Frame_t complete_frame = { 0 };
+    complete_frame.frame_type = key.components.frame_type;
+    complete_frame.sender_address = key.components.sender_address;
+    complete_frame.receiver_address = key.components.receiver_address;
+    complete_frame.transaction_id = key.components.transaction_id;
+    complete_frame.payload_size = slot->payload_size;
+    complete_frame.payload = slot->payload != 0 ? slot->payload->data : 0;
+    complete_frame.receive_timestamp = DWT->CYCCNT;
+    kc_reassembly_remove(table, slot);
+
+    // Commands and responses take the priority lane, which is dispatched first. Each
+    // lane is only written by the interrupt of its FIFO, so no interrupts are masked.
+    KC_Receive_Ring_t* recv_ring = frame->fifo == KC_COMMAND_FIFO ? &ctx->_priority_recv_ring : &ctx->_recv_ring;
+    if(!ring_put(*recv_ring, complete_frame)) {
+        statistics->receive_fifo_overruns++;
+        kc_payload_free(ctx, (KC_Payload_Block_t*)complete_frame.payload);
+        return;
     }
+    statistics->received_messages++;
+
+    // Wake up the dispatcher task
+    if(ctx->_dispatcher_task_handle != 0) {
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        vTaskNotifyGiveFromISR(ctx->_dispatcher_task_handle, &higher_priority_task_woken);
+        portYIELD_FROM_ISR(higher_priority_task_woken);
+    }
+}
+
+void can_tx_callback() {
+    if(kc_hardware_context != 0) kc_transmit_pump(kc_hardware_context);
 }
 
 void can_error_callback(CAN_ErrorCode_t error_code) {
@@ -164,59 +955,61 @@ void can_error_callback(CAN_ErrorCode_t error_code) {
 
 /* Event and command handlers */
 static void kc_internal_event_handler(KC_Received_EventFrame_t event_frame) {
+    KC_Context_t* ctx = event_frame.kc_context;
+
     switch(event_frame.event_id) {
         case KC_EVENT_ADDRESSING_FINISHED:
             // Set the bus size
-            kc_bus_size = event_frame.sender_address;
-            kc_address_end();
+            ctx->_bus_size = event_frame.sender_address;
+            kc_address_end(ctx);
             break;
 
         case KC_EVENT_ADDRESSING_NEXT:
-            if(KC_DAISY_IN_PIN->input_data == 0 && !already_addressed) {
+            if(KC_DAISY_IN_PIN->input_data == 0 && !ctx->_already_addressed) {
                 // This is the node currently being addressed.
-                kc_node_address = event_frame.sender_address + 1;
+                ctx->_node_address = event_frame.sender_address + 1;
 
                 vcp_println("Node address received!");
-                already_addressed = true;
+                ctx->_already_addressed = true;
                 
                 // Address the next node
-                kc_event_emit(KC_EVENT_ADDRESSING_SUCCESS, 0, 0);
-                kc_address_next();
+                kc_event_emit(ctx, KC_EVENT_ADDRESSING_SUCCESS, 0, 0);
+                kc_address_next(ctx);
             }
             break;
 
         case KC_EVENT_ADDRESSING_SUCCESS:
-            waiting_for_next_node_to_be_addressed = false;
+            ctx->_waiting_for_next_node_to_be_addressed = false;
 
             // Make sure the DAISY_OUT pin is pulled up again
             KC_DAISY_OUT_PIN->output_data = 1;
-            for(uint16_t i = 0; i < UINT16_MAX; i++) __asm("NOP");
+            KC_SETTLE_DELAY();
             break;
 
         case KC_EVENT_ADDRESSING_START:
             vcp_println("Addressing procedure started.");
-            kc_state = KC_STATE_ADDRESSING;
+            ctx->_state = KC_STATE_ADDRESSING;
             KC_DAISY_IN_PIN->pull_mode = GPIO_PULLUP;
             break;
 
         case KC_EVENT_ADDRESSING_REQUIRED:
             // Ignore requests while already addressing
-            if(kc_state == KC_STATE_ADDRESSING) { break; }
+            if(ctx->_state == KC_STATE_ADDRESSING) { break; }
             
-            already_addressed = false;
+            ctx->_already_addressed = false;
 
             // Indicate readyness for addressing
-            kc_state = KC_STATE_ADDRESSING;
+            ctx->_state = KC_STATE_ADDRESSING;
             KC_DAISY_IN_PIN->pull_mode = GPIO_PULLUP;
 
             if(kc_in_connected() == false) {
                 vcp_println("Initiating addressing procedure...");
-                kc_event_emit(KC_EVENT_ADDRESSING_START, 0, 0);
+                kc_event_emit(ctx, KC_EVENT_ADDRESSING_START, 0, 0);
 
                 // This is the first node on the bus, and it must start the
                 // addressing procedure
-                kc_node_address = 1;
-                kc_address_next();
+                ctx->_node_address = 1;
+                kc_address_next(ctx);
             } else {
                 vcp_println("Indicated readyness for addressing procedure.");
             }
@@ -224,6 +1017,7 @@ static void kc_internal_event_handler(KC_Received_EventFrame_t event_frame) {
     }
 }
 static KC_Response_t kc_internal_command_handler(KC_Received_CommandFrame_t command_frame) {
+    KC_Context_t* ctx = command_frame.kc_context;
     KC_Response_t response = { .payload = 0 };
 
     switch(command_frame.command_id) {
@@ -232,68 +1026,231 @@ static KC_Response_t kc_internal_command_handler(KC_Received_CommandFrame_t comm
             break;
 
         case KC_COMMAND_SET_INDICATORS_ACTIVE:
-            indicators_active = *((bool*)command_frame.payload);
+            if(command_frame.payload_size >= sizeof(bool)) {
+                ctx->_indicators_active = *((bool*)command_frame.payload);
+            }
             break;
 
-        case KC_COMMAND_READ_FWR_NAME:
-            varbuf_push_chunk(
-                response.payload,
-                kcan_fwr_name,
-                strlen(kcan_fwr_name)
-            );
-            response.payload_size = strlen(kcan_fwr_name);
+        case KC_COMMAND_READ_FWR_NAME: {
+            // Longer names are truncated to fit into a single response
+            size_t length = strnlen(kcan_fwr_name, KC_MAX_PAYLOAD_SIZE);
+            varbuf_push_chunk(response.payload, kcan_fwr_name, length);
+            response.payload_size = length;
+            break;
+        }
+
+        case KC_COMMAND_READ_RECEIVE_STATISTICS: {
+            KC_ReceiveStatistics_t statistics = kc_get_receive_statistics(ctx);
+            varbuf_push_chunk(response.payload, (uint8_t*)&statistics, sizeof(statistics));
+            response.payload_size = sizeof(statistics);
             break;
+        }
     }
 
     return response;
 }
 
 /* Internal function definitions */
-static void kc_request_addressing() {
-    KC_Received_EventFrame_t ef = { .event_id = KC_EVENT_ADDRESSING_REQUIRED, .payload = 0, .payload_size = 0, .sender_address = 0 };
-    kc_event_emit(KC_EVENT_ADDRESSING_REQUIRED, 0, 0);
+static void kc_request_addressing(KC_Context_t* ctx) {
+    KC_Received_EventFrame_t ef = { .kc_context = ctx, .event_id = KC_EVENT_ADDRESSING_REQUIRED, .payload = 0, .payload_size = 0, .sender_address = 0 };
+    kc_event_emit(ctx, KC_EVENT_ADDRESSING_REQUIRED, 0, 0);
     kc_internal_event_handler(ef);
 }
 
-void kc_frame_transmit(
+static size_t kc_filter_append(FilterPattern_t* patterns, size_t pattern_count, FilterPattern_t pattern, uint32_t key_mask) {
+    // A full buffer is compiled down to the filter banks first. The compiled patterns cover all the
+    // keys merged into them, so every key appended so far stays accepted.
+    if(pattern_count == KC_FILTER_PATTERN_BUFFER_SIZE) {
+        pattern_count = filter_compile(patterns, pattern_count, key_mask, KC_FILTERBANK_BROADCAST_COUNT);
+    }
+    patterns[pattern_count] = pattern;
+    return pattern_count + 1;
+}
+
+static void kc_update_filters(KC_Context_t* ctx) {
+    // The filters are configured as soon as the CAN peripheral is initialized
+    if(!ctx->_filters_enabled) return;
+
+    // Only broadcast events and commands which are defined are accepted
+    const KC_HandlerTable_t sources[] = {
+        kc_internal_handler_table,
+        ctx->_handler_table != 0 ? *ctx->_handler_table : (KC_HandlerTable_t){ .handlers = 0, .count = 0 },
+        { .handlers = ctx->_overflow_handlers, .count = ctx->_overflow_handler_count }
+    };
+
+    // Handler tables can be of any size, so the keys are compiled in a fixed buffer on the stack
+    FilterPattern_t patterns[KC_FILTER_PATTERN_BUFFER_SIZE];
+    size_t pattern_count = 0;
+
+    KC_Identifier_t key_mask = { .value = 0 };
+    key_mask.components.frame_type = 0b11;
+    key_mask.components.transaction_id = 0xFF;
+
+    for(size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        for(size_t j = 0; j < sources[i].count; j++) {
+            KC_Identifier_t key = { .value = 0 };
+            key.components.transaction_id = sources[i].handlers[j].transaction_id;
+            key.components.frame_type = sources[i].handlers[j].frame_type;
+            FilterPattern_t pattern = { .value = key.value << 3, .mask = key_mask.value << 3 };
+            pattern_count = kc_filter_append(patterns, pattern_count, pattern, key_mask.value << 3);
+        }
+    }
+
+    // Broadcasted errors of any code are accepted as long as someone listens to them
+    if(ctx->_error_callback_count > 0) {
+        KC_Identifier_t key = { .value = 0 };
+        KC_Identifier_t mask = { .value = 0 };
+        key.components.frame_type = KC_FRAMETYPE_ERROR;
+        mask.components.frame_type = 0b11;
+        FilterPattern_t pattern = { .value = key.value << 3, .mask = mask.value << 3 };
+        pattern_count = kc_filter_append(patterns, pattern_count, pattern, key_mask.value << 3);
+    }
+
+    pattern_count = filter_compile(patterns, pattern_count, key_mask.value << 3, KC_FILTERBANK_BROADCAST_COUNT);
+
+    for(size_t i = 0; i < KC_FILTERBANK_BROADCAST_COUNT; i++) {
+        CAN_FilterBank_t filter = KC_FILTERBANK_BROADCAST_FIRST + i;
+
+        if(i < pattern_count) {
+            // Patterns which only match commands are routed to the command FIFO
+            KC_Identifier_t value = { .value = patterns[i].value >> 3 };
+            KC_Identifier_t mask = { .value = patterns[i].mask >> 3 };
+            bool commands_only = mask.components.frame_type == 0b11 && value.components.frame_type == KC_FRAMETYPE_COMMAND;
+
+            // Broadcast frames have the receiver address 0
+            can_configure_filter_bank(
+                filter,
+                commands_only ? KC_COMMAND_FIFO : KC_EVENT_FIFO,
+                CAN_FILTERBANK_WIDTH_32BIT,
+                CAN_FILTERBANK_MODE_MASK,
+                KC_FILTER_IDE | patterns[i].value,
+                KC_FILTER_RECEIVER_MASK | patterns[i].mask
+            );
+        } else {
+            can_disable_filter_bank(filter);
+        }
+    }
+}
+
+static void kc_transmit_pump(KC_Context_t* ctx) {
+    // Keep loading frames as long as mailboxes are free. Every frame is loaded in its own critical
+    // section, so the completion callbacks run with the interrupts enabled.
+    bool loaded = true;
+    while(loaded) {
+        loaded = false;
+        KC_TransmitCallback_t callback = 0;
+        void* callback_context = 0;
+
+        critical_block {
+            bool active = ctx->_transmit_active;
+            if(!active && can_tx_mailbox_available()) {
+                active = fifo_try_get(ctx->_transmit_fifo, ctx->_transmit_current);
+                ctx->_transmit_active = active;
+            }
+
+            if(active && can_tx_mailbox_available()) {
+                KC_Transmit_Request_t* request = &ctx->_transmit_current;
+                size_t bytes_remaining = request->payload_size - request->payload_offset;
+                request->identifier.components.first = (request->payload_offset == 0);
+                request->identifier.components.last = bytes_remaining <= 8;
+
+                uint8_t dlc = 8;
+                if(request->identifier.components.last) {
+                    dlc = bytes_remaining;
+                }
+
+                CAN_Frame_t frame = { 0 };
+                frame.dlc = dlc;
+                frame.id = request->identifier.value;
+                frame.id_extended = true;
+                if(dlc > 0) memcpy(frame.data, request->payload + request->payload_offset, dlc);
+
+                can_transmit_frame(&frame);
+                loaded = true;
+
+                request->payload_offset += dlc;
+                request->identifier.components.counter = (request->identifier.components.counter + 1) % (KC_FRAME_COUNTER_MAX + 1);
+
+                if(request->identifier.components.last) {
+                    // The whole message is in the mailboxes, the payload is no longer needed
+                    ctx->_transmit_active = false;
+                    callback = request->callback;
+                    callback_context = request->context;
+                }
+            }
+        }
+
+        if(callback != 0) callback(callback_context);
+    }
+}
+
+static void kc_transmit_waiter_callback(void* context) {
+    KC_Transmit_Waiter_t* waiter = context;
+    waiter->done = true;
+
+    // Only wake the task when called from the TX interrupt, otherwise it's the
+    // waiting task itself which is running
+    if(waiter->task != 0 && CORTEX_ACTIVE_INTERRUPT_VECTOR) {
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        vTaskNotifyGiveFromISR(waiter->task, &higher_priority_task_woken);
+        portYIELD_FROM_ISR(higher_priority_task_woken);
+    }
+}
+
+void kc_frame_transmit_async(
+    KC_Context_t* ctx,
     KC_FrameType_t frame_type,
     KC_TransactionID_t tid,
     KC_Address_t receiver,
     size_t payload_size,
-    void* payload
+    const void* payload,
+    KC_TransmitCallback_t callback,
+    void* context
 ) {
-    KC_Identifier_t id;
-    id.components.counter = 0;
-    id.components.receiver_address = receiver;
-    id.components.sender_address = kc_node_address;
-    id.components.transaction_id = tid;
-    id.components.frame_type = frame_type;
-
-    for(size_t payload_offset = 0; (payload_offset < payload_size) || payload_offset == 0; payload_offset += 8) {
-        size_t bytes_remaining = (payload_size - payload_offset);
-        id.components.first = (payload_offset == 0);
-        id.components.last = bytes_remaining <= 8;
+    if(payload_size > KC_MAX_PAYLOAD_SIZE) {
+        error_throw(ERR_RANGE, "Payload too large.");
+    }
 
-        uint8_t dlc = 8;
-        if(id.components.last) {
-            dlc = bytes_remaining;
-        }
+    KC_Transmit_Request_t request = { 0 };
+    request.identifier.components.counter = 0;
+    request.identifier.components.receiver_address = receiver;
+    request.identifier.components.sender_address = ctx->_node_address;
+    request.identifier.components.transaction_id = tid;
+    request.identifier.components.frame_type = frame_type;
+    request.payload = payload;
+    request.payload_size = payload_size;
+    request.payload_offset = 0;
+    request.callback = callback;
+    request.context = context;
+
+    fifo_put(ctx->_transmit_fifo, request);
+    ctx->_send_flag = true;
+
+    // Start the transmission right away if the mailboxes are idle
+    kc_transmit_pump(ctx);
+}
 
-        CAN_Frame_t frame = { 0 };
-        frame.dlc = dlc;
-        frame.id = id.value;
-        frame.id_extended = true;
-        memcpy(frame.data, payload + payload_offset, dlc);
+void kc_frame_transmit(
+    KC_Context_t* ctx,
+    KC_FrameType_t frame_type,
+    KC_TransactionID_t tid,
+    KC_Address_t receiver,
+    size_t payload_size,
+    void* payload
+) {
+    KC_Transmit_Waiter_t waiter = { .done = false, .task = 0 };
+    if(xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        waiter.task = xTaskGetCurrentTaskHandle();
+    }
 
-        can_transmit_frame(&frame);
-        can_flush_tx_buffer();
+    kc_frame_transmit_async(ctx, frame_type, tid, receiver, payload_size, payload, kc_transmit_waiter_callback, &waiter);
 
-        id.components.counter = (id.components.counter + 1) % (KC_FRAME_COUNTER_MAX + 1);
+    while(!waiter.done) {
+        if(waiter.task != 0) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
-    send_flag = true;
 }
 
-static void kc_address_end() {
+static void kc_address_end(KC_Context_t* ctx) {
     // Set the DAISY signal to be Hi-Z again
     KC_DAISY_OUT_PIN->mode = GPIO_MODE_INPUT;
     KC_DAISY_OUT_PIN->pull_mode = GPIO_NOPULL;
@@ -303,36 +1260,37 @@ static void kc_address_end() {
 
     // Inform the user
     char info_string[64] = { 0 };
-    snprintf(info_string, 64, "Addressing finished [ Node address = %d, Bus size = %d ]", kc_node_address, kc_bus_size);
+    snprintf(info_string, 64, "Addressing finished [ Node address = %d, Bus size = %d ]", ctx->_node_address, ctx->_bus_size);
     vcp_println(info_string);
 
-    if(kc_node_address) {
+    if(ctx->_node_address) {
         // Emit the ONLINE event if addressed successfully
-        kc_event_emit(KC_EVENT_ONLINE, 0, 0);
+        kc_event_emit(ctx, KC_EVENT_ONLINE, 0, 0);
 
         // Configure the CAN filter bank to match node-specific frames
-        // Broadcast frames are accepted by filterbank 1
+        // Broadcast frames are accepted by the filter banks configured in kc_update_filters
+        // Commands and responses to this node take the command FIFO
         can_configure_filter_bank(
-            CAN_FILTERBANK_1,
-            CAN_FIFO_0,
+            KC_FILTERBANK_NODE,
+            KC_COMMAND_FIFO,
             CAN_FILTERBANK_WIDTH_32BIT,
             CAN_FILTERBANK_MODE_MASK,
-            0b00000000000000000000000000000100 | kc_node_address << 3,
-            0b00000000000000000000001111111110
+            KC_FILTER_IDE | ctx->_node_address << 3,
+            KC_FILTER_RECEIVER_MASK
         );
 
         // Addressing has been finished
-        kc_state = KC_STATE_READY;
+        ctx->_state = KC_STATE_READY;
     } else {
         // Addressing hasn't been successful, request another addressing procedure
-        kc_request_addressing();
+        kc_request_addressing(ctx);
     }
 }
 
-static void kc_address_next() {
+static void kc_address_next(KC_Context_t* ctx) {
     if(kc_out_connected()) {
         // Give the next node some time to be ready
-        for(uint16_t i = 0; i < UINT16_MAX; i++) __asm("NOP");
+        KC_SETTLE_DELAY();
 
         vcp_println("Addressing next node...");
 
@@ -340,24 +1298,31 @@ static void kc_address_next() {
         KC_DAISY_OUT_PIN->mode = GPIO_MODE_OUTPUT;
         KC_DAISY_OUT_PIN->output_data = 0;
 
-        kc_event_emit(KC_EVENT_ADDRESSING_NEXT, 0, 0);
-        waiting_for_next_node_to_be_addressed = true;
+        kc_event_emit(ctx, KC_EVENT_ADDRESSING_NEXT, 0, 0);
+        ctx->_waiting_for_next_node_to_be_addressed = true;
 
         // Give the next node some time to respond
-        for(uint16_t i = 0; i < UINT16_MAX; i++) __asm("NOP");
+        KC_SETTLE_DELAY();
     } else {
         // This is the last node in the chain
         // Notify the other nodes that the addressing has been finished
-        kc_event_emit(KC_EVENT_ADDRESSING_FINISHED, 0, 0);
+        kc_event_emit(ctx, KC_EVENT_ADDRESSING_FINISHED, 0, 0);
 
-        kc_bus_size = kc_node_address;
-        kc_address_end();
+        ctx->_bus_size = ctx->_node_address;
+        kc_address_end(ctx);
     }
 }
 
 /* Public function definitions */
-void kc_init() {
-    kc_state = KC_STATE_INITIALIZING;
+void kc_init(KC_Context_t* ctx) {
+    if(kc_hardware_context != 0) {
+        error_throw(ERR_RUNTIME_GENERIC, "A knabberCAN context has already been initialized.");
+    }
+    kc_hardware_context = ctx;
+    ctx->_state = KC_STATE_INITIALIZING;
+
+    // Uncaught errors are broadcasted once the node has been addressed
+    error_set_reporter(kc_report_uncaught_error);
 
     /* Configure the GPIO pins */
     KC_RXD_PIN->mode = GPIO_MODE_ALTERNATE;
@@ -373,6 +1338,12 @@ void kc_init() {
     KC_CONN_IN_PIN->mode = GPIO_MODE_INPUT;
     KC_CONN_OUT_PIN->mode = GPIO_MODE_INPUT;
 
+    // Connector changes are detected by the external interrupts, which read the tick count
+    gpio_exti_set_priority(KC_CONN_IN_PIN, KC_CONN_IRQ_PRIORITY);
+    gpio_exti_set_priority(KC_CONN_OUT_PIN, KC_CONN_IRQ_PRIORITY);
+    ctx->_conn_in_state = kc_in_connected();
+    ctx->_conn_out_state = kc_out_connected();
+
     KC_DAISY_IN_PIN->mode = GPIO_MODE_INPUT;
     KC_DAISY_OUT_PIN->mode = GPIO_MODE_INPUT;
     KC_DAISY_IN_PIN->pull_mode = GPIO_PULLDOWN;
@@ -380,52 +1351,203 @@ void kc_init() {
 
     KC_STBY_PIN->mode = GPIO_MODE_OUTPUT;
 
-    /* Define pre-defined commands and events */
-    kc_event_define(KC_EVENT_ADDRESSING_START, kc_internal_event_handler);
-    kc_event_define(KC_EVENT_ADDRESSING_NEXT, kc_internal_event_handler);
-    kc_event_define(KC_EVENT_ADDRESSING_SUCCESS, kc_internal_event_handler);
-    kc_event_define(KC_EVENT_ADDRESSING_FINISHED, kc_internal_event_handler);
-    kc_event_define(KC_EVENT_ADDRESSING_REQUIRED, kc_internal_event_handler);
-    kc_command_define(KC_COMMAND_RESET, kc_internal_command_handler);
-    kc_command_define(KC_COMMAND_SET_INDICATORS_ACTIVE, kc_internal_command_handler);
-    kc_command_define(KC_COMMAND_READ_FWR_NAME, kc_internal_command_handler);
+    /* Check the handler table, the pre-defined commands and events are always defined */
+    if(ctx->_handler_table != 0) {
+        kc_handler_table_validate(ctx->_handler_table);
+    }
     
     /* Initialize the CAN peripheral */
-    can_init(1000000, CAN_TESTMODE_NONE);
-
-    // Configure the filter bank to match broadcast frames
-    can_configure_filter_bank(
-        CAN_FILTERBANK_0,
-        CAN_FIFO_0,
-        CAN_FILTERBANK_WIDTH_32BIT,
-        CAN_FILTERBANK_MODE_MASK,
-        0b00000000000000000000000000000100,
-        0b00000000000000000000001111111110
-    );
+    can_init(KC_BITRATE, CAN_TESTMODE_NONE);
+
+    // Commands may preempt the reception of events
+    can_set_fifo_priority(KC_COMMAND_FIFO, KC_COMMAND_IRQ_PRIORITY);
+    can_set_fifo_priority(KC_EVENT_FIFO, KC_EVENT_IRQ_PRIORITY);
+
+    // Completed transmissions notify the waiting tasks
+    can_set_tx_priority(KC_TX_IRQ_PRIORITY);
+
+    // Configure the filter banks to match the defined broadcast events and commands
+    ctx->_filters_enabled = true;
+    kc_update_filters(ctx);
 
-    kc_request_addressing();
+    kc_request_addressing(ctx);
 }
 
-void kc_command_define(KC_TransactionID_t command_id, KC_CommandCallback_t callback) {
-    if(kc_command_callbacks[command_id] == 0) {
-        kc_command_callbacks[command_id] = callback;
+void kc_command_define(KC_Context_t* ctx, KC_TransactionID_t command_id, KC_CommandCallback_t callback) {
+    if(kc_handler_find(ctx, KC_FRAMETYPE_COMMAND, command_id) == 0 && !KC_STREAM_TRANSACTION(command_id)) {
+        kc_handler_define(ctx, (KC_Handler_t)KC_COMMAND_HANDLER(command_id, callback));
     } else {
         error_throw(ERR_RUNTIME_GENERIC, "Command is already defined.");
     }
 }
 
-void kc_event_define(KC_TransactionID_t event_id, KC_EventCallback_t callback) {
-    if(kc_event_callbacks[event_id] == 0) {
-        kc_event_callbacks[event_id] = callback;
+void kc_event_define(KC_Context_t* ctx, KC_TransactionID_t event_id, KC_EventCallback_t callback) {
+    if(kc_handler_find(ctx, KC_FRAMETYPE_EVENT, event_id) == 0) {
+        kc_handler_define(ctx, (KC_Handler_t)KC_EVENT_HANDLER(event_id, callback));
     } else {
         error_throw(ERR_RUNTIME_GENERIC, "Event is already defined.");
     }
 }
 
-KC_State_t kc_get_state() { return kc_state; }
+void kc_command_send(
+    KC_Context_t* ctx,
+    KC_Address_t receiver,
+    KC_TransactionID_t command_id,
+    const void* payload,
+    size_t payload_size,
+    TickType_t timeout,
+    KC_ResponseCallback_t callback,
+    void* context
+) {
+    if(receiver == KC_ADDRESS_BROADCAST) {
+        error_throw(ERR_IMPOSSIBLE, "Commands awaiting a response can't be broadcasted.");
+    }
+    if(callback == 0) {
+        error_throw(ERR_IMPOSSIBLE, "Response callback missing.");
+    }
+    if(payload_size > KC_MAX_PAYLOAD_SIZE) {
+        // Checked before the command is entered into the pending table
+        error_throw(ERR_RANGE, "Payload too large.");
+    }
+
+    bool pending = false;
+    bool full = false;
+
+    critical_block {
+        // The errors are thrown after leaving the critical block
+        pending = kc_pending_find(ctx, receiver, command_id) != 0;
+        // Keep one slot free so that probing always terminates
+        full = ctx->_pending_table_count >= KC_PENDING_TABLE_SIZE - 1;
+
+        if(!pending && !full) {
+            size_t index = kc_pending_home_index(receiver);
+            while(ctx->_pending_table[index].occupied) {
+                index = (index + 1) & KC_PENDING_TABLE_MASK;
+            }
+
+            KC_Pending_Command_t* entry = &(ctx->_pending_table[index]);
+            entry->occupied = true;
+            entry->receiver_address = receiver;
+            entry->command_id = command_id;
+            entry->deadline = xTaskGetTickCount() + timeout;
+            entry->callback = callback;
+            entry->context = context;
+
+            if(ctx->_pending_table_count == 0 || !kc_tick_reached(entry->deadline, ctx->_pending_next_deadline)) {
+                ctx->_pending_next_deadline = entry->deadline;
+            }
+            ctx->_pending_table_count++;
+        }
+    }
+
+    if(pending) {
+        error_throw(ERR_RUNTIME_GENERIC, "Command is already pending.");
+    }
+    if(full) {
+        error_throw(ERR_BUFFER_FULL, "knabberCAN pending command table full.");
+    }
+
+    kc_frame_transmit(ctx, KC_FRAMETYPE_COMMAND, command_id, receiver, payload_size, (void*)payload);
+}
+
+size_t kc_command_pending_count(KC_Context_t* ctx) { return ctx->_pending_table_count; }
+
+void kc_stream_listen(KC_Context_t* ctx, KC_StreamCallback_t callback, void* context) {
+    critical_block {
+        ctx->_stream_callback = callback;
+        ctx->_stream_callback_context = context;
+    }
+}
+
+bool kc_stream_send(
+    KC_Context_t* ctx,
+    KC_Address_t receiver,
+    uint8_t stream_id,
+    uint32_t total_size,
+    KC_StreamReadCallback_t read,
+    void* context
+) {
+    if(receiver == KC_ADDRESS_BROADCAST) {
+        error_throw(ERR_IMPOSSIBLE, "Streams can't be broadcasted.");
+    }
+    if(read == 0) {
+        error_throw(ERR_IMPOSSIBLE, "Stream read callback missing.");
+    }
+    if(ctx->_dispatcher_task_handle != 0 && xTaskGetCurrentTaskHandle() == ctx->_dispatcher_task_handle) {
+        // The acknowledgements would never be dispatched
+        error_throw(ERR_IMPOSSIBLE, "Streams can't be sent from the dispatcher task.");
+    }
+    if(ctx->_dispatcher_task_handle == 0 && ctx->_dispatching) {
+        // Waiting would dispatch the frames again from within the handler
+        error_throw(ERR_IMPOSSIBLE, "Streams can't be sent from a handler.");
+    }
+    if(total_size > KC_STREAM_MAX_SIZE) {
+        error_throw(ERR_RANGE, "Stream too large.");
+    }
+
+    KC_Stream_Sender_t* sender = &(ctx->_stream_sender);
+    bool busy;
+    critical_block {
+        busy = sender->active;
+        if(!busy) {
+            sender->active = true;
+            sender->opened = false;
+            sender->rejected = false;
+            sender->receiver_address = receiver;
+            sender->task = xTaskGetCurrentTaskHandle();
+            sender->window = 0;
+            sender->acknowledged_sequence = 0;
+            sender->received_chunks = 0;
+        }
+    }
+    if(busy) {
+        error_throw(ERR_RUNTIME_GENERIC, "A stream is already being sent.");
+    }
+
+    bool success = kc_stream_transfer(ctx, stream_id, total_size, read, context);
+    sender->active = false;
+    return success;
+}
+
+void kc_error_send(KC_Context_t* ctx, KC_Address_t receiver, KC_TransactionID_t error_code, const char* error_message) {
+    size_t length = error_message != 0 ? strnlen(error_message, KC_ERROR_MESSAGE_SIZE) : 0;
+    kc_frame_transmit(ctx, KC_FRAMETYPE_ERROR, error_code, receiver, length, (void*)error_message);
+}
+
+void kc_error_listen(KC_Context_t* ctx, KC_ErrorCallback_t callback, void* context) {
+    bool full = false;
+    bool first = false;
+
+    critical_block {
+        size_t count = ctx->_error_callback_count;
+        if(count < KC_ERROR_CALLBACK_COUNT) {
+            // The entry is written before it is published to the dispatcher
+            ctx->_error_callbacks[count] = callback;
+            ctx->_error_callback_contexts[count] = context;
+            ctx->_error_callback_count = count + 1;
+            first = count == 0;
+        } else {
+            full = true;
+        }
+    }
+
+    if(full) {
+        error_throw(ERR_BUFFER_FULL, "Too many knabberCAN error callbacks are registered.");
+    }
+
+    // Start accepting broadcasted errors
+    if(first) kc_update_filters(ctx);
+}
+
+KC_State_t kc_get_state(KC_Context_t* ctx) { return ctx->_state; }
+
+KC_Address_t kc_get_node_address(KC_Context_t* ctx) { return ctx->_node_address; }
 
-void kc_event_emit(KC_TransactionID_t event_id, void* payload, size_t payload_size) {
+KC_Address_t kc_get_bus_size(KC_Context_t* ctx) { return ctx->_bus_size; }
+
+void kc_event_emit(KC_Context_t* ctx, KC_TransactionID_t event_id, void* payload, size_t payload_size) {
     kc_frame_transmit(
+        ctx,
         KC_FRAMETYPE_EVENT,
         event_id,
         KC_ADDRESS_BROADCAST,
@@ -434,133 +1556,384 @@ void kc_event_emit(KC_TransactionID_t event_id, void* payload, size_t payload_si
     );
 }
 
-void kc_process_incoming() {
-    kc_check_if_addressing_required();
+void kc_process_incoming(KC_Context_t* ctx) {
+    kc_check_if_addressing_required(ctx);
 
-    bool received = false;
-
-    if(waiting_for_next_node_to_be_addressed && fifo_empty(kc_recv_fifo)) {
+    if(ctx->_waiting_for_next_node_to_be_addressed && ring_empty(ctx->_recv_ring) && ring_empty(ctx->_priority_recv_ring)) {
         vcp_println("Didn't react, retrying...");
-        kc_address_next();
+        kc_address_next(ctx);
     }
 
-    while(!fifo_empty(kc_recv_fifo)) {
+    bool received = kc_dispatch_received_frames(ctx);
+    kc_pending_check_timeouts(ctx);
+    kc_stream_check_timeouts(ctx);
+    kc_update_indicators(ctx, received);
+}
+
+static bool kc_dispatch_received_frames(KC_Context_t* ctx) {
+    bool received = false;
+    ctx->_dispatching = true;
+
+    while(true) {
+        // Check the priority lane before every frame, so commands never wait for a burst of events
         KC_Received_Frame_t frame;
-        fifo_get(kc_recv_fifo, frame);
+        if(!ring_get(ctx->_priority_recv_ring, frame) && !ring_get(ctx->_recv_ring, frame)) {
+            break;
+        }
         received = true;
 
+        // Payloads spanning several blocks are handed to the handlers in one piece
+        KC_Payload_Block_t* blocks = (KC_Payload_Block_t*)frame.payload;
+        if(frame.payload_size > KC_PAYLOAD_BLOCK_SIZE) {
+            size_t offset = 0;
+            for(KC_Payload_Block_t* block = blocks; block != 0; block = block->next) {
+                size_t size = frame.payload_size - offset < KC_PAYLOAD_BLOCK_SIZE ? frame.payload_size - offset : KC_PAYLOAD_BLOCK_SIZE;
+                memcpy(&(ctx->_payload_buffer[offset]), block->data, size);
+                offset += size;
+            }
+            frame.payload = ctx->_payload_buffer;
+        }
+
+        // Track the time from the RX interrupt to the dispatch
+        uint32_t latency = DWT->CYCCNT - frame.receive_timestamp;
+        ctx->_dispatch_statistics.last_latency_cycles = latency;
+        if(latency > ctx->_dispatch_statistics.max_latency_cycles) {
+            ctx->_dispatch_statistics.max_latency_cycles = latency;
+        }
+        ctx->_dispatch_statistics.dispatched_frames++;
+
+        const KC_Handler_t* handler;
+        bool retained = false;
         switch(frame.frame_type) {
             case KC_FRAMETYPE_EVENT:
-                if(kc_event_callbacks[frame.transaction_id] != 0) {
-                    KC_Received_EventFrame_t event_frame;
-                    event_frame.event_id = frame.transaction_id;
-                    event_frame.payload = frame.payload;
-                    event_frame.payload_size = frame.payload_size;
-                    event_frame.sender_address = frame.sender_address;
-
-                    kc_event_callbacks[frame.transaction_id](event_frame);
+                handler = kc_handler_find(ctx, KC_FRAMETYPE_EVENT, frame.transaction_id);
+                if(handler != 0) {
+                    kc_dispatch_event(ctx, handler, &frame);
                 }
                 break;
 
             case KC_FRAMETYPE_COMMAND:
-                if(kc_command_callbacks[frame.transaction_id] != 0) {
-                    KC_Received_CommandFrame_t command_frame;
-                    command_frame.command_id = frame.transaction_id;
-                    command_frame.payload = frame.payload;
-                    command_frame.payload_size = frame.payload_size;
-                    command_frame.receiver_address = frame.receiver_address;
-                    command_frame.sender_address = frame.sender_address;
-
-                    KC_Response_t response = kc_command_callbacks[frame.transaction_id](command_frame);
-                    kc_frame_transmit(
-                        KC_FRAMETYPE_RESPONSE,
-                        command_frame.command_id,
-                        command_frame.sender_address,
-                        response.payload_size,
-                        response.payload
-                    );
-
-                    // Invalidate response payload buffer
-                    varbuf_clear(response.payload);
+                if(KC_STREAM_TRANSACTION(frame.transaction_id)) {
+                    // Chunks held back for reordering keep their payload block
+                    retained = kc_stream_receive(ctx, &frame);
+                    break;
                 }
-                break; // TODO IMPLEMENT THIS
+
+                handler = kc_handler_find(ctx, KC_FRAMETYPE_COMMAND, frame.transaction_id);
+                if(handler != 0) {
+                    kc_dispatch_command(ctx, handler, &frame);
+                }
+                break;
 
             case KC_FRAMETYPE_RESPONSE:
-                break; // TODO IMPLEMENT THIS
+                if(frame.receiver_address == ctx->_node_address && KC_STREAM_TRANSACTION(frame.transaction_id)) {
+                    kc_stream_acknowledge(ctx, &frame);
+                } else if(frame.receiver_address == ctx->_node_address) {
+                    KC_Pending_Command_t entry = { 0 };
+
+                    critical_block {
+                        KC_Pending_Command_t* pending = kc_pending_find(ctx, frame.sender_address, frame.transaction_id);
+                        if(pending != 0) {
+                            entry = *pending;
+                            kc_pending_remove(ctx, pending);
+                        }
+                    }
+
+                    if(entry.occupied) {
+                        KC_Received_ResponseFrame_t response_frame;
+                        response_frame.kc_context = ctx;
+                        response_frame.status = KC_RESPONSE_RECEIVED;
+                        response_frame.sender_address = frame.sender_address;
+                        response_frame.command_id = frame.transaction_id;
+                        response_frame.payload_size = frame.payload_size;
+                        response_frame.payload = frame.payload;
+
+                        entry.callback(response_frame, entry.context);
+                    }
+                }
+                break;
 
             case KC_FRAMETYPE_ERROR:
-                break; // TODO IMPLEMENT THIS
+                kc_dispatch_error(ctx, &frame);
+                break;
+        }
+
+        // Return the payload to the pool to avoid a memory leak
+        if(!retained) {
+            kc_payload_free(ctx, blocks);
         }
+    }
+
+    ctx->_dispatching = false;
+    return received;
+}
+
+static void kc_dispatch_event(KC_Context_t* ctx, const KC_Handler_t* handler, KC_Received_Frame_t* frame) {
+    KC_Received_EventFrame_t event_frame;
+    event_frame.kc_context = ctx;
+    event_frame.event_id = frame->transaction_id;
+    event_frame.payload = frame->payload;
+    event_frame.payload_size = frame->payload_size;
+    event_frame.sender_address = frame->sender_address;
+
+    error_try {
+        handler->event(event_frame);
+    } error_catch(error_t error) {
+        // Events have no single sender waiting for them, so the failure is broadcasted
+        kc_error_send(ctx, KC_ADDRESS_BROADCAST, error.error_code, error.error_message);
+    }
+}
+
+static void kc_dispatch_command(KC_Context_t* ctx, const KC_Handler_t* handler, KC_Received_Frame_t* frame) {
+    KC_Received_CommandFrame_t command_frame;
+    command_frame.kc_context = ctx;
+    command_frame.command_id = frame->transaction_id;
+    command_frame.payload = frame->payload;
+    command_frame.payload_size = frame->payload_size;
+    command_frame.receiver_address = frame->receiver_address;
+    command_frame.sender_address = frame->sender_address;
+
+    // Assigned between setjmp() and longjmp(), so it must not be cached in a register
+    volatile KC_Response_t response = { .payload = 0 };
+    error_try {
+        response = handler->command(command_frame);
+    } error_catch(error_t error) {
+        // A failed command is answered with an error instead of the response
+        kc_error_send(ctx, command_frame.sender_address, error.error_code, error.error_message);
+        return;
+    }
+
+    KC_Response_t result = response;
+    if(result.payload_size > KC_MAX_PAYLOAD_SIZE) {
+        varbuf_clear(result.payload);
+        kc_error_send(ctx, command_frame.sender_address, ERR_RANGE, "Response too large.");
+        return;
+    }
+
+    kc_frame_transmit(
+        ctx,
+        KC_FRAMETYPE_RESPONSE,
+        command_frame.command_id,
+        command_frame.sender_address,
+        result.payload_size,
+        result.payload
+    );
+
+    // Invalidate response payload buffer
+    varbuf_clear(result.payload);
+}
+
+static void kc_dispatch_error(KC_Context_t* ctx, KC_Received_Frame_t* frame) {
+    // The message isn't necessarily null-terminated on the bus
+    char error_message[KC_PAYLOAD_BLOCK_SIZE + 1] = { 0 };
+    if(frame->payload_size > 0) {
+        memcpy(error_message, frame->payload, frame->payload_size < KC_PAYLOAD_BLOCK_SIZE ? frame->payload_size : KC_PAYLOAD_BLOCK_SIZE);
+    }
 
-        // Deallocate the payload to avoid a memory leak
-        varbuf_clear(frame.payload);
+    KC_Received_ErrorFrame_t error_frame;
+    error_frame.kc_context = ctx;
+    error_frame.sender_address = frame->sender_address;
+    error_frame.receiver_address = frame->receiver_address;
+    error_frame.error_code = frame->transaction_id;
+    error_frame.error_message = error_message;
+
+    // Callbacks are only ever appended, so the registered ones stay valid
+    size_t count = ctx->_error_callback_count;
+    for(size_t i = 0; i < count; i++) {
+        ctx->_error_callbacks[i](error_frame, ctx->_error_callback_contexts[i]);
     }
+}
+
+static void kc_error_report_done(void* context) {
+    KC_Error_Report_t* report = context;
+    report->busy = false;
+}
+
+static void kc_report_uncaught_error(error_t* error) {
+    KC_Context_t* ctx = kc_hardware_context;
+
+    // Only addressed nodes may send frames, and a full transmit FIFO would throw again
+    if(ctx == 0 || ctx->_state != KC_STATE_READY || fifo_full(ctx->_transmit_fifo)) return;
+
+    // Several tasks or interrupts may fail at once, so every report takes its own buffer until
+    // it's in the mailboxes. If all of them are in use, this error isn't reported.
+    KC_Error_Report_t* report = 0;
+    critical_block {
+        for(size_t i = 0; i < KC_ERROR_REPORT_COUNT && report == 0; i++) {
+            if(!ctx->_error_reports[i].busy) {
+                report = &ctx->_error_reports[i];
+                report->busy = true;
+            }
+        }
+    }
+    if(report == 0) return;
+
+    size_t length = error->error_message != 0 ? strnlen(error->error_message, KC_ERROR_MESSAGE_SIZE) : 0;
+    if(length > 0) memcpy(report->message, error->error_message, length);
+
+    // The task is deleted or the MCU is blocked afterwards, so the transmission isn't awaited
+    kc_frame_transmit_async(ctx, KC_FRAMETYPE_ERROR, error->error_code, KC_ADDRESS_BROADCAST, length, report->message, kc_error_report_done, report);
+}
+
+static void kc_update_indicators(KC_Context_t* ctx, bool received) {
+    // Only the context bound to the hardware owns the LEDs
+    if(ctx != kc_hardware_context) return;
 
     // Set the LED state
-    static TickType_t last_send_tick = 0;
-    static TickType_t last_recv_tick = 0;
     TickType_t current_tick = xTaskGetTickCount();
-    if(send_flag) {
-        last_send_tick = current_tick;
-        send_flag = false;
+    if(ctx->_send_flag) {
+        ctx->_last_send_tick = current_tick;
+        ctx->_send_flag = false;
     }
     if(received) {
-        last_recv_tick = current_tick;
-        received = false;
+        ctx->_last_recv_tick = current_tick;
     }
 
-    bool send_led_on = (current_tick - last_send_tick < KC_LED_FLASH_TICKS) && indicators_active;
-    bool recv_led_on = (current_tick - last_recv_tick < KC_LED_FLASH_TICKS) && indicators_active;
+    bool send_led_on = (current_tick - ctx->_last_send_tick < KC_LED_FLASH_TICKS) && ctx->_indicators_active;
+    bool recv_led_on = (current_tick - ctx->_last_recv_tick < KC_LED_FLASH_TICKS) && ctx->_indicators_active;
     KC_INLED_GREEN_PIN->output_data = send_led_on;
     KC_OUTLED_GREEN_PIN->output_data = send_led_on;
     KC_INLED_YELLOW_PIN->output_data = recv_led_on;
     KC_OUTLED_YELLOW_PIN->output_data = recv_led_on;
 }
 
-static void kc_check_if_addressing_required() {
-    static bool has_been_checked = false;
-    static bool conn_in_previous_state = 0;
-    static bool conn_out_previous_state = 0;
+static void kc_dispatcher_task(void* parameters) {
+    KC_Context_t* ctx = parameters;
+    TickType_t last_housekeeping_tick = xTaskGetTickCount();
+
+    while(1) {
+        // Sleep until the RX interrupt has queued a frame
+        ulTaskNotifyTake(pdTRUE, KC_DISPATCHER_HOUSEKEEPING_TICKS);
+
+        TickType_t current_tick = xTaskGetTickCount();
+        if(current_tick - last_housekeeping_tick >= KC_DISPATCHER_HOUSEKEEPING_TICKS) {
+            // Full processing, including addressing and timeouts
+            last_housekeeping_tick = current_tick;
+            kc_process_incoming(ctx);
+        } else {
+            // Fast path, only dispatch the received frames
+            kc_update_indicators(ctx, kc_dispatch_received_frames(ctx));
+        }
+    }
+}
+
+void kc_dispatcher_start(KC_Context_t* ctx, UBaseType_t priority) {
+    if(ctx->_dispatcher_task_handle != 0) {
+        error_throw(ERR_RUNTIME_GENERIC, "knabberCAN dispatcher already started.");
+    }
+
+    // Enable the cycle counter for the latency measurement
+    SET_MASK(CoreDebug->DEMCR, CoreDebug_DEMCR_TRCENA_Msk);
+    SET_MASK(DWT->CTRL, DWT_CTRL_CYCCNTENA_Msk);
+
+    TaskHandle_t task_handle;
+    if(xTaskCreate(kc_dispatcher_task, "knabberCAN", KC_DISPATCHER_STACK_SIZE, ctx, priority, &task_handle) != pdPASS) {
+        error_throw(ERR_ALLOCATION, "knabberCAN dispatcher task creation failed.");
+    }
+    ctx->_dispatcher_task_handle = task_handle;
+}
+
+KC_DispatchStatistics_t kc_get_dispatch_statistics(KC_Context_t* ctx) { return ctx->_dispatch_statistics; }
+
+KC_ReceiveStatistics_t kc_get_receive_statistics(KC_Context_t* ctx) {
+    KC_ReceiveStatistics_t statistics = { 0 };
+
+    // The statistics only consist of counters, which are added up over both FIFOs
+    uint32_t* total = (uint32_t*)&statistics;
+    for(size_t fifo = 0; fifo < 2; fifo++) {
+        const volatile uint32_t* counters = (const volatile uint32_t*)&ctx->_receive_statistics[fifo];
+        for(size_t i = 0; i < sizeof(statistics) / sizeof(uint32_t); i++) {
+            total[i] += counters[i];
+        }
+    }
+
+    return statistics;
+}
+
+static void kc_conn_edge_callback(uint8_t pin_number) {
+    KC_Context_t* ctx = kc_hardware_context;
+    if(ctx == 0) return;
+
+    // Restart the debounce time on every edge
+    ctx->_conn_change_tick = xTaskGetTickCountFromISR();
+    ctx->_conn_change_pending = true;
+}
+
+static void kc_check_if_addressing_required(KC_Context_t* ctx) {
+    // Only sample the connectors once they've been stable after an edge
+    if(!ctx->_conn_change_pending) return;
+    if(xTaskGetTickCount() - ctx->_conn_change_tick < KC_CONN_DEBOUNCE_TICKS) return;
+    ctx->_conn_change_pending = false;
 
     bool conn_in_current_state = kc_in_connected();
     bool conn_out_current_state = kc_out_connected();
 
-    if(has_been_checked && kc_state == KC_STATE_READY) {
-        // Check the CONN_IN pin for changes
+    if(ctx->_state == KC_STATE_READY) {
+        // Check the CONN pins for changes
         if(
-            conn_in_current_state != conn_in_previous_state ||
-            conn_out_previous_state != conn_out_current_state
+            conn_in_current_state != ctx->_conn_in_state ||
+            conn_out_current_state != ctx->_conn_out_state
         ) {
-            kc_request_addressing();
+            kc_request_addressing(ctx);
         }
     }
 
-    conn_in_previous_state = conn_in_current_state;
-    conn_out_previous_state = conn_out_current_state;
-    has_been_checked = true;
+    ctx->_conn_in_state = conn_in_current_state;
+    ctx->_conn_out_state = conn_out_current_state;
+}
+
+static void kc_conn_mark_changed(bool changed) {
+    KC_Context_t* ctx = kc_hardware_context;
+    if(ctx == 0 || !changed) return;
+
+    // The sample runs in a task, so the change is checked once debounced like an edge
+    ctx->_conn_change_tick = xTaskGetTickCount();
+    ctx->_conn_change_pending = true;
 }
 
 static bool kc_in_connected() {
+    // Level while the LED drives its pin, which is compared once the line is unmasked again
+    bool level = KC_CONN_IN_PIN->input_data;
+
+    // Switching the LED pin causes edges which must not be detected as connector changes
+    gpio_exti_disable(KC_CONN_IN_PIN);
+
     // LED pins must by Hi-Z for this
     KC_INLED_GREEN_PIN->mode = GPIO_MODE_ANALOG;
 
-    for(uint16_t i = 0; i < UINT16_MAX; i++) __asm("NOP");
+    KC_SETTLE_DELAY();
     bool result = KC_CONN_IN_PIN->input_data;
 
     // Reset LED pins
     KC_INLED_GREEN_PIN->mode = GPIO_MODE_OUTPUT;
-    
+
+    gpio_exti_enable(KC_CONN_IN_PIN, GPIO_EXTI_TRIGGER_BOTH, kc_conn_edge_callback);
+
+    // Edges of a connector change while the line was masked have been discarded, the level shows it
+    kc_conn_mark_changed(KC_CONN_IN_PIN->input_data != level);
+
     return result;
 }
 static bool kc_out_connected() {
+    // Level while the LED drives its pin, which is compared once the line is unmasked again
+    bool level = KC_CONN_OUT_PIN->input_data;
+
+    // Switching the LED pin causes edges which must not be detected as connector changes
+    gpio_exti_disable(KC_CONN_OUT_PIN);
+
     // LED pins must by Hi-Z for this
     KC_OUTLED_GREEN_PIN->mode = GPIO_MODE_ANALOG;
 
-    for(uint16_t i = 0; i < UINT16_MAX; i++) __asm("NOP");
+    KC_SETTLE_DELAY();
     bool result = KC_CONN_OUT_PIN->input_data;
 
     // Reset LED pins
     KC_OUTLED_GREEN_PIN->mode = GPIO_MODE_OUTPUT;
-    
+
+    gpio_exti_enable(KC_CONN_OUT_PIN, GPIO_EXTI_TRIGGER_BOTH, kc_conn_edge_callback);
+
+    // Edges of a connector change while the line was masked have been discarded, the level shows it
+    kc_conn_mark_changed(KC_CONN_OUT_PIN->input_data != level);
+
     return result;
 }
\ No newline at end of file
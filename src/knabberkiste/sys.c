@@ -8,5 +8,5 @@ void sys_init() {
     clock_configure64MHz();
     gpio_enable_port_clocks();
     vcp_init(921600);
-    kc_init();
+    kc_init(&kc_default_context);
 }
\ No newline at end of file
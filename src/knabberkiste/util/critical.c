@@ -12,4 +12,14 @@ void critical_enter() {
 void critical_exit() {
     critical_counter--;
     if(critical_counter == 0) __enable_irq();
+}
+
+uint32_t _critical_get_depth() {
+    return critical_counter;
+}
+
+void _critical_set_depth(uint32_t depth) {
+    // The interrupts must be disabled before the counter says so
+    if(depth > 0) __disable_irq();
+    critical_counter = depth;
 }
\ No newline at end of file
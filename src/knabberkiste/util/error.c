@@ -4,10 +4,10 @@
 #include <stdio.h>
 
 volatile __error_manager_state_t __error_manager_state;
-volatile __error_manager_state_t __previous_error_manager_state_global;
-volatile __error_manager_state_t* volatile __em_ptr_global;
 volatile jmp_buf __yield_buf;
 
+static error_reporter_t volatile error_reporter = 0;
+
 #if __has_include("FreeRTOS.h")
     #include <FreeRTOS.h>
     #include <task.h>
@@ -43,18 +43,24 @@ void __attribute__((weak)) uncaught_error_handler(error_t* error) {
     }
 }
 
-#if __has_include("FreeRTOS.h")
-    void _error_throw(error_code_t error_code, const char* error_name, const char* error_message, const char* origin_file, const char* origin_function) {
-        volatile __error_manager_state_t* __em_ptr;
+void error_set_reporter(error_reporter_t reporter) {
+    error_reporter = reporter;
+}
 
+#if __has_include("FreeRTOS.h")
+    static volatile __error_manager_state_t* error_get_state(void) {
         if(xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED && !CORTEX_ACTIVE_INTERRUPT_VECTOR) {
             /* FreeRTOS scheduler is running */
-            __em_ptr = pvTaskGetThreadLocalStoragePointer(NULL, __THREAD_LOCAL_ERROR_MANAGER_STATE_INDEX);
-        } else { \
+            return pvTaskGetThreadLocalStoragePointer(NULL, __THREAD_LOCAL_ERROR_MANAGER_STATE_INDEX);
+        } else {
             /* FreeRTOS scheduler is not running */
-            __em_ptr = &__error_manager_state;
+            return &__error_manager_state;
         }
-        
+    }
+
+    void _error_throw(error_code_t error_code, const char* error_name, const char* error_message, const char* origin_file, const char* origin_function) {
+        volatile __error_manager_state_t* __em_ptr = error_get_state();
+
         if(__em_ptr != 0 && __em_ptr->try_active) {
             /* Current code is wrapped in a try/catch block. */
             __em_ptr->error_occurred = true;
@@ -79,10 +85,13 @@ void __attribute__((weak)) uncaught_error_handler(error_t* error) {
 
         /* Current code is not wrapped in a try/catch block. */
         uncaught_error_handler(&current_error);
+        if(error_reporter != 0) error_reporter(&current_error);
             
         if(CORTEX_ACTIVE_INTERRUPT_VECTOR) {
             while(1);
         } else if(xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+            // The critical blocks of the deleted task are never exited
+            _critical_set_depth(0);
             __enable_irq();
             vTaskDelete(NULL);
             while(1);
@@ -93,6 +102,10 @@ void __attribute__((weak)) uncaught_error_handler(error_t* error) {
 
 #else
 
+    static volatile __error_manager_state_t* error_get_state(void) {
+        return &__error_manager_state;
+    }
+
     void _error_throw(error_code_t error_code, const char* error_name, const char* error_message, const char* origin_file, const char* origin_function) {    
         __error_manager_state.error_occurred = true;
         __error_manager_state.current_error.error_code = error_code;
@@ -109,8 +122,19 @@ void __attribute__((weak)) uncaught_error_handler(error_t* error) {
 
         /* Current code is not wrapped in a try/catch block. */
         uncaught_error_handler(&(__error_manager_state.current_error));
+        if(error_reporter != 0) error_reporter(&(__error_manager_state.current_error));
             
         while(1); // Stall if error handler returns (it shouldn't)
     }
 
-#endif
\ No newline at end of file
+#endif
+
+error_t* _error_catch_take(error_t* error) {
+    volatile __error_manager_state_t* __em_ptr = error_get_state();
+
+    // Interrupts which catch errors in between restore the state of this try block when they're done
+    if(__em_ptr == 0 || !__em_ptr->error_caught) return 0;
+    *error = __em_ptr->caught_error;
+    __em_ptr->error_caught = false;
+    return error;
+}
\ No newline at end of file
@@ -4,25 +4,73 @@
 #include <knabberkiste/io.h>
 #include <string.h>
 
-void _fifo_put(volatile _FIFO_t* fifo, void* element) {
-    while(fifo_full(*fifo));
+#if __has_include("FreeRTOS.h")
+    #include <FreeRTOS.h>
+    #include <task.h>
+#endif
+
+#define FIFO_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+size_t _fifo_put_n(volatile _FIFO_t* fifo, const void* elements, size_t count) {
+    const uint8_t* source = elements;
+    size_t element_size = fifo->_element_size;
+    size_t put;
+    size_t skipped = 0;
+
     critical_block {
-        // Increment the end pointer of the FIFO, allowing it to overflow
-        // to the start of the buffer
-        fifo->_end = (fifo->_end + 1) % fifo->_fifo_size;
-        volatile void* end_ptr = fifo->_buf + fifo->_element_size * fifo->_end;
+        if(fifo->_overwrite) {
+            // Only the newest elements fit, the older ones are dropped right away
+            skipped = count > fifo->_fifo_size ? count - fifo->_fifo_size : 0;
+            source += element_size * skipped;
+            count -= skipped;
+
+            // Drop the oldest elements of the FIFO to make space for the remaining ones
+            size_t dropped = count > fifo->_fifo_size - fifo->_count ? count - (fifo->_fifo_size - fifo->_count) : 0;
+            size_t start = fifo->_start + dropped;
+            fifo->_start = start >= fifo->_fifo_size ? start - fifo->_fifo_size : start;
+            fifo->_count -= dropped;
+            fifo->_overwritten_count += skipped + dropped;
+        }
+
+        put = FIFO_MIN(count, fifo->_fifo_size - fifo->_count);
 
-        memcpy((void*)end_ptr, element, fifo->_element_size);
-        fifo->_count++;
+        // The run is contiguous up to the end of the buffer, the rest wraps to its start
+        size_t first = _fifo_next_index(fifo->_end, fifo->_fifo_size);
+        size_t run = FIFO_MIN(put, fifo->_fifo_size - first);
+        memcpy((uint8_t*)fifo->_buf + element_size * first, source, element_size * run);
+        memcpy((uint8_t*)fifo->_buf, source + element_size * run, element_size * (put - run));
+
+        if(put > 0) {
+            fifo->_end = (put - run > 0) ? put - run - 1 : first + run - 1;
+            fifo->_count += put;
+        }
     }
+
+    // The skipped elements count as put, since they were overwritten right away
+    return put + skipped;
 }
 
-void _fifo_get(volatile _FIFO_t* fifo, void* element) {
-    while(fifo_empty(*fifo));
+size_t _fifo_get_n(volatile _FIFO_t* fifo, void* elements, size_t count) {
+    uint8_t* destination = elements;
+    size_t element_size = fifo->_element_size;
+    size_t taken;
+
     critical_block {
-        volatile void* ptr = _fifo_get_direct(fifo);
-        memcpy(element, (void*)ptr, fifo->_element_size);
+        taken = FIFO_MIN(count, fifo->_count);
+
+        // The run is contiguous up to the end of the buffer, the rest wraps to its start
+        size_t first = _fifo_next_index(fifo->_start, fifo->_fifo_size);
+        size_t run = FIFO_MIN(taken, fifo->_fifo_size - first);
+        memcpy(destination, (const uint8_t*)fifo->_buf + element_size * first, element_size * run);
+        memcpy(destination + element_size * run, (const uint8_t*)fifo->_buf, element_size * (taken - run));
+
+        if(taken > 0) {
+            fifo->_start = (taken - run > 0) ? taken - run - 1 : first + run - 1;
+            fifo->_count -= taken;
+        }
     }
+
+    return taken;
 }
 
 volatile void* _fifo_get_direct(volatile _FIFO_t* fifo) {
@@ -31,10 +79,36 @@ volatile void* _fifo_get_direct(volatile _FIFO_t* fifo) {
     critical_block {
         // Increment the start pointer of the FIFO, allowing it to overflow
         // to the start of the buffer
-        fifo->_start = (fifo->_start + 1) % fifo->_fifo_size;
+        fifo->_start = _fifo_next_index(fifo->_start, fifo->_fifo_size);
         start_ptr = fifo->_buf + fifo->_element_size * fifo->_start;
 
         fifo->_count--;
     }
     return start_ptr;
-}
\ No newline at end of file
+}
+
+#if __has_include("FreeRTOS.h")
+    bool _fifo_put_timeout(volatile _FIFO_t* fifo, const void* element, size_t element_size, TickType_t timeout) {
+        TickType_t start = xTaskGetTickCount();
+
+        while(!_fifo_try_put(fifo, element, element_size)) {
+            if(timeout != portMAX_DELAY && xTaskGetTickCount() - start >= timeout) return false;
+
+            // Sleep for a tick, so the consumer can run even if it has a lower priority
+            vTaskDelay(1);
+        }
+        return true;
+    }
+
+    bool _fifo_get_timeout(volatile _FIFO_t* fifo, void* element, size_t element_size, TickType_t timeout) {
+        TickType_t start = xTaskGetTickCount();
+
+        while(!_fifo_try_get(fifo, element, element_size)) {
+            if(timeout != portMAX_DELAY && xTaskGetTickCount() - start >= timeout) return false;
+
+            // Sleep for a tick, so the producer can run even if it has a lower priority
+            vTaskDelay(1);
+        }
+        return true;
+    }
+#endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include <knabberkiste/util/filter_compiler.h>
+#include <stdbool.h>
+
+static uint32_t filter_pattern_size(FilterPattern_t pattern, uint32_t key_mask) {
+    // Number of keys accepted by the pattern
+    return 1UL << __builtin_popcount(key_mask & ~pattern.mask);
+}
+
+static FilterPattern_t filter_pattern_merge(FilterPattern_t a, FilterPattern_t b) {
+    // The smallest pattern accepting both patterns ignores all the bits in which they differ
+    FilterPattern_t merged;
+    merged.mask = a.mask & b.mask & ~(a.value ^ b.value);
+    merged.value = a.value & merged.mask;
+    return merged;
+}
+
+static bool filter_pattern_contains(FilterPattern_t outer, FilterPattern_t inner) {
+    return (outer.mask & ~inner.mask) == 0 && filter_pattern_matches(outer, inner.value);
+}
+
+static size_t filter_remove_contained(FilterPattern_t* patterns, size_t pattern_count, size_t keep) {
+    // Drop all the patterns which are covered by the pattern at index keep
+    FilterPattern_t outer = patterns[keep];
+    size_t remaining = 0;
+
+    for(size_t i = 0; i < pattern_count; i++) {
+        if(i != keep && filter_pattern_contains(outer, patterns[i])) continue;
+        patterns[remaining++] = patterns[i];
+    }
+
+    return remaining;
+}
+
+size_t filter_compile(
+    FilterPattern_t* patterns,
+    size_t pattern_count,
+    uint32_t key_mask,
+    size_t max_patterns
+) {
+    for(size_t i = 0; i < pattern_count; i++) {
+        patterns[i].value &= patterns[i].mask;
+    }
+
+    // Drop duplicates and patterns covered by any other pattern, wherever it is in the buffer
+    for(size_t i = 0; i < pattern_count; i++) {
+        for(size_t j = 0; j < pattern_count; j++) {
+            if(j != i && filter_pattern_contains(patterns[j], patterns[i])) {
+                patterns[i--] = patterns[--pattern_count];
+                break;
+            }
+        }
+    }
+
+    // Greedily merge the pair of patterns which adds the fewest accepted keys
+    while(pattern_count > max_patterns && pattern_count > 1) {
+        size_t best_a = 0;
+        size_t best_b = 1;
+        int32_t best_cost = INT32_MAX;
+
+        for(size_t a = 0; a < pattern_count; a++) {
+            for(size_t b = a + 1; b < pattern_count; b++) {
+                FilterPattern_t merged = filter_pattern_merge(patterns[a], patterns[b]);
+                // Overlapping patterns yield a negative cost
+                int32_t cost = (int32_t)filter_pattern_size(merged, key_mask)
+                    - (int32_t)filter_pattern_size(patterns[a], key_mask)
+                    - (int32_t)filter_pattern_size(patterns[b], key_mask);
+
+                if(cost < best_cost) {
+                    best_cost = cost;
+                    best_a = a;
+                    best_b = b;
+                }
+            }
+        }
+
+        patterns[best_a] = filter_pattern_merge(patterns[best_a], patterns[best_b]);
+        pattern_count = filter_remove_contained(patterns, pattern_count, best_a);
+    }
+
+    return pattern_count;
+}
\ No newline at end of file
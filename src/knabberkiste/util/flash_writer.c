@@ -0,0 +1,94 @@
+#include <knabberkiste/util/flash_writer.h>
+#include <knabberkiste/util/error.h>
+
+#define FLASH_WRITER_PADDING 0xFF
+
+static void flash_writer_erase_until(FlashWriter_t* writer, size_t page) {
+    const FlashBackend_t* backend = writer->_backend;
+
+    // Pages are always erased in order
+    while(writer->_erased_pages <= page) {
+        if(writer->_erase_pending) {
+            while(backend->busy(backend->context));
+            writer->_erase_pending = false;
+            writer->_erased_pages++;
+        } else {
+            backend->erase_start(writer->_erased_pages, backend->context);
+            writer->_erase_pending = true;
+        }
+    }
+}
+
+void flash_writer_begin(FlashWriter_t* writer, const FlashBackend_t* backend, size_t image_size) {
+    if(image_size > backend->size) {
+        error_throw(ERR_RANGE, "Image doesn't fit into the flash region.");
+    }
+
+    writer->_backend = backend;
+    writer->_page_count = (image_size + backend->page_size - 1) / backend->page_size;
+    writer->_erased_pages = 0;
+    writer->_erase_pending = false;
+    writer->_lookahead_page = 0;
+
+    flash_writer_poll(writer);
+}
+
+void flash_writer_write(FlashWriter_t* writer, size_t offset, const uint8_t* data, size_t size) {
+    const FlashBackend_t* backend = writer->_backend;
+
+    if(offset + size > writer->_page_count * backend->page_size) {
+        error_throw(ERR_RANGE, "Data outside of the image.");
+    }
+    if(offset % 2 != 0) {
+        error_throw(ERR_IMPOSSIBLE, "Flash is programmed in half-words.");
+    }
+
+    while(size > 0) {
+        // Split the data at page boundaries, which keeps the offsets even
+        size_t page = offset / backend->page_size;
+        size_t length = backend->page_size - offset % backend->page_size;
+        if(length > size) length = size;
+
+        flash_writer_erase_until(writer, page);
+        if(page + 1 > writer->_lookahead_page) {
+            writer->_lookahead_page = page + 1;
+        }
+
+        size_t even_length = length & ~(size_t)1;
+        if(even_length > 0) {
+            backend->program(offset, data, even_length, backend->context);
+        }
+        if(even_length != length) {
+            uint8_t padded[2] = { data[even_length], FLASH_WRITER_PADDING };
+            backend->program(offset + even_length, padded, sizeof(padded), backend->context);
+        }
+
+        offset += length;
+        data += length;
+        size -= length;
+    }
+
+    flash_writer_poll(writer);
+}
+
+void flash_writer_poll(FlashWriter_t* writer) {
+    const FlashBackend_t* backend = writer->_backend;
+
+    if(writer->_erase_pending) {
+        if(backend->busy(backend->context)) return;
+        writer->_erase_pending = false;
+        writer->_erased_pages++;
+    }
+
+    // Erase the page following the highest page written while its predecessor is received
+    if(writer->_erased_pages <= writer->_lookahead_page && writer->_erased_pages < writer->_page_count) {
+        backend->erase_start(writer->_erased_pages, backend->context);
+        writer->_erase_pending = true;
+    }
+}
+
+void flash_writer_finish(FlashWriter_t* writer) {
+    if(writer->_page_count > 0) {
+        flash_writer_erase_until(writer, writer->_page_count - 1);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#include <knabberkiste/util/slab.h>
+#include <knabberkiste/util/critical.h>
+#include <stdint.h>
+
+void* _slab_alloc(volatile _Slab_t* slab) {
+    void* block = 0;
+
+    critical_block {
+        if(slab->_free_list != 0) {
+            // Reuse a previously freed block, the next pointer is stored in the block itself
+            block = slab->_free_list;
+            slab->_free_list = *(void**)block;
+        } else if(slab->_next_unused < slab->_block_count) {
+            // Hand out a block which has never been used before
+            block = slab->_buf + slab->_block_size * slab->_next_unused;
+            slab->_next_unused++;
+        }
+
+        if(block != 0) {
+            slab->_used_count++;
+        } else {
+            slab->_exhausted_count++;
+        }
+    }
+
+    return block;
+}
+
+void _slab_free(volatile _Slab_t* slab, void* block) {
+    if(block == 0) return;
+
+    critical_block {
+        *(void**)block = slab->_free_list;
+        slab->_free_list = block;
+        slab->_used_count--;
+    }
+}
\ No newline at end of file
@@ -2,18 +2,42 @@
 #include <knabberkiste/util/error.h>
 #include <stdint.h>
 
+#define VARBUF_GROWTH_FACTOR 2
+#define VARBUF_SHRINK_DIVISOR 4
+
 static struct _varbuf {
     size_t length;
+    size_t capacity;
     char elements[0];
 };
 
 static struct _varbuf* _varbuf_get(void** buf) {
-    if(*buf == 0) {
-        error_throw(ERR_ALLOCATION, "varbuf is empty.");
-    }
     return *buf - offsetof(struct _varbuf, elements);
 }
 
+static bool varbuf_set_capacity(void** buf, size_t capacity, size_t element_size) {
+    struct _varbuf* varbuf = *buf == 0 ? 0 : _varbuf_get(buf);
+    size_t length = varbuf == 0 ? 0 : varbuf->length;
+
+    if(capacity == 0) {
+        free(varbuf);
+        *buf = 0;
+        return true;
+    }
+
+    varbuf = realloc(varbuf, sizeof(struct _varbuf) + capacity * element_size);
+
+    // The old buffer is still valid if the reallocation has failed
+    if(varbuf == 0) return false;
+
+    varbuf->length = length;
+    varbuf->capacity = capacity;
+
+    // Reassign the user pointer
+    *buf = &(varbuf->elements);
+    return true;
+}
+
 size_t _varbuf_get_length(void** buf) {
     if(*buf == 0) return 0;
 
@@ -21,69 +45,96 @@ size_t _varbuf_get_length(void** buf) {
     return varbuf->length;
 }
 
-void _varbuf_push_chunk(void** buf, void* element, size_t element_size, size_t number_of_elements) {
+size_t _varbuf_get_capacity(void** buf) {
+    if(*buf == 0) return 0;
+
+    struct _varbuf* varbuf = _varbuf_get(buf);
+    return varbuf->capacity;
+}
+
+void _varbuf_reserve(void** buf, size_t capacity, size_t element_size) {
+    bool allocated = true;
+
     critical_block {
-        if(*buf == 0) {
-            struct _varbuf* varbuf = malloc(sizeof(struct _varbuf));
-            if(varbuf == 0) error_throw(ERR_ALLOCATION, "Initial varbuf allocation failed.");
-            *buf = &(varbuf->elements);
-            varbuf->length = 0;
+        if(capacity > _varbuf_get_capacity(buf)) {
+            allocated = varbuf_set_capacity(buf, capacity, element_size);
         }
-        struct _varbuf* varbuf = _varbuf_get(buf);
-        
-        // Resize the buffer to fit the new number of elements
-        size_t previous_size = varbuf->length * element_size + sizeof(struct _varbuf);
-        size_t new_size = previous_size + number_of_elements * element_size;
-        varbuf = realloc(varbuf, new_size);
+    }
 
-        // Check if the realloaction has succeeded
-        if(varbuf == 0) error_throw(ERR_ALLOCATION, "varbuf reallocation failed.");
+    // Errors are only thrown outside of critical blocks
+    if(!allocated) error_throw(ERR_ALLOCATION, "varbuf reallocation failed.");
+}
 
-        // Reassign the user pointer
-        *buf = &(varbuf->elements);
+void _varbuf_shrink_to_fit(void** buf, size_t element_size) {
+    critical_block {
+        // If the reallocation fails, the buffer just keeps its capacity
+        if(_varbuf_get_length(buf) != _varbuf_get_capacity(buf)) {
+            varbuf_set_capacity(buf, _varbuf_get_length(buf), element_size);
+        }
+    }
+}
+
+void _varbuf_push_chunk(void** buf, void* element, size_t element_size, size_t number_of_elements) {
+    bool allocated = true;
+
+    critical_block {
+        size_t length = _varbuf_get_length(buf);
+        size_t capacity = _varbuf_get_capacity(buf);
+
+        // Grow geometrically, so that pushing takes amortized constant time
+        if(length + number_of_elements > capacity) {
+            capacity *= VARBUF_GROWTH_FACTOR;
+            if(capacity < length + number_of_elements) capacity = length + number_of_elements;
+            allocated = varbuf_set_capacity(buf, capacity, element_size);
+        }
 
-        // Copy the elements to the buffer
-        memcpy(&(varbuf->elements[varbuf->length * element_size]), element, number_of_elements * element_size);
+        if(allocated) {
+            struct _varbuf* varbuf = _varbuf_get(buf);
 
-        // Increase the varbuf's length
-        varbuf->length += number_of_elements;
+            // Copy the elements to the buffer
+            memcpy(&(varbuf->elements[varbuf->length * element_size]), element, number_of_elements * element_size);
+
+            // Increase the varbuf's length
+            varbuf->length += number_of_elements;
+        }
     }
+
+    // Errors are only thrown outside of critical blocks
+    if(!allocated) error_throw(ERR_ALLOCATION, "varbuf reallocation failed.");
 }
 
 void _varbuf_pop_chunk(void** buf, void* dest, size_t start_idx, size_t elements, size_t element_size) {
-    critical_block {
-        struct _varbuf* varbuf = _varbuf_get(buf);
+    bool in_range = false;
 
+    critical_block {
         // Check if the index is in range
-        if(
-            *buf == 0 ||
-            varbuf->length < (start_idx + elements)
-        ) {
-            error_throw(ERR_RANGE, "varbuf index out of range.");
-        }
-
-        // Copy the elements to the destination
-        memcpy(dest, &(varbuf->elements[start_idx * element_size]), elements * element_size);
+        in_range = *buf != 0 && _varbuf_get_length(buf) >= (start_idx + elements);
 
-        // Move the elements after the popped elements to the front
-        size_t remaining_elements = varbuf->length - (start_idx + elements);
-        if(remaining_elements > 0) {
-            // Move the elements after the popped elements to the front
-            memmove(&(varbuf->elements[start_idx * element_size]), &(varbuf->elements[element_size * (start_idx + elements)]), remaining_elements * element_size);
-        }
+        if(in_range) {
+            struct _varbuf* varbuf = _varbuf_get(buf);
 
-        // Resize the buffer
-        varbuf->length -= elements;
-        if(varbuf->length > 0) {
-            size_t new_size = varbuf->length * element_size + sizeof(struct _varbuf);
-            varbuf = realloc(varbuf, new_size);
+            // Copy the elements to the destination
+            memcpy(dest, &(varbuf->elements[start_idx * element_size]), elements * element_size);
 
-            // Check if the realloaction has succeeded
-            if(varbuf == 0 && varbuf->length > 0) error_throw(ERR_ALLOCATION, "varbuf reallocation failed.");
-        } else {
-            varbuf_clear(*buf);
+            // Move the elements after the popped elements to the front
+            size_t remaining_elements = varbuf->length - (start_idx + elements);
+            if(remaining_elements > 0) {
+                // Move the elements after the popped elements to the front
+                memmove(&(varbuf->elements[start_idx * element_size]), &(varbuf->elements[element_size * (start_idx + elements)]), remaining_elements * element_size);
+            }
+
+            // Only shrink once the buffer is mostly unused, so alternating pushes and pops don't
+            // reallocate every time. Empty buffers are freed. If shrinking fails, the buffer just
+            // keeps its capacity.
+            varbuf->length -= elements;
+            if(varbuf->length <= varbuf->capacity / VARBUF_SHRINK_DIVISOR) {
+                varbuf_set_capacity(buf, varbuf->length * VARBUF_GROWTH_FACTOR, element_size);
+            }
         }
     }
+
+    // Errors are only thrown outside of critical blocks
+    if(!in_range) error_throw(ERR_RANGE, "varbuf index out of range.");
 }
 
 void _varbuf_clear(void** buf) {
@@ -0,0 +1,58 @@
+/**
+ * @file FreeRTOS.h
+ * @author Gabriel Heinzer
+ * @brief Host port of the FreeRTOS kernel header, see @ref sim.h.
+ *
+ * The tasks of a node run as coroutines in simulated time, so only the part of the FreeRTOS API
+ * which is used by the library is provided. The configuration matches a typical STM32F303 setup.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <knabberkiste/_freertos_config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Configuration */
+#define configTICK_RATE_HZ 1000
+#define configMAX_PRIORITIES 8
+#define configMINIMAL_STACK_SIZE 128
+#define configMAX_TASK_NAME_LEN 16
+#define configPRIO_BITS 4
+#define configLIBRARY_LOWEST_INTERRUPT_PRIORITY 15
+#define configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY 5
+#define configASSERT(x) do { if(!(x)) sim_fail("configASSERT(%s) failed in %s", #x, __func__); } while(0)
+
+/* Port types */
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t StackType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(milliseconds) ((TickType_t)(((TickType_t)(milliseconds) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+/**
+ * @brief Requests a context switch when leaving the interrupt, if @p switch_required is set.
+ */
+#define portYIELD_FROM_ISR(switch_required) sim_rtos_yield_from_isr(switch_required)
+#define portEND_SWITCHING_ISR(switch_required) portYIELD_FROM_ISR(switch_required)
+
+void sim_rtos_yield_from_isr(BaseType_t switch_required);
+void sim_fail(const char* format, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+void* pvPortMalloc(size_t size);
+void vPortFree(void* pointer);
+
+#ifdef __cplusplus
+}
+#endif
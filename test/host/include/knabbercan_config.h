@@ -0,0 +1,12 @@
+/**
+ * @file knabbercan_config.h
+ * @author Gabriel Heinzer
+ * @brief knabberCAN configuration for host builds, see @ref knabbercan.h.
+ */
+
+#pragma once
+
+#include <sim.h>
+
+// The NOP loop of the target takes about 4 cycles per iteration
+#define KC_SETTLE_DELAY() sim_busy_wait_cycles(UINT16_MAX * 4)
@@ -0,0 +1,486 @@
+/**
+ * @file knabberkiste_device.h
+ * @author Gabriel Heinzer
+ * @brief Host replacement of the STM32F303xC CMSIS header, see @ref knabberkiste/io.h.
+ *
+ * The register blocks have the layout and the addresses of the STM32F303xC. The host model
+ * maps them into the process and traps every access, so the HALs run unchanged against the
+ * peripheral models of sim.h. The core functions of the Cortex-M4 (NVIC, PRIMASK, ...) are
+ * implemented by the model as well.
+ *
+ * Only the registers and bits which are used by the library are defined.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __IO volatile
+#define __I volatile const
+#define __O volatile
+
+/* Interrupt numbers */
+typedef enum {
+    NonMaskableInt_IRQn = -14,
+    HardFault_IRQn = -13,
+    SVCall_IRQn = -5,
+    PendSV_IRQn = -2,
+    SysTick_IRQn = -1,
+    WWDG_IRQn = 0,
+    FLASH_IRQn = 4,
+    RCC_IRQn = 5,
+    EXTI0_IRQn = 6,
+    EXTI1_IRQn = 7,
+    EXTI2_TSC_IRQn = 8,
+    EXTI3_IRQn = 9,
+    EXTI4_IRQn = 10,
+    USB_HP_CAN_TX_IRQn = 19,
+    USB_LP_CAN_RX0_IRQn = 20,
+    CAN_RX1_IRQn = 21,
+    CAN_SCE_IRQn = 22,
+    EXTI9_5_IRQn = 23,
+    USART1_IRQn = 37,
+    EXTI15_10_IRQn = 40,
+    TIM6_DAC_IRQn = 54,
+    TIM7_IRQn = 55
+} IRQn_Type;
+
+#define CAN_TX_IRQn USB_HP_CAN_TX_IRQn
+#define CAN_RX0_IRQn USB_LP_CAN_RX0_IRQn
+
+/// @brief Number of external interrupts of the STM32F303xC.
+#define DEVICE_IRQ_COUNT 82
+
+/* Core peripherals */
+typedef struct {
+    __I uint32_t CPUID;
+    __IO uint32_t ICSR;
+    __IO uint32_t VTOR;
+    __IO uint32_t AIRCR;
+    __IO uint32_t SCR;
+    __IO uint32_t CCR;
+    __IO uint8_t SHP[12];
+    __IO uint32_t SHCSR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t DHCSR;
+    __O uint32_t DCRSR;
+    __IO uint32_t DCRDR;
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define SCS_BASE 0xE000E000UL
+#define SCB_BASE (SCS_BASE + 0x0D00UL)
+#define CoreDebug_BASE 0xE000EDF0UL
+#define DWT_BASE 0xE0001000UL
+
+#define SCB ((SCB_Type*)SCB_BASE)
+#define DWT ((DWT_Type*)DWT_BASE)
+#define CoreDebug ((CoreDebug_Type*)CoreDebug_BASE)
+
+#define SCB_ICSR_VECTACTIVE_Pos 0U
+#define SCB_ICSR_VECTACTIVE_Msk 0x1FFUL
+#define SCB_AIRCR_VECTKEY_Pos 16U
+#define SCB_AIRCR_SYSRESETREQ_Msk (1UL << 2)
+#define DWT_CTRL_CYCCNTENA_Msk 1UL
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+/* Peripherals */
+typedef struct {
+    __IO uint32_t TIR;
+    __IO uint32_t TDTR;
+    __IO uint32_t TDLR;
+    __IO uint32_t TDHR;
+} CAN_TxMailBox_TypeDef;
+
+typedef struct {
+    __IO uint32_t RIR;
+    __IO uint32_t RDTR;
+    __IO uint32_t RDLR;
+    __IO uint32_t RDHR;
+} CAN_FIFOMailBox_TypeDef;
+
+typedef struct {
+    __IO uint32_t FR1;
+    __IO uint32_t FR2;
+} CAN_FilterRegister_TypeDef;
+
+typedef struct {
+    __IO uint32_t MCR;
+    __IO uint32_t MSR;
+    __IO uint32_t TSR;
+    __IO uint32_t RF0R;
+    __IO uint32_t RF1R;
+    __IO uint32_t IER;
+    __IO uint32_t ESR;
+    __IO uint32_t BTR;
+    uint32_t RESERVED0[88];
+    CAN_TxMailBox_TypeDef sTxMailBox[3];
+    CAN_FIFOMailBox_TypeDef sFIFOMailBox[2];
+    uint32_t RESERVED1[12];
+    __IO uint32_t FMR;
+    __IO uint32_t FM1R;
+    uint32_t RESERVED2;
+    __IO uint32_t FS1R;
+    uint32_t RESERVED3;
+    __IO uint32_t FFA1R;
+    uint32_t RESERVED4;
+    __IO uint32_t FA1R;
+    uint32_t RESERVED5[8];
+    CAN_FilterRegister_TypeDef sFilterRegister[28];
+} CAN_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR;
+    __IO uint32_t CFGR;
+    __IO uint32_t CIR;
+    __IO uint32_t APB2RSTR;
+    __IO uint32_t APB1RSTR;
+    __IO uint32_t AHBENR;
+    __IO uint32_t APB2ENR;
+    __IO uint32_t APB1ENR;
+    __IO uint32_t BDCR;
+    __IO uint32_t CSR;
+    __IO uint32_t AHBRSTR;
+    __IO uint32_t CFGR2;
+    __IO uint32_t CFGR3;
+} RCC_TypeDef;
+
+typedef struct {
+    __IO uint32_t ACR;
+    __IO uint32_t KEYR;
+    __IO uint32_t OPTKEYR;
+    __IO uint32_t SR;
+    __IO uint32_t CR;
+    __IO uint32_t AR;
+    uint32_t RESERVED;
+    __IO uint32_t OBR;
+    __IO uint32_t WRPR;
+} FLASH_TypeDef;
+
+typedef struct {
+    __IO uint32_t MODER;
+    __IO uint32_t OTYPER;
+    __IO uint32_t OSPEEDR;
+    __IO uint32_t PUPDR;
+    __IO uint32_t IDR;
+    __IO uint32_t ODR;
+    __IO uint32_t BSRR;
+    __IO uint32_t LCKR;
+    __IO uint32_t AFR[2];
+    __IO uint32_t BRR;
+} GPIO_TypeDef;
+
+typedef struct {
+    __IO uint32_t IMR;
+    __IO uint32_t EMR;
+    __IO uint32_t RTSR;
+    __IO uint32_t FTSR;
+    __IO uint32_t SWIER;
+    __IO uint32_t PR;
+} EXTI_TypeDef;
+
+typedef struct {
+    __IO uint32_t CFGR1;
+    __IO uint32_t RCR;
+    __IO uint32_t EXTICR[4];
+    __IO uint32_t CFGR2;
+} SYSCFG_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t CR3;
+    __IO uint32_t BRR;
+    __IO uint16_t GTPR;
+    uint16_t RESERVED1;
+    __IO uint32_t RTOR;
+    __IO uint16_t RQR;
+    uint16_t RESERVED2;
+    __IO uint32_t ISR;
+    __IO uint32_t ICR;
+    __IO uint16_t RDR;
+    uint16_t RESERVED3;
+    __IO uint16_t TDR;
+    uint16_t RESERVED4;
+} USART_TypeDef;
+
+typedef struct {
+    __IO uint32_t KR;
+    __IO uint32_t PR;
+    __IO uint32_t RLR;
+    __IO uint32_t SR;
+    __IO uint32_t WINR;
+} IWDG_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t SMCR;
+    __IO uint32_t DIER;
+    __IO uint32_t SR;
+    __IO uint32_t EGR;
+    __IO uint32_t CCMR1;
+    __IO uint32_t CCMR2;
+    __IO uint32_t CCER;
+    __IO uint32_t CNT;
+    __IO uint32_t PSC;
+    __IO uint32_t ARR;
+} TIM_TypeDef;
+
+#define PERIPH_BASE 0x40000000UL
+#define APB1PERIPH_BASE PERIPH_BASE
+#define APB2PERIPH_BASE (PERIPH_BASE + 0x00010000UL)
+#define AHB1PERIPH_BASE (PERIPH_BASE + 0x00020000UL)
+#define AHB2PERIPH_BASE (PERIPH_BASE + 0x08000000UL)
+
+#define TIM6_BASE (APB1PERIPH_BASE + 0x00001000UL)
+#define TIM7_BASE (APB1PERIPH_BASE + 0x00001400UL)
+#define IWDG_BASE (APB1PERIPH_BASE + 0x00003000UL)
+#define CAN_BASE (APB1PERIPH_BASE + 0x00006400UL)
+#define SYSCFG_BASE (APB2PERIPH_BASE + 0x00000000UL)
+#define EXTI_BASE (APB2PERIPH_BASE + 0x00000400UL)
+#define USART1_BASE (APB2PERIPH_BASE + 0x00003800UL)
+#define RCC_BASE (AHB1PERIPH_BASE + 0x00001000UL)
+#define FLASH_R_BASE (AHB1PERIPH_BASE + 0x00002000UL)
+#define GPIOA_BASE (AHB2PERIPH_BASE + 0x00000000UL)
+#define GPIOB_BASE (AHB2PERIPH_BASE + 0x00000400UL)
+#define GPIOC_BASE (AHB2PERIPH_BASE + 0x00000800UL)
+#define GPIOD_BASE (AHB2PERIPH_BASE + 0x00000C00UL)
+#define GPIOE_BASE (AHB2PERIPH_BASE + 0x00001000UL)
+#define GPIOF_BASE (AHB2PERIPH_BASE + 0x00001400UL)
+
+#define TIM6 ((TIM_TypeDef*)TIM6_BASE)
+#define TIM7 ((TIM_TypeDef*)TIM7_BASE)
+#define IWDG ((IWDG_TypeDef*)IWDG_BASE)
+#define CAN ((CAN_TypeDef*)CAN_BASE)
+#define SYSCFG ((SYSCFG_TypeDef*)SYSCFG_BASE)
+#define EXTI ((EXTI_TypeDef*)EXTI_BASE)
+#define USART1 ((USART_TypeDef*)USART1_BASE)
+#define RCC ((RCC_TypeDef*)RCC_BASE)
+#define FLASH ((FLASH_TypeDef*)FLASH_R_BASE)
+#define GPIOA ((GPIO_TypeDef*)GPIOA_BASE)
+#define GPIOB ((GPIO_TypeDef*)GPIOB_BASE)
+#define GPIOC ((GPIO_TypeDef*)GPIOC_BASE)
+#define GPIOD ((GPIO_TypeDef*)GPIOD_BASE)
+#define GPIOE ((GPIO_TypeDef*)GPIOE_BASE)
+#define GPIOF ((GPIO_TypeDef*)GPIOF_BASE)
+
+/* bxCAN */
+#define CAN_MCR_INRQ (1UL << 0)
+#define CAN_MCR_SLEEP (1UL << 1)
+#define CAN_MCR_TXFP (1UL << 2)
+#define CAN_MCR_RFLM (1UL << 3)
+#define CAN_MCR_NART (1UL << 4)
+#define CAN_MCR_AWUM (1UL << 5)
+#define CAN_MCR_ABOM (1UL << 6)
+#define CAN_MCR_TTCM (1UL << 7)
+#define CAN_MCR_RESET (1UL << 15)
+#define CAN_MCR_DBF (1UL << 16)
+
+#define CAN_MSR_INAK (1UL << 0)
+#define CAN_MSR_SLAK (1UL << 1)
+#define CAN_MSR_ERRI (1UL << 2)
+#define CAN_MSR_WKUI (1UL << 3)
+#define CAN_MSR_SLAKI (1UL << 4)
+#define CAN_MSR_TXM (1UL << 8)
+#define CAN_MSR_RXM (1UL << 9)
+#define CAN_MSR_SAMP (1UL << 10)
+#define CAN_MSR_RX (1UL << 11)
+
+#define CAN_TSR_RQCP0 (1UL << 0)
+#define CAN_TSR_TXOK0 (1UL << 1)
+#define CAN_TSR_ALST0 (1UL << 2)
+#define CAN_TSR_TERR0 (1UL << 3)
+#define CAN_TSR_ABRQ0 (1UL << 7)
+#define CAN_TSR_RQCP1 (1UL << 8)
+#define CAN_TSR_TXOK1 (1UL << 9)
+#define CAN_TSR_ALST1 (1UL << 10)
+#define CAN_TSR_TERR1 (1UL << 11)
+#define CAN_TSR_ABRQ1 (1UL << 15)
+#define CAN_TSR_RQCP2 (1UL << 16)
+#define CAN_TSR_TXOK2 (1UL << 17)
+#define CAN_TSR_ALST2 (1UL << 18)
+#define CAN_TSR_TERR2 (1UL << 19)
+#define CAN_TSR_ABRQ2 (1UL << 23)
+#define CAN_TSR_CODE_Pos 24U
+#define CAN_TSR_CODE (3UL << CAN_TSR_CODE_Pos)
+#define CAN_TSR_TME_Pos 26U
+#define CAN_TSR_TME (7UL << CAN_TSR_TME_Pos)
+#define CAN_TSR_TME0 (1UL << 26)
+#define CAN_TSR_TME1 (1UL << 27)
+#define CAN_TSR_TME2 (1UL << 28)
+#define CAN_TSR_LOW_Pos 29U
+
+#define CAN_RF0R_FMP0_Pos 0U
+#define CAN_RF0R_FMP0 (3UL << CAN_RF0R_FMP0_Pos)
+#define CAN_RF0R_FULL0 (1UL << 3)
+#define CAN_RF0R_FOVR0 (1UL << 4)
+#define CAN_RF0R_RFOM0 (1UL << 5)
+#define CAN_RF1R_FMP1_Pos 0U
+#define CAN_RF1R_FMP1 (3UL << CAN_RF1R_FMP1_Pos)
+#define CAN_RF1R_FULL1 (1UL << 3)
+#define CAN_RF1R_FOVR1 (1UL << 4)
+#define CAN_RF1R_RFOM1 (1UL << 5)
+
+#define CAN_IER_TMEIE (1UL << 0)
+#define CAN_IER_FMPIE0 (1UL << 1)
+#define CAN_IER_FFIE0 (1UL << 2)
+#define CAN_IER_FOVIE0 (1UL << 3)
+#define CAN_IER_FMPIE1 (1UL << 4)
+#define CAN_IER_FFIE1 (1UL << 5)
+#define CAN_IER_FOVIE1 (1UL << 6)
+#define CAN_IER_EWGIE (1UL << 8)
+#define CAN_IER_EPVIE (1UL << 9)
+#define CAN_IER_BOFIE (1UL << 10)
+#define CAN_IER_LECIE (1UL << 11)
+#define CAN_IER_ERRIE (1UL << 15)
+#define CAN_IER_WKUIE (1UL << 16)
+#define CAN_IER_SLKIE (1UL << 17)
+
+#define CAN_ESR_EWGF (1UL << 0)
+#define CAN_ESR_EPVF (1UL << 1)
+#define CAN_ESR_BOFF (1UL << 2)
+#define CAN_ESR_LEC_Pos 4U
+#define CAN_ESR_LEC (7UL << CAN_ESR_LEC_Pos)
+#define CAN_ESR_TEC_Pos 16U
+#define CAN_ESR_TEC (0xFFUL << CAN_ESR_TEC_Pos)
+#define CAN_ESR_REC_Pos 24U
+#define CAN_ESR_REC (0xFFUL << CAN_ESR_REC_Pos)
+
+#define CAN_BTR_BRP_Pos 0U
+#define CAN_BTR_BRP (0x3FFUL << CAN_BTR_BRP_Pos)
+#define CAN_BTR_TS1_Pos 16U
+#define CAN_BTR_TS1 (0xFUL << CAN_BTR_TS1_Pos)
+#define CAN_BTR_TS2_Pos 20U
+#define CAN_BTR_TS2 (0x7UL << CAN_BTR_TS2_Pos)
+#define CAN_BTR_SJW_Pos 24U
+#define CAN_BTR_SJW (0x3UL << CAN_BTR_SJW_Pos)
+#define CAN_BTR_LBKM (1UL << 30)
+#define CAN_BTR_SILM (1UL << 31)
+
+#define CAN_TI0R_TXRQ (1UL << 0)
+#define CAN_TI0R_RTR_Pos 1U
+#define CAN_TI0R_IDE_Pos 2U
+#define CAN_TI0R_EXID_Pos 3U
+#define CAN_TI0R_STID_Pos 21U
+#define CAN_TDT0R_DLC_Pos 0U
+#define CAN_TDT0R_TGT (1UL << 8)
+#define CAN_TDT0R_TIME_Pos 16U
+
+#define CAN_RI0R_RTR_Pos 1U
+#define CAN_RI0R_IDE_Pos 2U
+#define CAN_RI0R_EXID_Pos 3U
+#define CAN_RI0R_STID_Pos 21U
+#define CAN_RDT0R_DLC_Pos 0U
+#define CAN_RDT0R_FMI_Pos 8U
+#define CAN_RDT0R_TIME_Pos 16U
+
+#define CAN_FMR_FINIT (1UL << 0)
+#define CAN_FMR_CAN2SB_Pos 8U
+
+/* RCC */
+#define RCC_CR_HSION (1UL << 0)
+#define RCC_CR_HSIRDY (1UL << 1)
+#define RCC_CR_HSEON (1UL << 16)
+#define RCC_CR_HSERDY (1UL << 17)
+#define RCC_CR_PLLON (1UL << 24)
+#define RCC_CR_PLLRDY (1UL << 25)
+
+#define RCC_CFGR_SW_Pos 0U
+#define RCC_CFGR_SW (3UL << RCC_CFGR_SW_Pos)
+#define RCC_CFGR_SWS_Pos 2U
+#define RCC_CFGR_SWS (3UL << RCC_CFGR_SWS_Pos)
+#define RCC_CFGR_HPRE_Pos 4U
+#define RCC_CFGR_HPRE (0xFUL << RCC_CFGR_HPRE_Pos)
+#define RCC_CFGR_PPRE1_Pos 8U
+#define RCC_CFGR_PPRE1 (7UL << RCC_CFGR_PPRE1_Pos)
+#define RCC_CFGR_PPRE2_Pos 11U
+#define RCC_CFGR_PPRE2 (7UL << RCC_CFGR_PPRE2_Pos)
+#define RCC_CFGR_PLLSRC (1UL << 16)
+#define RCC_CFGR_PLLXTPRE (1UL << 17)
+#define RCC_CFGR_PLLMUL_Pos 18U
+#define RCC_CFGR_PLLMUL (0xFUL << RCC_CFGR_PLLMUL_Pos)
+
+#define RCC_AHBENR_GPIOAEN (1UL << 17)
+#define RCC_AHBENR_GPIOBEN (1UL << 18)
+#define RCC_AHBENR_GPIOCEN (1UL << 19)
+#define RCC_AHBENR_GPIODEN (1UL << 20)
+#define RCC_AHBENR_GPIOEEN (1UL << 21)
+#define RCC_AHBENR_GPIOFEN (1UL << 22)
+#define RCC_APB1ENR_TIM6EN (1UL << 4)
+#define RCC_APB1ENR_TIM7EN (1UL << 5)
+#define RCC_APB1ENR_CANEN (1UL << 25)
+#define RCC_APB1RSTR_CANRST (1UL << 25)
+#define RCC_APB2ENR_SYSCFGEN (1UL << 0)
+#define RCC_APB2ENR_USART1EN (1UL << 14)
+
+/* Flash interface */
+#define FLASH_ACR_LATENCY_Pos 0U
+#define FLASH_ACR_LATENCY (7UL << FLASH_ACR_LATENCY_Pos)
+#define FLASH_SR_BSY (1UL << 0)
+#define FLASH_SR_PGERR (1UL << 2)
+#define FLASH_SR_WRPERR (1UL << 4)
+#define FLASH_SR_EOP (1UL << 5)
+#define FLASH_CR_PG (1UL << 0)
+#define FLASH_CR_PER (1UL << 1)
+#define FLASH_CR_MER (1UL << 2)
+#define FLASH_CR_STRT (1UL << 6)
+#define FLASH_CR_LOCK (1UL << 7)
+
+/* USART */
+#define USART_CR1_UE (1UL << 0)
+#define USART_CR1_RE (1UL << 2)
+#define USART_CR1_TE (1UL << 3)
+#define USART_CR1_RXNEIE (1UL << 5)
+#define USART_CR3_DMAR (1UL << 6)
+#define USART_ISR_RXNE (1UL << 5)
+#define USART_ISR_TC (1UL << 6)
+#define USART_ISR_TXE (1UL << 7)
+
+/* Basic timers */
+#define TIM_CR1_CEN (1UL << 0)
+#define TIM_CR1_OPM (1UL << 3)
+#define TIM_DIER_UIE (1UL << 0)
+#define TIM_SR_UIF (1UL << 0)
+#define TIM_EGR_UG (1UL << 0)
+
+/* Core functions, implemented by the host model */
+void NVIC_EnableIRQ(IRQn_Type irqn);
+void NVIC_DisableIRQ(IRQn_Type irqn);
+uint32_t NVIC_GetEnableIRQ(IRQn_Type irqn);
+void NVIC_SetPendingIRQ(IRQn_Type irqn);
+void NVIC_ClearPendingIRQ(IRQn_Type irqn);
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irqn);
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority);
+uint32_t NVIC_GetPriority(IRQn_Type irqn);
+void NVIC_SystemReset(void);
+
+void __enable_irq(void);
+void __disable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __set_MSP(uint32_t top_of_stack);
+void __DSB(void);
+void __DMB(void);
+void __ISB(void);
+void __NOP(void);
+
+uint32_t SysTick_Config(uint32_t ticks);
+
+extern uint32_t SystemCoreClock;
+void SystemCoreClockUpdate(void);
+
+#ifdef __cplusplus
+}
+#endif
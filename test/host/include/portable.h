@@ -0,0 +1,9 @@
+/**
+ * @file portable.h
+ * @author Gabriel Heinzer
+ * @brief Host port of the FreeRTOS memory API, which is declared by @ref FreeRTOS.h.
+ */
+
+#pragma once
+
+#include <FreeRTOS.h>
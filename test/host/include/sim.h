@@ -0,0 +1,284 @@
+/**
+ * @file sim.h
+ * @author Gabriel Heinzer
+ * @brief Register-level model of the STM32F303 peripherals, used to run the library on the host.
+ *
+ * @section sim_overview Overview
+ * The peripheral register blocks of @ref knabberkiste_device.h are mapped at their real addresses
+ * without any access rights. Every access traps, the register image of the running node is loaded
+ * for a single instruction and the written registers are passed to the peripheral models. This way
+ * the HALs run unchanged, including their busy-waits and read-modify-write sequences.
+ *
+ * The model runs in simulated time. Several nodes, i.e. microcontrollers, can be simulated at the
+ * same time. Each node has its own peripherals, its own NVIC and its own FreeRTOS tasks, which run
+ * as coroutines. All the nodes are attached to a single simulated CAN bus, which arbitrates frames by
+ * their identifier and times them bit-accurately, including the stuff bits.
+ *
+ * @section sim_nodes Nodes
+ * A node runs its entry function in a task of priority 1, like the main function of a firmware which
+ * has started the scheduler. Several nodes linked into the same executable share the library's static
+ * data, so multi-node simulations load a copy of a shared library per node (see @ref sim_node_create).
+ *
+ * @section sim_time CPU time
+ * Code only consumes simulated time in fixed amounts: each register access, interrupt entry and
+ * FreeRTOS call costs a few cycles of the node's system clock, which is derived from its RCC
+ * registers. Plain computations are free, use @ref sim_busy_wait_cycles() to account for them.
+ * Interrupts are taken between register accesses and calls into the model. Loops which only poll
+ * RAM are detected after a while and served in slices of @ref SIM_SPIN_SLICE_NS.
+ *
+ * @section sim_limits Limitations
+ *  - The flash memory itself isn't modelled, the flash interface only has its registers.
+ *  - Pins in alternate function mode don't drive their nets, the CAN bus is modelled separately.
+ *  - The USART only transmits, which is printed to the console of the node.
+ *  - NVIC_SystemReset() and watchdog resets halt the node instead of restarting it.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Time */
+/// @brief Simulated time in nanoseconds.
+typedef uint64_t SIM_Time_t;
+
+#define SIM_NS(ns) ((SIM_Time_t)(ns))
+#define SIM_US(us) ((SIM_Time_t)(us) * 1000ULL)
+#define SIM_MS(ms) ((SIM_Time_t)(ms) * 1000000ULL)
+#define SIM_S(s) ((SIM_Time_t)(s) * 1000000000ULL)
+
+/// @brief Simulated time which is charged for every detected slice of a polling loop.
+#define SIM_SPIN_SLICE_NS SIM_US(20)
+
+/**
+ * @brief Gets the current simulated time. Inside a node, this includes the CPU time which the
+ * node has consumed since it was last scheduled.
+ */
+SIM_Time_t sim_now(void);
+
+/* Simulation */
+/**
+ * @brief Initializes the model. Maps the peripherals and installs the signal handlers. Must be
+ * called before creating any node.
+ */
+void sim_init(void);
+
+/**
+ * @brief Runs the simulation for the given amount of simulated time.
+ */
+void sim_run_for(SIM_Time_t duration);
+
+/**
+ * @brief Runs the simulation until @p condition returns true or until @p timeout has passed. The
+ * condition is checked between events.
+ *
+ * @return Whether the condition has been met.
+ */
+bool sim_run_until(bool (*condition)(void* context), void* context, SIM_Time_t timeout);
+
+/**
+ * @brief Makes the running @ref sim_run_for() or @ref sim_run_until() return after the current
+ * event. May be called from nodes.
+ */
+void sim_stop(void);
+
+/**
+ * @brief Prints the message with the current time and node and terminates the process with
+ * exit code 1.
+ */
+void sim_fail(const char* format, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+/**
+ * @brief Controls whether the console output of the nodes is printed, which is the default.
+ */
+void sim_set_console_echo(bool echo);
+
+/* Nodes */
+/// @brief Opaque type of a simulated node.
+typedef struct SIM_Node SIM_Node_t;
+
+/// @brief Entry function of a node, which runs in its first task.
+typedef void (*SIM_NodeEntry_t)(void* argument);
+
+/**
+ * @brief Creates a node, which starts running at the current time.
+ *
+ * @param name Name of the node, used in messages.
+ * @param entry Entry function of the node.
+ * @param argument Argument passed to @p entry.
+ * @param library Handle returned by ``dlopen()`` of the library containing the firmware of the
+ * node, whose interrupt handlers are used. Pass 0 to use the handlers of the executable.
+ */
+SIM_Node_t* sim_node_create(const char* name, SIM_NodeEntry_t entry, void* argument, void* library);
+
+/**
+ * @brief Gets the node whose code is running, or 0 outside of the nodes.
+ */
+SIM_Node_t* sim_node_current(void);
+
+/**
+ * @brief Gets the name of a node.
+ */
+const char* sim_node_name(const SIM_Node_t* node);
+
+/**
+ * @brief Checks if a node has been halted, e.g. by NVIC_SystemReset().
+ */
+bool sim_node_halted(const SIM_Node_t* node);
+
+/**
+ * @brief Gets the system clock frequency of a node, which is derived from its RCC registers.
+ */
+uint32_t sim_node_sysclk(const SIM_Node_t* node);
+
+/**
+ * @brief Gets the total number of interrupts which have been taken by a node.
+ */
+uint64_t sim_node_interrupt_count(const SIM_Node_t* node);
+
+/* CPU */
+/**
+ * @brief Spends CPU cycles on the current node, e.g. to model a computation or to replace a
+ * busy-wait loop. Interrupts are still taken while waiting.
+ */
+void sim_busy_wait_cycles(uint32_t cycles);
+
+/* CAN bus */
+/**
+ * @brief CAN frame as it appears on the simulated bus.
+ */
+typedef struct {
+    /// @brief Identifier, 11 or 29 bits.
+    uint32_t id;
+    /// @brief Whether the identifier is extended.
+    bool extended;
+    /// @brief Remote-transmission-request bit.
+    bool rtr;
+    /// @brief Data length code, 0-15.
+    uint8_t dlc;
+    /// @brief Data bytes, of which min(dlc, 8) are transmitted.
+    uint8_t data[8];
+} SIM_CANFrame_t;
+
+/**
+ * @brief Counters of the simulated CAN bus.
+ */
+typedef struct {
+    /// @brief Number of frames which have been transmitted successfully.
+    uint64_t frames;
+    /// @brief Number of frames which haven't been acknowledged.
+    uint64_t acknowledgement_errors;
+    /// @brief Number of times a transmitter lost the arbitration.
+    uint64_t arbitration_losses;
+    /// @brief Time during which the bus has been busy with frames or error frames.
+    SIM_Time_t busy_time;
+    /// @brief Time at which the counters have been reset.
+    SIM_Time_t since;
+} SIM_CANStatistics_t;
+
+/**
+ * @brief Callback for frames which have been transmitted on the bus.
+ *
+ * @param frame The frame.
+ * @param start Time of the start-of-frame bit.
+ * @param end Time after the end-of-frame field.
+ * @param context Context passed to @ref sim_can_add_listener().
+ */
+typedef void (*SIM_CANListener_t)(const SIM_CANFrame_t* frame, SIM_Time_t start, SIM_Time_t end, void* context);
+
+/// @brief Opaque type of a CAN controller which is driven by the test directly.
+typedef struct SIM_CANPeer SIM_CANPeer_t;
+
+/**
+ * @brief Sets the bitrate of the bus. Nodes whose bit timing doesn't match it fail the simulation
+ * once they start to communicate. The default is 1 Mbit/s.
+ */
+void sim_can_set_bitrate(uint32_t bitrate);
+
+/**
+ * @brief Gets the duration of a bit on the bus.
+ */
+SIM_Time_t sim_can_bit_time(void);
+
+/**
+ * @brief Gets the number of bits of a frame from the start-of-frame bit to the end-of-frame
+ * field, including the stuff bits.
+ */
+uint32_t sim_can_frame_bits(const SIM_CANFrame_t* frame);
+
+/**
+ * @brief Adds a callback for every frame which is transmitted successfully.
+ */
+void sim_can_add_listener(SIM_CANListener_t listener, void* context);
+
+/**
+ * @brief Gets the counters of the bus.
+ */
+SIM_CANStatistics_t sim_can_statistics(void);
+
+/**
+ * @brief Resets the counters of the bus.
+ */
+void sim_can_reset_statistics(void);
+
+/**
+ * @brief Creates a CAN controller on the bus which is driven directly, without any registers.
+ *
+ * @param acknowledge Whether the peer acknowledges the frames of the other controllers.
+ */
+SIM_CANPeer_t* sim_can_peer_create(bool acknowledge);
+
+/**
+ * @brief Queues a frame for transmission by the peer. The frames of a peer are transmitted in
+ * order and retransmitted until they are acknowledged.
+ */
+void sim_can_peer_transmit(SIM_CANPeer_t* peer, const SIM_CANFrame_t* frame);
+
+/**
+ * @brief Gets the number of frames which are still queued in the peer.
+ */
+size_t sim_can_peer_pending(const SIM_CANPeer_t* peer);
+
+/* GPIO */
+/// @brief Opaque type of an electrical connection between pins.
+typedef struct SIM_Net SIM_Net_t;
+
+/// @brief Level of a net which isn't driven externally.
+#define SIM_GPIO_RELEASED (-1)
+
+/**
+ * @brief Gets the net of a pin. Every pin starts out on a net of its own.
+ *
+ * @param node Node of the pin.
+ * @param port Index of the port, i.e. 0 for port A, 1 for port B, ...
+ * @param pin Number of the pin.
+ */
+SIM_Net_t* sim_gpio_net(SIM_Node_t* node, uint8_t port, uint8_t pin);
+
+/**
+ * @brief Connects two pins, merging their nets.
+ */
+void sim_gpio_connect(SIM_Node_t* node_a, uint8_t port_a, uint8_t pin_a, SIM_Node_t* node_b, uint8_t port_b, uint8_t pin_b);
+
+/**
+ * @brief Drives a net from outside of the nodes, e.g. to model a cable detection.
+ *
+ * @param net The net.
+ * @param level 0 or 1 to drive the net, @ref SIM_GPIO_RELEASED to release it.
+ */
+void sim_gpio_drive(SIM_Net_t* net, int level);
+
+/**
+ * @brief Gets the level of a net. A net which is neither driven nor pulled reads as 0, as do
+ * nets with both pull-up and pull-down resistors.
+ */
+bool sim_gpio_level(const SIM_Net_t* net);
+
+#ifdef __cplusplus
+}
+#endif
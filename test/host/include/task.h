@@ -0,0 +1,54 @@
+/**
+ * @file task.h
+ * @author Gabriel Heinzer
+ * @brief Host port of the FreeRTOS task API, see @ref FreeRTOS.h.
+ */
+
+#pragma once
+
+#include <FreeRTOS.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SIM_Task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* parameters);
+
+#define tskIDLE_PRIORITY ((UBaseType_t)0U)
+
+#define taskSCHEDULER_SUSPENDED ((BaseType_t)0)
+#define taskSCHEDULER_NOT_STARTED ((BaseType_t)1)
+#define taskSCHEDULER_RUNNING ((BaseType_t)2)
+
+#define taskYIELD() vTaskYield()
+
+BaseType_t xTaskCreate(
+    TaskFunction_t task_function,
+    const char* name,
+    uint16_t stack_depth,
+    void* parameters,
+    UBaseType_t priority,
+    TaskHandle_t* created_task
+);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskYield(void);
+
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+BaseType_t xTaskGetSchedulerState(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+char* pcTaskGetName(TaskHandle_t task);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higher_priority_task_woken);
+
+void* pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index);
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index, void* value);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,750 @@
+#include "sim_internal.h"
+#include <knabberkiste/util/bit_manipulation.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_CAN_PAGE_ADDRESS (CAN_BASE & ~(uintptr_t)(SIM_PAGE_SIZE - 1))
+#define SIM_CAN_OFFSET (CAN_BASE - SIM_CAN_PAGE_ADDRESS)
+#define SIM_CAN_REGISTER(member) (SIM_CAN_OFFSET + offsetof(CAN_TypeDef, member))
+
+#define SIM_CAN_FILTER_BANKS 14
+
+// Reset values of the registers
+#define SIM_CAN_MCR_RESET 0x00010002UL
+#define SIM_CAN_BTR_RESET 0x01230000UL
+#define SIM_CAN_FMR_RESET 0x2A1C0E01UL
+
+// Bits after the end of frame field before the next start of frame
+#define SIM_CAN_INTERMISSION_BITS 3
+// Error flag and error delimiter
+#define SIM_CAN_ERROR_FRAME_BITS (6 + 8)
+// Transmissions of error passive controllers are suspended for this many bits after an error
+#define SIM_CAN_SUSPEND_BITS 8
+// Acknowledge delimiter and end of frame, which follow the acknowledge slot
+#define SIM_CAN_AFTER_ACK_BITS (1 + 7)
+
+#define SIM_CAN_LEC_ACKNOWLEDGEMENT 3
+#define SIM_CAN_ERROR_WARNING_LIMIT 96
+#define SIM_CAN_ERROR_PASSIVE_LIMIT 128
+
+#define SIM_CAN_MAX_LISTENERS 8
+
+struct SIM_CANPeer {
+    SIM_CANController_t controller;
+    bool acknowledge;
+    SIM_CANFrame_t* queue;
+    size_t head;
+    size_t count;
+    size_t capacity;
+};
+
+typedef struct {
+    SIM_CANListener_t callback;
+    void* context;
+} SIM_CANListenerEntry_t;
+
+static uint32_t sim_can_bitrate = 1000000;
+static SIM_CANChannel_t sim_can_bus = { 0 };
+static SIM_CANController_t* sim_can_controllers = 0;
+static SIM_CANStatistics_t sim_can_bus_statistics = { 0 };
+static SIM_CANListenerEntry_t sim_can_listeners[SIM_CAN_MAX_LISTENERS];
+static size_t sim_can_listener_count = 0;
+static uint64_t sim_can_sequence = 0;
+
+static void sim_can_kick(SIM_CANChannel_t* channel, SIM_Time_t time);
+
+/* Frames */
+static uint16_t sim_can_crc(uint16_t crc, bool bit) {
+    bool next = bit ^ ((crc >> 14) & 1);
+    crc = (crc << 1) & 0x7FFF;
+    if(next) crc ^= 0x4599;
+    return crc;
+}
+
+uint32_t sim_can_frame_bits(const SIM_CANFrame_t* frame) {
+    // Collect the bits from the start of frame to the CRC, which are stuffed
+    bool bits[160];
+    size_t count = 0;
+    #define SIM_CAN_PUSH(value, width) \
+        for(int bit = (width) - 1; bit >= 0; bit--) bits[count++] = ((value) >> bit) & 1
+
+    SIM_CAN_PUSH(0, 1);
+    if(frame->extended) {
+        SIM_CAN_PUSH(frame->id >> 18, 11);
+        SIM_CAN_PUSH(1, 1); // SRR
+        SIM_CAN_PUSH(1, 1); // IDE
+        SIM_CAN_PUSH(frame->id & 0x3FFFF, 18);
+        SIM_CAN_PUSH(frame->rtr, 1);
+        SIM_CAN_PUSH(0, 2); // r1, r0
+    } else {
+        SIM_CAN_PUSH(frame->id, 11);
+        SIM_CAN_PUSH(frame->rtr, 1);
+        SIM_CAN_PUSH(0, 2); // IDE, r0
+    }
+    SIM_CAN_PUSH(frame->dlc, 4);
+
+    uint8_t data_bytes = frame->rtr ? 0 : (frame->dlc > 8 ? 8 : frame->dlc);
+    for(uint8_t i = 0; i < data_bytes; i++) {
+        SIM_CAN_PUSH(frame->data[i], 8);
+    }
+
+    uint16_t crc = 0;
+    for(size_t i = 0; i < count; i++) crc = sim_can_crc(crc, bits[i]);
+    SIM_CAN_PUSH(crc, 15);
+    #undef SIM_CAN_PUSH
+
+    // A stuff bit of the opposite level follows five equal bits, it starts the next run
+    uint32_t stuffed = 0;
+    int run = 0;
+    bool level = !bits[0];
+    for(size_t i = 0; i < count; i++) {
+        if(bits[i] == level) {
+            run++;
+        } else {
+            level = bits[i];
+            run = 1;
+        }
+        stuffed++;
+
+        if(run == 5) {
+            stuffed++;
+            level = !level;
+            run = 1;
+        }
+    }
+
+    // CRC delimiter, acknowledge slot, acknowledge delimiter and end of frame
+    return stuffed + 1 + 1 + SIM_CAN_AFTER_ACK_BITS;
+}
+
+static uint64_t sim_can_arbitration_key(const SIM_CANFrame_t* frame) {
+    // The fields in the order of the arbitration, dominant bits (0) win
+    if(frame->extended) {
+        return ((uint64_t)(frame->id >> 18) << 21) | (1ULL << 20) | (1ULL << 19) | ((uint64_t)(frame->id & 0x3FFFF) << 1) | frame->rtr;
+    }
+    return ((uint64_t)frame->id << 21) | ((uint64_t)frame->rtr << 20);
+}
+
+/* Controllers of the nodes */
+static CAN_TypeDef* sim_can_registers(SIM_Node_t* node) {
+    return (CAN_TypeDef*)sim_register(node, SIM_PAGE_CAN, SIM_CAN_OFFSET);
+}
+
+static bool sim_can_in_reset(const SIM_Node_t* node) {
+    RCC_TypeDef* rcc = (RCC_TypeDef*)&node->image[SIM_PAGE_RCC][0];
+    return !READ_MASK(rcc->APB1ENR, RCC_APB1ENR_CANEN) || READ_MASK(rcc->APB1RSTR, RCC_APB1RSTR_CANRST);
+}
+
+bool sim_can_clocked(const SIM_Node_t* node, uint32_t offset) {
+    return !sim_can_in_reset(node);
+}
+
+static bool sim_can_normal_mode(SIM_CANController_t* controller) {
+    if(controller->node == 0) return true;
+    if(sim_can_in_reset(controller->node)) return false;
+
+    CAN_TypeDef* can = sim_can_registers(controller->node);
+    return !READ_MASK(can->MCR, CAN_MCR_INRQ | CAN_MCR_SLEEP);
+}
+
+static bool sim_can_loopback(SIM_CANController_t* controller) {
+    return controller->node != 0 && READ_MASK(sim_can_registers(controller->node)->BTR, CAN_BTR_LBKM);
+}
+
+static bool sim_can_silent(SIM_CANController_t* controller) {
+    return controller->node != 0 && READ_MASK(sim_can_registers(controller->node)->BTR, CAN_BTR_SILM);
+}
+
+static SIM_CANChannel_t* sim_can_channel(SIM_CANController_t* controller) {
+    return sim_can_loopback(controller) ? &controller->loopback : &sim_can_bus;
+}
+
+static SIM_Time_t sim_can_node_bit_time(SIM_Node_t* node) {
+    CAN_TypeDef* can = sim_can_registers(node);
+    uint64_t prescaler = READ_MASK_OFFSET(can->BTR, 0x3FF, CAN_BTR_BRP_Pos) + 1;
+    uint64_t quanta = 1 + (READ_MASK_OFFSET(can->BTR, 0xF, CAN_BTR_TS1_Pos) + 1) + (READ_MASK_OFFSET(can->BTR, 0x7, CAN_BTR_TS2_Pos) + 1);
+    return prescaler * quanta * SIM_S(1) / sim_rcc_pclk1(node);
+}
+
+static void sim_can_check_bit_time(SIM_CANController_t* controller) {
+    if(controller->node == 0) return;
+
+    SIM_Time_t bus = sim_can_bit_time();
+    SIM_Time_t node = sim_can_node_bit_time(controller->node);
+    SIM_Time_t difference = node > bus ? node - bus : bus - node;
+    if(difference * 100 > bus) {
+        sim_fail("%s: The bit time of the CAN controller is %llu ns, the bus has %llu ns.",
+            controller->node->name, (unsigned long long)node, (unsigned long long)bus);
+    }
+}
+
+static SIM_CANFrame_t sim_can_mailbox_frame(SIM_CANController_t* controller, int mailbox) {
+    SIM_CANFrame_t frame = { 0 };
+
+    if(controller->peer != 0) {
+        return controller->peer->queue[controller->peer->head];
+    }
+
+    CAN_TxMailBox_TypeDef* registers = &sim_can_registers(controller->node)->sTxMailBox[mailbox];
+    frame.extended = READ_BIT(registers->TIR, CAN_TI0R_IDE_Pos);
+    frame.rtr = READ_BIT(registers->TIR, CAN_TI0R_RTR_Pos);
+    frame.id = frame.extended ? READ_MASK_OFFSET(registers->TIR, 0x1FFFFFFFUL, CAN_TI0R_EXID_Pos) : READ_MASK_OFFSET(registers->TIR, 0x7FF, CAN_TI0R_STID_Pos);
+    frame.dlc = READ_MASK_OFFSET(registers->TDTR, 0xF, CAN_TDT0R_DLC_Pos);
+
+    uint32_t data[2] = { registers->TDLR, registers->TDHR };
+    memcpy(frame.data, data, sizeof(frame.data));
+    return frame;
+}
+
+static void sim_can_render(SIM_CANController_t* controller) {
+    SIM_Node_t* node = controller->node;
+    if(node == 0) return;
+    CAN_TypeDef* can = sim_can_registers(node);
+
+    // Master status
+    uint32_t msr = CAN_MSR_RX;
+    if(READ_MASK(can->MCR, CAN_MCR_INRQ)) {
+        msr |= CAN_MSR_INAK;
+    } else if(READ_MASK(can->MCR, CAN_MCR_SLEEP)) {
+        msr |= CAN_MSR_SLAK;
+    }
+    if(controller->error_interrupt) msr |= CAN_MSR_ERRI;
+    can->MSR = msr;
+
+    // Transmit status, CODE is the next empty mailbox or the pending one with the lowest priority
+    uint32_t tsr = controller->tx_status;
+    int code = -1;
+    int lowest = -1;
+    int pending = 0;
+    for(int mailbox = 0; mailbox < SIM_CAN_MAILBOXES; mailbox++) {
+        if(!controller->pending[mailbox]) {
+            tsr |= CAN_TSR_TME0 << mailbox;
+            if(code < 0) code = mailbox;
+            CLEAR_MASK(can->sTxMailBox[mailbox].TIR, CAN_TI0R_TXRQ);
+            continue;
+        }
+
+        pending++;
+        if(lowest < 0 || controller->sequence[mailbox] > controller->sequence[lowest]) lowest = mailbox;
+    }
+    if(code < 0) code = lowest;
+    if(pending > 1) tsr |= 1UL << (CAN_TSR_LOW_Pos + lowest);
+    can->TSR = tsr | ((uint32_t)code << CAN_TSR_CODE_Pos);
+
+    // Receive FIFOs, the output mailbox shows the oldest frame
+    volatile uint32_t* rfr[2] = { &can->RF0R, &can->RF1R };
+    for(int fifo = 0; fifo < 2; fifo++) {
+        *rfr[fifo] =
+            ((uint32_t)controller->fifo_count[fifo] << CAN_RF0R_FMP0_Pos) |
+            (controller->fifo_full[fifo] ? CAN_RF0R_FULL0 : 0) |
+            (controller->fifo_overrun[fifo] ? CAN_RF0R_FOVR0 : 0);
+        if(controller->fifo_count[fifo] == 0) continue;
+
+        const SIM_CANReceived_t* received = &controller->fifo[fifo][0];
+        const SIM_CANFrame_t* frame = &received->frame;
+        CAN_FIFOMailBox_TypeDef* mailbox = &can->sFIFOMailBox[fifo];
+        mailbox->RIR =
+            (frame->extended ? frame->id << CAN_RI0R_EXID_Pos : frame->id << CAN_RI0R_STID_Pos) |
+            ((uint32_t)frame->extended << CAN_RI0R_IDE_Pos) |
+            ((uint32_t)frame->rtr << CAN_RI0R_RTR_Pos);
+        mailbox->RDTR =
+            ((uint32_t)frame->dlc << CAN_RDT0R_DLC_Pos) |
+            ((uint32_t)received->filter_match << CAN_RDT0R_FMI_Pos) |
+            ((uint32_t)received->time << CAN_RDT0R_TIME_Pos);
+
+        uint32_t data[2];
+        memcpy(data, frame->data, sizeof(data));
+        mailbox->RDLR = data[0];
+        mailbox->RDHR = data[1];
+    }
+
+    // Error status
+    uint32_t esr = ((uint32_t)controller->lec << CAN_ESR_LEC_Pos) |
+        ((uint32_t)(controller->tec > 255 ? 255 : controller->tec) << CAN_ESR_TEC_Pos) |
+        ((uint32_t)(controller->rec > 255 ? 255 : controller->rec) << CAN_ESR_REC_Pos);
+    if(controller->tec >= SIM_CAN_ERROR_WARNING_LIMIT || controller->rec >= SIM_CAN_ERROR_WARNING_LIMIT) esr |= CAN_ESR_EWGF;
+    if(controller->tec >= SIM_CAN_ERROR_PASSIVE_LIMIT || controller->rec >= SIM_CAN_ERROR_PASSIVE_LIMIT) esr |= CAN_ESR_EPVF;
+    can->ESR = esr;
+
+    // Interrupt lines
+    uint32_t ier = can->IER;
+    bool completed = READ_MASK(controller->tx_status, CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2);
+    sim_irq_set_line(node, USB_HP_CAN_TX_IRQn, READ_MASK(ier, CAN_IER_TMEIE) && completed);
+    sim_irq_set_line(node, USB_LP_CAN_RX0_IRQn,
+        (READ_MASK(ier, CAN_IER_FMPIE0) && controller->fifo_count[0] > 0) ||
+        (READ_MASK(ier, CAN_IER_FFIE0) && controller->fifo_full[0]) ||
+        (READ_MASK(ier, CAN_IER_FOVIE0) && controller->fifo_overrun[0]));
+    sim_irq_set_line(node, CAN_RX1_IRQn,
+        (READ_MASK(ier, CAN_IER_FMPIE1) && controller->fifo_count[1] > 0) ||
+        (READ_MASK(ier, CAN_IER_FFIE1) && controller->fifo_full[1]) ||
+        (READ_MASK(ier, CAN_IER_FOVIE1) && controller->fifo_overrun[1]));
+    sim_irq_set_line(node, CAN_SCE_IRQn, READ_MASK(ier, CAN_IER_ERRIE) && controller->error_interrupt);
+}
+
+static void sim_can_set_error(SIM_CANController_t* controller, uint8_t lec, uint16_t tec) {
+    if(controller->node == 0) return;
+    uint32_t ier = sim_can_registers(controller->node)->IER;
+
+    // ERRI is set by the errors whose interrupts are enabled
+    bool warning = controller->tec < SIM_CAN_ERROR_WARNING_LIMIT && tec >= SIM_CAN_ERROR_WARNING_LIMIT;
+    bool passive = controller->tec < SIM_CAN_ERROR_PASSIVE_LIMIT && tec >= SIM_CAN_ERROR_PASSIVE_LIMIT;
+    if((lec != 0 && READ_MASK(ier, CAN_IER_LECIE)) ||
+        (warning && READ_MASK(ier, CAN_IER_EWGIE)) ||
+        (passive && READ_MASK(ier, CAN_IER_EPVIE))) {
+        controller->error_interrupt = true;
+    }
+
+    controller->lec = lec;
+    controller->tec = tec;
+}
+
+static void sim_can_controller_clear(SIM_CANController_t* controller) {
+    memset(controller->pending, 0, sizeof(controller->pending));
+    controller->transmitting = -1;
+    controller->tx_status = 0;
+    memset(controller->fifo_count, 0, sizeof(controller->fifo_count));
+    memset(controller->fifo_full, 0, sizeof(controller->fifo_full));
+    memset(controller->fifo_overrun, 0, sizeof(controller->fifo_overrun));
+    controller->error_interrupt = false;
+    controller->tec = 0;
+    controller->rec = 0;
+    controller->lec = 0;
+}
+
+static void sim_can_attach(SIM_CANController_t* controller) {
+    controller->transmitting = -1;
+    controller->loopback.transmitter = 0;
+
+    SIM_CANController_t** last = &sim_can_controllers;
+    while(*last != 0) last = &(*last)->next;
+    *last = controller;
+}
+
+void sim_can_reset(SIM_Node_t* node) {
+    SIM_CANController_t* controller = &node->can;
+    if(controller->node == 0) {
+        controller->node = node;
+        sim_can_attach(controller);
+    }
+
+    // A frame which is being transmitted completes, only its result is dropped
+    sim_can_controller_clear(controller);
+
+    memset(sim_register(node, SIM_PAGE_CAN, SIM_CAN_OFFSET), 0, sizeof(CAN_TypeDef));
+    CAN_TypeDef* can = sim_can_registers(node);
+    can->MCR = SIM_CAN_MCR_RESET;
+    can->BTR = SIM_CAN_BTR_RESET;
+    can->FMR = SIM_CAN_FMR_RESET;
+    sim_can_render(controller);
+}
+
+static void sim_can_request(SIM_CANController_t* controller, int mailbox) {
+    controller->pending[mailbox] = true;
+    controller->sequence[mailbox] = ++sim_can_sequence;
+    sim_can_kick(sim_can_channel(controller), sim_now());
+}
+
+static void sim_can_abort(SIM_CANController_t* controller, int mailbox) {
+    // A mailbox which is being transmitted completes its transmission first
+    if(!controller->pending[mailbox] || controller->transmitting == mailbox) return;
+
+    controller->pending[mailbox] = false;
+    controller->tx_status &= ~(0xFFUL << (8 * mailbox));
+    controller->tx_status |= CAN_TSR_RQCP0 << (8 * mailbox);
+}
+
+static void sim_can_release(SIM_CANController_t* controller, int fifo) {
+    if(controller->fifo_count[fifo] == 0) return;
+
+    controller->fifo_count[fifo]--;
+    memmove(&controller->fifo[fifo][0], &controller->fifo[fifo][1], controller->fifo_count[fifo] * sizeof(SIM_CANReceived_t));
+}
+
+void sim_can_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    SIM_CANController_t* controller = &node->can;
+    CAN_TypeDef* can = sim_can_registers(node);
+    uint32_t* word = sim_register(node, SIM_PAGE_CAN, offset);
+    bool filter_init = READ_MASK(can->FMR, CAN_FMR_FINIT);
+
+    if(offset == SIM_CAN_REGISTER(MCR)) {
+        if(READ_MASK(value, CAN_MCR_RESET)) {
+            sim_can_reset(node);
+            return;
+        }
+
+        // The mode changes are acknowledged immediately
+        bool was_normal = sim_can_normal_mode(controller);
+        can->MCR = value & 0x000100FF;
+        if(!was_normal && sim_can_normal_mode(controller)) sim_can_kick(sim_can_channel(controller), sim_now());
+    } else if(offset == SIM_CAN_REGISTER(MSR)) {
+        if(READ_MASK(value, CAN_MSR_ERRI)) controller->error_interrupt = false;
+    } else if(offset == SIM_CAN_REGISTER(TSR)) {
+        for(int mailbox = 0; mailbox < SIM_CAN_MAILBOXES; mailbox++) {
+            if(READ_BIT(value, 8 * mailbox)) controller->tx_status &= ~(0xFUL << (8 * mailbox));
+            if(READ_BIT(value, 8 * mailbox + 7)) sim_can_abort(controller, mailbox);
+        }
+    } else if(offset == SIM_CAN_REGISTER(RF0R) || offset == SIM_CAN_REGISTER(RF1R)) {
+        int fifo = offset == SIM_CAN_REGISTER(RF0R) ? 0 : 1;
+        if(READ_MASK(value, CAN_RF0R_FULL0)) controller->fifo_full[fifo] = false;
+        if(READ_MASK(value, CAN_RF0R_FOVR0)) controller->fifo_overrun[fifo] = false;
+        if(READ_MASK(value, CAN_RF0R_RFOM0)) sim_can_release(controller, fifo);
+    } else if(offset == SIM_CAN_REGISTER(IER)) {
+        can->IER = value & 0x00038F7F;
+    } else if(offset == SIM_CAN_REGISTER(ESR)) {
+        // Only the last error code is writable
+        controller->lec = READ_MASK_OFFSET(value, 0x7, CAN_ESR_LEC_Pos);
+    } else if(offset == SIM_CAN_REGISTER(BTR)) {
+        if(READ_MASK(can->MCR, CAN_MCR_INRQ)) can->BTR = value & 0xC37F03FF;
+    } else if(offset >= SIM_CAN_REGISTER(sTxMailBox) && offset < SIM_CAN_REGISTER(sFIFOMailBox)) {
+        int mailbox = (offset - SIM_CAN_REGISTER(sTxMailBox)) / sizeof(CAN_TxMailBox_TypeDef);
+
+        // The mailboxes are write protected while they are pending
+        if(controller->pending[mailbox]) return;
+        *word = value;
+        if(offset == SIM_CAN_REGISTER(sTxMailBox[mailbox].TIR) && READ_MASK(value, CAN_TI0R_TXRQ)) {
+            sim_can_request(controller, mailbox);
+        }
+    } else if(offset == SIM_CAN_REGISTER(FMR)) {
+        can->FMR = (value & 0x3F01) | (SIM_CAN_FMR_RESET & 0x2A1C0000);
+    } else if(offset == SIM_CAN_REGISTER(FM1R) || offset == SIM_CAN_REGISTER(FS1R) || offset == SIM_CAN_REGISTER(FFA1R)) {
+        if(filter_init) *word = value & ((1UL << SIM_CAN_FILTER_BANKS) - 1);
+    } else if(offset == SIM_CAN_REGISTER(FA1R)) {
+        *word = value & ((1UL << SIM_CAN_FILTER_BANKS) - 1);
+    } else if(offset >= SIM_CAN_REGISTER(sFilterRegister) && offset < SIM_CAN_REGISTER(sFilterRegister[SIM_CAN_FILTER_BANKS])) {
+        // A filter bank is writable while it is inactive or while the filters are initialized
+        int bank = (offset - SIM_CAN_REGISTER(sFilterRegister)) / sizeof(CAN_FilterRegister_TypeDef);
+        if(filter_init || !READ_BIT(can->FA1R, bank)) *word = value;
+    }
+
+    sim_can_render(controller);
+}
+
+/* Filters */
+static bool sim_can_filter_match(SIM_Node_t* node, const SIM_CANFrame_t* frame, int* fifo, uint8_t* filter_match) {
+    CAN_TypeDef* can = sim_can_registers(node);
+
+    uint32_t key32 = (frame->extended ? frame->id << 3 : frame->id << 21) | ((uint32_t)frame->extended << 2) | ((uint32_t)frame->rtr << 1);
+    uint32_t standard = frame->extended ? frame->id >> 18 : frame->id;
+    uint16_t key16 = (uint16_t)((standard << 5) | ((uint32_t)frame->rtr << 4) | ((uint32_t)frame->extended << 3) | (frame->extended ? (frame->id >> 15) & 0x7 : 0));
+
+    // Filter numbers count every bank of a FIFO, active or not
+    uint8_t numbers[2] = { 0, 0 };
+    int best_rank = 4;
+    int best_fifo = 0;
+    uint8_t best_number = 0;
+
+    for(int bank = 0; bank < SIM_CAN_FILTER_BANKS; bank++) {
+        int bank_fifo = READ_BIT(can->FFA1R, bank);
+        bool wide = READ_BIT(can->FS1R, bank);
+        bool list = READ_BIT(can->FM1R, bank);
+        uint32_t fr1 = can->sFilterRegister[bank].FR1;
+        uint32_t fr2 = can->sFilterRegister[bank].FR2;
+        uint8_t first = numbers[bank_fifo];
+        numbers[bank_fifo] += wide ? (list ? 2 : 1) : (list ? 4 : 2);
+
+        if(!READ_BIT(can->FA1R, bank)) continue;
+
+        // 32 bit filters take precedence over 16 bit ones, lists over masks
+        int rank = (wide ? 0 : 2) + (list ? 0 : 1);
+        int matched = -1;
+        if(wide && list) {
+            if((fr1 & ~1UL) == key32) matched = 0;
+            else if((fr2 & ~1UL) == key32) matched = 1;
+        } else if(wide) {
+            if(((fr1 ^ key32) & fr2 & ~1UL) == 0) matched = 0;
+        } else if(list) {
+            uint16_t ids[4] = { fr1 & 0xFFFF, fr1 >> 16, fr2 & 0xFFFF, fr2 >> 16 };
+            for(int i = 0; i < 4 && matched < 0; i++) {
+                if((ids[i] & ~7U) == (key16 & ~7U) && (ids[i] & 7U) == (key16 & 7U)) matched = i;
+            }
+        } else {
+            if(((fr1 ^ key16) & (fr1 >> 16) & 0xFFFF) == 0) matched = 0;
+            else if(((fr2 ^ key16) & (fr2 >> 16) & 0xFFFF) == 0) matched = 1;
+        }
+
+        if(matched >= 0 && rank < best_rank) {
+            best_rank = rank;
+            best_fifo = bank_fifo;
+            best_number = first + matched;
+        }
+    }
+
+    if(best_rank == 4) return false;
+    *fifo = best_fifo;
+    *filter_match = best_number;
+    return true;
+}
+
+static void sim_can_receive(SIM_CANController_t* controller, const SIM_CANFrame_t* frame, SIM_Time_t end) {
+    SIM_Node_t* node = controller->node;
+    if(node == 0) return;
+
+    if(controller->rec > 0) controller->rec--;
+    controller->lec = 0;
+
+    // The filters are inactive while they are initialized
+    CAN_TypeDef* can = sim_can_registers(node);
+    int fifo;
+    uint8_t filter_match;
+    if(READ_MASK(can->FMR, CAN_FMR_FINIT) || !sim_can_filter_match(node, frame, &fifo, &filter_match)) {
+        sim_can_render(controller);
+        return;
+    }
+
+    SIM_CANReceived_t received = {
+        .frame = *frame,
+        .filter_match = filter_match,
+        .time = (uint16_t)(end / sim_can_node_bit_time(node))
+    };
+
+    if(controller->fifo_count[fifo] < SIM_CAN_FIFO_DEPTH) {
+        controller->fifo[fifo][controller->fifo_count[fifo]++] = received;
+        if(controller->fifo_count[fifo] == SIM_CAN_FIFO_DEPTH) controller->fifo_full[fifo] = true;
+    } else {
+        // Locked FIFOs discard the new frame, otherwise it overwrites the last one
+        controller->fifo_overrun[fifo] = true;
+        if(!READ_MASK(can->MCR, CAN_MCR_RFLM)) controller->fifo[fifo][SIM_CAN_FIFO_DEPTH - 1] = received;
+    }
+
+    sim_can_render(controller);
+}
+
+/* Channels */
+static bool sim_can_member(SIM_CANChannel_t* channel, SIM_CANController_t* controller) {
+    if(!sim_can_normal_mode(controller)) return false;
+    return sim_can_channel(controller) == channel;
+}
+
+static SIM_CANController_t* sim_can_first(SIM_CANChannel_t* channel) {
+    // The loop back channel only has the controller which contains it
+    if(channel != &sim_can_bus) return (SIM_CANController_t*)((char*)channel - offsetof(SIM_CANController_t, loopback));
+    return sim_can_controllers;
+}
+
+static SIM_CANController_t* sim_can_next(SIM_CANChannel_t* channel, SIM_CANController_t* controller) {
+    return channel != &sim_can_bus ? 0 : controller->next;
+}
+
+#define sim_can_foreach(channel, controller) \
+    for(SIM_CANController_t* controller = sim_can_first(channel); controller != 0; controller = sim_can_next((channel), controller))
+
+static bool sim_can_transmitter(SIM_CANChannel_t* channel, SIM_CANController_t* controller) {
+    // Silent controllers only transmit to themselves
+    return sim_can_member(channel, controller) && (channel != &sim_can_bus || !sim_can_silent(controller));
+}
+
+static SIM_Time_t sim_can_channel_bit_time(SIM_CANChannel_t* channel) {
+    return channel != &sim_can_bus ? sim_can_node_bit_time(sim_can_first(channel)->node) : sim_can_bit_time();
+}
+
+static int sim_can_next_mailbox(SIM_CANController_t* controller) {
+    if(controller->peer != 0) return controller->peer->count > controller->peer->head ? 0 : -1;
+
+    // Request order (TXFP) or identifier order, equal identifiers go by mailbox number
+    bool request_order = READ_MASK(sim_can_registers(controller->node)->MCR, CAN_MCR_TXFP);
+    int selected = -1;
+    uint64_t selected_key = 0;
+    for(int mailbox = 0; mailbox < SIM_CAN_MAILBOXES; mailbox++) {
+        if(!controller->pending[mailbox]) continue;
+
+        uint64_t key = controller->sequence[mailbox];
+        if(!request_order) {
+            SIM_CANFrame_t frame = sim_can_mailbox_frame(controller, mailbox);
+            key = sim_can_arbitration_key(&frame);
+        }
+        if(selected < 0 || key < selected_key) {
+            selected = mailbox;
+            selected_key = key;
+        }
+    }
+    return selected;
+}
+
+static void sim_can_complete(void* context, uint64_t tag);
+
+static void sim_can_arbitrate(void* context, uint64_t tag) {
+    SIM_CANChannel_t* channel = context;
+    bool bus = channel == &sim_can_bus;
+    channel->arbitration_scheduled = false;
+    if(channel->transmitter != 0) return;
+
+    // Every controller with a pending frame starts to transmit, the lowest arbitration key wins
+    SIM_CANController_t* winner = 0;
+    int winner_mailbox = -1;
+    SIM_CANFrame_t winner_frame;
+    uint64_t winner_key = 0;
+
+    sim_can_foreach(channel, controller) {
+        if(!sim_can_transmitter(channel, controller)) continue;
+
+        int mailbox = sim_can_next_mailbox(controller);
+        if(mailbox < 0) continue;
+        if(bus) sim_can_check_bit_time(controller);
+
+        SIM_CANFrame_t frame = sim_can_mailbox_frame(controller, mailbox);
+        uint64_t key = sim_can_arbitration_key(&frame);
+        if(winner == 0 || key < winner_key) {
+            winner = controller;
+            winner_mailbox = mailbox;
+            winner_frame = frame;
+            winner_key = key;
+        }
+    }
+    if(winner == 0) return;
+
+    // The losers retry after this frame, unless automatic retransmission is disabled
+    sim_can_foreach(channel, controller) {
+        if(controller == winner || !sim_can_transmitter(channel, controller)) continue;
+
+        int mailbox = sim_can_next_mailbox(controller);
+        if(mailbox < 0) continue;
+        sim_can_bus_statistics.arbitration_losses++;
+        if(controller->node == 0) continue;
+
+        controller->tx_status |= CAN_TSR_ALST0 << (8 * mailbox);
+        if(READ_MASK(sim_can_registers(controller->node)->MCR, CAN_MCR_NART)) {
+            controller->pending[mailbox] = false;
+            controller->tx_status |= CAN_TSR_RQCP0 << (8 * mailbox);
+        }
+        sim_can_render(controller);
+    }
+
+    // The frame is acknowledged by any other controller which takes part in the bus, loop back ignores it
+    bool acknowledged = !bus;
+    sim_can_foreach(channel, controller) {
+        if(acknowledged) break;
+        if(controller == winner || !sim_can_member(channel, controller) || sim_can_silent(controller)) continue;
+        if(controller->peer != 0 && !controller->peer->acknowledge) continue;
+
+        sim_can_check_bit_time(controller);
+        acknowledged = true;
+    }
+
+    channel->transmitter = winner;
+    channel->mailbox = winner_mailbox;
+    channel->frame = winner_frame;
+    channel->acknowledged = acknowledged;
+    channel->start = sim_time;
+    winner->transmitting = winner_mailbox;
+
+    // An unacknowledged frame is cut short by an error frame after the acknowledge slot
+    uint32_t bits = sim_can_frame_bits(&winner_frame);
+    if(!acknowledged) bits = bits - SIM_CAN_AFTER_ACK_BITS + SIM_CAN_ERROR_FRAME_BITS;
+    sim_event_schedule(sim_time + bits * sim_can_channel_bit_time(channel), sim_can_complete, channel, 0);
+}
+
+static void sim_can_complete(void* context, uint64_t tag) {
+    SIM_CANChannel_t* channel = context;
+    SIM_CANController_t* transmitter = channel->transmitter;
+    int mailbox = channel->mailbox;
+    bool bus = channel == &sim_can_bus;
+    SIM_Time_t bit_time = sim_can_channel_bit_time(channel);
+
+    channel->transmitter = 0;
+    transmitter->transmitting = -1;
+    if(bus) sim_can_bus_statistics.busy_time += sim_time - channel->start;
+
+    SIM_Time_t idle_at = sim_time + SIM_CAN_INTERMISSION_BITS * bit_time;
+    if(channel->acknowledged) {
+        // The mailbox may have been reset in the meantime, the frame has been transmitted nonetheless
+        if(transmitter->peer != 0) {
+            transmitter->peer->head++;
+        } else if(transmitter->pending[mailbox]) {
+            transmitter->pending[mailbox] = false;
+            transmitter->tx_status |= (CAN_TSR_RQCP0 | CAN_TSR_TXOK0) << (8 * mailbox);
+            transmitter->tx_status &= ~((CAN_TSR_ALST0 | CAN_TSR_TERR0) << (8 * mailbox));
+        }
+        if(transmitter->tec > 0) transmitter->tec--;
+        transmitter->lec = 0;
+
+        if(bus) {
+            sim_can_bus_statistics.frames++;
+            sim_can_foreach(channel, controller) {
+                if(controller != transmitter && sim_can_member(channel, controller)) sim_can_receive(controller, &channel->frame, sim_time);
+            }
+            for(size_t i = 0; i < sim_can_listener_count; i++) {
+                sim_can_listeners[i].callback(&channel->frame, channel->start, sim_time, sim_can_listeners[i].context);
+            }
+        } else {
+            sim_can_receive(transmitter, &channel->frame, sim_time);
+        }
+    } else {
+        sim_can_bus_statistics.acknowledgement_errors++;
+
+        // Error passive transmitters don't count acknowledgement errors and suspend their next transmission
+        bool passive = transmitter->tec >= SIM_CAN_ERROR_PASSIVE_LIMIT;
+        if(passive) idle_at += SIM_CAN_SUSPEND_BITS * bit_time;
+        sim_can_set_error(transmitter, SIM_CAN_LEC_ACKNOWLEDGEMENT, passive ? transmitter->tec : transmitter->tec + 8);
+
+        if(transmitter->node != 0 && READ_MASK(sim_can_registers(transmitter->node)->MCR, CAN_MCR_NART) && transmitter->pending[mailbox]) {
+            transmitter->pending[mailbox] = false;
+            transmitter->tx_status |= (CAN_TSR_RQCP0 | CAN_TSR_TERR0) << (8 * mailbox);
+        }
+    }
+
+    sim_can_render(transmitter);
+    channel->idle_at = idle_at;
+    sim_can_kick(channel, idle_at);
+}
+
+static void sim_can_kick(SIM_CANChannel_t* channel, SIM_Time_t time) {
+    if(channel->arbitration_scheduled || channel->transmitter != 0) return;
+    if(time < channel->idle_at) time = channel->idle_at;
+
+    channel->arbitration_scheduled = true;
+    sim_event_schedule(time, sim_can_arbitrate, channel, 0);
+}
+
+/* Bus */
+void sim_can_set_bitrate(uint32_t bitrate) {
+    sim_can_bitrate = bitrate;
+}
+
+SIM_Time_t sim_can_bit_time(void) {
+    return SIM_S(1) / sim_can_bitrate;
+}
+
+void sim_can_add_listener(SIM_CANListener_t listener, void* context) {
+    if(sim_can_listener_count == SIM_CAN_MAX_LISTENERS) sim_fail("Too many CAN listeners.");
+    sim_can_listeners[sim_can_listener_count++] = (SIM_CANListenerEntry_t){ .callback = listener, .context = context };
+}
+
+SIM_CANStatistics_t sim_can_statistics(void) {
+    return sim_can_bus_statistics;
+}
+
+void sim_can_reset_statistics(void) {
+    sim_can_bus_statistics = (SIM_CANStatistics_t){ .since = sim_now() };
+}
+
+SIM_CANPeer_t* sim_can_peer_create(bool acknowledge) {
+    SIM_CANPeer_t* peer = calloc(1, sizeof(SIM_CANPeer_t));
+    if(peer == 0) sim_fail("Out of memory for a CAN peer.");
+
+    peer->acknowledge = acknowledge;
+    peer->controller.peer = peer;
+    sim_can_attach(&peer->controller);
+    return peer;
+}
+
+void sim_can_peer_transmit(SIM_CANPeer_t* peer, const SIM_CANFrame_t* frame) {
+    if(peer->count == peer->capacity) {
+        // Drop the transmitted frames before growing the queue
+        memmove(peer->queue, &peer->queue[peer->head], (peer->count - peer->head) * sizeof(SIM_CANFrame_t));
+        peer->count -= peer->head;
+        peer->head = 0;
+    }
+    if(peer->count == peer->capacity) {
+        peer->capacity = peer->capacity ? peer->capacity * 2 : 64;
+        peer->queue = realloc(peer->queue, peer->capacity * sizeof(SIM_CANFrame_t));
+        if(peer->queue == 0) sim_fail("Out of memory for the CAN peer queue.");
+    }
+
+    peer->queue[peer->count++] = *frame;
+    sim_can_kick(&sim_can_bus, sim_now());
+}
+
+size_t sim_can_peer_pending(const SIM_CANPeer_t* peer) {
+    return peer->count - peer->head;
+}
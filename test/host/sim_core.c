@@ -0,0 +1,638 @@
+#define _GNU_SOURCE
+#include "sim_internal.h"
+#include <dlfcn.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+// CPU cycles charged for the core operations
+#define SIM_CYCLES_REGISTER_ACCESS 4
+#define SIM_CYCLES_CORE_CALL 2
+#define SIM_CYCLES_EXCEPTION_ENTRY 12
+#define SIM_CYCLES_EXCEPTION_EXIT 10
+
+// A node keeps running until it has consumed this much CPU time
+#define SIM_QUANTUM SIM_US(2)
+
+// Polling loops are detected after this many profiling ticks without a safe point
+#define SIM_SPIN_TIMER_PERIOD_US 1000
+#define SIM_SPIN_TICKS 3
+
+#define SIM_EFLAGS_TRAP 0x100
+#define SIM_PAGE_FAULT_WRITE 0x2
+
+typedef struct {
+    SIM_Time_t time;
+    uint64_t order;
+    SIM_EventCallback_t callback;
+    void* context;
+    uint64_t tag;
+} SIM_Event_t;
+
+SIM_Node_t* sim_current = 0;
+SIM_Time_t sim_time = 0;
+
+static bool sim_initialized = false;
+static ucontext_t sim_scheduler_context;
+static volatile bool sim_stop_requested = false;
+static size_t sim_node_count = 0;
+
+// Event queue, a binary min-heap ordered by time and insertion order
+static SIM_Event_t* sim_events = 0;
+static size_t sim_event_count = 0;
+static size_t sim_event_capacity = 0;
+static uint64_t sim_event_order = 0;
+
+// Nesting of model code, node code runs at depth 0
+volatile sig_atomic_t sim_model_depth = 1;
+
+// Access which is currently being single-stepped
+static volatile sig_atomic_t sim_stepping = 0;
+static SIM_Node_t* sim_step_node;
+static SIM_Page_t sim_step_page;
+static uint32_t sim_step_word;
+static bool sim_step_write;
+static bool sim_step_clocked;
+
+// Polling loop detection
+static SIM_Node_t* sim_spin_node = 0;
+static uint64_t sim_spin_progress = 0;
+static int sim_spin_ticks = 0;
+
+static const char* const sim_irq_names[SIM_IRQ_COUNT] = {
+    [EXTI0_IRQn] = "EXTI0_IRQHandler",
+    [EXTI1_IRQn] = "EXTI1_IRQHandler",
+    [EXTI2_TSC_IRQn] = "EXTI2_TSC_IRQHandler",
+    [EXTI3_IRQn] = "EXTI3_IRQHandler",
+    [EXTI4_IRQn] = "EXTI4_IRQHandler",
+    [USB_HP_CAN_TX_IRQn] = "USB_HP_CAN_TX_IRQHandler",
+    [USB_LP_CAN_RX0_IRQn] = "USB_LP_CAN_RX0_IRQHandler",
+    [CAN_RX1_IRQn] = "CAN_RX1_IRQHandler",
+    [CAN_SCE_IRQn] = "CAN_SCE_IRQHandler",
+    [EXTI9_5_IRQn] = "EXTI9_5_IRQHandler",
+    [USART1_IRQn] = "USART1_IRQHandler",
+    [EXTI15_10_IRQn] = "EXTI15_10_IRQHandler",
+    [TIM6_DAC_IRQn] = "TIM6_DAC_IRQHandler",
+    [TIM7_IRQn] = "TIM7_IRQHandler",
+};
+
+static void sim_irq_dispatch(SIM_Node_t* node);
+
+/* Events */
+static bool sim_event_before(const SIM_Event_t* a, const SIM_Event_t* b) {
+    return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+
+void sim_event_schedule(SIM_Time_t time, SIM_EventCallback_t callback, void* context, uint64_t tag) {
+    if(time < sim_time) time = sim_time;
+
+    if(sim_event_count == sim_event_capacity) {
+        sim_event_capacity = sim_event_capacity ? sim_event_capacity * 2 : 256;
+        sim_events = realloc(sim_events, sim_event_capacity * sizeof(SIM_Event_t));
+        if(sim_events == 0) sim_fail("Out of memory for events.");
+    }
+
+    // Sift the new event up
+    size_t index = sim_event_count++;
+    SIM_Event_t event = { .time = time, .order = sim_event_order++, .callback = callback, .context = context, .tag = tag };
+    while(index > 0) {
+        size_t parent = (index - 1) / 2;
+        if(!sim_event_before(&event, &sim_events[parent])) break;
+        sim_events[index] = sim_events[parent];
+        index = parent;
+    }
+    sim_events[index] = event;
+}
+
+static SIM_Event_t sim_event_pop(void) {
+    SIM_Event_t top = sim_events[0];
+    SIM_Event_t last = sim_events[--sim_event_count];
+
+    // Sift the last event down from the root
+    size_t index = 0;
+    while(true) {
+        size_t child = index * 2 + 1;
+        if(child >= sim_event_count) break;
+        if(child + 1 < sim_event_count && sim_event_before(&sim_events[child + 1], &sim_events[child])) child++;
+        if(!sim_event_before(&sim_events[child], &last)) break;
+        sim_events[index] = sim_events[child];
+        index = child;
+    }
+    if(sim_event_count > 0) sim_events[index] = last;
+
+    return top;
+}
+
+/* Simulation */
+SIM_Time_t sim_now(void) {
+    return sim_current != 0 ? sim_time + sim_current->debt : sim_time;
+}
+
+void sim_fail(const char* format, ...) {
+    fflush(stdout);
+    fprintf(stderr, "[%12.3f us] ", sim_now() / 1000.0);
+    if(sim_current != 0) fprintf(stderr, "%s: ", sim_current->name);
+
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(stderr, format, arguments);
+    va_end(arguments);
+
+    fputc('\n', stderr);
+    exit(1);
+}
+
+void sim_stop(void) {
+    sim_stop_requested = true;
+}
+
+static bool sim_run_step(SIM_Time_t end) {
+    if(sim_event_count == 0 || sim_events[0].time > end) return false;
+
+    SIM_Event_t event = sim_event_pop();
+    sim_time = event.time;
+    event.callback(event.context, event.tag);
+    return true;
+}
+
+void sim_run_for(SIM_Time_t duration) {
+    SIM_Time_t end = sim_time + duration;
+
+    sim_stop_requested = false;
+    while(!sim_stop_requested && sim_run_step(end));
+    if(!sim_stop_requested && sim_time < end) sim_time = end;
+}
+
+bool sim_run_until(bool (*condition)(void* context), void* context, SIM_Time_t timeout) {
+    SIM_Time_t end = sim_time + timeout;
+
+    sim_stop_requested = false;
+    while(!condition(context)) {
+        if(sim_stop_requested || !sim_run_step(end)) return condition(context);
+    }
+    return true;
+}
+
+/* Register traps */
+static const SIM_PageModel_t* sim_page_find(uintptr_t address, SIM_Page_t* page) {
+    for(size_t i = 0; i < SIM_PAGE_COUNT; i++) {
+        if(address - sim_page_models[i].address < SIM_PAGE_SIZE) {
+            *page = (SIM_Page_t)i;
+            return &sim_page_models[i];
+        }
+    }
+    return 0;
+}
+
+static void sim_access_handler(int signal_number, siginfo_t* info, void* context) {
+    ucontext_t* user_context = context;
+    uintptr_t address = (uintptr_t)info->si_addr;
+    SIM_Page_t page;
+    const SIM_PageModel_t* model = sim_page_find(address, &page);
+
+    if(model == 0 || sim_stepping) {
+        // Not a register access, let the default action crash the process
+        fprintf(stderr, "Segmentation fault at %p%s\n", info->si_addr, sim_stepping ? " while accessing a register" : "");
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    SIM_Node_t* node = sim_current;
+    if(node == 0) sim_fail("Access to %s at %p outside of a node.", model->name, info->si_addr);
+
+    uint32_t offset = (uint32_t)(address - model->address) & ~3U;
+    sim_step_clocked = model->clocked == 0 || model->clocked(node, offset);
+    if(sim_step_clocked && model->refresh != 0) model->refresh(node, offset);
+
+    // Load the register image of the node for a single instruction
+    void* base = (void*)model->address;
+    mprotect(base, SIM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+    if(sim_step_clocked) {
+        memcpy(base, node->image[page], SIM_PAGE_SIZE);
+    } else {
+        memset(base, 0, SIM_PAGE_SIZE);
+    }
+
+    sim_step_node = node;
+    sim_step_page = page;
+    sim_step_word = offset / 4;
+    sim_step_write = (user_context->uc_mcontext.gregs[REG_ERR] & SIM_PAGE_FAULT_WRITE) != 0;
+    sim_stepping = 1;
+    user_context->uc_mcontext.gregs[REG_EFL] |= SIM_EFLAGS_TRAP;
+}
+
+static void sim_step_handler(int signal_number, siginfo_t* info, void* context) {
+    ucontext_t* user_context = context;
+    if(!sim_stepping) return;
+
+    SIM_MODEL_BEGIN();
+    user_context->uc_mcontext.gregs[REG_EFL] &= ~SIM_EFLAGS_TRAP;
+
+    SIM_Node_t* node = sim_step_node;
+    const SIM_PageModel_t* model = &sim_page_models[sim_step_page];
+    uint32_t* page = (uint32_t*)model->address;
+    uint32_t* image = node->image[sim_step_page];
+
+    // Vector instructions may write several words, so the whole page is compared with the image. The
+    // image is copied as well, because the models update other registers while handling a write.
+    static uint32_t values[SIM_PAGE_WORDS];
+    static uint32_t previous[SIM_PAGE_WORDS];
+    memcpy(values, page, SIM_PAGE_SIZE);
+    memcpy(previous, image, SIM_PAGE_SIZE);
+    mprotect(page, SIM_PAGE_SIZE, PROT_NONE);
+    sim_stepping = 0;
+
+    // Writing a register with its current value still has side effects, e.g. for flags cleared by writing 1
+    for(uint32_t word = 0; word < SIM_PAGE_WORDS && sim_step_clocked; word++) {
+        if(values[word] == previous[word] && !(sim_step_write && word == sim_step_word)) continue;
+
+        if(model->write != 0) {
+            model->write(node, word * 4, values[word]);
+        } else {
+            image[word] = values[word];
+        }
+    }
+
+    sim_node_charge(node, SIM_CYCLES_REGISTER_ACCESS);
+    sim_safepoint();
+    SIM_MODEL_END();
+}
+
+static void sim_spin_handler(int signal_number, siginfo_t* info, void* context) {
+    SIM_Node_t* node = sim_current;
+    if(node == 0 || sim_model_depth != 0 || sim_stepping) {
+        sim_spin_ticks = 0;
+        return;
+    }
+
+    if(node != sim_spin_node || node->progress != sim_spin_progress) {
+        sim_spin_node = node;
+        sim_spin_progress = node->progress;
+        sim_spin_ticks = 0;
+        return;
+    }
+
+    // The node polls RAM without reaching a safe point, serve it a slice of time
+    if(++sim_spin_ticks < SIM_SPIN_TICKS) return;
+    sim_spin_ticks = 0;
+
+    sim_model_depth = 1;
+    node->debt += SIM_SPIN_SLICE_NS;
+    sim_safepoint();
+    sim_model_depth = 0;
+}
+
+void sim_init(void) {
+    if(sim_initialized) return;
+    sim_initialized = true;
+
+    for(size_t i = 0; i < SIM_PAGE_COUNT; i++) {
+        void* address = (void*)sim_page_models[i].address;
+        void* mapped = mmap(address, SIM_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if(mapped != address) sim_fail("Can't map %s at %p.", sim_page_models[i].name, address);
+    }
+
+    struct sigaction action = { 0 };
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    action.sa_sigaction = sim_access_handler;
+    sigaction(SIGSEGV, &action, 0);
+    action.sa_sigaction = sim_step_handler;
+    sigaction(SIGTRAP, &action, 0);
+
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    action.sa_sigaction = sim_spin_handler;
+    sigaction(SIGPROF, &action, 0);
+
+    struct itimerval timer = {
+        .it_interval = { .tv_sec = 0, .tv_usec = SIM_SPIN_TIMER_PERIOD_US },
+        .it_value = { .tv_sec = 0, .tv_usec = SIM_SPIN_TIMER_PERIOD_US }
+    };
+    setitimer(ITIMER_PROF, &timer, 0);
+}
+
+uint32_t* sim_register(SIM_Node_t* node, SIM_Page_t page, uint32_t offset) {
+    return &node->image[page][offset / 4];
+}
+
+/* Nodes */
+static void sim_node_resume_event(void* context, uint64_t tag) {
+    SIM_Node_t* node = context;
+    if(node->state != SIM_NODE_SCHEDULED || tag != node->resume_generation) return;
+
+    sim_enter_node(node);
+}
+
+void sim_enter_node(SIM_Node_t* node) {
+    node->state = SIM_NODE_RUNNING;
+    sim_current = node;
+    swapcontext(&sim_scheduler_context, &node->current->context);
+    sim_current = 0;
+    sim_model_depth = 1;
+}
+
+SIM_Node_t* sim_node_create(const char* name, SIM_NodeEntry_t entry, void* argument, void* library) {
+    if(!sim_initialized) sim_fail("sim_init() must be called before creating nodes.");
+
+    SIM_Node_t* node = calloc(1, sizeof(SIM_Node_t));
+    if(node == 0) sim_fail("Out of memory for node %s.", name);
+
+    snprintf(node->name, sizeof(node->name), "%s", name);
+    node->index = sim_node_count++;
+    node->library = library;
+    node->start_time = sim_time;
+    node->entry = entry;
+    node->entry_argument = argument;
+
+    for(size_t irq = 0; irq < SIM_IRQ_COUNT; irq++) {
+        if(sim_irq_names[irq] == 0) continue;
+        node->irq_handler[irq] = (void (*)(void))dlsym(library != 0 ? library : RTLD_DEFAULT, sim_irq_names[irq]);
+    }
+
+    sim_periph_reset(node);
+    sim_can_reset(node);
+    sim_gpio_node_init(node);
+    sim_rtos_node_start(node);
+
+    node->state = SIM_NODE_SCHEDULED;
+    sim_event_schedule(sim_time, sim_node_resume_event, node, ++node->resume_generation);
+    return node;
+}
+
+SIM_Node_t* sim_node_current(void) { return sim_current; }
+
+const char* sim_node_name(const SIM_Node_t* node) { return node->name; }
+
+bool sim_node_halted(const SIM_Node_t* node) { return node->state == SIM_NODE_HALTED; }
+
+uint32_t sim_node_sysclk(const SIM_Node_t* node) { return sim_rcc_hclk(node); }
+
+uint64_t sim_node_interrupt_count(const SIM_Node_t* node) { return node->interrupt_count; }
+
+SIM_Node_t* sim_require_node(const char* function) {
+    if(sim_current == 0) sim_fail("%s() called outside of a node.", function);
+    return sim_current;
+}
+
+void sim_node_charge(SIM_Node_t* node, uint32_t cycles) {
+    // The remainder keeps the rounding errors from adding up
+    uint64_t frequency = sim_rcc_hclk(node);
+    uint64_t scaled = (uint64_t)cycles * 1000000000ULL + node->cycle_remainder;
+    node->debt += scaled / frequency;
+    node->cycle_remainder = scaled % frequency;
+}
+
+void sim_node_wake(SIM_Node_t* node) {
+    if(node->state != SIM_NODE_IDLE) return;
+
+    node->state = SIM_NODE_SCHEDULED;
+    sim_event_schedule(sim_now(), sim_node_resume_event, node, ++node->resume_generation);
+}
+
+void sim_node_suspend(SIM_Time_t duration) {
+    SIM_Node_t* node = sim_current;
+    SIM_Time_t resume_time = sim_time + node->debt + duration;
+    node->debt = 0;
+
+    node->state = SIM_NODE_SCHEDULED;
+    sim_event_schedule(resume_time, sim_node_resume_event, node, ++node->resume_generation);
+    swapcontext(&node->current->context, &sim_scheduler_context);
+}
+
+void sim_node_idle(void) {
+    SIM_Node_t* node = sim_current;
+
+    // Pay for the CPU time before sleeping, the interrupts which are pending by then wake the node right away
+    if(node->debt > 0) sim_node_suspend(0);
+
+    node->state = SIM_NODE_IDLE;
+    for(size_t irq = 0; irq < SIM_IRQ_COUNT; irq++) {
+        if(node->irq_pending[irq] && node->irq_enabled[irq]) node->state = SIM_NODE_SCHEDULED;
+    }
+    if(node->switch_pending) node->state = SIM_NODE_SCHEDULED;
+
+    if(node->state == SIM_NODE_SCHEDULED) {
+        sim_event_schedule(sim_time, sim_node_resume_event, node, ++node->resume_generation);
+    }
+    swapcontext(&node->current->context, &sim_scheduler_context);
+}
+
+void sim_node_halt(SIM_Node_t* node, const char* reason) {
+    fflush(stdout);
+    fprintf(stderr, "[%12.3f us] %s: Halted, %s.\n", sim_now() / 1000.0, node->name, reason);
+    sim_console_flush(node);
+    node->state = SIM_NODE_HALTED;
+
+    // A halted node never runs again
+    if(node == sim_current) swapcontext(&node->current->context, &sim_scheduler_context);
+}
+
+void sim_safepoint(void) {
+    SIM_Node_t* node = sim_current;
+    node->progress++;
+
+    if(node->debt >= SIM_QUANTUM) sim_node_suspend(0);
+    sim_irq_dispatch(node);
+    sim_rtos_run_next(node);
+
+    // Context switches are pended until all interrupts have returned
+    if(node->switch_pending && node->active_count == 0 && !node->primask) {
+        sim_rtos_schedule(node);
+    }
+}
+
+void sim_busy_wait_cycles(uint32_t cycles) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    SIM_MODEL_BEGIN();
+
+    // Wait in slices, so interrupts are taken in between
+    uint32_t slice = (uint32_t)((uint64_t)sim_rcc_hclk(node) * SIM_QUANTUM / 1000000000ULL);
+    if(slice == 0) slice = 1;
+    while(cycles > 0) {
+        uint32_t spent = cycles < slice ? cycles : slice;
+        sim_node_charge(node, spent);
+        sim_safepoint();
+        cycles -= spent;
+    }
+
+    SIM_MODEL_END();
+}
+
+/* Interrupts */
+int sim_execution_priority(const SIM_Node_t* node) {
+    int priority = SIM_PRIORITY_THREAD;
+    for(size_t i = 0; i < node->active_count; i++) {
+        if(node->irq_priority[node->active[i]] < priority) priority = node->irq_priority[node->active[i]];
+    }
+    return priority;
+}
+
+static void sim_irq_dispatch(SIM_Node_t* node) {
+    while(!node->primask && node->state != SIM_NODE_HALTED) {
+        // The pending interrupt with the highest priority preempts, ties are taken by the lowest number
+        int priority = sim_execution_priority(node);
+        int selected = -1;
+        for(int irq = 0; irq < SIM_IRQ_COUNT; irq++) {
+            if(!node->irq_pending[irq] || !node->irq_enabled[irq] || node->irq_priority[irq] >= priority) continue;
+            if(selected < 0 || node->irq_priority[irq] < node->irq_priority[selected]) selected = irq;
+        }
+        if(selected < 0) break;
+
+        void (*handler)(void) = node->irq_handler[selected];
+        if(handler == 0) sim_fail("No handler for the enabled interrupt %d.", selected);
+
+        node->irq_pending[selected] = false;
+        node->active[node->active_count++] = (int16_t)selected;
+        node->interrupt_count++;
+        sim_node_charge(node, SIM_CYCLES_EXCEPTION_ENTRY);
+
+        sig_atomic_t depth = sim_model_depth;
+        sim_model_depth = 0;
+        handler();
+        sim_model_depth = depth;
+
+        sim_node_charge(node, SIM_CYCLES_EXCEPTION_EXIT);
+        node->active_count--;
+
+        // Level-triggered lines pend their interrupt again if they are still active
+        if(node->irq_line[selected]) node->irq_pending[selected] = true;
+    }
+}
+
+void sim_irq_set_line(SIM_Node_t* node, IRQn_Type irqn, bool level) {
+    if(irqn < 0 || irqn >= SIM_IRQ_COUNT) return;
+
+    bool rising = level && !node->irq_line[irqn];
+    node->irq_line[irqn] = level;
+    if(!rising) return;
+
+    node->irq_pending[irqn] = true;
+    if(node->irq_enabled[irqn]) sim_node_wake(node);
+}
+
+/* Core functions of CMSIS */
+#define SIM_CORE_BEGIN(node) \
+    SIM_Node_t* node = sim_require_node(__func__); \
+    SIM_MODEL_BEGIN()
+
+#define SIM_CORE_END() SIM_MODEL_END()
+
+static void sim_check_irqn(IRQn_Type irqn) {
+    if(irqn < 0 || irqn >= SIM_IRQ_COUNT) sim_fail("Invalid interrupt number %d.", irqn);
+}
+
+void NVIC_EnableIRQ(IRQn_Type irqn) {
+    SIM_CORE_BEGIN(node);
+    sim_check_irqn(irqn);
+    node->irq_enabled[irqn] = true;
+    sim_node_charge(node, SIM_CYCLES_REGISTER_ACCESS);
+    sim_safepoint();
+    SIM_CORE_END();
+}
+
+void NVIC_DisableIRQ(IRQn_Type irqn) {
+    SIM_CORE_BEGIN(node);
+    sim_check_irqn(irqn);
+    node->irq_enabled[irqn] = false;
+    sim_node_charge(node, SIM_CYCLES_REGISTER_ACCESS);
+    SIM_CORE_END();
+}
+
+uint32_t NVIC_GetEnableIRQ(IRQn_Type irqn) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    sim_check_irqn(irqn);
+    return node->irq_enabled[irqn];
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type irqn) {
+    SIM_CORE_BEGIN(node);
+    sim_check_irqn(irqn);
+    node->irq_pending[irqn] = true;
+    sim_node_charge(node, SIM_CYCLES_REGISTER_ACCESS);
+    sim_safepoint();
+    SIM_CORE_END();
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type irqn) {
+    SIM_CORE_BEGIN(node);
+    sim_check_irqn(irqn);
+    node->irq_pending[irqn] = false;
+    sim_node_charge(node, SIM_CYCLES_REGISTER_ACCESS);
+    SIM_CORE_END();
+}
+
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irqn) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    sim_check_irqn(irqn);
+    return node->irq_pending[irqn];
+}
+
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority) {
+    SIM_CORE_BEGIN(node);
+
+    // The priorities of the system exceptions aren't modelled
+    if(irqn >= 0) {
+        sim_check_irqn(irqn);
+        node->irq_priority[irqn] = priority & ((1U << configPRIO_BITS) - 1);
+    }
+    sim_node_charge(node, SIM_CYCLES_REGISTER_ACCESS);
+    sim_safepoint();
+    SIM_CORE_END();
+}
+
+uint32_t NVIC_GetPriority(IRQn_Type irqn) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    if(irqn < 0) return 0;
+    sim_check_irqn(irqn);
+    return node->irq_priority[irqn];
+}
+
+void NVIC_SystemReset(void) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    sim_node_halt(node, "system reset requested");
+    __builtin_unreachable();
+}
+
+void __enable_irq(void) {
+    SIM_CORE_BEGIN(node);
+    node->primask = false;
+    sim_node_charge(node, SIM_CYCLES_CORE_CALL);
+    sim_safepoint();
+    SIM_CORE_END();
+}
+
+void __disable_irq(void) {
+    SIM_CORE_BEGIN(node);
+    node->primask = true;
+    sim_node_charge(node, SIM_CYCLES_CORE_CALL);
+    SIM_CORE_END();
+}
+
+uint32_t __get_PRIMASK(void) {
+    return sim_require_node(__func__)->primask;
+}
+
+void __set_PRIMASK(uint32_t primask) {
+    if(primask & 1) {
+        __disable_irq();
+    } else {
+        __enable_irq();
+    }
+}
+
+void __set_MSP(uint32_t top_of_stack) {
+    sim_fail("Setting the main stack pointer (0x%08x) isn't supported on the host.", top_of_stack);
+}
+
+void __DSB(void) {}
+void __DMB(void) {}
+void __ISB(void) {}
+void __NOP(void) {}
+
+uint32_t SysTick_Config(uint32_t ticks) {
+    // The FreeRTOS port keeps the ticks in simulated time
+    return 0;
+}
@@ -0,0 +1,260 @@
+/**
+ * @file sim_internal.h
+ * @author Gabriel Heinzer
+ * @brief Internal interfaces between the parts of the host model, see @ref sim.h.
+ */
+
+#pragma once
+
+#include <sim.h>
+#include <knabberkiste_device.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <signal.h>
+#include <ucontext.h>
+
+/* Mapped peripheral pages */
+#define SIM_PAGE_SIZE 4096
+#define SIM_PAGE_WORDS (SIM_PAGE_SIZE / 4)
+
+typedef enum {
+    SIM_PAGE_TIM,
+    SIM_PAGE_IWDG,
+    SIM_PAGE_CAN,
+    SIM_PAGE_SYSCFG_EXTI,
+    SIM_PAGE_USART1,
+    SIM_PAGE_RCC,
+    SIM_PAGE_FLASH,
+    SIM_PAGE_GPIO_AD,
+    SIM_PAGE_GPIO_EF,
+    SIM_PAGE_DWT,
+    SIM_PAGE_SCS,
+    SIM_PAGE_COUNT
+} SIM_Page_t;
+
+/**
+ * @brief Peripheral model of a mapped page. The register image of a node is loaded into the page
+ * before each access, and every written word is passed to @ref write afterwards.
+ */
+typedef struct {
+    uintptr_t address;
+    const char* name;
+    /// @brief Checks if the register at @p offset is clocked. Unclocked registers read as 0 and ignore writes. May be 0.
+    bool (*clocked)(const SIM_Node_t* node, uint32_t offset);
+    /// @brief Updates the registers which change by themselves before they are read. May be 0.
+    void (*refresh)(SIM_Node_t* node, uint32_t offset);
+    /// @brief Applies a write of @p value to the word at @p offset. The image still holds the old value.
+    void (*write)(SIM_Node_t* node, uint32_t offset, uint32_t value);
+} SIM_PageModel_t;
+
+/* Interrupts */
+#define SIM_IRQ_COUNT DEVICE_IRQ_COUNT
+#define SIM_PRIORITY_THREAD 0x100
+
+/* CAN controller */
+#define SIM_CAN_MAILBOXES 3
+#define SIM_CAN_FIFO_DEPTH 3
+
+typedef struct {
+    SIM_CANFrame_t frame;
+    uint8_t filter_match;
+    uint16_t time;
+} SIM_CANReceived_t;
+
+struct SIM_CANController;
+
+/**
+ * @brief Medium on which frames are arbitrated and transmitted one at a time. This is the bus for
+ * most controllers, a controller in loop back mode has a channel of its own.
+ */
+typedef struct {
+    SIM_Time_t idle_at;
+    bool arbitration_scheduled;
+    struct SIM_CANController* transmitter;
+    int mailbox;
+    SIM_CANFrame_t frame;
+    bool acknowledged;
+    SIM_Time_t start;
+} SIM_CANChannel_t;
+
+typedef struct SIM_CANController {
+    // Either the node of the controller or the peer which drives it
+    SIM_Node_t* node;
+    SIM_CANPeer_t* peer;
+    struct SIM_CANController* next;
+    SIM_CANChannel_t loopback;
+
+    // Transmit mailboxes, requested in the order of their sequence numbers
+    bool pending[SIM_CAN_MAILBOXES];
+    uint64_t sequence[SIM_CAN_MAILBOXES];
+    int transmitting;
+    uint32_t tx_status;
+
+    // Receive FIFOs
+    SIM_CANReceived_t fifo[2][SIM_CAN_FIFO_DEPTH];
+    uint8_t fifo_count[2];
+    bool fifo_full[2];
+    bool fifo_overrun[2];
+
+    // Error state
+    bool error_interrupt;
+    uint16_t tec;
+    uint16_t rec;
+    uint8_t lec;
+} SIM_CANController_t;
+
+/* GPIO */
+#define SIM_GPIO_PORTS 6
+#define SIM_GPIO_PINS 16
+
+typedef struct {
+    SIM_Node_t* node;
+    uint8_t port;
+    uint8_t pin;
+} SIM_NetMember_t;
+
+struct SIM_Net {
+    SIM_NetMember_t* members;
+    size_t member_count;
+    int external;
+    bool level;
+};
+
+/* RTOS */
+typedef enum {
+    SIM_TASK_READY,
+    SIM_TASK_BLOCKED,
+    SIM_TASK_DELETED
+} SIM_TaskState_t;
+
+struct SIM_Task {
+    SIM_Node_t* node;
+    struct SIM_Task* next;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;
+    SIM_TaskState_t state;
+    ucontext_t context;
+    void* stack;
+    size_t stack_size;
+    TaskFunction_t function;
+    void* parameters;
+    // Order in which the task became ready, for round-robin between equal priorities
+    uint64_t ready_sequence;
+    uint32_t notification;
+    bool waiting_for_notification;
+    uint64_t wake_generation;
+    void* thread_local_storage[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+};
+
+typedef struct SIM_Task SIM_Task_t;
+
+/* Nodes */
+typedef enum {
+    SIM_NODE_RUNNING,
+    SIM_NODE_SCHEDULED,
+    SIM_NODE_IDLE,
+    SIM_NODE_HALTED
+} SIM_NodeState_t;
+
+struct SIM_Node {
+    char name[32];
+    size_t index;
+    void* library;
+    SIM_NodeState_t state;
+    SIM_Time_t start_time;
+
+    // CPU time consumed since the node has been scheduled
+    SIM_Time_t debt;
+    uint64_t cycle_remainder;
+    uint64_t resume_generation;
+    uint64_t progress;
+
+    // Core
+    bool primask;
+    uint32_t vtor;
+    uint64_t interrupt_count;
+    uint32_t cycle_base;
+    SIM_Time_t cycle_base_time;
+
+    // NVIC
+    bool irq_enabled[SIM_IRQ_COUNT];
+    bool irq_pending[SIM_IRQ_COUNT];
+    bool irq_line[SIM_IRQ_COUNT];
+    uint8_t irq_priority[SIM_IRQ_COUNT];
+    void (*irq_handler[SIM_IRQ_COUNT])(void);
+    int16_t active[SIM_IRQ_COUNT];
+    size_t active_count;
+
+    // Tasks
+    SIM_Task_t* tasks;
+    SIM_Task_t* current;
+    SIM_Task_t* idle;
+    uint64_t ready_sequence;
+    bool switch_pending;
+    TickType_t slice_tick;
+    SIM_NodeEntry_t entry;
+    void* entry_argument;
+
+    // Peripherals
+    uint32_t image[SIM_PAGE_COUNT][SIM_PAGE_WORDS];
+    SIM_CANController_t can;
+    SIM_Net_t* nets[SIM_GPIO_PORTS][SIM_GPIO_PINS];
+    SIM_Time_t usart_ready_at;
+    SIM_Time_t usart_shift_free_at;
+    char console[256];
+    size_t console_length;
+    bool watchdog_running;
+    bool watchdog_unlocked;
+    uint64_t watchdog_generation;
+    uint8_t flash_key_stage;
+    SIM_Time_t flash_busy_until;
+};
+
+/* Core, see sim_core.c */
+/**
+ * @brief Nesting of model code. Node code runs at depth 0, which is where polling loops are
+ * detected. Every entry point of the model which is called by node code is wrapped in
+ * @ref SIM_MODEL_BEGIN and @ref SIM_MODEL_END.
+ */
+extern volatile sig_atomic_t sim_model_depth;
+
+#define SIM_MODEL_BEGIN() \
+    sig_atomic_t sim_saved_depth = sim_model_depth; \
+    sim_model_depth = sim_saved_depth + 1
+
+#define SIM_MODEL_END() sim_model_depth = sim_saved_depth
+
+extern SIM_Node_t* sim_current;
+extern SIM_Time_t sim_time;
+extern const SIM_PageModel_t sim_page_models[SIM_PAGE_COUNT];
+
+typedef void (*SIM_EventCallback_t)(void* context, uint64_t tag);
+
+void sim_event_schedule(SIM_Time_t time, SIM_EventCallback_t callback, void* context, uint64_t tag);
+uint32_t* sim_register(SIM_Node_t* node, SIM_Page_t page, uint32_t offset);
+void sim_node_charge(SIM_Node_t* node, uint32_t cycles);
+void sim_node_wake(SIM_Node_t* node);
+void sim_node_halt(SIM_Node_t* node, const char* reason);
+void sim_safepoint(void);
+void sim_node_suspend(SIM_Time_t duration);
+void sim_node_idle(void);
+void sim_irq_set_line(SIM_Node_t* node, IRQn_Type irqn, bool level);
+int sim_execution_priority(const SIM_Node_t* node);
+SIM_Node_t* sim_require_node(const char* function);
+void sim_enter_node(SIM_Node_t* node);
+
+/* RTOS, see sim_rtos.c */
+void sim_rtos_node_start(SIM_Node_t* node);
+void sim_rtos_schedule(SIM_Node_t* node);
+void sim_rtos_run_next(SIM_Node_t* node);
+
+/* Peripherals, see sim_can.c and sim_periph.c */
+void sim_periph_reset(SIM_Node_t* node);
+void sim_can_reset(SIM_Node_t* node);
+bool sim_can_clocked(const SIM_Node_t* node, uint32_t offset);
+void sim_can_write(SIM_Node_t* node, uint32_t offset, uint32_t value);
+uint32_t sim_rcc_hclk(const SIM_Node_t* node);
+uint32_t sim_rcc_pclk1(const SIM_Node_t* node);
+uint32_t sim_rcc_pclk2(const SIM_Node_t* node);
+void sim_gpio_node_init(SIM_Node_t* node);
+void sim_console_flush(SIM_Node_t* node);
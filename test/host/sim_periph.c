@@ -0,0 +1,596 @@
+#include "sim_internal.h"
+#include <knabberkiste/util/bit_manipulation.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_PAGE_OF(address) ((uintptr_t)(address) & ~(uintptr_t)(SIM_PAGE_SIZE - 1))
+#define SIM_OFFSET_OF(address) ((uintptr_t)(address) & (SIM_PAGE_SIZE - 1))
+
+#define SIM_HSI_FREQUENCY 8000000UL
+#define SIM_HSE_FREQUENCY 8000000UL
+#define SIM_LSI_FREQUENCY 40000UL
+
+#define SIM_GPIO_PORT_SIZE (GPIOB_BASE - GPIOA_BASE)
+#define SIM_GPIO_PORTS_PER_PAGE (SIM_PAGE_SIZE / SIM_GPIO_PORT_SIZE)
+
+#define SIM_IWDG_RELOAD_KEY 0xAAAA
+#define SIM_IWDG_CONFIG_KEY 0x5555
+#define SIM_IWDG_ENABLE_KEY 0xCCCC
+
+#define SIM_FLASH_KEY1 0x45670123
+#define SIM_FLASH_KEY2 0xCDEF89AB
+#define SIM_FLASH_PAGE_ERASE_TIME SIM_MS(20)
+
+#define SIM_SCB_VECTKEY 0x05FAUL
+
+static bool sim_console_echo = true;
+
+/* Register blocks in the images */
+#define SIM_REGISTERS(node, type, base) ((type*)sim_register((node), sim_page_index(base), SIM_OFFSET_OF(base)))
+
+static SIM_Page_t sim_page_index(uintptr_t address) {
+    for(size_t i = 0; i < SIM_PAGE_COUNT; i++) {
+        if(sim_page_models[i].address == SIM_PAGE_OF(address)) return (SIM_Page_t)i;
+    }
+    sim_fail("No page for the register at 0x%08lx.", (unsigned long)address);
+}
+
+static RCC_TypeDef* sim_rcc(const SIM_Node_t* node) {
+    return (RCC_TypeDef*)&node->image[SIM_PAGE_RCC][SIM_OFFSET_OF(RCC_BASE) / 4];
+}
+
+static GPIO_TypeDef* sim_gpio_registers(SIM_Node_t* node, uint8_t port) {
+    SIM_Page_t page = port < SIM_GPIO_PORTS_PER_PAGE ? SIM_PAGE_GPIO_AD : SIM_PAGE_GPIO_EF;
+    return (GPIO_TypeDef*)sim_register(node, page, (port % SIM_GPIO_PORTS_PER_PAGE) * SIM_GPIO_PORT_SIZE);
+}
+
+/* RCC */
+uint32_t sim_rcc_hclk(const SIM_Node_t* node) {
+    static const uint16_t ahb_prescalers[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 2, 4, 8, 16, 64, 128, 256, 512 };
+    RCC_TypeDef* rcc = sim_rcc(node);
+
+    uint32_t sysclk = SIM_HSI_FREQUENCY;
+    switch(READ_MASK_OFFSET(rcc->CFGR, 0x3, RCC_CFGR_SWS_Pos)) {
+        case 1:
+            sysclk = SIM_HSE_FREQUENCY;
+            break;
+        case 2: {
+            uint32_t multiplier = READ_MASK_OFFSET(rcc->CFGR, 0xF, RCC_CFGR_PLLMUL_Pos) + 2;
+            if(multiplier > 16) multiplier = 16;
+            uint32_t source = READ_MASK(rcc->CFGR, RCC_CFGR_PLLSRC) ? SIM_HSE_FREQUENCY : SIM_HSI_FREQUENCY / 2;
+            sysclk = source * multiplier;
+            break;
+        }
+    }
+
+    return sysclk / ahb_prescalers[READ_MASK_OFFSET(rcc->CFGR, 0xF, RCC_CFGR_HPRE_Pos)];
+}
+
+static uint32_t sim_rcc_apb_prescaler(uint32_t value) {
+    return value < 4 ? 1 : 2U << (value - 4);
+}
+
+uint32_t sim_rcc_pclk1(const SIM_Node_t* node) {
+    return sim_rcc_hclk(node) / sim_rcc_apb_prescaler(READ_MASK_OFFSET(sim_rcc(node)->CFGR, 0x7, RCC_CFGR_PPRE1_Pos));
+}
+
+uint32_t sim_rcc_pclk2(const SIM_Node_t* node) {
+    return sim_rcc_hclk(node) / sim_rcc_apb_prescaler(READ_MASK_OFFSET(sim_rcc(node)->CFGR, 0x7, RCC_CFGR_PPRE2_Pos));
+}
+
+static void sim_rcc_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    RCC_TypeDef* rcc = sim_rcc(node);
+    uint32_t* word = sim_register(node, SIM_PAGE_RCC, offset);
+
+    if(offset == offsetof(RCC_TypeDef, CR)) {
+        // The oscillators and the PLL are ready immediately
+        value &= ~(RCC_CR_HSIRDY | RCC_CR_HSERDY | RCC_CR_PLLRDY);
+        if(READ_MASK(value, RCC_CR_HSION)) value |= RCC_CR_HSIRDY;
+        if(READ_MASK(value, RCC_CR_HSEON)) value |= RCC_CR_HSERDY;
+        if(READ_MASK(value, RCC_CR_PLLON)) value |= RCC_CR_PLLRDY;
+        rcc->CR = value;
+    } else if(offset == offsetof(RCC_TypeDef, CFGR)) {
+        // The PLL is configured while it is disabled, the clock switch follows SW if the source is ready
+        if(READ_MASK(rcc->CR, RCC_CR_PLLON)) {
+            uint32_t pll = RCC_CFGR_PLLMUL | RCC_CFGR_PLLSRC | RCC_CFGR_PLLXTPRE;
+            value = (value & ~pll) | (rcc->CFGR & pll);
+        }
+
+        uint32_t source = READ_MASK_OFFSET(value, 0x3, RCC_CFGR_SW_Pos);
+        uint32_t ready[3] = { RCC_CR_HSIRDY, RCC_CR_HSERDY, RCC_CR_PLLRDY };
+        uint32_t status = READ_MASK_OFFSET(rcc->CFGR, 0x3, RCC_CFGR_SWS_Pos);
+        if(source < 3 && READ_MASK(rcc->CR, ready[source])) status = source;
+        rcc->CFGR = (value & ~RCC_CFGR_SWS) | (status << RCC_CFGR_SWS_Pos);
+    } else if(offset == offsetof(RCC_TypeDef, APB1RSTR)) {
+        *word = value;
+        if(READ_MASK(value, RCC_APB1RSTR_CANRST)) sim_can_reset(node);
+    } else {
+        *word = value;
+    }
+}
+
+/* GPIO */
+static void sim_exti_update(SIM_Node_t* node) {
+    static const struct {
+        IRQn_Type irqn;
+        uint32_t lines;
+    } groups[] = {
+        { EXTI0_IRQn, 1UL << 0 },
+        { EXTI1_IRQn, 1UL << 1 },
+        { EXTI2_TSC_IRQn, 1UL << 2 },
+        { EXTI3_IRQn, 1UL << 3 },
+        { EXTI4_IRQn, 1UL << 4 },
+        { EXTI9_5_IRQn, 0x03E0 },
+        { EXTI15_10_IRQn, 0xFC00 }
+    };
+    EXTI_TypeDef* exti = SIM_REGISTERS(node, EXTI_TypeDef, EXTI_BASE);
+
+    for(size_t i = 0; i < sizeof(groups) / sizeof(*groups); i++) {
+        sim_irq_set_line(node, groups[i].irqn, (exti->PR & exti->IMR & groups[i].lines) != 0);
+    }
+}
+
+static void sim_gpio_update_input(SIM_Node_t* node, uint8_t port, uint8_t pin) {
+    GPIO_TypeDef* gpio = sim_gpio_registers(node, port);
+
+    // The input of an analog pin is disconnected
+    bool analog = READ_MASK_OFFSET(gpio->MODER, 0x3, pin * 2) == 0x3;
+    bool input = !analog && node->nets[port][pin]->level;
+    if(input == READ_BIT(gpio->IDR, pin)) return;
+    WRITE_BIT(gpio->IDR, pin, input);
+
+    // Edge on the EXTI line, if the line is connected to this port
+    SYSCFG_TypeDef* syscfg = SIM_REGISTERS(node, SYSCFG_TypeDef, SYSCFG_BASE);
+    EXTI_TypeDef* exti = SIM_REGISTERS(node, EXTI_TypeDef, EXTI_BASE);
+    if(READ_MASK_OFFSET(syscfg->EXTICR[pin / 4], 0xF, (pin % 4) * 4) != port) return;
+
+    if(READ_BIT(input ? exti->RTSR : exti->FTSR, pin)) {
+        SET_BIT(exti->PR, pin);
+        sim_exti_update(node);
+    }
+}
+
+static void sim_gpio_evaluate(SIM_Net_t* net) {
+    int driven = net->external;
+    bool pull_up = false;
+    bool pull_down = false;
+
+    for(size_t i = 0; i < net->member_count; i++) {
+        SIM_NetMember_t* member = &net->members[i];
+        GPIO_TypeDef* gpio = sim_gpio_registers(member->node, member->port);
+        uint32_t mode = READ_MASK_OFFSET(gpio->MODER, 0x3, member->pin * 2);
+        if(mode == 0x3) continue;
+
+        // Outputs drive strongly, open-drain outputs only drive low
+        if(mode == 0x1) {
+            bool level = READ_BIT(gpio->ODR, member->pin);
+            if(!level || !READ_BIT(gpio->OTYPER, member->pin)) {
+                if(driven >= 0 && driven != level) sim_fail("Contention on the net of %s P%c%u.", member->node->name, 'A' + member->port, member->pin);
+                driven = level;
+            }
+        }
+
+        uint32_t pull = READ_MASK_OFFSET(gpio->PUPDR, 0x3, member->pin * 2);
+        if(pull == 0x1) pull_up = true;
+        if(pull == 0x2) pull_down = true;
+    }
+
+    // Nets which are neither driven nor pulled read as 0
+    net->level = driven >= 0 ? driven : (pull_up && !pull_down);
+
+    for(size_t i = 0; i < net->member_count; i++) {
+        sim_gpio_update_input(net->members[i].node, net->members[i].port, net->members[i].pin);
+    }
+}
+
+static void sim_gpio_evaluate_port(SIM_Node_t* node, uint8_t port) {
+    for(uint8_t pin = 0; pin < SIM_GPIO_PINS; pin++) {
+        sim_gpio_evaluate(node->nets[port][pin]);
+    }
+}
+
+static void sim_gpio_write(SIM_Node_t* node, uint8_t port, uint32_t offset, uint32_t value) {
+    GPIO_TypeDef* gpio = sim_gpio_registers(node, port);
+
+    switch(offset) {
+        case offsetof(GPIO_TypeDef, IDR):
+            return;
+        case offsetof(GPIO_TypeDef, BSRR):
+            // Setting takes precedence over resetting, the register itself reads as 0
+            gpio->ODR = ((gpio->ODR & ~(value >> 16)) | value) & 0xFFFF;
+            break;
+        case offsetof(GPIO_TypeDef, BRR):
+            gpio->ODR &= ~value & 0xFFFF;
+            break;
+        case offsetof(GPIO_TypeDef, ODR):
+            gpio->ODR = value & 0xFFFF;
+            break;
+        default:
+            *(uint32_t*)((char*)gpio + offset) = value;
+            break;
+    }
+
+    sim_gpio_evaluate_port(node, port);
+}
+
+static void sim_gpio_ad_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    sim_gpio_write(node, offset / SIM_GPIO_PORT_SIZE, offset % SIM_GPIO_PORT_SIZE, value);
+}
+
+static void sim_gpio_ef_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    uint8_t port = SIM_GPIO_PORTS_PER_PAGE + offset / SIM_GPIO_PORT_SIZE;
+    if(port >= SIM_GPIO_PORTS) return;
+    sim_gpio_write(node, port, offset % SIM_GPIO_PORT_SIZE, value);
+}
+
+static bool sim_gpio_clocked(const SIM_Node_t* node, uint8_t port) {
+    return port < SIM_GPIO_PORTS && READ_BIT(sim_rcc(node)->AHBENR, 17 + port);
+}
+
+static bool sim_gpio_ad_clocked(const SIM_Node_t* node, uint32_t offset) {
+    return sim_gpio_clocked(node, offset / SIM_GPIO_PORT_SIZE);
+}
+
+static bool sim_gpio_ef_clocked(const SIM_Node_t* node, uint32_t offset) {
+    return sim_gpio_clocked(node, SIM_GPIO_PORTS_PER_PAGE + offset / SIM_GPIO_PORT_SIZE);
+}
+
+void sim_gpio_node_init(SIM_Node_t* node) {
+    for(uint8_t port = 0; port < SIM_GPIO_PORTS; port++) {
+        for(uint8_t pin = 0; pin < SIM_GPIO_PINS; pin++) {
+            SIM_Net_t* net = calloc(1, sizeof(SIM_Net_t));
+            if(net != 0) net->members = malloc(sizeof(SIM_NetMember_t));
+            if(net == 0 || net->members == 0) sim_fail("Out of memory for the nets of %s.", node->name);
+
+            net->members[0] = (SIM_NetMember_t){ .node = node, .port = port, .pin = pin };
+            net->member_count = 1;
+            net->external = SIM_GPIO_RELEASED;
+            node->nets[port][pin] = net;
+        }
+    }
+
+    for(uint8_t port = 0; port < SIM_GPIO_PORTS; port++) {
+        sim_gpio_evaluate_port(node, port);
+    }
+}
+
+SIM_Net_t* sim_gpio_net(SIM_Node_t* node, uint8_t port, uint8_t pin) {
+    if(port >= SIM_GPIO_PORTS || pin >= SIM_GPIO_PINS) sim_fail("There is no pin P%c%u.", 'A' + port, pin);
+    return node->nets[port][pin];
+}
+
+void sim_gpio_connect(SIM_Node_t* node_a, uint8_t port_a, uint8_t pin_a, SIM_Node_t* node_b, uint8_t port_b, uint8_t pin_b) {
+    SIM_Net_t* net = sim_gpio_net(node_a, port_a, pin_a);
+    SIM_Net_t* merged = sim_gpio_net(node_b, port_b, pin_b);
+    if(net == merged) return;
+
+    if(net->external >= 0 && merged->external >= 0 && net->external != merged->external) {
+        sim_fail("Connected nets are driven to different levels.");
+    }
+    if(net->external < 0) net->external = merged->external;
+
+    net->members = realloc(net->members, (net->member_count + merged->member_count) * sizeof(SIM_NetMember_t));
+    if(net->members == 0) sim_fail("Out of memory for a net.");
+
+    for(size_t i = 0; i < merged->member_count; i++) {
+        SIM_NetMember_t member = merged->members[i];
+        member.node->nets[member.port][member.pin] = net;
+        net->members[net->member_count++] = member;
+    }
+    free(merged->members);
+    free(merged);
+
+    sim_gpio_evaluate(net);
+}
+
+void sim_gpio_drive(SIM_Net_t* net, int level) {
+    net->external = level < 0 ? SIM_GPIO_RELEASED : level != 0;
+    sim_gpio_evaluate(net);
+}
+
+bool sim_gpio_level(const SIM_Net_t* net) {
+    return net->level;
+}
+
+/* SYSCFG and EXTI */
+static bool sim_syscfg_exti_clocked(const SIM_Node_t* node, uint32_t offset) {
+    // The EXTI controller is always clocked
+    return offset >= SIM_OFFSET_OF(EXTI_BASE) || READ_MASK(sim_rcc(node)->APB2ENR, RCC_APB2ENR_SYSCFGEN);
+}
+
+static void sim_syscfg_exti_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    EXTI_TypeDef* exti = SIM_REGISTERS(node, EXTI_TypeDef, EXTI_BASE);
+    uint32_t* word = sim_register(node, SIM_PAGE_SYSCFG_EXTI, offset);
+
+    if(offset == SIM_OFFSET_OF(EXTI_BASE) + offsetof(EXTI_TypeDef, PR)) {
+        exti->PR &= ~value;
+    } else if(offset == SIM_OFFSET_OF(EXTI_BASE) + offsetof(EXTI_TypeDef, SWIER)) {
+        exti->PR |= value & exti->IMR;
+    } else {
+        *word = value;
+    }
+
+    sim_exti_update(node);
+}
+
+/* USART1, the console of the node */
+#define SIM_USART_OFFSET SIM_OFFSET_OF(USART1_BASE)
+
+static USART_TypeDef* sim_usart(SIM_Node_t* node) {
+    return SIM_REGISTERS(node, USART_TypeDef, USART1_BASE);
+}
+
+void sim_set_console_echo(bool echo) {
+    sim_console_echo = echo;
+}
+
+void sim_console_flush(SIM_Node_t* node) {
+    if(node->console_length == 0) return;
+
+    if(sim_console_echo) printf("[%12.3f us] %s: %.*s\n", sim_now() / 1000.0, node->name, (int)node->console_length, node->console);
+    node->console_length = 0;
+}
+
+static void sim_console_putchar(SIM_Node_t* node, char c) {
+    if(c == '\r') return;
+    if(c == '\n' || node->console_length == sizeof(node->console)) sim_console_flush(node);
+    if(c != '\n') node->console[node->console_length++] = c;
+}
+
+static bool sim_usart_clocked(const SIM_Node_t* node, uint32_t offset) {
+    // The other peripherals of the page aren't modelled
+    return offset >= SIM_USART_OFFSET && offset < SIM_USART_OFFSET + sizeof(USART_TypeDef) &&
+        READ_MASK(sim_rcc(node)->APB2ENR, RCC_APB2ENR_USART1EN);
+}
+
+static void sim_usart_refresh(SIM_Node_t* node, uint32_t offset) {
+    USART_TypeDef* usart = sim_usart(node);
+    if(offset != SIM_USART_OFFSET + offsetof(USART_TypeDef, ISR)) return;
+
+    // Polling for TXE ends once the character has moved on, so the waiting time is charged at once
+    if(sim_now() < node->usart_ready_at) node->debt += node->usart_ready_at - sim_now();
+
+    SIM_Time_t now = sim_now();
+    usart->ISR = (usart->ISR & ~(USART_ISR_TXE | USART_ISR_TC)) |
+        (now >= node->usart_ready_at ? USART_ISR_TXE : 0) |
+        (now >= node->usart_shift_free_at ? USART_ISR_TC : 0);
+}
+
+static void sim_usart_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    USART_TypeDef* usart = sim_usart(node);
+    uint32_t* word = sim_register(node, SIM_PAGE_USART1, offset);
+
+    if(offset == SIM_USART_OFFSET + offsetof(USART_TypeDef, TDR)) {
+        if(!READ_MASK(usart->CR1, USART_CR1_UE) || !READ_MASK(usart->CR1, USART_CR1_TE)) return;
+
+        // A start bit, 8 data bits and a stop bit, with oversampling by 16
+        uint32_t divider = usart->BRR != 0 ? usart->BRR : 1;
+        SIM_Time_t character = 10ULL * divider * SIM_S(1) / sim_rcc_pclk2(node);
+
+        // The data register is free once the shift register has taken the character
+        SIM_Time_t now = sim_now();
+        SIM_Time_t start = now > node->usart_shift_free_at ? now : node->usart_shift_free_at;
+        node->usart_ready_at = start;
+        node->usart_shift_free_at = start + character;
+        sim_console_putchar(node, (char)(value & 0xFF));
+    } else if(offset == SIM_USART_OFFSET + offsetof(USART_TypeDef, ISR) ||
+        offset == SIM_USART_OFFSET + offsetof(USART_TypeDef, RDR)) {
+        return;
+    } else if(offset != SIM_USART_OFFSET + offsetof(USART_TypeDef, ICR) && offset != SIM_USART_OFFSET + offsetof(USART_TypeDef, RQR)) {
+        *word = value;
+    }
+}
+
+/* Independent watchdog */
+static IWDG_TypeDef* sim_iwdg(SIM_Node_t* node) {
+    return SIM_REGISTERS(node, IWDG_TypeDef, IWDG_BASE);
+}
+
+static void sim_iwdg_expire(void* context, uint64_t tag) {
+    SIM_Node_t* node = context;
+    if(tag != node->watchdog_generation || node->state == SIM_NODE_HALTED) return;
+
+    sim_node_halt(node, "watchdog reset");
+}
+
+static void sim_iwdg_reload(SIM_Node_t* node) {
+    IWDG_TypeDef* iwdg = sim_iwdg(node);
+    uint64_t prescaler = 4ULL << (iwdg->PR & 0x7);
+    if(prescaler > 256) prescaler = 256;
+    SIM_Time_t timeout = prescaler * ((iwdg->RLR & 0xFFF) + 1) * SIM_S(1) / SIM_LSI_FREQUENCY;
+
+    sim_event_schedule(sim_now() + timeout, sim_iwdg_expire, node, ++node->watchdog_generation);
+}
+
+static void sim_iwdg_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    uint32_t* word = sim_register(node, SIM_PAGE_IWDG, offset);
+
+    if(offset == SIM_OFFSET_OF(IWDG_BASE) + offsetof(IWDG_TypeDef, KR)) {
+        switch(value & 0xFFFF) {
+            case SIM_IWDG_ENABLE_KEY:
+                node->watchdog_running = true;
+                sim_iwdg_reload(node);
+                break;
+            case SIM_IWDG_CONFIG_KEY:
+                node->watchdog_unlocked = true;
+                break;
+            case SIM_IWDG_RELOAD_KEY:
+                node->watchdog_unlocked = false;
+                if(node->watchdog_running) sim_iwdg_reload(node);
+                break;
+            default:
+                node->watchdog_unlocked = false;
+                break;
+        }
+    } else if(offset == SIM_OFFSET_OF(IWDG_BASE) + offsetof(IWDG_TypeDef, PR) ||
+        offset == SIM_OFFSET_OF(IWDG_BASE) + offsetof(IWDG_TypeDef, RLR) ||
+        offset == SIM_OFFSET_OF(IWDG_BASE) + offsetof(IWDG_TypeDef, WINR)) {
+        // The registers are updated immediately, so SR stays 0
+        if(node->watchdog_unlocked) *word = value & 0xFFF;
+    } else if(offset != SIM_OFFSET_OF(IWDG_BASE) + offsetof(IWDG_TypeDef, SR)) {
+        *word = value;
+    }
+}
+
+/* Flash interface */
+static FLASH_TypeDef* sim_flash(SIM_Node_t* node) {
+    return SIM_REGISTERS(node, FLASH_TypeDef, FLASH_R_BASE);
+}
+
+static void sim_flash_refresh(SIM_Node_t* node, uint32_t offset) {
+    FLASH_TypeDef* flash = sim_flash(node);
+    if(READ_MASK(flash->SR, FLASH_SR_BSY) && sim_now() >= node->flash_busy_until) {
+        CLEAR_MASK(flash->SR, FLASH_SR_BSY);
+        SET_MASK(flash->SR, FLASH_SR_EOP);
+    }
+}
+
+static void sim_flash_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    FLASH_TypeDef* flash = sim_flash(node);
+    uint32_t* word = sim_register(node, SIM_PAGE_FLASH, offset);
+
+    switch(offset - SIM_OFFSET_OF(FLASH_R_BASE)) {
+        case offsetof(FLASH_TypeDef, KEYR):
+            // Unlocked by the two keys in sequence, a wrong key locks the interface until the next reset
+            if(node->flash_key_stage == 0 && value == SIM_FLASH_KEY1) {
+                node->flash_key_stage = 1;
+            } else if(node->flash_key_stage == 1 && value == SIM_FLASH_KEY2) {
+                node->flash_key_stage = 0;
+                CLEAR_MASK(flash->CR, FLASH_CR_LOCK);
+            } else {
+                node->flash_key_stage = 2;
+            }
+            break;
+        case offsetof(FLASH_TypeDef, SR):
+            flash->SR &= ~(value & (FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR));
+            break;
+        case offsetof(FLASH_TypeDef, CR):
+            if(READ_MASK(flash->CR, FLASH_CR_LOCK)) break;
+            flash->CR = value & ~FLASH_CR_STRT;
+
+            // Only page erases are started by STRT, the memory itself isn't modelled
+            if(READ_MASK(value, FLASH_CR_STRT) && READ_MASK(value, FLASH_CR_PER | FLASH_CR_MER)) {
+                SET_MASK(flash->SR, FLASH_SR_BSY);
+                node->flash_busy_until = sim_now() + SIM_FLASH_PAGE_ERASE_TIME;
+            }
+            break;
+        default:
+            *word = value;
+            break;
+    }
+}
+
+/* Timers, only the registers */
+static bool sim_tim_clocked(const SIM_Node_t* node, uint32_t offset) {
+    if(offset < SIM_OFFSET_OF(TIM7_BASE)) return READ_MASK(sim_rcc(node)->APB1ENR, RCC_APB1ENR_TIM6EN);
+    if(offset < SIM_OFFSET_OF(TIM7_BASE) + sizeof(TIM_TypeDef)) return READ_MASK(sim_rcc(node)->APB1ENR, RCC_APB1ENR_TIM7EN);
+    return false;
+}
+
+/* Core peripherals */
+static DWT_Type* sim_dwt(SIM_Node_t* node) {
+    return SIM_REGISTERS(node, DWT_Type, DWT_BASE);
+}
+
+static CoreDebug_Type* sim_core_debug(SIM_Node_t* node) {
+    return SIM_REGISTERS(node, CoreDebug_Type, CoreDebug_BASE);
+}
+
+static bool sim_dwt_counting(SIM_Node_t* node) {
+    return READ_MASK(sim_dwt(node)->CTRL, DWT_CTRL_CYCCNTENA_Msk) && READ_MASK(sim_core_debug(node)->DEMCR, CoreDebug_DEMCR_TRCENA_Msk);
+}
+
+static uint32_t sim_dwt_cycles(SIM_Node_t* node) {
+    if(!sim_dwt_counting(node)) return node->cycle_base;
+    return node->cycle_base + (uint32_t)((sim_now() - node->cycle_base_time) * sim_rcc_hclk(node) / SIM_S(1));
+}
+
+static void sim_dwt_rebase(SIM_Node_t* node, uint32_t cycles) {
+    node->cycle_base = cycles;
+    node->cycle_base_time = sim_now();
+}
+
+static void sim_dwt_refresh(SIM_Node_t* node, uint32_t offset) {
+    sim_dwt(node)->CYCCNT = sim_dwt_cycles(node);
+}
+
+static void sim_dwt_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    uint32_t* word = sim_register(node, SIM_PAGE_DWT, offset);
+
+    if(offset == SIM_OFFSET_OF(DWT_BASE) + offsetof(DWT_Type, CYCCNT)) {
+        sim_dwt_rebase(node, value);
+    } else {
+        sim_dwt_rebase(node, sim_dwt_cycles(node));
+        *word = value;
+    }
+}
+
+static void sim_scs_refresh(SIM_Node_t* node, uint32_t offset) {
+    SCB_Type* scb = SIM_REGISTERS(node, SCB_Type, SCB_BASE);
+    uint32_t active = node->active_count > 0 ? node->active[node->active_count - 1] + 16 : 0;
+    scb->ICSR = (scb->ICSR & ~SCB_ICSR_VECTACTIVE_Msk) | active;
+}
+
+static void sim_scs_write(SIM_Node_t* node, uint32_t offset, uint32_t value) {
+    uint32_t* word = sim_register(node, SIM_PAGE_SCS, offset);
+
+    if(offset == SIM_OFFSET_OF(SCB_BASE) + offsetof(SCB_Type, CPUID) ||
+        offset == SIM_OFFSET_OF(SCB_BASE) + offsetof(SCB_Type, ICSR)) {
+        return;
+    } else if(offset == SIM_OFFSET_OF(SCB_BASE) + offsetof(SCB_Type, AIRCR)) {
+        if((value >> SCB_AIRCR_VECTKEY_Pos) == SIM_SCB_VECTKEY && READ_MASK(value, SCB_AIRCR_SYSRESETREQ_Msk)) {
+            sim_node_halt(node, "system reset requested");
+        }
+    } else if(offset == SIM_OFFSET_OF(CoreDebug_BASE) + offsetof(CoreDebug_Type, DEMCR)) {
+        sim_dwt_rebase(node, sim_dwt_cycles(node));
+        *word = value;
+    } else {
+        *word = value;
+        if(offset == SIM_OFFSET_OF(SCB_BASE) + offsetof(SCB_Type, VTOR)) node->vtor = value;
+    }
+}
+
+/* Pages */
+const SIM_PageModel_t sim_page_models[SIM_PAGE_COUNT] = {
+    [SIM_PAGE_TIM] = { SIM_PAGE_OF(TIM6_BASE), "TIM6/TIM7", sim_tim_clocked, 0, 0 },
+    [SIM_PAGE_IWDG] = { SIM_PAGE_OF(IWDG_BASE), "IWDG", 0, 0, sim_iwdg_write },
+    [SIM_PAGE_CAN] = { SIM_PAGE_OF(CAN_BASE), "CAN", sim_can_clocked, 0, sim_can_write },
+    [SIM_PAGE_SYSCFG_EXTI] = { SIM_PAGE_OF(SYSCFG_BASE), "SYSCFG/EXTI", sim_syscfg_exti_clocked, 0, sim_syscfg_exti_write },
+    [SIM_PAGE_USART1] = { SIM_PAGE_OF(USART1_BASE), "USART1", sim_usart_clocked, sim_usart_refresh, sim_usart_write },
+    [SIM_PAGE_RCC] = { SIM_PAGE_OF(RCC_BASE), "RCC", 0, 0, sim_rcc_write },
+    [SIM_PAGE_FLASH] = { SIM_PAGE_OF(FLASH_R_BASE), "FLASH", 0, sim_flash_refresh, sim_flash_write },
+    [SIM_PAGE_GPIO_AD] = { SIM_PAGE_OF(GPIOA_BASE), "GPIOA-D", sim_gpio_ad_clocked, 0, sim_gpio_ad_write },
+    [SIM_PAGE_GPIO_EF] = { SIM_PAGE_OF(GPIOE_BASE), "GPIOE/F", sim_gpio_ef_clocked, 0, sim_gpio_ef_write },
+    [SIM_PAGE_DWT] = { SIM_PAGE_OF(DWT_BASE), "DWT", 0, sim_dwt_refresh, sim_dwt_write },
+    [SIM_PAGE_SCS] = { SIM_PAGE_OF(SCS_BASE), "SCS", 0, sim_scs_refresh, sim_scs_write }
+};
+
+void sim_periph_reset(SIM_Node_t* node) {
+    for(size_t page = 0; page < SIM_PAGE_COUNT; page++) {
+        memset(node->image[page], 0, SIM_PAGE_SIZE);
+    }
+
+    // Reset values which aren't 0
+    RCC_TypeDef* rcc = sim_rcc(node);
+    rcc->CR = 0x00000083;
+    rcc->AHBENR = 0x00000014;
+    rcc->CSR = 0x0C000000;
+
+    GPIO_TypeDef* gpioa = sim_gpio_registers(node, 0);
+    gpioa->MODER = 0xA8000000;
+    gpioa->OSPEEDR = 0x0C000000;
+    gpioa->PUPDR = 0x64000000;
+    GPIO_TypeDef* gpiob = sim_gpio_registers(node, 1);
+    gpiob->MODER = 0x00000280;
+    gpiob->OSPEEDR = 0x000000C0;
+    gpiob->PUPDR = 0x00000100;
+
+    SIM_REGISTERS(node, EXTI_TypeDef, EXTI_BASE)->IMR = 0x1F800000;
+    sim_usart(node)->ISR = USART_ISR_TXE | USART_ISR_TC;
+    sim_iwdg(node)->RLR = 0xFFF;
+    sim_flash(node)->ACR = 0x00000030;
+    sim_flash(node)->CR = FLASH_CR_LOCK;
+    sim_dwt(node)->CTRL = 0x40000000;
+    *sim_register(node, SIM_PAGE_SCS, SIM_OFFSET_OF(SCB_BASE) + offsetof(SCB_Type, CPUID)) = 0x410FC241;
+}
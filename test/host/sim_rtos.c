@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+#include "sim_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Host stacks are independent of the requested depth, the host code needs far more than the target
+#define SIM_TASK_STACK_SIZE (256 * 1024)
+
+// CPU cycles charged for the kernel
+#define SIM_CYCLES_RTOS_CALL 60
+#define SIM_CYCLES_CONTEXT_SWITCH 150
+
+#define SIM_TICK_NS (SIM_S(1) / configTICK_RATE_HZ)
+
+/* Tasks */
+static TickType_t sim_rtos_ticks(const SIM_Node_t* node) {
+    return (TickType_t)((sim_now() - node->start_time) / SIM_TICK_NS);
+}
+
+static void sim_task_entry(void) {
+    SIM_Task_t* task = sim_current->current;
+
+    sim_model_depth = 0;
+    task->function(task->parameters);
+
+    // FreeRTOS tasks must not return, deleting them is the closest behavior
+    vTaskDelete(NULL);
+}
+
+static SIM_Task_t* sim_task_create(SIM_Node_t* node, TaskFunction_t function, const char* name, void* parameters, UBaseType_t priority) {
+    if(priority >= configMAX_PRIORITIES) sim_fail("Task %s has priority %lu, the maximum is %d.", name, priority, configMAX_PRIORITIES - 1);
+
+    SIM_Task_t* task = calloc(1, sizeof(SIM_Task_t));
+    if(task == 0) sim_fail("Out of memory for task %s.", name);
+
+    task->stack = mmap(0, SIM_TASK_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if(task->stack == MAP_FAILED) sim_fail("Out of memory for the stack of task %s.", name);
+
+    task->node = node;
+    task->stack_size = SIM_TASK_STACK_SIZE;
+    task->function = function;
+    task->parameters = parameters;
+    task->priority = priority;
+    task->state = SIM_TASK_READY;
+    task->ready_sequence = ++node->ready_sequence;
+    snprintf(task->name, sizeof(task->name), "%s", name);
+
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = task->stack_size;
+    task->context.uc_link = 0;
+    makecontext(&task->context, sim_task_entry, 0);
+
+    task->next = node->tasks;
+    node->tasks = task;
+    return task;
+}
+
+static void sim_task_make_ready(SIM_Task_t* task) {
+    SIM_Node_t* node = task->node;
+
+    task->state = SIM_TASK_READY;
+    task->waiting_for_notification = false;
+    task->ready_sequence = ++node->ready_sequence;
+
+    // Cancels a pending timeout
+    task->wake_generation++;
+}
+
+static SIM_Task_t* sim_rtos_select(SIM_Node_t* node) {
+    // Highest priority first, the task which has been ready the longest among equal priorities
+    SIM_Task_t* selected = 0;
+    for(SIM_Task_t* task = node->tasks; task != 0; task = task->next) {
+        if(task->state != SIM_TASK_READY) continue;
+
+        if(selected == 0 || task->priority > selected->priority ||
+            (task->priority == selected->priority && task->ready_sequence < selected->ready_sequence)) {
+            selected = task;
+        }
+    }
+    return selected;
+}
+
+static void sim_node_main(void* parameters) {
+    SIM_Node_t* node = sim_current;
+    node->entry(node->entry_argument);
+}
+
+static void sim_idle_task(void* parameters) {
+    for(;;) {
+        sim_model_depth = 1;
+        sim_node_idle();
+        sim_safepoint();
+    }
+}
+
+void sim_rtos_node_start(SIM_Node_t* node) {
+    node->idle = sim_task_create(node, sim_idle_task, "IDLE", 0, tskIDLE_PRIORITY);
+    sim_task_create(node, sim_node_main, "main", 0, 1);
+    node->current = sim_rtos_select(node);
+}
+
+void sim_rtos_schedule(SIM_Node_t* node) {
+    node->switch_pending = false;
+
+    SIM_Task_t* previous = node->current;
+    SIM_Task_t* next = sim_rtos_select(node);
+
+    if(next == previous) return;
+
+    sim_node_charge(node, SIM_CYCLES_CONTEXT_SWITCH);
+    node->current = next;
+    swapcontext(&previous->context, &next->context);
+}
+
+void sim_rtos_run_next(SIM_Node_t* node) {
+    // Time slicing, the running task goes behind the other ready tasks of its priority
+    TickType_t tick = sim_rtos_ticks(node);
+    if(tick == node->slice_tick) return;
+    node->slice_tick = tick;
+
+    SIM_Task_t* current = node->current;
+    if(current->state != SIM_TASK_READY) return;
+
+    for(SIM_Task_t* task = node->tasks; task != 0; task = task->next) {
+        if(task != current && task->state == SIM_TASK_READY && task->priority == current->priority) {
+            current->ready_sequence = ++node->ready_sequence;
+            node->switch_pending = true;
+            return;
+        }
+    }
+}
+
+static void sim_task_timeout(void* context, uint64_t tag) {
+    SIM_Task_t* task = context;
+    if(task->state != SIM_TASK_BLOCKED || tag != task->wake_generation) return;
+
+    SIM_Node_t* node = task->node;
+    sim_task_make_ready(task);
+    if(task->priority > node->current->priority) node->switch_pending = true;
+    sim_node_wake(node);
+}
+
+static void sim_task_block(SIM_Node_t* node, TickType_t ticks) {
+    SIM_Task_t* task = node->current;
+    task->state = SIM_TASK_BLOCKED;
+    task->wake_generation++;
+
+    if(ticks != portMAX_DELAY) {
+        SIM_Time_t wake_time = node->start_time + (SIM_Time_t)(sim_rtos_ticks(node) + (uint64_t)ticks) * SIM_TICK_NS;
+        sim_event_schedule(wake_time, sim_task_timeout, task, task->wake_generation);
+    }
+
+    sim_rtos_schedule(node);
+}
+
+static void sim_task_notify(SIM_Task_t* task) {
+    task->notification++;
+    if(task->state == SIM_TASK_BLOCKED && task->waiting_for_notification) sim_task_make_ready(task);
+}
+
+/* API of FreeRTOS */
+#define SIM_RTOS_BEGIN(node) \
+    SIM_Node_t* node = sim_require_node(__func__); \
+    SIM_MODEL_BEGIN(); \
+    sim_node_charge(node, SIM_CYCLES_RTOS_CALL)
+
+#define SIM_RTOS_END() SIM_MODEL_END()
+
+static void sim_rtos_require_thread(const SIM_Node_t* node, const char* function) {
+    if(node->active_count > 0) sim_fail("%s() called from interrupt %d.", function, node->active[node->active_count - 1]);
+}
+
+static void sim_rtos_require_blocking(const SIM_Node_t* node, const char* function) {
+    sim_rtos_require_thread(node, function);
+    if(node->primask) sim_fail("%s() would block with interrupts disabled.", function);
+}
+
+static void sim_rtos_require_isr_priority(const SIM_Node_t* node, const char* function) {
+    // Only interrupts at or below the maximum syscall priority may call the kernel
+    int priority = sim_execution_priority(node);
+    if(priority < configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY) {
+        sim_fail("%s() called from interrupt %d with priority %d, which is above configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY.",
+            function, node->active[node->active_count - 1], priority);
+    }
+}
+
+static SIM_Task_t* sim_rtos_task(SIM_Node_t* node, TaskHandle_t task) {
+    if(task == NULL) return node->current;
+    if(task->node != node) sim_fail("Task %s belongs to node %s.", task->name, task->node->name);
+    return task;
+}
+
+BaseType_t xTaskCreate(
+    TaskFunction_t task_function,
+    const char* name,
+    uint16_t stack_depth,
+    void* parameters,
+    UBaseType_t priority,
+    TaskHandle_t* created_task
+) {
+    SIM_RTOS_BEGIN(node);
+    sim_rtos_require_thread(node, __func__);
+
+    SIM_Task_t* task = sim_task_create(node, task_function, name, parameters, priority);
+    if(created_task != NULL) *created_task = task;
+
+    if(task->priority > node->current->priority) node->switch_pending = true;
+    sim_safepoint();
+
+    SIM_RTOS_END();
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    SIM_RTOS_BEGIN(node);
+    sim_rtos_require_thread(node, __func__);
+
+    SIM_Task_t* deleted = sim_rtos_task(node, task);
+    if(deleted == node->idle) sim_fail("The idle task can't be deleted.");
+    deleted->state = SIM_TASK_DELETED;
+    deleted->wake_generation++;
+
+    // The stack of a deleted task is kept, a task may delete itself while running on it
+    if(deleted == node->current) {
+        if(node->primask) sim_fail("Task %s deleted itself with interrupts disabled.", deleted->name);
+        sim_rtos_schedule(node);
+        sim_fail("Deleted task %s has been resumed.", deleted->name);
+    }
+
+    SIM_RTOS_END();
+}
+
+void vTaskDelay(TickType_t ticks) {
+    SIM_RTOS_BEGIN(node);
+    sim_rtos_require_blocking(node, __func__);
+
+    if(ticks > 0) {
+        sim_task_block(node, ticks);
+    } else {
+        node->current->ready_sequence = ++node->ready_sequence;
+        node->switch_pending = true;
+        sim_safepoint();
+    }
+
+    SIM_RTOS_END();
+}
+
+void vTaskYield(void) {
+    vTaskDelay(0);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    SIM_RTOS_BEGIN(node);
+    TickType_t ticks = sim_rtos_ticks(node);
+    SIM_RTOS_END();
+    return ticks;
+}
+
+TickType_t xTaskGetTickCountFromISR(void) {
+    SIM_RTOS_BEGIN(node);
+    sim_rtos_require_isr_priority(node, __func__);
+    TickType_t ticks = sim_rtos_ticks(node);
+    SIM_RTOS_END();
+    return ticks;
+}
+
+BaseType_t xTaskGetSchedulerState(void) {
+    // Each node starts its scheduler before running its entry function
+    return sim_current != 0 ? taskSCHEDULER_RUNNING : taskSCHEDULER_NOT_STARTED;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return sim_require_node(__func__)->current;
+}
+
+char* pcTaskGetName(TaskHandle_t task) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    return sim_rtos_task(node, task)->name;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    return sim_rtos_task(node, task)->priority;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait) {
+    SIM_RTOS_BEGIN(node);
+    sim_rtos_require_thread(node, __func__);
+
+    SIM_Task_t* task = node->current;
+    if(task->notification == 0 && ticks_to_wait > 0) {
+        sim_rtos_require_blocking(node, __func__);
+        task->waiting_for_notification = true;
+        sim_task_block(node, ticks_to_wait);
+        task->waiting_for_notification = false;
+    }
+
+    uint32_t value = task->notification;
+    if(value != 0) task->notification = clear_count_on_exit ? 0 : value - 1;
+
+    SIM_RTOS_END();
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    SIM_RTOS_BEGIN(node);
+    sim_rtos_require_thread(node, __func__);
+
+    SIM_Task_t* notified = sim_rtos_task(node, task);
+    sim_task_notify(notified);
+    if(notified->state == SIM_TASK_READY && notified->priority > node->current->priority) node->switch_pending = true;
+    sim_safepoint();
+
+    SIM_RTOS_END();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higher_priority_task_woken) {
+    SIM_RTOS_BEGIN(node);
+    sim_rtos_require_isr_priority(node, __func__);
+
+    SIM_Task_t* notified = sim_rtos_task(node, task);
+    sim_task_notify(notified);
+
+    // The switch happens once the interrupt calls portYIELD_FROM_ISR()
+    if(notified->state == SIM_TASK_READY && notified->priority > node->current->priority && higher_priority_task_woken != NULL) {
+        *higher_priority_task_woken = pdTRUE;
+    }
+
+    SIM_RTOS_END();
+}
+
+void sim_rtos_yield_from_isr(BaseType_t switch_required) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    if(switch_required) node->switch_pending = true;
+}
+
+void* pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    if(index < 0 || index >= configNUM_THREAD_LOCAL_STORAGE_POINTERS) return NULL;
+    return sim_rtos_task(node, task)->thread_local_storage[index];
+}
+
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index, void* value) {
+    SIM_Node_t* node = sim_require_node(__func__);
+    if(index < 0 || index >= configNUM_THREAD_LOCAL_STORAGE_POINTERS) return;
+    sim_rtos_task(node, task)->thread_local_storage[index] = value;
+}
+
+void* pvPortMalloc(size_t size) {
+    SIM_RTOS_BEGIN(node);
+    sim_rtos_require_thread(node, __func__);
+    void* pointer = malloc(size);
+    SIM_RTOS_END();
+    return pointer;
+}
+
+void vPortFree(void* pointer) {
+    SIM_RTOS_BEGIN(node);
+    sim_rtos_require_thread(node, __func__);
+    free(pointer);
+    SIM_RTOS_END();
+}
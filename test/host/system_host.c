@@ -0,0 +1,30 @@
+#include <knabberkiste_device.h>
+#include <knabberkiste/util/bit_manipulation.h>
+
+#define HSI_VALUE 8000000UL
+#define HSE_VALUE 8000000UL
+
+// Like the system file of CMSIS, the clock starts out as the HSI
+uint32_t SystemCoreClock = HSI_VALUE;
+
+static const uint8_t AHBPrescTable[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 6, 7, 8, 9 };
+
+void SystemCoreClockUpdate(void) {
+    uint32_t sysclk = HSI_VALUE;
+
+    switch(READ_MASK_OFFSET(RCC->CFGR, 0b11, RCC_CFGR_SWS_Pos)) {
+        case 0b01:
+            sysclk = HSE_VALUE;
+            break;
+        case 0b10: {
+            uint32_t multiplier = READ_MASK_OFFSET(RCC->CFGR, 0b1111, RCC_CFGR_PLLMUL_Pos) + 2;
+            if(multiplier > 16) multiplier = 16;
+
+            uint32_t source = READ_MASK(RCC->CFGR, RCC_CFGR_PLLSRC) ? HSE_VALUE : HSI_VALUE / 2;
+            sysclk = source * multiplier;
+            break;
+        }
+    }
+
+    SystemCoreClock = sysclk >> AHBPrescTable[READ_MASK_OFFSET(RCC->CFGR, 0b1111, RCC_CFGR_HPRE_Pos)];
+}
@@ -0,0 +1,138 @@
+/**
+ * @file test.h
+ * @author Gabriel Heinzer
+ * @brief Minimal harness for the host tests.
+ *
+ * A test executable lists its cases with @ref TEST_MAIN(). Every case runs in a process of its own,
+ * as the library and the peripheral model keep their state in static variables. The case to run is
+ * given as the first argument, all cases are run one after the other if it is omitted.
+ *
+ * Code which enters critical sections or accesses peripherals must run on a simulated node, see
+ * @ref test_in_node().
+ */
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <sim.h>
+
+/**
+ * @brief Single test case.
+ */
+typedef struct {
+    const char* name;
+    void (*function)(void);
+} TEST_Case_t;
+
+/**
+ * @brief Fails the test case with a message, which is printed with the location of the failure.
+ */
+#define TEST_FAIL(...) test_fail(__FILE__, __LINE__, __VA_ARGS__)
+
+/**
+ * @brief Fails the test case if @p condition is false.
+ */
+#define TEST_ASSERT(condition) do { \
+    if(!(condition)) TEST_FAIL("Assertion failed: %s", #condition); \
+} while(0)
+
+/**
+ * @brief Fails the test case if the integers @p expected and @p actual differ.
+ */
+#define TEST_ASSERT_EQUAL(expected, actual) do { \
+    long long test_expected = (long long)(expected); \
+    long long test_actual = (long long)(actual); \
+    if(test_expected != test_actual) { \
+        TEST_FAIL("%s is %lld, expected %s = %lld", #actual, test_actual, #expected, test_expected); \
+    } \
+} while(0)
+
+/**
+ * @brief Defines the main function of a test executable with the given cases.
+ */
+#define TEST_MAIN(...) \
+    static const TEST_Case_t test_cases[] = { __VA_ARGS__ }; \
+    int main(int argc, char** argv) { \
+        return test_main(test_cases, sizeof(test_cases) / sizeof(*test_cases), argc, argv); \
+    }
+
+/**
+ * @brief Entry of the test case @p name in @ref TEST_MAIN(), which is implemented by test_<name>().
+ */
+#define TEST_CASE(name) { #name, test_##name }
+
+__attribute__((noreturn, format(printf, 3, 4), unused))
+static void test_fail(const char* file, int line, const char* format, ...) {
+    va_list arguments;
+
+    fflush(stdout);
+    fprintf(stderr, "%s:%d: ", file, line);
+    va_start(arguments, format);
+    vfprintf(stderr, format, arguments);
+    va_end(arguments);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static volatile bool test_in_node_returned = false;
+
+static void test_in_node_entry(void* argument) {
+    ((void (*)(void))argument)();
+    test_in_node_returned = true;
+}
+
+static bool test_in_node_done(void* context) {
+    return test_in_node_returned;
+}
+
+/**
+ * @brief Runs @p function on a single simulated node and returns once it has returned.
+ */
+__attribute__((unused))
+static void test_in_node(void (*function)(void)) {
+    sim_init();
+    sim_set_console_echo(false);
+    sim_node_create("node", test_in_node_entry, (void*)function, 0);
+    if(!sim_run_until(test_in_node_done, 0, SIM_S(3600))) TEST_FAIL("The node didn't return.");
+}
+
+static int test_run(const TEST_Case_t* test_case) {
+    fflush(stdout);
+    pid_t child = fork();
+    if(child == 0) {
+        test_case->function();
+        fflush(stdout);
+        _exit(0);
+    }
+
+    int status = 1;
+    if(child < 0 || waitpid(child, &status, 0) < 0) return 1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+__attribute__((unused))
+static int test_main(const TEST_Case_t* cases, size_t count, int argc, char** argv) {
+    int failed = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        if(argc > 1 && strcmp(argv[1], cases[i].name) != 0) continue;
+
+        int result = test_run(&cases[i]);
+        printf("%s: %s\n", cases[i].name, result == 0 ? "passed" : "FAILED");
+        if(result != 0) failed++;
+        if(argc > 1) return result;
+    }
+
+    if(argc > 1) {
+        fprintf(stderr, "Unknown test case %s.\n", argv[1]);
+        return 1;
+    }
+    return failed != 0;
+}
@@ -0,0 +1,673 @@
+/**
+ * @file test_bxcan.c
+ * @author Gabriel Heinzer
+ * @brief Runs the bxCAN HAL against the register-level model of the peripheral.
+ */
+
+#include "test.h"
+#include <sim.h>
+#include <knabberkiste/hal/bxcan.h>
+#include <knabberkiste/hal/clock.h>
+#include <knabberkiste/hal/gpio.h>
+#include <knabberkiste/io.h>
+#include <knabberkiste/util/bit_manipulation.h>
+#include <knabberkiste/util/critical.h>
+#include <knabberkiste/util/fifo.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#define TEST_BITRATE 1000000
+#define TEST_FRAME_COUNT 1000
+
+typedef struct {
+    uint32_t id;
+    CAN_FIFO_t fifo;
+    uint8_t filter_match;
+    uint8_t dlc;
+    uint8_t data[8];
+    // Receive callback which was running when this one started, -1 if none
+    int interrupted_fifo;
+} TEST_Received_t;
+
+static TEST_Received_t test_received[TEST_FRAME_COUNT];
+static volatile size_t test_received_count = 0;
+static volatile int test_active_fifo = -1;
+static volatile uint32_t test_fifo0_delay_cycles = 0;
+
+static CAN_ErrorCode_t test_errors[64];
+static volatile size_t test_error_count = 0;
+
+static volatile bool test_node_done = false;
+static volatile bool test_load_done = false;
+
+/* Callbacks of the HAL */
+void can_recv_callback(CAN_ReceivedFrame_t* frame) {
+    int interrupted = test_active_fifo;
+    test_active_fifo = frame->fifo;
+
+    TEST_ASSERT(test_received_count < TEST_FRAME_COUNT);
+    TEST_Received_t* received = &test_received[test_received_count++];
+    received->id = frame->frame.id;
+    received->fifo = frame->fifo;
+    received->filter_match = frame->filter_match;
+    received->dlc = frame->frame.dlc;
+    received->interrupted_fifo = interrupted;
+    can_read_frame_data(frame, received->data);
+
+    // A slow handler for FIFO 0, during which FIFO 1 may preempt it
+    if(frame->fifo == CAN_FIFO_0 && test_fifo0_delay_cycles > 0) sim_busy_wait_cycles(test_fifo0_delay_cycles);
+
+    test_active_fifo = interrupted;
+}
+
+void can_error_callback(CAN_ErrorCode_t error_code) {
+    if(test_error_count < sizeof(test_errors) / sizeof(*test_errors)) test_errors[test_error_count++] = error_code;
+}
+
+/* Helpers */
+static void test_can_setup(void) {
+    clock_configure64MHz();
+    gpio_enable_port_clocks();
+
+    PA11->mode = GPIO_MODE_ALTERNATE;
+    PA12->mode = GPIO_MODE_ALTERNATE;
+    PA11->alternate = 9;
+    PA12->alternate = 9;
+
+    can_init(TEST_BITRATE, CAN_TESTMODE_NONE);
+}
+
+static void test_accept_all(CAN_FIFO_t fifo) {
+    // A 32 bit mask without any bits set matches every frame
+    can_configure_filter_bank(CAN_FILTERBANK_0, fifo, CAN_FILTERBANK_WIDTH_32BIT, CAN_FILTERBANK_MODE_MASK, 0, 0);
+}
+
+static SIM_CANFrame_t test_frame(uint32_t id, uint32_t sequence) {
+    SIM_CANFrame_t frame = { .id = id, .dlc = 8 };
+    for(int i = 0; i < 4; i++) frame.data[i] = (uint8_t)(sequence >> (8 * i));
+    frame.data[7] = 0xA5;
+    return frame;
+}
+
+static uint32_t test_sequence(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static bool test_node_finished(void* context) {
+    return test_node_done;
+}
+
+static bool test_load_finished(void* context) {
+    return test_load_done;
+}
+
+static bool test_received_at_least(void* context) {
+    return test_received_count >= *(size_t*)context;
+}
+
+static SIM_Node_t* test_start_node(SIM_NodeEntry_t entry) {
+    sim_init();
+    sim_set_console_echo(false);
+    sim_can_set_bitrate(TEST_BITRATE);
+    return sim_node_create("node", entry, 0, 0);
+}
+
+/* Initialization */
+static void test_init_node(void* argument) {
+    test_can_setup();
+
+    // 64 MHz core and 32 MHz APB1, so 4 clocks per time quantum for 8 quanta per bit
+    TEST_ASSERT_EQUAL(64000000, SystemCoreClock);
+    TEST_ASSERT_EQUAL(3, READ_MASK_OFFSET(CAN->BTR, 0x3FF, CAN_BTR_BRP_Pos));
+    TEST_ASSERT_EQUAL(5, READ_MASK_OFFSET(CAN->BTR, 0xF, CAN_BTR_TS1_Pos));
+    TEST_ASSERT_EQUAL(0, READ_MASK_OFFSET(CAN->BTR, 0x7, CAN_BTR_TS2_Pos));
+    TEST_ASSERT(!READ_MASK(CAN->MSR, CAN_MSR_INAK));
+    TEST_ASSERT(READ_MASK(CAN->MCR, CAN_MCR_TXFP | CAN_MCR_RFLM | CAN_MCR_ABOM) == (CAN_MCR_TXFP | CAN_MCR_RFLM | CAN_MCR_ABOM));
+    TEST_ASSERT_EQUAL(CAN_TSR_TME, READ_MASK(CAN->TSR, CAN_TSR_TME));
+    TEST_ASSERT(can_tx_mailbox_available());
+
+    test_node_done = true;
+}
+
+static void test_init(void) {
+    SIM_Node_t* node = test_start_node(test_init_node);
+
+    TEST_ASSERT(sim_run_until(test_node_finished, 0, SIM_MS(100)));
+    TEST_ASSERT_EQUAL(64000000, sim_node_sysclk(node));
+}
+
+/* Transmission */
+static uint32_t test_transmitted[TEST_FRAME_COUNT];
+static size_t test_transmitted_count = 0;
+static SIM_Time_t test_first_start = 0;
+static SIM_Time_t test_last_end = 0;
+
+static void test_record_frame(const SIM_CANFrame_t* frame, SIM_Time_t start, SIM_Time_t end, void* context) {
+    if(test_transmitted_count < TEST_FRAME_COUNT) test_transmitted[test_transmitted_count] = test_sequence(frame->data);
+    if(test_transmitted_count == 0) test_first_start = start;
+    test_last_end = end;
+    test_transmitted_count++;
+}
+
+static void test_transmit_order_node(void* argument) {
+    test_can_setup();
+
+    // Descending identifiers, which would be reordered if the mailboxes went by identifier
+    for(uint32_t i = 0; i < TEST_FRAME_COUNT; i++) {
+        CAN_Frame_t frame = { .id = 0x7FF - (i % 0x700), .dlc = 8 };
+        memcpy(frame.data, &i, sizeof(i));
+        can_transmit_frame(&frame);
+    }
+
+    can_flush_tx_buffer();
+    test_node_done = true;
+}
+
+static bool test_all_transmitted(void* context) {
+    return test_node_done && test_transmitted_count == TEST_FRAME_COUNT;
+}
+
+static void test_transmit_order(void) {
+    test_start_node(test_transmit_order_node);
+    sim_can_peer_create(true);
+    sim_can_add_listener(test_record_frame, 0);
+
+    TEST_ASSERT(sim_run_until(test_all_transmitted, 0, SIM_S(1)));
+
+    for(uint32_t i = 0; i < TEST_FRAME_COUNT; i++) TEST_ASSERT_EQUAL(i, test_transmitted[i]);
+
+    // The queue keeps all three mailboxes filled, so the bus only pauses for the intermission
+    SIM_CANStatistics_t statistics = sim_can_statistics();
+    SIM_Time_t elapsed = test_last_end - test_first_start;
+    SIM_Time_t minimum = statistics.busy_time + (statistics.frames - 1) * 3 * sim_can_bit_time();
+    printf("%llu frames in %.3f ms, bus utilization %.1f %%\n",
+        (unsigned long long)statistics.frames, elapsed / 1e6, 100.0 * statistics.busy_time / elapsed);
+    TEST_ASSERT_EQUAL(TEST_FRAME_COUNT, statistics.frames);
+    TEST_ASSERT_EQUAL(minimum, elapsed);
+}
+
+/* Transmit rate */
+#define TEST_RATE_FRAMES 500
+#define TEST_REFERENCE_QUEUE_SIZE 32
+
+// Time during which a task masks the interrupts once per tick, in frames on the bus
+static const uint32_t test_rate_masked_frames[] = { 0, 2 };
+
+static volatile bool test_rate_go = false;
+static volatile bool test_rate_reference = false;
+static volatile uint32_t test_masked_cycles = 0;
+
+/*
+ * Previous transmit path, which loads a mailbox from the task if one is free and queues the frame
+ * otherwise, and which loads a single queued frame per transmit interrupt. It runs in the transmit
+ * callback, as the transmit queue of the HAL stays empty.
+ */
+fifo_declare_qualifier(CAN_Frame_t, test_reference_queue, TEST_REFERENCE_QUEUE_SIZE, static);
+
+static void test_reference_load(CAN_Frame_t* frame) {
+    critical_block {
+        uint8_t mailbox_id = READ_MASK_OFFSET(CAN->TSR, 0b11, CAN_TSR_CODE_Pos);
+        CAN_TxMailBox_TypeDef* mailbox = &(CAN->sTxMailBox[mailbox_id]);
+
+        WRITE_BIT(mailbox->TIR, CAN_TI0R_RTR_Pos, frame->rtr);
+        WRITE_BIT(mailbox->TIR, CAN_TI0R_IDE_Pos, frame->id_extended);
+        WRITE_MASK_OFFSET(mailbox->TIR, 0x7FFUL, frame->id, CAN_TI0R_STID_Pos);
+        WRITE_MASK_OFFSET(mailbox->TDTR, 0xF, frame->dlc, CAN_TDT0R_DLC_Pos);
+
+        uint32_t data[2];
+        memcpy(data, frame->data, sizeof(data));
+        mailbox->TDLR = data[0];
+        mailbox->TDHR = data[1];
+
+        SET_MASK(mailbox->TIR, CAN_TI0R_TXRQ);
+    }
+}
+
+static void test_reference_transmit(CAN_Frame_t* frame) {
+    if(READ_MASK(CAN->TSR, CAN_TSR_TME)) {
+        test_reference_load(frame);
+    } else {
+        fifo_put(test_reference_queue, *frame);
+    }
+}
+
+void can_tx_callback() {
+    if(!test_rate_reference) return;
+
+    critical_block {
+        if(!fifo_empty(test_reference_queue) && READ_MASK(CAN->TSR, CAN_TSR_TME)) {
+            CAN_Frame_t frame;
+            fifo_get(test_reference_queue, frame);
+            test_reference_load(&frame);
+        }
+    }
+}
+
+static void test_load_task(void* argument) {
+    while(1) {
+        vTaskDelay(1);
+        if(test_masked_cycles == 0) continue;
+
+        __disable_irq();
+        sim_busy_wait_cycles(test_masked_cycles);
+        __enable_irq();
+    }
+}
+
+static void test_transmit_rate_node(void* argument) {
+    test_can_setup();
+    TEST_ASSERT(xTaskCreate(test_load_task, "load", configMINIMAL_STACK_SIZE, 0, 2, 0) == pdPASS);
+    test_node_done = true;
+
+    while(1) {
+        while(!test_rate_go) vTaskDelay(1);
+
+        for(uint32_t i = 0; i < TEST_RATE_FRAMES; i++) {
+            CAN_Frame_t frame = { .id = 0x7FF - (i % 0x700), .dlc = 8 };
+            memcpy(frame.data, &i, sizeof(i));
+            if(test_rate_reference) {
+                test_reference_transmit(&frame);
+            } else {
+                can_transmit_frame(&frame);
+            }
+        }
+        test_rate_go = false;
+    }
+}
+
+static bool test_rate_transmitted(void* context) {
+    return !test_rate_go && test_transmitted_count == TEST_RATE_FRAMES;
+}
+
+static void test_transmit_rate(void) {
+    SIM_Node_t* node = test_start_node(test_transmit_rate_node);
+    sim_can_peer_create(true);
+    sim_can_add_listener(test_record_frame, 0);
+    TEST_ASSERT(sim_run_until(test_node_finished, 0, SIM_MS(100)));
+
+    SIM_Time_t frame_time = sim_can_frame_bits(&(SIM_CANFrame_t){ .dlc = 8 }) * sim_can_bit_time();
+    uint32_t frame_cycles = sim_can_frame_bits(&(SIM_CANFrame_t){ .dlc = 8 }) * (sim_node_sysclk(node) / TEST_BITRATE);
+    double rates[2][2];
+    uint32_t reordered[2][2];
+
+    printf("%14s %16s %12s %16s %12s\n", "masked[frames]", "previous[fr/s]", "reordered", "current[fr/s]", "reordered");
+    for(size_t load = 0; load < sizeof(test_rate_masked_frames) / sizeof(*test_rate_masked_frames); load++) {
+        for(int current = 0; current < 2; current++) {
+            test_masked_cycles = test_rate_masked_frames[load] * frame_cycles;
+            test_rate_reference = !current;
+            test_transmitted_count = 0;
+            test_rate_go = true;
+            TEST_ASSERT(sim_run_until(test_rate_transmitted, 0, SIM_S(1)));
+
+            // The previous path lets the task load a mailbox while frames are queued, which overtakes them
+            reordered[load][current] = 0;
+            for(uint32_t i = 1; i < TEST_RATE_FRAMES; i++) {
+                if(test_transmitted[i] < test_transmitted[i - 1]) reordered[load][current]++;
+            }
+            rates[load][current] = (TEST_RATE_FRAMES - 1) / ((test_last_end - test_first_start - frame_time) / 1e9);
+        }
+        printf("%14u %16.0f %12u %16.0f %12u\n", test_rate_masked_frames[load], rates[load][0], reordered[load][0],
+            rates[load][1], reordered[load][1]);
+    }
+
+    // Keeping all the mailboxes filled is never slower, and faster if the interrupts are delayed
+    double bus_rate = 1e9 / (frame_time + 3 * sim_can_bit_time());
+    TEST_ASSERT(rates[0][1] >= bus_rate * 0.99);
+    for(size_t load = 0; load < 2; load++) {
+        TEST_ASSERT(rates[load][1] >= rates[load][0]);
+        TEST_ASSERT_EQUAL(0, reordered[load][1]);
+    }
+    TEST_ASSERT(rates[1][1] > rates[1][0]);
+}
+
+/* Reception */
+#define TEST_BURST_FRAMES 200
+#define TEST_BLOCKED_FRAMES 8
+
+static void test_receive_burst_node(void* argument) {
+    test_can_setup();
+    test_accept_all(CAN_FIFO_0);
+    test_node_done = true;
+
+    // Wait until the burst is half done, then keep the interrupts disabled for a few frames
+    while(test_received_count < TEST_BURST_FRAMES / 2) vTaskDelay(1);
+
+    __disable_irq();
+    uint64_t frame_cycles = sim_can_frame_bits(&(SIM_CANFrame_t){ .dlc = 8 }) * (SystemCoreClock / TEST_BITRATE);
+    sim_busy_wait_cycles(TEST_BLOCKED_FRAMES * frame_cycles);
+    __enable_irq();
+}
+
+static void test_receive_burst(void) {
+    test_start_node(test_receive_burst_node);
+    SIM_CANPeer_t* peer = sim_can_peer_create(true);
+    TEST_ASSERT(sim_run_until(test_node_finished, 0, SIM_MS(100)));
+
+    for(uint32_t i = 0; i < TEST_BURST_FRAMES; i++) {
+        SIM_CANFrame_t frame = test_frame(0x123, i);
+        sim_can_peer_transmit(peer, &frame);
+    }
+    sim_run_for(SIM_MS(100));
+    TEST_ASSERT_EQUAL(0, sim_can_peer_pending(peer));
+
+    // The frames arriving while the FIFO was full are lost, the others are received in order
+    size_t lost = TEST_BURST_FRAMES - test_received_count;
+    TEST_ASSERT(lost > 0 && lost < TEST_BLOCKED_FRAMES);
+    uint32_t previous = 0;
+    for(size_t i = 0; i < test_received_count; i++) {
+        uint32_t sequence = test_sequence(test_received[i].data);
+        TEST_ASSERT_EQUAL(0x123, test_received[i].id);
+        TEST_ASSERT_EQUAL(8, test_received[i].dlc);
+        TEST_ASSERT_EQUAL(0xA5, test_received[i].data[7]);
+        TEST_ASSERT(i == 0 ? sequence == 0 : sequence > previous);
+        previous = sequence;
+    }
+    TEST_ASSERT_EQUAL(TEST_BURST_FRAMES - 1, previous);
+
+    // The interrupt after the blocked period drains the whole FIFO at once
+    CAN_FIFOStatistics_t statistics = can_get_fifo_statistics(CAN_FIFO_0);
+    TEST_ASSERT_EQUAL(test_received_count, statistics.frame_count);
+    TEST_ASSERT_EQUAL(3, statistics.max_frames_per_irq);
+    TEST_ASSERT_EQUAL(1, statistics.overrun_count);
+    TEST_ASSERT_EQUAL(0, can_get_fifo_statistics(CAN_FIFO_1).frame_count);
+    TEST_ASSERT_EQUAL(1, test_error_count);
+    TEST_ASSERT_EQUAL(CAN_ERR_FIFO0_OVERRUN, test_errors[0]);
+}
+
+/* Reception under load */
+#define TEST_LOAD_FRAMES 600
+#define TEST_LOAD_PERIODS 10
+
+// Time during which the interrupts are masked once per tick, in frames on the bus
+static const uint32_t test_load_masked_frames[] = { 0, 1, 2, 4 };
+#define TEST_LOAD_PHASES (sizeof(test_load_masked_frames) / sizeof(*test_load_masked_frames))
+
+typedef struct {
+    CAN_FIFOStatistics_t fifo;
+    uint64_t interrupts;
+} TEST_LoadResult_t;
+
+static TEST_LoadResult_t test_load_results[TEST_LOAD_PHASES];
+
+static void test_receive_load_node(void* argument) {
+    test_can_setup();
+    test_accept_all(CAN_FIFO_0);
+    test_node_done = true;
+
+    // A task masks the interrupts once per tick, like a driver with a long critical section
+    while(test_received_count == 0) vTaskDelay(1);
+    uint64_t frame_cycles = sim_can_frame_bits(&(SIM_CANFrame_t){ .dlc = 8 }) * (SystemCoreClock / TEST_BITRATE);
+
+    for(size_t phase = 0; phase < TEST_LOAD_PHASES; phase++) {
+        CAN_FIFOStatistics_t before = can_get_fifo_statistics(CAN_FIFO_0);
+        uint64_t interrupts = sim_node_interrupt_count(sim_node_current());
+
+        for(int period = 0; period < TEST_LOAD_PERIODS; period++) {
+            vTaskDelay(1);
+            __disable_irq();
+            sim_busy_wait_cycles(test_load_masked_frames[phase] * frame_cycles);
+            __enable_irq();
+        }
+        vTaskDelay(1);
+
+        CAN_FIFOStatistics_t after = can_get_fifo_statistics(CAN_FIFO_0);
+        test_load_results[phase] = (TEST_LoadResult_t){
+            .fifo = {
+                .irq_count = after.irq_count - before.irq_count,
+                .frame_count = after.frame_count - before.frame_count,
+                .max_frames_per_irq = after.max_frames_per_irq,
+                .overrun_count = after.overrun_count - before.overrun_count
+            },
+            .interrupts = sim_node_interrupt_count(sim_node_current()) - interrupts
+        };
+    }
+    test_load_done = true;
+}
+
+static void test_receive_load(void) {
+    SIM_Node_t* node = test_start_node(test_receive_load_node);
+    SIM_CANPeer_t* peer = sim_can_peer_create(true);
+    TEST_ASSERT(sim_run_until(test_node_finished, 0, SIM_MS(100)));
+
+    // Back-to-back frames, which outlast all the phases
+    for(uint32_t i = 0; i < TEST_LOAD_FRAMES; i++) {
+        SIM_CANFrame_t frame = test_frame(0x123, i);
+        sim_can_peer_transmit(peer, &frame);
+    }
+    TEST_ASSERT(sim_run_until(test_load_finished, 0, SIM_MS(200)));
+    TEST_ASSERT(sim_can_peer_pending(peer) > 0);
+    TEST_ASSERT(!sim_node_halted(node));
+
+    // An interrupt entry and exit cost 22 cycles in the model, the previous handlers took one per frame
+    printf("%14s %8s %8s %14s %14s %10s %14s\n", "masked[frames]", "frames", "IRQs", "frames per IRQ",
+        "max per IRQ", "overruns", "entries saved");
+    for(size_t phase = 0; phase < TEST_LOAD_PHASES; phase++) {
+        const CAN_FIFOStatistics_t* statistics = &test_load_results[phase].fifo;
+        printf("%14u %8u %8u %14.2f %14u %10u %14u\n", test_load_masked_frames[phase], statistics->frame_count,
+            statistics->irq_count, (double)statistics->frame_count / statistics->irq_count,
+            statistics->max_frames_per_irq, statistics->overrun_count, statistics->frame_count - statistics->irq_count);
+    }
+
+    for(size_t phase = 0; phase < TEST_LOAD_PHASES; phase++) {
+        const CAN_FIFOStatistics_t* statistics = &test_load_results[phase].fifo;
+        uint32_t masked = test_load_masked_frames[phase];
+
+        // Every frame pending after a masked period is read by a single interrupt
+        TEST_ASSERT(statistics->frame_count > 0);
+        TEST_ASSERT(statistics->irq_count <= test_load_results[phase].interrupts);
+        if(masked == 0) {
+            TEST_ASSERT_EQUAL(statistics->frame_count, statistics->irq_count);
+        } else if(masked < 3) {
+            TEST_ASSERT(statistics->frame_count - statistics->irq_count >= (masked - 1) * TEST_LOAD_PERIODS);
+        }
+
+        // The three mailboxes of the FIFO only overflow if the interrupts are masked for longer
+        if(masked < 3) {
+            TEST_ASSERT_EQUAL(0, statistics->overrun_count);
+        } else {
+            TEST_ASSERT_EQUAL(3, statistics->max_frames_per_irq);
+            TEST_ASSERT(statistics->overrun_count > 0);
+        }
+    }
+}
+
+/* Filters */
+static void test_filters_node(void* argument) {
+    test_can_setup();
+
+    // Bank 0: two 16 bit masks for the standard identifiers 0x100-0x10F and 0x200 into FIFO 0
+    can_configure_filter_bank(CAN_FILTERBANK_0, CAN_FIFO_0, CAN_FILTERBANK_WIDTH_16BIT, CAN_FILTERBANK_MODE_MASK,
+        (0x100 << 5) | ((0x7F0 << 5) << 16) | ((1 << 3) << 16),
+        (0x200 << 5) | ((0x7FF << 5) << 16) | ((1 << 3) << 16));
+
+    // Bank 1: a list of two extended identifiers into FIFO 1
+    can_configure_filter_bank(CAN_FILTERBANK_1, CAN_FIFO_1, CAN_FILTERBANK_WIDTH_32BIT, CAN_FILTERBANK_MODE_LIST,
+        (0x1234567 << 3) | (1 << 2),
+        (0x0ABCDEF << 3) | (1 << 2));
+
+    // Bank 2: a 32 bit mask for the standard identifiers 0x300-0x3FF into FIFO 0
+    can_configure_filter_bank(CAN_FILTERBANK_2, CAN_FIFO_0, CAN_FILTERBANK_WIDTH_32BIT, CAN_FILTERBANK_MODE_MASK,
+        0x300UL << 21,
+        (0x700UL << 21) | (1 << 2));
+
+    // Bank 3 is configured and disabled again
+    can_configure_filter_bank(CAN_FILTERBANK_3, CAN_FIFO_0, CAN_FILTERBANK_WIDTH_32BIT, CAN_FILTERBANK_MODE_MASK, 0, 0);
+    can_disable_filter_bank(CAN_FILTERBANK_3);
+
+    test_node_done = true;
+}
+
+static void test_filters(void) {
+    static const struct {
+        uint32_t id;
+        bool extended;
+        bool accepted;
+        CAN_FIFO_t fifo;
+        uint8_t filter_match;
+    } frames[] = {
+        { 0x105, false, true, CAN_FIFO_0, 0 },
+        { 0x10F, false, true, CAN_FIFO_0, 0 },
+        { 0x110, false, false },
+        { 0x200, false, true, CAN_FIFO_0, 1 },
+        { 0x201, false, false },
+        { 0x105, true, false },
+        { 0x1234567, true, true, CAN_FIFO_1, 0 },
+        { 0x0ABCDEF, true, true, CAN_FIFO_1, 1 },
+        { 0x0ABCDEE, true, false },
+        // Filter numbers go on after the two filters of bank 0
+        { 0x3A5, false, true, CAN_FIFO_0, 2 },
+        { 0x3A5, true, false },
+        { 0x7FF, false, false }
+    };
+    size_t count = sizeof(frames) / sizeof(*frames);
+
+    test_start_node(test_filters_node);
+    SIM_CANPeer_t* peer = sim_can_peer_create(true);
+    TEST_ASSERT(sim_run_until(test_node_finished, 0, SIM_MS(100)));
+
+    for(size_t i = 0; i < count; i++) {
+        SIM_CANFrame_t frame = test_frame(frames[i].id, i);
+        frame.extended = frames[i].extended;
+        sim_can_peer_transmit(peer, &frame);
+    }
+    sim_run_for(SIM_MS(10));
+
+    size_t received = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(!frames[i].accepted) continue;
+
+        TEST_ASSERT(received < test_received_count);
+        TEST_Received_t* frame = &test_received[received++];
+        TEST_ASSERT_EQUAL(i, test_sequence(frame->data));
+        TEST_ASSERT_EQUAL(frames[i].id, frame->id);
+        TEST_ASSERT_EQUAL(frames[i].fifo, frame->fifo);
+        TEST_ASSERT_EQUAL(frames[i].filter_match, frame->filter_match);
+    }
+    TEST_ASSERT_EQUAL(received, test_received_count);
+}
+
+/* Errors */
+static void test_acknowledgement_error_node(void* argument) {
+    test_can_setup();
+
+    CAN_Frame_t frame = { .id = 0x42, .dlc = 2, .data = { 1, 2 } };
+    can_transmit_frame(&frame);
+    test_node_done = true;
+}
+
+static void test_acknowledgement_error(void) {
+    test_start_node(test_acknowledgement_error_node);
+    sim_can_add_listener(test_record_frame, 0);
+    TEST_ASSERT(sim_run_until(test_node_finished, 0, SIM_MS(100)));
+
+    // Nobody acknowledges the frame, so it is retransmitted until a peer joins the bus
+    sim_run_for(SIM_MS(5));
+    TEST_ASSERT_EQUAL(0, test_transmitted_count);
+    TEST_ASSERT(sim_can_statistics().acknowledgement_errors > 16);
+    TEST_ASSERT(test_error_count > 0);
+    for(size_t i = 0; i < test_error_count; i++) TEST_ASSERT_EQUAL(CAN_ERR_ACKNOWLEDGEMENT_ERROR, test_errors[i]);
+
+    sim_can_peer_create(true);
+    sim_run_for(SIM_MS(1));
+    TEST_ASSERT_EQUAL(1, test_transmitted_count);
+    TEST_ASSERT_EQUAL(1, sim_can_statistics().frames);
+}
+
+static volatile bool test_timeout_result = true;
+static volatile SIM_Time_t test_timeout_wait = 0;
+static volatile bool test_masked_result = false;
+
+static void test_transmit_timeout_node(void* argument) {
+    test_can_setup();
+
+    // The three mailboxes and the queue take frames without waiting
+    uint32_t sequence = 0;
+    for(; sequence < 3 + 32; sequence++) {
+        CAN_Frame_t frame = { .id = 0x100, .dlc = 8 };
+        memcpy(frame.data, &sequence, sizeof(sequence));
+        TEST_ASSERT(can_transmit_frame(&frame));
+    }
+
+    // Nobody acknowledges the frames, so the next one gives up after a while
+    CAN_Frame_t frame = { .id = 0x100, .dlc = 8 };
+    memcpy(frame.data, &sequence, sizeof(sequence));
+    SIM_Time_t start = sim_now();
+    test_timeout_result = can_transmit_frame(&frame);
+    test_timeout_wait = sim_now() - start;
+    test_node_done = true;
+
+    // A peer joins while this waits with the interrupts masked, so the mailboxes are refilled here
+    critical_block {
+        test_masked_result = can_transmit_frame(&frame);
+    }
+    can_flush_tx_buffer();
+    test_load_done = true;
+}
+
+static void test_transmit_timeout(void) {
+    test_start_node(test_transmit_timeout_node);
+    sim_can_add_listener(test_record_frame, 0);
+    TEST_ASSERT(sim_run_until(test_node_finished, 0, SIM_MS(200)));
+    printf("A full queue gave up after %.1f ms\n", test_timeout_wait / 1e6);
+    TEST_ASSERT(!test_timeout_result);
+    TEST_ASSERT(test_timeout_wait > SIM_MS(1));
+    TEST_ASSERT(test_timeout_wait < SIM_MS(100));
+
+    sim_can_peer_create(true);
+    TEST_ASSERT(sim_run_until(test_load_finished, 0, SIM_MS(100)));
+    sim_run_for(SIM_MS(1));
+    TEST_ASSERT(test_masked_result);
+
+    // Every queued frame has been transmitted in order, the one which timed out only once
+    TEST_ASSERT_EQUAL(3 + 32 + 1, test_transmitted_count);
+    for(uint32_t i = 0; i < test_transmitted_count; i++) TEST_ASSERT_EQUAL(i, test_transmitted[i]);
+}
+
+/* Priorities of the FIFOs */
+static void test_fifo_priority_node(void* argument) {
+    test_can_setup();
+
+    // FIFO 1 preempts FIFO 0, whose handler takes as long as three frames
+    can_set_fifo_priority(CAN_FIFO_0, 12);
+    can_set_fifo_priority(CAN_FIFO_1, 6);
+    test_fifo0_delay_cycles = 3 * 150 * (SystemCoreClock / TEST_BITRATE);
+
+    can_configure_filter_bank(CAN_FILTERBANK_0, CAN_FIFO_0, CAN_FILTERBANK_WIDTH_32BIT, CAN_FILTERBANK_MODE_MASK,
+        0x100UL << 21, 0x7FFUL << 21);
+    can_configure_filter_bank(CAN_FILTERBANK_1, CAN_FIFO_1, CAN_FILTERBANK_WIDTH_32BIT, CAN_FILTERBANK_MODE_MASK,
+        0x080UL << 21, 0x7FFUL << 21);
+
+    test_node_done = true;
+}
+
+static void test_fifo_priority(void) {
+    test_start_node(test_fifo_priority_node);
+    SIM_CANPeer_t* peer = sim_can_peer_create(true);
+    TEST_ASSERT(sim_run_until(test_node_finished, 0, SIM_MS(100)));
+
+    SIM_CANFrame_t low = test_frame(0x100, 0);
+    SIM_CANFrame_t high = test_frame(0x080, 1);
+    sim_can_peer_transmit(peer, &low);
+    sim_can_peer_transmit(peer, &high);
+
+    size_t expected = 2;
+    TEST_ASSERT(sim_run_until(test_received_at_least, &expected, SIM_MS(10)));
+
+    // The frame of FIFO 1 is handled while the handler of FIFO 0 is still running
+    TEST_ASSERT_EQUAL(CAN_FIFO_0, test_received[0].fifo);
+    TEST_ASSERT_EQUAL(-1, test_received[0].interrupted_fifo);
+    TEST_ASSERT_EQUAL(CAN_FIFO_1, test_received[1].fifo);
+    TEST_ASSERT_EQUAL(CAN_FIFO_0, test_received[1].interrupted_fifo);
+}
+
+TEST_MAIN(
+    TEST_CASE(init),
+    TEST_CASE(transmit_order),
+    TEST_CASE(transmit_rate),
+    TEST_CASE(receive_burst),
+    TEST_CASE(receive_load),
+    TEST_CASE(filters),
+    TEST_CASE(acknowledgement_error),
+    TEST_CASE(transmit_timeout),
+    TEST_CASE(fifo_priority)
+)
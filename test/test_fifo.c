@@ -0,0 +1,176 @@
+/**
+ * @file test_fifo.c
+ * @author Gabriel Heinzer
+ * @brief Benchmarks the inlined FIFO operations against out-of-line ones, which copy the elements
+ * with the element size of the FIFO and wrap the indices with a modulo like the FIFO used to.
+ *
+ * The cycles are counted with the time stamp counter of the host, as the peripheral model doesn't
+ * charge plain computations. The file is compiled with optimization in every build type, and it
+ * defines the critical sections itself, so it runs without a node and without the library.
+ *
+ * Besides elements of a few sizes, the benchmark moves the elements of the transmit paths, i.e. the
+ * CAN_Frame_t of the bxCAN transmit queue and the KC_Transmit_Request_t of the knabberCAN transmit
+ * FIFO. The receive paths pass their frames through the lock-free rings, see test_ring.c.
+ */
+
+#include "test.h"
+// Before the device header, whose register qualifiers clash with the intrinsics
+#include <x86intrin.h>
+#include <knabberkiste/util/fifo.h>
+#include <knabberkiste/hal/bxcan.h>
+#include <knabberkiste/knabbercan.h>
+
+#define TEST_FIFO_SIZE 16
+#define TEST_ITERATIONS 100000
+#define TEST_REPETITIONS 5
+
+// Allows for timing noise. On x86-64, the inlined operations take about a third fewer cycles
+#define TEST_TOLERANCE 1.05
+
+/* Critical sections like on the target, where masking the interrupts is a single instruction */
+static volatile uint32_t test_critical_depth = 0;
+
+__attribute__((noinline))
+void critical_enter() {
+    test_critical_depth++;
+}
+
+__attribute__((noinline))
+void critical_exit() {
+    test_critical_depth--;
+}
+
+/* Previous implementation, whose element size is only known at runtime */
+__attribute__((noinline))
+static void test_reference_put(volatile _FIFO_t* fifo, const void* element) {
+    while(fifo->_count == fifo->_fifo_size);
+    critical_enter();
+    fifo->_end = (fifo->_end + 1) % fifo->_fifo_size;
+    memcpy((uint8_t*)fifo->_buf + fifo->_element_size * fifo->_end, element, fifo->_element_size);
+    fifo->_count++;
+    critical_exit();
+}
+
+__attribute__((noinline))
+static void test_reference_get(volatile _FIFO_t* fifo, void* element) {
+    while(fifo->_count == 0);
+    critical_enter();
+    fifo->_start = (fifo->_start + 1) % fifo->_fifo_size;
+    memcpy(element, (const uint8_t*)fifo->_buf + fifo->_element_size * fifo->_start, fifo->_element_size);
+    fifo->_count--;
+    critical_exit();
+}
+
+typedef struct {
+    const char* name;
+    size_t element_size;
+    double inline_cycles;
+    double reference_cycles;
+} TEST_Result_t;
+
+/**
+ * @brief Defines test_benchmark_<label>(), which measures the cycles of putting and getting an
+ * element of @p type with both implementations, the best of a few runs each.
+ */
+#define TEST_BENCHMARK(label, type) \
+    fifo_declare_qualifier(type, test_fifo_##label, TEST_FIFO_SIZE, static); \
+    \
+    static TEST_Result_t test_benchmark_##label(void) { \
+        TEST_Result_t result = { .name = #label, .element_size = sizeof(type) }; \
+        type element; \
+        uint8_t* bytes = (uint8_t*)&element; \
+        uint32_t inline_checksum = 0; \
+        uint32_t reference_checksum = 0; \
+        memset(&element, 0, sizeof(element)); \
+        \
+        for(int repetition = 0; repetition < TEST_REPETITIONS; repetition++) { \
+            uint64_t start = __rdtsc(); \
+            for(uint32_t i = 0; i < TEST_ITERATIONS; i++) { \
+                bytes[0] = (uint8_t)i; \
+                fifo_put(test_fifo_##label, element); \
+                fifo_get(test_fifo_##label, element); \
+                inline_checksum += bytes[sizeof(type) - 1] + bytes[0]; \
+            } \
+            double cycles = (double)(__rdtsc() - start) / TEST_ITERATIONS; \
+            if(repetition == 0 || cycles < result.inline_cycles) result.inline_cycles = cycles; \
+            \
+            start = __rdtsc(); \
+            for(uint32_t i = 0; i < TEST_ITERATIONS; i++) { \
+                bytes[0] = (uint8_t)i; \
+                test_reference_put((_FIFO_t*)&test_fifo_##label, &element); \
+                test_reference_get((_FIFO_t*)&test_fifo_##label, &element); \
+                reference_checksum += bytes[sizeof(type) - 1] + bytes[0]; \
+            } \
+            cycles = (double)(__rdtsc() - start) / TEST_ITERATIONS; \
+            if(repetition == 0 || cycles < result.reference_cycles) result.reference_cycles = cycles; \
+        } \
+        \
+        /* Both implementations moved the same elements through the FIFO */ \
+        TEST_ASSERT_EQUAL(inline_checksum, reference_checksum); \
+        TEST_ASSERT(fifo_empty(test_fifo_##label)); \
+        return result; \
+    }
+
+typedef struct { uint8_t bytes[1]; } TEST_Bytes_1_t;
+typedef struct { uint8_t bytes[4]; } TEST_Bytes_4_t;
+typedef struct { uint8_t bytes[16]; } TEST_Bytes_16_t;
+typedef struct { uint8_t bytes[64]; } TEST_Bytes_64_t;
+
+TEST_BENCHMARK(bytes_1, TEST_Bytes_1_t)
+TEST_BENCHMARK(bytes_4, TEST_Bytes_4_t)
+TEST_BENCHMARK(bytes_16, TEST_Bytes_16_t)
+TEST_BENCHMARK(bytes_64, TEST_Bytes_64_t)
+TEST_BENCHMARK(can_frame, CAN_Frame_t)
+TEST_BENCHMARK(kc_transmit, KC_Transmit_Request_t)
+
+/* Test cases */
+static void test_cycles(void) {
+    TEST_Result_t results[] = {
+        test_benchmark_bytes_1(),
+        test_benchmark_bytes_4(),
+        test_benchmark_bytes_16(),
+        test_benchmark_bytes_64(),
+        test_benchmark_can_frame(),
+        test_benchmark_kc_transmit()
+    };
+
+    printf("%12s %8s %14s %14s\n", "element", "bytes", "inline", "out of line");
+    for(size_t i = 0; i < sizeof(results) / sizeof(*results); i++) {
+        printf("%12s %8zu %14.1f %14.1f\n", results[i].name, results[i].element_size, results[i].inline_cycles, results[i].reference_cycles);
+    }
+
+    // Cycles of a put and a get, which must not be slower than the previous implementation
+    for(size_t i = 0; i < sizeof(results) / sizeof(*results); i++) {
+        if(results[i].inline_cycles > results[i].reference_cycles * TEST_TOLERANCE) {
+            TEST_FAIL("Inlined operations on %zu-byte elements take %.1f cycles, out-of-line ones %.1f.",
+                results[i].element_size, results[i].inline_cycles, results[i].reference_cycles);
+        }
+    }
+}
+
+static void test_untyped(void) {
+    // A FIFO embedded into a structure, like the transmit FIFO of a knabberCAN context
+    static volatile uint32_t buf[4];
+    static struct {
+        volatile _FIFO_t fifo;
+    } holder = { .fifo = _FIFO_INITIALIZER(uint32_t, 4, buf) };
+
+    uint32_t value = 0x11223344;
+    TEST_ASSERT(fifo_try_put(holder.fifo, value));
+    value = 0;
+    TEST_ASSERT(fifo_try_get(holder.fifo, value));
+    TEST_ASSERT_EQUAL(0x11223344, value);
+
+    // Elements of another size are copied with the element size of the FIFO, like before
+    uint64_t wide = 0x5566778811223344;
+    fifo_put(holder.fifo, wide);
+    value = 0;
+    fifo_get(holder.fifo, value);
+    TEST_ASSERT_EQUAL(0x11223344, value);
+    TEST_ASSERT(fifo_empty(holder.fifo));
+}
+
+TEST_MAIN(
+    TEST_CASE(cycles),
+    TEST_CASE(untyped)
+)
@@ -0,0 +1,323 @@
+/**
+ * @file test_filter_compiler.c
+ * @author Gabriel Heinzer
+ * @brief Tests the filter compiler, on its own and through the acceptance filters which knabberCAN
+ * configures with it.
+ */
+
+#include "test.h"
+#include <sim.h>
+#include <knabberkiste/util/filter_compiler.h>
+#include <knabberkiste/knabbercan.h>
+#include <knabberkiste/hal/bxcan.h>
+#include <knabberkiste/sys.h>
+#include <knabberkiste/io.h>
+
+#define TEST_MAX_KEYS 64
+#define TEST_RANDOM_SETS 200
+
+// Filter banks available for broadcast frames, the first bank is reserved for the node address
+#define TEST_BROADCAST_BANKS (CAN_FILTERBANK_COUNT - 1)
+
+// Bits of the knabberCAN identifier which make up the keys, i.e. the frame type and the transaction ID
+#define TEST_KC_KEY(frame_type, tid) ((uint32_t)(frame_type) << 27 | (uint32_t)(tid) << 14)
+#define TEST_KC_KEY_MASK TEST_KC_KEY(0x3, 0xFF)
+
+/* Helpers */
+static bool test_accepted(const FilterPattern_t* patterns, size_t pattern_count, uint32_t key) {
+    for(size_t i = 0; i < pattern_count; i++) {
+        if(filter_pattern_matches(patterns[i], key)) return true;
+    }
+    return false;
+}
+
+static void test_check_compiled(const uint32_t* keys, size_t key_count, uint32_t key_mask, size_t max_patterns) {
+    FilterPattern_t patterns[TEST_MAX_KEYS];
+    for(size_t i = 0; i < key_count; i++) patterns[i] = (FilterPattern_t){ .value = keys[i], .mask = key_mask };
+
+    size_t pattern_count = filter_compile(patterns, key_count, key_mask, max_patterns);
+
+    TEST_ASSERT(pattern_count <= max_patterns);
+    TEST_ASSERT(pattern_count <= key_count);
+    for(size_t i = 0; i < pattern_count; i++) {
+        TEST_ASSERT_EQUAL(0, patterns[i].mask & ~key_mask);
+        TEST_ASSERT_EQUAL(patterns[i].value, patterns[i].value & patterns[i].mask);
+    }
+    for(size_t i = 0; i < key_count; i++) {
+        if(!test_accepted(patterns, pattern_count, keys[i])) TEST_FAIL("Key 0x%08x isn't accepted.", keys[i]);
+    }
+}
+
+/* Compiler */
+static void test_exact(void) {
+    // Keys which fit into the budget are accepted exactly
+    uint32_t keys[] = { 0x10, 0x11, 0x12, 0x40 };
+    FilterPattern_t patterns[4];
+    for(size_t i = 0; i < 4; i++) patterns[i] = (FilterPattern_t){ .value = keys[i], .mask = 0xFF };
+
+    TEST_ASSERT_EQUAL(4, filter_compile(patterns, 4, 0xFF, 4));
+    for(size_t i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL(keys[i], patterns[i].value);
+        TEST_ASSERT_EQUAL(0xFF, patterns[i].mask);
+    }
+
+    for(uint32_t key = 0; key <= 0xFF; key++) {
+        bool defined = key == 0x10 || key == 0x11 || key == 0x12 || key == 0x40;
+        TEST_ASSERT_EQUAL(defined, test_accepted(patterns, 4, key));
+    }
+}
+
+static void test_merge(void) {
+    // 0x10 and 0x11 differ in a single bit, so merging them costs nothing
+    FilterPattern_t patterns[] = {
+        { .value = 0x10, .mask = 0xFF },
+        { .value = 0x11, .mask = 0xFF },
+        { .value = 0x12, .mask = 0xFF },
+        { .value = 0x40, .mask = 0xFF }
+    };
+
+    TEST_ASSERT_EQUAL(3, filter_compile(patterns, 4, 0xFF, 3));
+    TEST_ASSERT(test_accepted(patterns, 3, 0x10));
+    TEST_ASSERT(test_accepted(patterns, 3, 0x11));
+    TEST_ASSERT(test_accepted(patterns, 3, 0x12));
+    TEST_ASSERT(test_accepted(patterns, 3, 0x40));
+
+    size_t accepted = 0;
+    for(uint32_t key = 0; key <= 0xFF; key++) accepted += test_accepted(patterns, 3, key);
+    TEST_ASSERT_EQUAL(4, accepted);
+
+    // A single pattern accepts everything the keys have in common
+    TEST_ASSERT_EQUAL(1, filter_compile(patterns, 3, 0xFF, 1));
+    TEST_ASSERT_EQUAL(0x00, patterns[0].value);
+    TEST_ASSERT_EQUAL(0xAC, patterns[0].mask);
+}
+
+static void test_duplicates(void) {
+    // Duplicates and patterns contained in others are dropped even if they fit into the budget
+    FilterPattern_t patterns[] = {
+        { .value = 0x20, .mask = 0xFF },
+        { .value = 0x20, .mask = 0xFF },
+        { .value = 0x30, .mask = 0xF0 },
+        { .value = 0x35, .mask = 0xFF },
+        { .value = 0x20, .mask = 0xFF }
+    };
+
+    TEST_ASSERT_EQUAL(2, filter_compile(patterns, 5, 0xFF, 5));
+    TEST_ASSERT(test_accepted(patterns, 2, 0x20));
+    TEST_ASSERT(test_accepted(patterns, 2, 0x35));
+    TEST_ASSERT(test_accepted(patterns, 2, 0x3F));
+    TEST_ASSERT(!test_accepted(patterns, 2, 0x21));
+}
+
+static void test_budget(void) {
+    // Random key sets, each compiled for every budget
+    srand(1);
+    for(int set = 0; set < TEST_RANDOM_SETS; set++) {
+        uint32_t keys[TEST_MAX_KEYS];
+        size_t key_count = 1 + rand() % TEST_MAX_KEYS;
+        for(size_t i = 0; i < key_count; i++) {
+            keys[i] = TEST_KC_KEY(rand() % 4, rand() % 256);
+        }
+
+        for(size_t max_patterns = 1; max_patterns <= TEST_BROADCAST_BANKS; max_patterns++) {
+            test_check_compiled(keys, key_count, TEST_KC_KEY_MASK, max_patterns);
+        }
+    }
+}
+
+static uint64_t test_accepted_count(const FilterPattern_t* patterns, size_t pattern_count) {
+    // The keys are the frame type and the transaction ID, which are few enough to enumerate
+    uint64_t count = 0;
+    for(uint32_t frame_type = 0; frame_type < 4; frame_type++) {
+        for(uint32_t tid = 0; tid < 256; tid++) {
+            if(test_accepted(patterns, pattern_count, TEST_KC_KEY(frame_type, tid))) count++;
+        }
+    }
+    return count;
+}
+
+static void test_buffered(void) {
+    // knabberCAN compiles its keys in a buffer of twice the banks, which is compiled whenever it runs full
+    const size_t buffer_size = 2 * TEST_BROADCAST_BANKS;
+    uint64_t batch_accepted = 0;
+    uint64_t buffered_accepted = 0;
+
+    srand(2);
+    for(int set = 0; set < TEST_RANDOM_SETS; set++) {
+        uint32_t keys[TEST_MAX_KEYS];
+        size_t key_count = 1 + rand() % TEST_MAX_KEYS;
+        for(size_t i = 0; i < key_count; i++) keys[i] = TEST_KC_KEY(rand() % 4, rand() % 256);
+
+        FilterPattern_t batch[TEST_MAX_KEYS];
+        for(size_t i = 0; i < key_count; i++) batch[i] = (FilterPattern_t){ .value = keys[i], .mask = TEST_KC_KEY_MASK };
+        size_t batch_count = filter_compile(batch, key_count, TEST_KC_KEY_MASK, TEST_BROADCAST_BANKS);
+
+        FilterPattern_t buffered[2 * TEST_BROADCAST_BANKS];
+        size_t buffered_count = 0;
+        for(size_t i = 0; i < key_count; i++) {
+            if(buffered_count == buffer_size) {
+                buffered_count = filter_compile(buffered, buffered_count, TEST_KC_KEY_MASK, TEST_BROADCAST_BANKS);
+            }
+            buffered[buffered_count++] = (FilterPattern_t){ .value = keys[i], .mask = TEST_KC_KEY_MASK };
+        }
+        buffered_count = filter_compile(buffered, buffered_count, TEST_KC_KEY_MASK, TEST_BROADCAST_BANKS);
+
+        TEST_ASSERT(buffered_count <= TEST_BROADCAST_BANKS);
+        for(size_t i = 0; i < key_count; i++) {
+            if(!test_accepted(buffered, buffered_count, keys[i])) TEST_FAIL("Key 0x%08x isn't accepted.", keys[i]);
+        }
+        batch_accepted += test_accepted_count(batch, batch_count);
+        buffered_accepted += test_accepted_count(buffered, buffered_count);
+    }
+
+    printf("accepted keys per set: %.1f compiled at once, %.1f buffered\n",
+        (double)batch_accepted / TEST_RANDOM_SETS, (double)buffered_accepted / TEST_RANDOM_SETS);
+
+    // Merging in rounds lets through a few more keys than merging all of them at once
+    TEST_ASSERT(buffered_accepted * 4 <= batch_accepted * 5);
+}
+
+static void test_knabbercan_keys(void) {
+    // The pre-defined events and commands, a block of application events and a few commands
+    uint32_t keys[TEST_MAX_KEYS];
+    size_t key_count = 0;
+    const uint8_t internal_events[] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x10 };
+    const uint8_t internal_commands[] = { 0x00, 0x10, 0x11, 0x12, 0x20, 0x21 };
+
+    for(size_t i = 0; i < sizeof(internal_events); i++) keys[key_count++] = TEST_KC_KEY(KC_FRAMETYPE_EVENT, internal_events[i]);
+    for(size_t i = 0; i < sizeof(internal_commands); i++) keys[key_count++] = TEST_KC_KEY(KC_FRAMETYPE_COMMAND, internal_commands[i]);
+    for(uint8_t tid = 0x20; tid < 0x40; tid++) keys[key_count++] = TEST_KC_KEY(KC_FRAMETYPE_EVENT, tid);
+    keys[key_count++] = TEST_KC_KEY(KC_FRAMETYPE_COMMAND, 0x40);
+    keys[key_count++] = TEST_KC_KEY(KC_FRAMETYPE_COMMAND, 0x41);
+    keys[key_count++] = TEST_KC_KEY(KC_FRAMETYPE_ERROR, 0x00);
+
+    test_check_compiled(keys, key_count, TEST_KC_KEY_MASK, TEST_BROADCAST_BANKS);
+}
+
+/* knabberCAN */
+#define TEST_SENDER 5
+#define TEST_APP_EVENT_FIRST 0x20
+#define TEST_APP_EVENT_COUNT 32
+#define TEST_RUNTIME_EVENT 0x90
+#define TEST_UNDEFINED_EVENT_FIRST 0x80
+#define TEST_UNDEFINED_EVENT_COUNT 16
+
+static const uint8_t test_app_commands[] = { 0x40, 0x41, 0x60 };
+
+static volatile uint32_t test_event_calls[256];
+static volatile uint32_t test_command_calls[256];
+static volatile bool test_node_ready = false;
+static volatile uint32_t test_enabled_banks = 0;
+
+static void test_on_event(KC_Received_EventFrame_t event_frame) {
+    test_event_calls[event_frame.event_id]++;
+}
+
+static KC_Response_t test_on_command(KC_Received_CommandFrame_t command_frame) {
+    test_command_calls[command_frame.command_id]++;
+    return (KC_Response_t){ .payload = 0, .payload_size = 0 };
+}
+
+#define TEST_EVENT_HANDLER(offset) KC_EVENT_HANDLER(TEST_APP_EVENT_FIRST + (offset), test_on_event)
+#define TEST_EVENT_HANDLERS_8(offset) \
+    TEST_EVENT_HANDLER(offset), TEST_EVENT_HANDLER(offset + 1), TEST_EVENT_HANDLER(offset + 2), TEST_EVENT_HANDLER(offset + 3), \
+    TEST_EVENT_HANDLER(offset + 4), TEST_EVENT_HANDLER(offset + 5), TEST_EVENT_HANDLER(offset + 6), TEST_EVENT_HANDLER(offset + 7)
+
+kc_handler_table_declare(kc_default_handler_table,
+    TEST_EVENT_HANDLERS_8(0),
+    TEST_EVENT_HANDLERS_8(8),
+    TEST_EVENT_HANDLERS_8(16),
+    TEST_EVENT_HANDLERS_8(24),
+    KC_COMMAND_HANDLER(0x40, test_on_command),
+    KC_COMMAND_HANDLER(0x41, test_on_command),
+    KC_COMMAND_HANDLER(0x60, test_on_command)
+);
+
+static void test_knabbercan_node(void* argument) {
+    sys_init();
+    kc_dispatcher_start(&kc_default_context, 2);
+    while(kc_get_state(&kc_default_context) != KC_STATE_READY) vTaskDelay(1);
+
+    // Defining an event at runtime recompiles the filters
+    kc_event_define(&kc_default_context, TEST_RUNTIME_EVENT, test_on_event);
+
+    test_enabled_banks = CAN->FA1R;
+    test_node_ready = true;
+
+    while(1) vTaskDelay(100);
+}
+
+static bool test_knabbercan_ready(void* context) {
+    return test_node_ready;
+}
+
+static bool test_knabbercan_dispatched(void* context) {
+    uint32_t calls = 0;
+    for(size_t i = 0; i < 256; i++) calls += test_event_calls[i] + test_command_calls[i];
+    return calls >= *(uint32_t*)context;
+}
+
+static void test_broadcast(SIM_CANPeer_t* peer, KC_FrameType_t frame_type, uint8_t tid) {
+    // Single frame transaction from TEST_SENDER to the broadcast address
+    KC_Identifier_t identifier = { .value = 0 };
+    identifier.components.frame_type = frame_type;
+    identifier.components.first = true;
+    identifier.components.last = true;
+    identifier.components.transaction_id = tid;
+    identifier.components.sender_address = TEST_SENDER;
+    identifier.components.receiver_address = KC_ADDRESS_BROADCAST;
+
+    SIM_CANFrame_t frame = { .id = identifier.value, .extended = true, .dlc = 0 };
+    sim_can_peer_transmit(peer, &frame);
+}
+
+static void test_knabbercan_acceptance(void) {
+    sim_init();
+    sim_set_console_echo(false);
+    SIM_CANPeer_t* peer = sim_can_peer_create(true);
+    sim_node_create("node", test_knabbercan_node, 0, 0);
+
+    TEST_ASSERT(sim_run_until(test_knabbercan_ready, 0, SIM_S(1)));
+    TEST_ASSERT_EQUAL(KC_STATE_READY, kc_get_state(&kc_default_context));
+
+    // The node filter and at most all the other banks are in use
+    TEST_ASSERT(test_enabled_banks & 1);
+    TEST_ASSERT(test_enabled_banks < 1UL << CAN_FILTERBANK_COUNT);
+    KC_ReceiveStatistics_t before = kc_get_receive_statistics(&kc_default_context);
+
+    // Every defined event and command, and a block of undefined events
+    uint32_t expected = 0;
+    for(uint8_t i = 0; i < TEST_APP_EVENT_COUNT; i++, expected++) {
+        test_broadcast(peer, KC_FRAMETYPE_EVENT, TEST_APP_EVENT_FIRST + i);
+    }
+    test_broadcast(peer, KC_FRAMETYPE_EVENT, TEST_RUNTIME_EVENT);
+    expected++;
+    for(size_t i = 0; i < sizeof(test_app_commands); i++, expected++) {
+        test_broadcast(peer, KC_FRAMETYPE_COMMAND, test_app_commands[i]);
+    }
+    for(uint8_t i = 0; i < TEST_UNDEFINED_EVENT_COUNT; i++) {
+        test_broadcast(peer, KC_FRAMETYPE_EVENT, TEST_UNDEFINED_EVENT_FIRST + i);
+    }
+
+    TEST_ASSERT(sim_run_until(test_knabbercan_dispatched, &expected, SIM_MS(100)));
+    sim_run_for(SIM_MS(20));
+    TEST_ASSERT_EQUAL(0, sim_can_peer_pending(peer));
+
+    for(uint8_t i = 0; i < TEST_APP_EVENT_COUNT; i++) TEST_ASSERT_EQUAL(1, test_event_calls[TEST_APP_EVENT_FIRST + i]);
+    TEST_ASSERT_EQUAL(1, test_event_calls[TEST_RUNTIME_EVENT]);
+    for(size_t i = 0; i < sizeof(test_app_commands); i++) TEST_ASSERT_EQUAL(1, test_command_calls[test_app_commands[i]]);
+
+    // The undefined events have been rejected by the filters, so only the defined messages were received
+    KC_ReceiveStatistics_t after = kc_get_receive_statistics(&kc_default_context);
+    TEST_ASSERT_EQUAL(expected, after.received_messages - before.received_messages);
+}
+
+TEST_MAIN(
+    TEST_CASE(exact),
+    TEST_CASE(merge),
+    TEST_CASE(duplicates),
+    TEST_CASE(budget),
+    TEST_CASE(buffered),
+    TEST_CASE(knabbercan_keys),
+    TEST_CASE(knabbercan_acceptance)
+)
@@ -0,0 +1,309 @@
+/**
+ * @file test_flash_writer.c
+ * @author Gabriel Heinzer
+ * @brief Tests the flash writer and the installation of firmware updates against flash regions in RAM,
+ * which check the order of erasing and programming like the real flash would.
+ */
+
+#include "test.h"
+#include <knabberkiste/fwupdate.h>
+#include <knabberkiste/util/error.h>
+#include <knabberkiste/util/flash_writer.h>
+
+#define TEST_PAGE_SIZE 64
+#define TEST_PAGE_COUNT 8
+#define TEST_FLASH_SIZE (TEST_PAGE_SIZE * TEST_PAGE_COUNT)
+#define TEST_ERASE_POLLS 4
+#define TEST_NO_PAGE ((size_t)-1)
+
+// Odd, so the last chunk is padded, and chunks cross page boundaries like the update chunks do
+#define TEST_IMAGE_SIZE 401
+#define TEST_CHUNK_SIZE FW_CHUNK_SIZE
+#define TEST_CHUNK_COUNT ((TEST_IMAGE_SIZE + TEST_CHUNK_SIZE - 1) / TEST_CHUNK_SIZE)
+
+#define TEST_TRAILER_MAGIC 0x4B465755
+
+/**
+ * @brief Flash region in RAM. Erasing takes a few calls of busy(), and pages which are neither
+ * erased nor programmed hold zeros rather than 0xFF.
+ */
+typedef struct {
+    uint8_t data[TEST_FLASH_SIZE];
+    bool erased[TEST_PAGE_COUNT];
+    size_t erase_order[TEST_PAGE_COUNT * 2];
+    size_t erase_count;
+    size_t erasing_page;
+    int busy_polls;
+    long highest_programmed_page;
+    size_t programs_during_erase;
+} TEST_Flash_t;
+
+/* Trailer written by the update service, see fwupdate.c */
+typedef struct __attribute__((__packed__)) {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t crc;
+} TEST_Trailer_t;
+
+static void test_flash_erase_start(size_t page, void* context) {
+    TEST_Flash_t* flash = context;
+
+    TEST_ASSERT(page < TEST_PAGE_COUNT);
+    if(flash->erasing_page != TEST_NO_PAGE) TEST_FAIL("Page %zu erased while page %zu is still erasing.", page, flash->erasing_page);
+
+    flash->erased[page] = false;
+    flash->erasing_page = page;
+    flash->busy_polls = TEST_ERASE_POLLS;
+    flash->erase_order[flash->erase_count++] = page;
+}
+
+static bool test_flash_busy(void* context) {
+    TEST_Flash_t* flash = context;
+
+    if(flash->erasing_page == TEST_NO_PAGE) return false;
+    if(--flash->busy_polls > 0) return true;
+
+    memset(&flash->data[flash->erasing_page * TEST_PAGE_SIZE], 0xFF, TEST_PAGE_SIZE);
+    flash->erased[flash->erasing_page] = true;
+    flash->erasing_page = TEST_NO_PAGE;
+    return false;
+}
+
+static void test_flash_program(size_t offset, const uint8_t* data, size_t size, void* context) {
+    TEST_Flash_t* flash = context;
+
+    TEST_ASSERT(offset % 2 == 0 && size % 2 == 0);
+    TEST_ASSERT(offset + size <= TEST_FLASH_SIZE);
+    if(flash->erasing_page != TEST_NO_PAGE) flash->programs_during_erase++;
+
+    for(size_t i = offset; i < offset + size; i += 2) {
+        size_t page = i / TEST_PAGE_SIZE;
+        if(!flash->erased[page]) TEST_FAIL("Offset %zu programmed before page %zu is erased.", i, page);
+
+        // A half-word can only be programmed once after erasing
+        if(flash->data[i] != 0xFF || flash->data[i + 1] != 0xFF) TEST_FAIL("Offset %zu programmed twice.", i);
+        flash->data[i] = data[i - offset];
+        flash->data[i + 1] = data[i - offset + 1];
+
+        if((long)page > flash->highest_programmed_page) flash->highest_programmed_page = page;
+    }
+}
+
+static void test_flash_read(size_t offset, uint8_t* data, size_t size, void* context) {
+    TEST_Flash_t* flash = context;
+
+    TEST_ASSERT(offset + size <= TEST_FLASH_SIZE);
+    memcpy(data, &flash->data[offset], size);
+}
+
+static TEST_Flash_t test_staging_flash;
+static TEST_Flash_t test_application_flash;
+
+static const FlashBackend_t test_staging = {
+    .page_size = TEST_PAGE_SIZE,
+    .size = TEST_FLASH_SIZE,
+    .erase_start = test_flash_erase_start,
+    .busy = test_flash_busy,
+    .program = test_flash_program,
+    .read = test_flash_read,
+    .context = &test_staging_flash
+};
+
+static const FlashBackend_t test_application = {
+    .page_size = TEST_PAGE_SIZE,
+    .size = TEST_FLASH_SIZE,
+    .erase_start = test_flash_erase_start,
+    .busy = test_flash_busy,
+    .program = test_flash_program,
+    .read = test_flash_read,
+    .context = &test_application_flash
+};
+
+static uint8_t test_image[TEST_IMAGE_SIZE];
+
+static void test_setup(void) {
+    TEST_Flash_t* flashes[] = { &test_staging_flash, &test_application_flash };
+    for(size_t i = 0; i < 2; i++) {
+        memset(flashes[i], 0, sizeof(*flashes[i]));
+        flashes[i]->erasing_page = TEST_NO_PAGE;
+        flashes[i]->highest_programmed_page = -1;
+    }
+
+    for(size_t i = 0; i < TEST_IMAGE_SIZE; i++) {
+        test_image[i] = (uint8_t)(i * 7 + (i >> 8) + 1);
+    }
+}
+
+static void test_write_chunk(FlashWriter_t* writer, size_t chunk) {
+    size_t offset = chunk * TEST_CHUNK_SIZE;
+    size_t size = TEST_IMAGE_SIZE - offset < TEST_CHUNK_SIZE ? TEST_IMAGE_SIZE - offset : TEST_CHUNK_SIZE;
+    flash_writer_write(writer, offset, &test_image[offset], size);
+}
+
+static void test_assert_image(const TEST_Flash_t* flash) {
+    TEST_ASSERT(memcmp(flash->data, test_image, TEST_IMAGE_SIZE) == 0);
+
+    // The odd tail is padded, the rest of the last page stays erased
+    for(size_t i = TEST_IMAGE_SIZE; i < (TEST_IMAGE_SIZE + TEST_PAGE_SIZE - 1) / TEST_PAGE_SIZE * TEST_PAGE_SIZE; i++) {
+        TEST_ASSERT_EQUAL(0xFF, flash->data[i]);
+    }
+}
+
+static void test_assert_erased_once(const TEST_Flash_t* flash, size_t page_count) {
+    TEST_ASSERT_EQUAL(page_count, flash->erase_count);
+    for(size_t page = 0; page < page_count; page++) {
+        TEST_ASSERT_EQUAL(page, flash->erase_order[page]);
+    }
+    for(size_t page = page_count; page < TEST_PAGE_COUNT; page++) {
+        TEST_ASSERT(!flash->erased[page]);
+    }
+}
+
+static bool test_erased_ahead(const TEST_Flash_t* flash) {
+    // Pages are erased in order, and at most one page beyond the highest page written
+    return (long)flash->erase_count > flash->highest_programmed_page + 2;
+}
+
+static uint32_t test_crc32(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    for(size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for(int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+
+    return ~crc;
+}
+
+/* Test cases */
+static void test_in_order(void) {
+    FlashWriter_t writer;
+    size_t page_count = (TEST_IMAGE_SIZE + TEST_PAGE_SIZE - 1) / TEST_PAGE_SIZE;
+    test_setup();
+
+    // Only the first page is erased before anything has been written
+    flash_writer_begin(&writer, &test_staging, TEST_IMAGE_SIZE);
+    while(test_staging_flash.erasing_page != TEST_NO_PAGE) flash_writer_poll(&writer);
+    flash_writer_poll(&writer);
+    TEST_ASSERT_EQUAL(1, test_staging_flash.erase_count);
+
+    for(size_t chunk = 0; chunk < TEST_CHUNK_COUNT; chunk++) {
+        test_write_chunk(&writer, chunk);
+        flash_writer_poll(&writer);
+        TEST_ASSERT(!test_erased_ahead(&test_staging_flash));
+    }
+    flash_writer_finish(&writer);
+
+    test_assert_image(&test_staging_flash);
+    test_assert_erased_once(&test_staging_flash, page_count);
+
+    // The next page is erased while the current one is being programmed
+    TEST_ASSERT(test_staging_flash.programs_during_erase > 0);
+}
+
+static void test_out_of_order(void) {
+    FlashWriter_t writer;
+    size_t page_count = (TEST_IMAGE_SIZE + TEST_PAGE_SIZE - 1) / TEST_PAGE_SIZE;
+    test_setup();
+
+    // Every third chunk, as if the others had been lost and were repeated later. The last chunk comes first
+    flash_writer_begin(&writer, &test_staging, TEST_IMAGE_SIZE);
+    test_write_chunk(&writer, TEST_CHUNK_COUNT - 1);
+    for(size_t start = 0; start < 3; start++) {
+        for(size_t chunk = start; chunk < TEST_CHUNK_COUNT - 1; chunk += 3) {
+            test_write_chunk(&writer, chunk);
+            flash_writer_poll(&writer);
+            TEST_ASSERT(!test_erased_ahead(&test_staging_flash));
+        }
+    }
+    flash_writer_finish(&writer);
+
+    test_assert_image(&test_staging_flash);
+    test_assert_erased_once(&test_staging_flash, page_count);
+}
+
+static void test_errors_node(void) {
+    FlashWriter_t writer;
+    uint8_t data[4] = { 0 };
+    error_code_t caught;
+    test_setup();
+
+    caught = ERR_NONE;
+    error_try {
+        flash_writer_begin(&writer, &test_staging, TEST_FLASH_SIZE + 1);
+    } error_catch(error_t error) {
+        caught = error.error_code;
+    }
+    TEST_ASSERT_EQUAL(ERR_RANGE, caught);
+
+    flash_writer_begin(&writer, &test_staging, TEST_IMAGE_SIZE);
+
+    caught = ERR_NONE;
+    error_try {
+        flash_writer_write(&writer, 2 * TEST_PAGE_SIZE - 1, data, sizeof(data));
+    } error_catch(error_t error) {
+        caught = error.error_code;
+    }
+    TEST_ASSERT_EQUAL(ERR_IMPOSSIBLE, caught);
+
+    // The image is rounded up to whole pages, anything beyond them is rejected
+    caught = ERR_NONE;
+    error_try {
+        flash_writer_write(&writer, 7 * TEST_PAGE_SIZE - 2, data, sizeof(data));
+    } error_catch(error_t error) {
+        caught = error.error_code;
+    }
+    TEST_ASSERT_EQUAL(ERR_RANGE, caught);
+
+    // Nothing has been programmed by the failed writes
+    TEST_ASSERT_EQUAL(-1, test_staging_flash.highest_programmed_page);
+}
+
+static void test_errors(void) {
+    test_in_node(test_errors_node);
+}
+
+static void test_install(void) {
+    FlashWriter_t writer;
+    size_t trailer_page = TEST_PAGE_COUNT - 1;
+    test_setup();
+
+    // Known value of the CRC-32 used by the update service
+    TEST_ASSERT_EQUAL(0xCBF43926, test_crc32((const uint8_t*)"123456789", 9));
+
+    // Receive the image into the staging region, then mark it as complete
+    flash_writer_begin(&writer, &test_staging, TEST_IMAGE_SIZE);
+    for(size_t chunk = TEST_CHUNK_COUNT; chunk-- > 0;) test_write_chunk(&writer, chunk);
+    flash_writer_finish(&writer);
+
+    test_flash_erase_start(trailer_page, &test_staging_flash);
+    while(test_flash_busy(&test_staging_flash));
+    TEST_Trailer_t trailer = { .magic = TEST_TRAILER_MAGIC, .size = TEST_IMAGE_SIZE, .crc = test_crc32(test_image, TEST_IMAGE_SIZE) };
+    test_flash_program(trailer_page * TEST_PAGE_SIZE, (const uint8_t*)&trailer, sizeof(trailer), &test_staging_flash);
+
+    // A corrupt staging image is not installed and the application stays untouched
+    test_staging_flash.data[100] ^= 0x10;
+    TEST_ASSERT(!fw_update_install(&test_staging, &test_application));
+    TEST_ASSERT_EQUAL(0, test_application_flash.erase_count);
+    test_staging_flash.data[100] ^= 0x10;
+
+    TEST_ASSERT(fw_update_install(&test_staging, &test_application));
+    test_assert_image(&test_application_flash);
+    TEST_ASSERT(!test_erased_ahead(&test_application_flash));
+    TEST_ASSERT_EQUAL(trailer.crc, test_crc32(test_application_flash.data, TEST_IMAGE_SIZE));
+
+    // The trailer is erased once the image has been installed, so it isn't installed again
+    for(size_t i = 0; i < sizeof(trailer); i++) {
+        TEST_ASSERT_EQUAL(0xFF, test_staging_flash.data[trailer_page * TEST_PAGE_SIZE + i]);
+    }
+    TEST_ASSERT(!fw_update_install(&test_staging, &test_application));
+}
+
+TEST_MAIN(
+    TEST_CASE(in_order),
+    TEST_CASE(out_of_order),
+    TEST_CASE(errors),
+    TEST_CASE(install)
+)
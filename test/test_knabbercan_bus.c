@@ -0,0 +1,1557 @@
+/**
+ * @file test_knabbercan_bus.c
+ * @author Gabriel Heinzer
+ * @brief Simulates a knabberCAN bus of several nodes, each running the unchanged library.
+ *
+ * The nodes are chained by their DAISY signals and their CONN pins are driven like the cables of
+ * a real bus. Once the bus has been addressed, every node emits events at a fixed rate, which are
+ * timed from the call to kc_event_emit() on the sender to the dispatch on each receiver.
+ *
+ * The cases check buses of a few nodes. ``test_knabbercan_bus report [nodes...]`` prints the
+ * addressing duration, the bus utilization and the latency percentiles for buses of 2 up to 127
+ * nodes, which takes a few minutes.
+ *
+ * The protocol cases let the nodes perform single actions, see @ref TEST_BusAction_t, against each
+ * other or against a peer. The peer is a CAN controller driven by the test, which takes part in
+ * the protocol with hand-made frames, e.g. to answer late or to lose a frame.
+ */
+
+#include "test.h"
+#include "test_knabbercan_bus.h"
+#include <sim.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define TEST_MAX_NODES 127
+
+// Default pins of knabbercan.c, all on port A
+#define TEST_PORT_A 0
+#define TEST_DAISY_OUT_PIN 4
+#define TEST_DAISY_IN_PIN 6
+#define TEST_CONN_OUT_PIN 7
+#define TEST_CONN_IN_PIN 8
+
+// Share of the bus which is offered by the traffic of all the nodes together
+#define TEST_TRAFFIC_LOAD_PERCENT 30
+// Messages emitted by all the nodes together, but at least TEST_MIN_MESSAGES_PER_NODE by each node
+#define TEST_TRAFFIC_MESSAGES 512
+#define TEST_MIN_MESSAGES_PER_NODE 8
+
+// Fields of the knabberCAN identifier, see KC_Identifier_t
+#define TEST_ID_FRAME_TYPE(id) (((id) >> 27) & 0x3)
+#define TEST_ID_FIRST(id) (((id) >> 26) & 0x1)
+#define TEST_ID_LAST(id) (((id) >> 25) & 0x1)
+#define TEST_ID_COUNTER(id) (((id) >> 22) & 0x7)
+#define TEST_ID_TRANSACTION(id) (((id) >> 14) & 0xFF)
+#define TEST_ID_SENDER(id) (((id) >> 7) & 0x7F)
+#define TEST_ID_RECEIVER(id) ((id) & 0x7F)
+#define TEST_ID(frame_type, transaction, sender, receiver) \
+    ((uint32_t)(frame_type) << 27 | (uint32_t)(transaction) << 14 | (uint32_t)(sender) << 7 | (uint32_t)(receiver))
+#define TEST_FRAMETYPE_EVENT 0
+#define TEST_FRAMETYPE_COMMAND 1
+#define TEST_FRAMETYPE_RESPONSE 2
+#define TEST_FRAMETYPE_ERROR 3
+#define TEST_EVENT_ADDRESSING_NEXT 0x02
+#define TEST_EVENT_ONLINE 0x10
+#define TEST_ADDRESS_BROADCAST 0
+
+// Values of KC_ResponseStatus_t
+#define TEST_RESPONSE_RECEIVED 0
+#define TEST_RESPONSE_TIMEOUT 1
+
+// Values of error_code_t, which are sent as the transaction ID of the error frames
+#define TEST_ERR_RUNTIME_GENERIC 1
+#define TEST_ERR_NOT_IMPLEMENTED 2
+#define TEST_ERR_IMPOSSIBLE 8
+#define TEST_ERR_RANGE 10
+
+// Length of the messages of the error frames, see KC_ERROR_MESSAGE_SIZE
+#define TEST_ERROR_MESSAGE_SIZE 24
+
+// Stream layer of knabbercan.c, see kc_stream_send
+#define TEST_COMMAND_STREAM_OPEN 0x20
+#define TEST_COMMAND_STREAM_DATA 0x21
+#define TEST_STREAM_CHUNK_SIZE 62
+#define TEST_STREAM_WINDOW 8
+#define TEST_STREAM_RETRANSMIT_TICKS 50
+#define TEST_STREAM_RETRIES 5
+#define TEST_STREAM_TIMEOUT_TICKS 1000
+#define TEST_STREAM_SIZE 1000
+
+// Firmware updates, see fwupdate.c
+#define TEST_COMMAND_FWUPDATE_BEGIN 0x30
+#define TEST_COMMAND_FWUPDATE_STATUS 0x31
+#define TEST_COMMAND_FWUPDATE_FINISH 0x32
+#define TEST_EVENT_FWUPDATE_DATA 0x30
+#define TEST_FW_STATUS_OK 0
+#define TEST_FW_STATUS_TOO_LARGE 1
+#define TEST_FW_STATUS_NOT_STARTED 3
+#define TEST_FW_STATUS_INCOMPLETE 4
+#define TEST_FW_STATUS_CORRUPT 5
+#define TEST_FW_CHUNK_SIZE 62
+#define TEST_FW_TRAILER_MAGIC 0x4B465755
+#define TEST_FW_FLASH_SIZE (32 * TEST_BUS_FLASH_PAGE_SIZE)
+// Odd, so the last chunk is shorter than the others
+#define TEST_FW_IMAGE_SIZE 1001
+#define TEST_FW_CHUNK_COUNT ((TEST_FW_IMAGE_SIZE + TEST_FW_CHUNK_SIZE - 1) / TEST_FW_CHUNK_SIZE)
+
+// The peer uses an address which isn't given to any node of the small buses of the protocol cases
+#define TEST_PEER_ADDRESS 100
+#define TEST_MESSAGE_LOG_SIZE 4096
+
+// Housekeeping period of the dispatcher task, which checks the command timeouts
+#define TEST_HOUSEKEEPING_TICKS 10
+
+// Messages queued at once by the transmit benchmark, which fit into the transmit FIFO
+#define TEST_TRANSMIT_MESSAGES 8
+
+// Events of the dispatch latency benchmark, whose period isn't a multiple of the tick
+#define TEST_DISPATCH_EVENTS 64
+#define TEST_DISPATCH_PERIOD SIM_US(1370)
+
+// Event flood of the command latency benchmark. The handler is slower than the events arrive, so
+// they pile up in the receive ring, but fewer of them than the payload pool has blocks. A command
+// is sent among every few events.
+#define TEST_FLOOD_ADDRESS (TEST_PEER_ADDRESS + 1)
+#define TEST_FLOOD_EVENTS 128
+#define TEST_FLOOD_PERIOD SIM_US(250)
+#define TEST_FLOOD_HANDLER_TIME SIM_US(300)
+#define TEST_FLOOD_COMMAND_INTERVAL 8
+#define TEST_FLOOD_COMMANDS (TEST_FLOOD_EVENTS / TEST_FLOOD_COMMAND_INTERVAL)
+
+typedef struct __attribute__((packed)) {
+    uint8_t stream_id;
+    uint32_t total_size;
+    uint8_t window;
+} TEST_StreamOpen_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t next_sequence;
+    uint16_t received_chunks;
+} TEST_StreamAcknowledgement_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t size;
+    uint32_t crc;
+} TEST_FirmwareBegin_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t status;
+    uint16_t missing_count;
+    uint16_t missing[30];
+} TEST_FirmwareStatus_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t crc;
+} TEST_FirmwareTrailer_t;
+
+typedef struct {
+    size_t node_count;
+    TEST_BusNode_t nodes[TEST_MAX_NODES];
+
+    // Bus trace
+    SIM_Time_t last_online_end;
+    size_t online_count;
+    size_t next_count;
+    SIM_Time_t first_traffic_start;
+    SIM_Time_t last_traffic_end;
+    size_t traffic_frames;
+} TEST_Bus_t;
+
+typedef struct {
+    SIM_Time_t addressing_time;
+    size_t addressing_retries;
+    size_t messages;
+    size_t deliveries;
+    size_t missing;
+    uint32_t dropped;
+    SIM_Time_t traffic_time;
+    double utilization;
+    SIM_Time_t latency_p50;
+    SIM_Time_t latency_p90;
+    SIM_Time_t latency_p99;
+    SIM_Time_t latency_max;
+} TEST_BusResult_t;
+
+/**
+ * @brief knabberCAN message which has been reassembled from the frames on the bus.
+ */
+typedef struct {
+    uint8_t frame_type;
+    uint8_t transaction;
+    uint8_t sender;
+    uint8_t receiver;
+    size_t payload_size;
+    uint8_t payload[TEST_BUS_MAX_PAYLOAD];
+    SIM_Time_t start;
+    SIM_Time_t end;
+    bool consumed;
+} TEST_Message_t;
+
+/**
+ * @brief CAN controller driven by the test, which logs all the messages on the bus.
+ */
+typedef struct {
+    SIM_CANPeer_t* can;
+    // Every node transmits its messages one after the other, so a message per sender is incomplete at most
+    TEST_Message_t partial[128];
+    bool partial_valid[128];
+    TEST_Message_t log[TEST_MESSAGE_LOG_SIZE];
+    size_t log_count;
+} TEST_Peer_t;
+
+static size_t test_node_count = 0;
+static TEST_Bus_t test_bus_state;
+static TEST_Peer_t test_peer;
+
+/* Bus trace */
+static void test_bus_listener(const SIM_CANFrame_t* frame, SIM_Time_t start, SIM_Time_t end, void* context) {
+    TEST_Bus_t* bus = context;
+    if(!frame->extended || TEST_ID_FRAME_TYPE(frame->id) != TEST_FRAMETYPE_EVENT) return;
+
+    switch(TEST_ID_TRANSACTION(frame->id)) {
+        case TEST_EVENT_ONLINE:
+            bus->online_count++;
+            bus->last_online_end = end;
+            break;
+
+        case TEST_EVENT_ADDRESSING_NEXT:
+            bus->next_count++;
+            break;
+
+        case TEST_BUS_TRAFFIC_EVENT:
+            if(bus->traffic_frames++ == 0) bus->first_traffic_start = start;
+            bus->last_traffic_end = end;
+            break;
+    }
+}
+
+/* Peer */
+static void test_peer_listener(const SIM_CANFrame_t* frame, SIM_Time_t start, SIM_Time_t end, void* context) {
+    TEST_Peer_t* peer = context;
+    if(!frame->extended) return;
+
+    uint8_t sender = TEST_ID_SENDER(frame->id);
+    TEST_Message_t* message = &peer->partial[sender];
+    if(TEST_ID_FIRST(frame->id)) {
+        *message = (TEST_Message_t){
+            .frame_type = TEST_ID_FRAME_TYPE(frame->id),
+            .transaction = TEST_ID_TRANSACTION(frame->id),
+            .sender = sender,
+            .receiver = TEST_ID_RECEIVER(frame->id),
+            .start = start
+        };
+        peer->partial_valid[sender] = true;
+    } else if(!peer->partial_valid[sender]) {
+        return;
+    }
+
+    size_t size = frame->dlc > 8 ? 8 : frame->dlc;
+    if(message->payload_size + size <= TEST_BUS_MAX_PAYLOAD) {
+        memcpy(&message->payload[message->payload_size], frame->data, size);
+    }
+    message->payload_size += size;
+
+    if(TEST_ID_LAST(frame->id)) {
+        if(peer->log_count == TEST_MESSAGE_LOG_SIZE) TEST_FAIL("More than %d messages on the bus.", TEST_MESSAGE_LOG_SIZE);
+        message->end = end;
+        peer->log[peer->log_count++] = *message;
+        peer->partial_valid[sender] = false;
+    }
+}
+
+/**
+ * @brief Attaches the @p peer to the bus, which also acknowledges the frames of a single node.
+ */
+static void test_peer_attach(TEST_Peer_t* peer) {
+    memset(peer, 0, sizeof(*peer));
+    peer->can = sim_can_peer_create(true);
+    sim_can_add_listener(test_peer_listener, peer);
+}
+
+/**
+ * @brief Queues a message of the peer, split into frames like knabbercan.c does.
+ */
+static void test_peer_send(TEST_Peer_t* peer, uint8_t frame_type, uint8_t transaction, uint8_t receiver, const void* payload, size_t payload_size) {
+    const uint8_t* data = payload;
+    size_t offset = 0;
+    uint32_t counter = 0;
+
+    do {
+        size_t size = payload_size - offset > 8 ? 8 : payload_size - offset;
+        SIM_CANFrame_t frame = {
+            .id = TEST_ID(frame_type, transaction, TEST_PEER_ADDRESS, receiver) |
+                counter << 22 | (uint32_t)(offset + size == payload_size) << 25 | (uint32_t)(offset == 0) << 26,
+            .extended = true,
+            .dlc = size
+        };
+        if(size > 0) memcpy(frame.data, data + offset, size);
+        sim_can_peer_transmit(peer->can, &frame);
+
+        offset += size;
+        counter = (counter + 1) % 8;
+    } while(offset < payload_size);
+}
+
+typedef struct {
+    TEST_Peer_t* peer;
+    uint8_t frame_type;
+    uint8_t transaction;
+    TEST_Message_t* message;
+} TEST_MessageQuery_t;
+
+static bool test_message_arrived(void* context) {
+    TEST_MessageQuery_t* query = context;
+    for(size_t i = 0; i < query->peer->log_count; i++) {
+        TEST_Message_t* message = &query->peer->log[i];
+        if(
+            !message->consumed &&
+            message->sender != TEST_PEER_ADDRESS &&
+            (message->receiver == TEST_PEER_ADDRESS || message->receiver == TEST_ADDRESS_BROADCAST) &&
+            message->frame_type == query->frame_type &&
+            message->transaction == query->transaction
+        ) {
+            query->message = message;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Runs the simulation until a node has sent a message of the given type to the peer or the
+ * whole bus, which hasn't been received before.
+ *
+ * @return The message, or a null pointer if none has arrived before the @p timeout.
+ */
+static TEST_Message_t* test_peer_receive(TEST_Peer_t* peer, uint8_t frame_type, uint8_t transaction, SIM_Time_t timeout) {
+    TEST_MessageQuery_t query = { .peer = peer, .frame_type = frame_type, .transaction = transaction };
+    if(!sim_run_until(test_message_arrived, &query, timeout)) return 0;
+    query.message->consumed = true;
+    return query.message;
+}
+
+/**
+ * @brief Counts the messages on the bus of the given type, including the consumed ones.
+ */
+static size_t test_peer_count(const TEST_Peer_t* peer, uint8_t frame_type, uint8_t transaction) {
+    size_t count = 0;
+    for(size_t i = 0; i < peer->log_count; i++) {
+        if(peer->log[i].frame_type == frame_type && peer->log[i].transaction == transaction) count++;
+    }
+    return count;
+}
+
+/* Conditions */
+static bool test_all_ready(void* context) {
+    TEST_Bus_t* bus = context;
+    for(size_t i = 0; i < bus->node_count; i++) {
+        if(!bus->nodes[i].ready) return false;
+    }
+    return true;
+}
+
+static size_t test_delivered(const TEST_Bus_t* bus) {
+    size_t delivered = 0;
+    for(size_t i = 0; i < bus->node_count; i++) {
+        delivered += bus->nodes[i].latency_count + bus->nodes[i].latency_overflows;
+    }
+    return delivered;
+}
+
+static bool test_traffic_done(void* context) {
+    TEST_Bus_t* bus = context;
+    for(size_t i = 0; i < bus->node_count; i++) {
+        if(!bus->nodes[i].traffic_done) return false;
+    }
+
+    // Every message is received by all the nodes but its sender
+    size_t messages = bus->node_count * bus->nodes[0].traffic_message_count;
+    return test_delivered(bus) == messages * (bus->node_count - 1);
+}
+
+static bool test_action_done(void* context) {
+    TEST_BusNode_t* node = context;
+    return node->action == TEST_ACTION_NONE;
+}
+
+typedef struct {
+    TEST_BusNode_t* node;
+    size_t count;
+} TEST_ResponseQuery_t;
+
+static bool test_responses_recorded(void* context) {
+    TEST_ResponseQuery_t* query = context;
+    return query->node->response_count >= query->count;
+}
+
+/* Helpers */
+static void* test_load_node(size_t index, const char* directory, const void* image, size_t image_size) {
+    // A library is only loaded once per path, so each node gets a copy of its own
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/node%zu.so", directory, index);
+
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+    if(file < 0 || write(file, image, image_size) != (ssize_t)image_size || close(file) != 0) {
+        TEST_FAIL("Couldn't write %s.", path);
+    }
+
+    void* library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if(library == 0) TEST_FAIL("Couldn't load the node firmware: %s", dlerror());
+    unlink(path);
+    return library;
+}
+
+static void* test_read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if(file == 0) TEST_FAIL("Couldn't open %s.", path);
+
+    fseek(file, 0, SEEK_END);
+    *size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void* data = malloc(*size);
+    if(data == 0 || fread(data, 1, *size, file) != *size) TEST_FAIL("Couldn't read %s.", path);
+    fclose(file);
+    return data;
+}
+
+static int test_compare_time(const void* a, const void* b) {
+    SIM_Time_t time_a = *(const SIM_Time_t*)a;
+    SIM_Time_t time_b = *(const SIM_Time_t*)b;
+    return (time_a > time_b) - (time_a < time_b);
+}
+
+static SIM_Time_t test_percentile(const SIM_Time_t* sorted, size_t count, unsigned percent) {
+    if(count == 0) return 0;
+    size_t rank = (count * percent + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static SIM_Time_t test_traffic_frame_time(void) {
+    // Event of a node in the middle of the bus, carrying a timestamp of a few seconds
+    SIM_CANFrame_t frame = {
+        .id = 1UL << 26 | 1UL << 25 | (uint32_t)TEST_BUS_TRAFFIC_EVENT << 14 | 64UL << 7,
+        .extended = true,
+        .dlc = sizeof(SIM_Time_t)
+    };
+    SIM_Time_t timestamp = SIM_S(3) + SIM_US(141);
+    memcpy(frame.data, &timestamp, sizeof(timestamp));
+
+    // Frames are separated by the 3 bit intermission
+    return (sim_can_frame_bits(&frame) + 3) * sim_can_bit_time();
+}
+
+/**
+ * @brief Powers up the @p bus of @p node_count nodes, whose states are initialized already, and
+ * runs the simulation until it has been addressed. The @p peer is attached before, if given.
+ */
+static void test_bus_start(TEST_Bus_t* bus, size_t node_count, TEST_Peer_t* peer) {
+    TEST_ASSERT(node_count >= 1 && node_count <= TEST_MAX_NODES);
+    bus->node_count = node_count;
+
+    sim_init();
+    sim_set_console_echo(false);
+    sim_can_add_listener(test_bus_listener, bus);
+    if(peer != 0) test_peer_attach(peer);
+
+    // Nodes, each with a copy of the firmware
+    char directory[] = "/tmp/knabbercan_bus.XXXXXX";
+    if(mkdtemp(directory) == 0) TEST_FAIL("Couldn't create a temporary directory.");
+
+    size_t image_size;
+    void* image = test_read_file(TEST_BUS_NODE_LIBRARY, &image_size);
+
+    SIM_Node_t* nodes[TEST_MAX_NODES];
+    for(size_t i = 0; i < node_count; i++) {
+        void* library = test_load_node(i, directory, image, image_size);
+        SIM_NodeEntry_t entry = (SIM_NodeEntry_t)dlsym(library, TEST_BUS_NODE_ENTRY);
+        TEST_ASSERT(entry != 0);
+
+        char name[16];
+        snprintf(name, sizeof(name), "node%zu", i + 1);
+        nodes[i] = sim_node_create(name, entry, &bus->nodes[i], library);
+    }
+    free(image);
+    rmdir(directory);
+
+    // The DAISY signal runs from node to node, the CONN pins detect the neighbours
+    for(size_t i = 0; i < node_count; i++) {
+        if(i + 1 < node_count) {
+            sim_gpio_connect(nodes[i], TEST_PORT_A, TEST_DAISY_OUT_PIN, nodes[i + 1], TEST_PORT_A, TEST_DAISY_IN_PIN);
+        }
+        sim_gpio_drive(sim_gpio_net(nodes[i], TEST_PORT_A, TEST_CONN_IN_PIN), i > 0);
+        sim_gpio_drive(sim_gpio_net(nodes[i], TEST_PORT_A, TEST_CONN_OUT_PIN), i + 1 < node_count);
+    }
+
+    /* Addressing */
+    if(!sim_run_until(test_all_ready, bus, SIM_S(1) + node_count * SIM_MS(100))) {
+        TEST_FAIL("The bus of %zu nodes hasn't been addressed.", node_count);
+    }
+    for(size_t i = 0; i < node_count; i++) {
+        TEST_ASSERT(!sim_node_halted(nodes[i]));
+        TEST_ASSERT_EQUAL(i + 1, bus->nodes[i].address);
+        TEST_ASSERT_EQUAL(node_count, bus->nodes[i].bus_size);
+    }
+}
+
+/**
+ * @brief Simulates a bus of @p node_count nodes, from the power-up to the end of the traffic.
+ */
+static TEST_BusResult_t test_bus_simulate(size_t node_count) {
+    TEST_Bus_t* bus = &test_bus_state;
+    TEST_BusResult_t result = { 0 };
+    TEST_ASSERT(node_count >= 2);
+
+    // Traffic, which is configured before the nodes start
+    SIM_Time_t frame_time = test_traffic_frame_time();
+    uint32_t period_ticks = (uint32_t)((node_count * frame_time * 100 + TEST_TRAFFIC_LOAD_PERCENT * SIM_MS(1) - 1) /
+        (TEST_TRAFFIC_LOAD_PERCENT * SIM_MS(1)));
+    uint32_t message_count = TEST_TRAFFIC_MESSAGES / node_count;
+    if(message_count < TEST_MIN_MESSAGES_PER_NODE) message_count = TEST_MIN_MESSAGES_PER_NODE;
+
+    static SIM_Time_t latencies[TEST_MAX_NODES * (TEST_MAX_NODES - 1) * TEST_MIN_MESSAGES_PER_NODE + TEST_TRAFFIC_MESSAGES * TEST_MAX_NODES];
+    size_t latency_capacity = (node_count - 1) * message_count;
+    TEST_ASSERT(latency_capacity * node_count <= sizeof(latencies) / sizeof(*latencies));
+
+    for(size_t i = 0; i < node_count; i++) {
+        bus->nodes[i] = (TEST_BusNode_t){
+            .traffic_period_ticks = period_ticks,
+            .traffic_message_count = message_count,
+            .latencies = &latencies[i * latency_capacity],
+            .latency_capacity = latency_capacity
+        };
+    }
+
+    test_bus_start(bus, node_count, 0);
+    result.addressing_time = bus->last_online_end;
+    result.addressing_retries = bus->next_count - (node_count - 1);
+
+    /* Traffic */
+    sim_run_for(SIM_MS(10));
+    sim_can_reset_statistics();
+
+    uint32_t start_tick = (uint32_t)(sim_now() / SIM_MS(1)) + 2;
+    for(size_t i = 0; i < node_count; i++) {
+        bus->nodes[i].traffic_start_tick = start_tick;
+        bus->nodes[i].traffic_enabled = true;
+    }
+
+    result.messages = node_count * message_count;
+    SIM_Time_t traffic_timeout = SIM_MS(100) + 2 * (SIM_Time_t)period_ticks * message_count * SIM_MS(1);
+    sim_run_until(test_traffic_done, bus, traffic_timeout);
+    sim_run_for(SIM_MS(2));
+
+    SIM_CANStatistics_t statistics = sim_can_statistics();
+    result.traffic_time = bus->last_traffic_end - bus->first_traffic_start;
+    result.utilization = result.traffic_time > 0 ? (double)statistics.busy_time / result.traffic_time : 0;
+
+    // Latencies of all the receivers together
+    size_t count = 0;
+    for(size_t i = 0; i < node_count; i++) {
+        memmove(&latencies[count], bus->nodes[i].latencies, bus->nodes[i].latency_count * sizeof(SIM_Time_t));
+        count += bus->nodes[i].latency_count;
+        result.dropped += bus->nodes[i].dropped;
+    }
+    qsort(latencies, count, sizeof(SIM_Time_t), test_compare_time);
+
+    result.deliveries = test_delivered(bus);
+    result.missing = result.messages * (node_count - 1) - result.deliveries;
+    result.latency_p50 = test_percentile(latencies, count, 50);
+    result.latency_p90 = test_percentile(latencies, count, 90);
+    result.latency_p99 = test_percentile(latencies, count, 99);
+    result.latency_max = count > 0 ? latencies[count - 1] : 0;
+    return result;
+}
+
+static void test_print_header(void) {
+    printf("%5s %15s %7s %8s %11s %9s %9s %9s %9s %7s\n",
+        "nodes", "addressing[ms]", "retries", "messages", "bus load[%]",
+        "p50[us]", "p90[us]", "p99[us]", "max[us]", "dropped");
+}
+
+static void test_print_result(size_t node_count, const TEST_BusResult_t* result) {
+    printf("%5zu %15.1f %7zu %8zu %11.1f %9.1f %9.1f %9.1f %9.1f %7u\n",
+        node_count,
+        result->addressing_time / 1e6,
+        result->addressing_retries,
+        result->messages,
+        result->utilization * 100,
+        result->latency_p50 / 1e3,
+        result->latency_p90 / 1e3,
+        result->latency_p99 / 1e3,
+        result->latency_max / 1e3,
+        result->dropped);
+}
+
+static void test_bus(size_t node_count) {
+    TEST_BusResult_t result = test_bus_simulate(node_count);
+    test_print_header();
+    test_print_result(node_count, &result);
+
+    // Every message must arrive at every other node, well before the next message of its sender
+    TEST_ASSERT_EQUAL(0, result.dropped);
+    TEST_ASSERT_EQUAL(0, result.missing);
+    TEST_ASSERT(result.latency_max < SIM_MS(10));
+    TEST_ASSERT(result.utilization > TEST_TRAFFIC_LOAD_PERCENT / 200.0);
+}
+
+/**
+ * @brief Starts a bus of @p node_count nodes which don't emit any traffic, and attaches the peer.
+ * The nodes are set up like the @p configurations before they start, if given.
+ */
+static TEST_Peer_t* test_protocol_start(size_t node_count, const TEST_BusNode_t* configurations) {
+    for(size_t i = 0; i < node_count; i++) {
+        test_bus_state.nodes[i] = configurations != 0 ? configurations[i] : (TEST_BusNode_t){ 0 };
+        test_bus_state.nodes[i].traffic_enabled = true;
+    }
+    test_bus_start(&test_bus_state, node_count, &test_peer);
+    return &test_peer;
+}
+
+/**
+ * @brief Lets the @p node perform its action, which has been set up already.
+ */
+static void test_node_act(TEST_BusNode_t* node, TEST_BusAction_t action, SIM_Time_t timeout) {
+    node->action = action;
+    if(!sim_run_until(test_action_done, node, timeout)) TEST_FAIL("The action %d hasn't finished.", action);
+}
+
+/**
+ * @brief Runs the simulation until the @p node has recorded @p count responses.
+ */
+static void test_wait_responses(TEST_BusNode_t* node, size_t count, SIM_Time_t timeout) {
+    TEST_ResponseQuery_t query = { .node = node, .count = count };
+    if(!sim_run_until(test_responses_recorded, &query, timeout)) {
+        TEST_FAIL("%zu of %zu responses recorded.", node->response_count, count);
+    }
+}
+
+/**
+ * @brief Runs the simulation until a node has sent a stream chunk to the peer.
+ *
+ * @return The sequence number of the chunk, or -1 if none has arrived before the @p timeout.
+ */
+static int32_t test_peer_receive_chunk(TEST_Peer_t* peer, SIM_Time_t timeout, TEST_Message_t** message) {
+    TEST_Message_t* data = test_peer_receive(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_DATA, timeout);
+    if(data == 0) return -1;
+    TEST_ASSERT(data->payload_size >= sizeof(uint16_t));
+
+    uint16_t sequence;
+    memcpy(&sequence, data->payload, sizeof(sequence));
+    if(message != 0) *message = data;
+    return sequence;
+}
+
+/**
+ * @brief Receives the request of a node to open a stream to the peer, and accepts it with the @p window.
+ */
+static TEST_StreamOpen_t test_peer_accept_stream(TEST_Peer_t* peer, uint8_t receiver, uint8_t window) {
+    TEST_Message_t* request = test_peer_receive(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_OPEN, SIM_MS(10));
+    TEST_ASSERT(request != 0);
+    TEST_ASSERT_EQUAL(sizeof(TEST_StreamOpen_t), request->payload_size);
+
+    TEST_StreamOpen_t open;
+    memcpy(&open, request->payload, sizeof(open));
+    test_peer_send(peer, TEST_FRAMETYPE_RESPONSE, TEST_COMMAND_STREAM_OPEN, receiver, &window, sizeof(window));
+    return open;
+}
+
+/**
+ * @brief Sends the chunk @p sequence of a stream of @p total_size bytes from the peer to a node.
+ */
+static void test_peer_send_chunk(TEST_Peer_t* peer, uint8_t receiver, uint32_t total_size, uint16_t sequence) {
+    uint8_t payload[sizeof(uint16_t) + TEST_STREAM_CHUNK_SIZE];
+    uint32_t offset = (uint32_t)sequence * TEST_STREAM_CHUNK_SIZE;
+    size_t size = total_size - offset < TEST_STREAM_CHUNK_SIZE ? total_size - offset : TEST_STREAM_CHUNK_SIZE;
+
+    memcpy(payload, &sequence, sizeof(sequence));
+    for(size_t i = 0; i < size; i++) payload[sizeof(sequence) + i] = test_bus_payload_byte(offset + i);
+    test_peer_send(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_DATA, receiver, payload, sizeof(sequence) + size);
+}
+
+static TEST_StreamAcknowledgement_t test_peer_receive_acknowledgement(TEST_Peer_t* peer, SIM_Time_t timeout) {
+    TEST_Message_t* response = test_peer_receive(peer, TEST_FRAMETYPE_RESPONSE, TEST_COMMAND_STREAM_DATA, timeout);
+    TEST_ASSERT(response != 0);
+    TEST_ASSERT_EQUAL(sizeof(TEST_StreamAcknowledgement_t), response->payload_size);
+
+    TEST_StreamAcknowledgement_t acknowledgement;
+    memcpy(&acknowledgement, response->payload, sizeof(acknowledgement));
+    return acknowledgement;
+}
+
+static void test_assert_stream_data(const TEST_BusNode_t* node, uint32_t size) {
+    TEST_ASSERT_EQUAL(size, node->stream_received);
+    TEST_ASSERT_EQUAL(0, node->stream_order_errors);
+    for(uint32_t i = 0; i < size; i++) TEST_ASSERT_EQUAL(test_bus_payload_byte(i), node->stream_data[i]);
+}
+
+static uint32_t test_crc32(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    for(size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for(int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t test_firmware_crc(void) {
+    static uint8_t image[TEST_FW_IMAGE_SIZE];
+    for(size_t i = 0; i < TEST_FW_IMAGE_SIZE; i++) image[i] = test_bus_payload_byte(i);
+    return test_crc32(image, TEST_FW_IMAGE_SIZE);
+}
+
+/**
+ * @brief Starts a node with the update service on flash regions in RAM, which aren't erased yet.
+ */
+static TEST_BusNode_t* test_firmware_start(void) {
+    static uint8_t staging[TEST_FW_FLASH_SIZE];
+    static uint8_t application[TEST_FW_FLASH_SIZE];
+    memset(staging, 0, sizeof(staging));
+    memset(application, 0, sizeof(application));
+
+    TEST_BusNode_t configuration = { .staging_flash = staging, .application_flash = application, .flash_size = TEST_FW_FLASH_SIZE };
+    test_protocol_start(1, &configuration);
+    return &test_bus_state.nodes[0];
+}
+
+/**
+ * @brief Sends an update command from the peer to the @p node and receives its response.
+ */
+static TEST_Message_t* test_firmware_command(TEST_BusNode_t* node, uint8_t command, const void* payload, size_t payload_size) {
+    test_peer_send(&test_peer, TEST_FRAMETYPE_COMMAND, command, node->address, payload, payload_size);
+    TEST_Message_t* response = test_peer_receive(&test_peer, TEST_FRAMETYPE_RESPONSE, command, SIM_MS(20));
+    if(response == 0) TEST_FAIL("No response to the update command 0x%02x.", command);
+    return response;
+}
+
+static uint8_t test_firmware_status(TEST_BusNode_t* node, uint8_t command, const void* payload, size_t payload_size) {
+    TEST_Message_t* response = test_firmware_command(node, command, payload, payload_size);
+    TEST_ASSERT_EQUAL(1, response->payload_size);
+    return response->payload[0];
+}
+
+static uint8_t test_firmware_begin(TEST_BusNode_t* node, uint32_t size, uint32_t crc) {
+    TEST_FirmwareBegin_t begin = { .size = size, .crc = crc };
+    return test_firmware_status(node, TEST_COMMAND_FWUPDATE_BEGIN, &begin, sizeof(begin));
+}
+
+static TEST_FirmwareStatus_t test_firmware_query(TEST_BusNode_t* node) {
+    TEST_Message_t* response = test_firmware_command(node, TEST_COMMAND_FWUPDATE_STATUS, 0, 0);
+    TEST_FirmwareStatus_t status = { 0 };
+    TEST_ASSERT(response->payload_size >= 3 && response->payload_size <= sizeof(status));
+    memcpy(&status, response->payload, response->payload_size);
+    TEST_ASSERT_EQUAL(3 + status.missing_count * sizeof(uint16_t), response->payload_size);
+    return status;
+}
+
+static bool test_peer_idle(void* context) {
+    TEST_Peer_t* peer = context;
+    return sim_can_peer_pending(peer->can) == 0;
+}
+
+/**
+ * @brief Broadcasts the chunk @p sequence of the image from the peer, with @p size bytes of
+ * data, and XORs the data with @p corruption.
+ */
+static void test_firmware_send_chunk(uint16_t sequence, size_t size, uint8_t corruption) {
+    uint8_t payload[sizeof(uint16_t) + TEST_FW_CHUNK_SIZE + 1];
+    uint32_t offset = (uint32_t)sequence * TEST_FW_CHUNK_SIZE;
+
+    memcpy(payload, &sequence, sizeof(sequence));
+    for(size_t i = 0; i < size; i++) payload[sizeof(sequence) + i] = test_bus_payload_byte(offset + i) ^ corruption;
+    test_peer_send(&test_peer, TEST_FRAMETYPE_EVENT, TEST_EVENT_FWUPDATE_DATA, TEST_ADDRESS_BROADCAST, payload, sizeof(sequence) + size);
+}
+
+static size_t test_firmware_chunk_size(uint16_t sequence) {
+    size_t offset = (size_t)sequence * TEST_FW_CHUNK_SIZE;
+    return TEST_FW_IMAGE_SIZE - offset < TEST_FW_CHUNK_SIZE ? TEST_FW_IMAGE_SIZE - offset : TEST_FW_CHUNK_SIZE;
+}
+
+/**
+ * @brief Runs the simulation until all the chunks sent so far are on the bus, and the node has
+ * dispatched them. Commands take the priority lane, so they'd overtake the chunks otherwise.
+ */
+static void test_firmware_flush(void) {
+    if(!sim_run_until(test_peer_idle, &test_peer, SIM_MS(100))) TEST_FAIL("The peer hasn't sent its frames.");
+    sim_run_for(SIM_MS(2));
+}
+
+/* Test cases */
+static void test_nodes_2(void) { test_bus(2); }
+static void test_nodes_4(void) { test_bus(4); }
+static void test_nodes_8(void) { test_bus(8); }
+static void test_nodes_16(void) { test_bus(16); }
+
+static void test_command_timeout(void) {
+    TEST_Peer_t* peer = test_protocol_start(1, 0);
+    TEST_BusNode_t* node = &test_bus_state.nodes[0];
+    const uint32_t timeout_ticks = 20;
+
+    // The commands to the same receiver share their home slot in the pending table, so their
+    // removal shifts the following ones back into the slots which are being scanned
+    node->action_receiver = TEST_PEER_ADDRESS;
+    node->action_id = 0x50;
+    node->action_size = 1;
+    node->action_count = 3;
+    node->action_timeout_ticks = timeout_ticks;
+
+    for(size_t round = 0; round < 2; round++) {
+        // The second round is only accepted if every command of the first round has been removed
+        test_node_act(node, TEST_ACTION_COMMAND, SIM_MS(10));
+        test_wait_responses(node, 3 * (round + 1), SIM_MS(200));
+
+        for(size_t i = 0; i < 3; i++) {
+            TEST_BusResponse_t* response = &node->responses[3 * round + i];
+            printf("round %zu: command 0x%02X timed out after %.1f ms\n", round, response->command_id, response->time / 1e6);
+            TEST_ASSERT_EQUAL(TEST_RESPONSE_TIMEOUT, response->status);
+            TEST_ASSERT_EQUAL(TEST_PEER_ADDRESS, response->sender_address);
+            TEST_ASSERT_EQUAL(0, response->payload_size);
+            TEST_ASSERT(response->time >= SIM_MS(timeout_ticks - 1));
+            TEST_ASSERT(response->time <= SIM_MS(timeout_ticks + TEST_HOUSEKEEPING_TICKS + 1));
+        }
+
+        // Every command has timed out exactly once
+        uint32_t seen = 0;
+        for(size_t i = 0; i < 3; i++) seen |= 1UL << (node->responses[3 * round + i].command_id - node->action_id);
+        TEST_ASSERT_EQUAL(0x7, seen);
+    }
+
+    sim_run_for(SIM_MS(100));
+    TEST_ASSERT_EQUAL(6, node->response_count);
+    TEST_ASSERT_EQUAL(6, test_peer_count(peer, TEST_FRAMETYPE_COMMAND, 0x50) + test_peer_count(peer, TEST_FRAMETYPE_COMMAND, 0x51) +
+        test_peer_count(peer, TEST_FRAMETYPE_COMMAND, 0x52));
+}
+
+static void test_command_late_response(void) {
+    TEST_Peer_t* peer = test_protocol_start(1, 0);
+    TEST_BusNode_t* node = &test_bus_state.nodes[0];
+    const uint32_t timeout_ticks = 20;
+    static const uint8_t answer[] = { 0x12, 0x34, 0x56 };
+
+    node->action_receiver = TEST_PEER_ADDRESS;
+    node->action_id = 0x50;
+    node->action_size = 4;
+    node->action_count = 2;
+    node->action_timeout_ticks = timeout_ticks;
+    test_node_act(node, TEST_ACTION_COMMAND, SIM_MS(10));
+
+    // The first command is answered right away, the second one after its timeout
+    TEST_Message_t* first = test_peer_receive(peer, TEST_FRAMETYPE_COMMAND, 0x50, SIM_MS(10));
+    TEST_Message_t* second = test_peer_receive(peer, TEST_FRAMETYPE_COMMAND, 0x51, SIM_MS(10));
+    TEST_ASSERT(first != 0 && second != 0);
+    TEST_ASSERT_EQUAL(4, first->payload_size);
+    for(size_t i = 0; i < first->payload_size; i++) TEST_ASSERT_EQUAL(test_bus_payload_byte(i), first->payload[i]);
+
+    test_peer_send(peer, TEST_FRAMETYPE_RESPONSE, 0x50, node->address, answer, sizeof(answer));
+    test_wait_responses(node, 1, SIM_MS(10));
+    TEST_ASSERT_EQUAL(TEST_RESPONSE_RECEIVED, node->responses[0].status);
+    TEST_ASSERT_EQUAL(0x50, node->responses[0].command_id);
+    TEST_ASSERT_EQUAL(sizeof(answer), node->responses[0].payload_size);
+    TEST_ASSERT(memcmp(node->response_payload, answer, sizeof(answer)) == 0);
+    TEST_ASSERT(node->responses[0].time < SIM_MS(2));
+
+    test_wait_responses(node, 2, SIM_MS(100));
+    TEST_ASSERT_EQUAL(TEST_RESPONSE_TIMEOUT, node->responses[1].status);
+    TEST_ASSERT_EQUAL(0x51, node->responses[1].command_id);
+
+    // The late response doesn't belong to any pending command anymore and is dropped silently
+    test_peer_send(peer, TEST_FRAMETYPE_RESPONSE, 0x51, node->address, answer, sizeof(answer));
+    sim_run_for(SIM_MS(50));
+    TEST_ASSERT_EQUAL(0, sim_can_peer_pending(peer->can));
+    TEST_ASSERT_EQUAL(2, node->response_count);
+    TEST_ASSERT_EQUAL(0, node->dropped);
+}
+
+static void test_command_large_payload(void) {
+    TEST_Peer_t* peer = test_protocol_start(2, 0);
+    TEST_BusNode_t* sender = &test_bus_state.nodes[0];
+    TEST_BusNode_t* receiver = &test_bus_state.nodes[1];
+    static const size_t sizes[] = { 65, 200, TEST_BUS_MAX_PAYLOAD };
+    const size_t size_count = sizeof(sizes) / sizeof(*sizes);
+
+    // Payloads larger than a block of the payload pool are chained, and echoed in one piece
+    sender->action_receiver = receiver->address;
+    sender->action_id = TEST_BUS_ECHO_COMMAND;
+    sender->action_count = 1;
+    sender->action_timeout_ticks = 50;
+    for(size_t i = 0; i < size_count; i++) {
+        sender->action_size = sizes[i];
+        test_node_act(sender, TEST_ACTION_COMMAND, SIM_MS(10));
+        test_wait_responses(sender, i + 1, SIM_MS(50));
+
+        TEST_BusResponse_t* response = &sender->responses[i];
+        TEST_ASSERT_EQUAL(TEST_RESPONSE_RECEIVED, response->status);
+        TEST_ASSERT_EQUAL(sizes[i], response->payload_size);
+        for(size_t j = 0; j < sizes[i]; j++) TEST_ASSERT_EQUAL(test_bus_payload_byte(j), sender->response_payload[j]);
+    }
+
+    // Larger payloads are refused by the sender
+    sender->action_size = TEST_BUS_MAX_PAYLOAD + 1;
+    test_node_act(sender, TEST_ACTION_COMMAND, SIM_MS(10));
+    TEST_ASSERT_EQUAL(TEST_ERR_RANGE, sender->action_error);
+    sim_run_for(SIM_MS(50));
+    TEST_ASSERT_EQUAL(size_count, sender->response_count);
+    TEST_ASSERT_EQUAL(size_count, test_peer_count(peer, TEST_FRAMETYPE_COMMAND, TEST_BUS_ECHO_COMMAND));
+
+    // ...and discarded by the receivers
+    static uint8_t oversized[TEST_BUS_MAX_PAYLOAD + 1];
+    test_peer_send(peer, TEST_FRAMETYPE_COMMAND, TEST_BUS_ECHO_COMMAND, receiver->address, oversized, sizeof(oversized));
+    TEST_ASSERT(test_peer_receive(peer, TEST_FRAMETYPE_RESPONSE, TEST_BUS_ECHO_COMMAND, SIM_MS(20)) == 0);
+    TEST_ASSERT_EQUAL(1, receiver->dropped);
+    TEST_ASSERT_EQUAL(0, sender->dropped);
+}
+
+typedef struct {
+    TEST_Peer_t* peer;
+    size_t first;
+} TEST_EventQuery_t;
+
+static bool test_events_arrived(void* context) {
+    TEST_EventQuery_t* query = context;
+    size_t count = 0;
+    for(size_t i = query->first; i < query->peer->log_count; i++) {
+        const TEST_Message_t* message = &query->peer->log[i];
+        if(message->frame_type == TEST_FRAMETYPE_EVENT && message->transaction == TEST_BUS_BULK_EVENT) count++;
+    }
+    return count >= TEST_TRANSMIT_MESSAGES;
+}
+
+/**
+ * @brief Lets the @p node broadcast @ref TEST_TRANSMIT_MESSAGES events of @p size bytes with the
+ * @p action, and checks that they arrive in one piece.
+ *
+ * @return The time from the start of the first event to the end of the last one on the bus.
+ */
+static SIM_Time_t test_transmit_events(TEST_Peer_t* peer, TEST_BusNode_t* node, TEST_BusAction_t action, size_t size) {
+    size_t first = peer->log_count;
+    node->action_size = size;
+    node->action_count = TEST_TRANSMIT_MESSAGES;
+    test_node_act(node, action, SIM_MS(100));
+
+    // The asynchronous action returns long before its events are on the bus
+    TEST_EventQuery_t query = { .peer = peer, .first = first };
+    if(!sim_run_until(test_events_arrived, &query, SIM_MS(100))) TEST_FAIL("Not all the events have been transmitted.");
+
+    TEST_Message_t* events[TEST_TRANSMIT_MESSAGES];
+    size_t count = 0;
+    for(size_t i = first; i < peer->log_count; i++) {
+        TEST_Message_t* message = &peer->log[i];
+        if(message->frame_type != TEST_FRAMETYPE_EVENT || message->transaction != TEST_BUS_BULK_EVENT) continue;
+        TEST_ASSERT(count < TEST_TRANSMIT_MESSAGES);
+        TEST_ASSERT_EQUAL(size, message->payload_size);
+        for(size_t j = 0; j < size; j++) TEST_ASSERT_EQUAL(test_bus_payload_byte(j), message->payload[j]);
+        events[count++] = message;
+    }
+    TEST_ASSERT_EQUAL(TEST_TRANSMIT_MESSAGES, count);
+    return events[count - 1]->end - events[0]->start;
+}
+
+static void test_transmit_throughput(void) {
+    TEST_Peer_t* peer = test_protocol_start(1, 0);
+    TEST_BusNode_t* node = &test_bus_state.nodes[0];
+    static const size_t sizes[] = { 1, 8, 9, 16, 64, 128, 256 };
+
+    printf("%8s %28s %28s %12s\n", "", "kc_frame_transmit", "kc_frame_transmit_async", "");
+    printf("%8s %14s %13s %14s %13s %12s\n", "bytes", "blocked [us]", "kB/s", "blocked [us]", "kB/s", "done [us]");
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        size_t bytes = sizes[i] * TEST_TRANSMIT_MESSAGES;
+
+        SIM_Time_t bus_time = test_transmit_events(peer, node, TEST_ACTION_TRANSMIT, sizes[i]);
+        SIM_Time_t blocked = node->action_time / TEST_TRANSMIT_MESSAGES;
+        double throughput = bytes / (bus_time / 1e9) / 1e3;
+
+        SIM_Time_t async_bus_time = test_transmit_events(peer, node, TEST_ACTION_TRANSMIT_ASYNC, sizes[i]);
+        SIM_Time_t async_blocked = node->action_time / TEST_TRANSMIT_MESSAGES;
+        double async_throughput = bytes / (async_bus_time / 1e9) / 1e3;
+
+        printf("%8zu %14.1f %13.1f %14.1f %13.1f %12.1f\n", sizes[i], blocked / 1e3, throughput,
+            async_blocked / 1e3, async_throughput, node->transmit_completion_time / 1e3);
+
+        // Every message has been handed to the hardware, and the bus is kept as busy as before
+        TEST_ASSERT_EQUAL(TEST_TRANSMIT_MESSAGES, node->transmit_completions);
+        TEST_ASSERT(async_throughput >= throughput * 0.95);
+
+        // Messages which don't fit into the mailboxes at once block the caller of kc_frame_transmit()
+        // until their last frame is loaded, but only the queueing of kc_frame_transmit_async()
+        if(sizes[i] > 3 * 8) TEST_ASSERT(async_blocked * 10 < blocked);
+    }
+}
+
+static void test_dispatch_latency(void) {
+    static SIM_Time_t latencies[2][TEST_DISPATCH_EVENTS];
+    static SIM_Time_t dispatch_latencies[2][TEST_DISPATCH_EVENTS];
+    TEST_BusNode_t configurations[2];
+    for(size_t i = 0; i < 2; i++) {
+        configurations[i] = (TEST_BusNode_t){
+            .latencies = latencies[i],
+            .dispatch_latencies = dispatch_latencies[i],
+            .latency_capacity = TEST_DISPATCH_EVENTS,
+            .polling = i == 1
+        };
+    }
+    TEST_Peer_t* peer = test_protocol_start(2, configurations);
+
+    // The peer broadcasts the events, whose payload is the time at which they're queued
+    for(size_t i = 0; i < TEST_DISPATCH_EVENTS; i++) {
+        SIM_Time_t emitted = sim_now();
+        test_peer_send(peer, TEST_FRAMETYPE_EVENT, TEST_BUS_TRAFFIC_EVENT, TEST_ADDRESS_BROADCAST, &emitted, sizeof(emitted));
+        sim_run_for(TEST_DISPATCH_PERIOD);
+    }
+
+    // The first node dispatches from its task, the second one calls kc_process_incoming() every tick
+    SIM_Time_t dispatch_p50[2], dispatch_max[2];
+    printf("%12s %16s %16s %16s %16s\n", "", "dispatch p50[us]", "dispatch max[us]", "total p50[us]", "total max[us]");
+    for(size_t i = 0; i < 2; i++) {
+        TEST_BusNode_t* node = &test_bus_state.nodes[i];
+        TEST_ASSERT_EQUAL(TEST_DISPATCH_EVENTS, node->latency_count);
+        TEST_ASSERT_EQUAL(0, node->dropped);
+
+        qsort(latencies[i], TEST_DISPATCH_EVENTS, sizeof(SIM_Time_t), test_compare_time);
+        qsort(dispatch_latencies[i], TEST_DISPATCH_EVENTS, sizeof(SIM_Time_t), test_compare_time);
+        dispatch_p50[i] = test_percentile(dispatch_latencies[i], TEST_DISPATCH_EVENTS, 50);
+        dispatch_max[i] = dispatch_latencies[i][TEST_DISPATCH_EVENTS - 1];
+        printf("%12s %16.1f %16.1f %16.1f %16.1f\n", node->polling ? "polling" : "task",
+            dispatch_p50[i] / 1e3, dispatch_max[i] / 1e3,
+            test_percentile(latencies[i], TEST_DISPATCH_EVENTS, 50) / 1e3, latencies[i][TEST_DISPATCH_EVENTS - 1] / 1e3);
+    }
+
+    // The task wakes up from the receive interrupt within microseconds, polling waits for the next tick
+    TEST_ASSERT(dispatch_max[0] < SIM_US(50));
+    TEST_ASSERT(dispatch_p50[1] > 10 * dispatch_max[0]);
+    TEST_ASSERT(dispatch_max[1] <= SIM_MS(1) + SIM_US(50));
+}
+
+typedef struct {
+    SIM_Time_t p50;
+    SIM_Time_t max;
+} TEST_LatencySummary_t;
+
+static TEST_LatencySummary_t test_summarize(SIM_Time_t* latencies, size_t count) {
+    qsort(latencies, count, sizeof(SIM_Time_t), test_compare_time);
+    return (TEST_LatencySummary_t){ .p50 = test_percentile(latencies, count, 50), .max = count > 0 ? latencies[count - 1] : 0 };
+}
+
+static void test_command_flood(void) {
+    static SIM_Time_t latencies[TEST_FLOOD_EVENTS];
+    static SIM_Time_t event_latencies[TEST_FLOOD_EVENTS];
+    static SIM_Time_t command_latencies[2 * TEST_FLOOD_COMMANDS];
+    TEST_BusNode_t configuration = {
+        .latencies = latencies,
+        .dispatch_latencies = event_latencies,
+        .latency_capacity = TEST_FLOOD_EVENTS,
+        .command_latencies = command_latencies,
+        .command_latency_capacity = 2 * TEST_FLOOD_COMMANDS
+    };
+    TEST_Peer_t* peer = test_protocol_start(1, &configuration);
+    TEST_BusNode_t* node = &test_bus_state.nodes[0];
+    node->traffic_handler_time = TEST_FLOOD_HANDLER_TIME;
+    uint8_t argument = 0;
+
+    // The commands alone, one at a time
+    for(size_t i = 0; i < TEST_FLOOD_COMMANDS; i++) {
+        test_peer_send(peer, TEST_FRAMETYPE_COMMAND, TEST_BUS_ECHO_COMMAND, node->address, &argument, sizeof(argument));
+        TEST_ASSERT(test_peer_receive(peer, TEST_FRAMETYPE_RESPONSE, TEST_BUS_ECHO_COMMAND, SIM_MS(10)) != 0);
+    }
+    TEST_ASSERT_EQUAL(TEST_FLOOD_COMMANDS, node->command_latency_count);
+
+    // The same commands among the flood, which a second controller broadcasts
+    SIM_CANPeer_t* flood = sim_can_peer_create(true);
+    for(size_t i = 0; i < TEST_FLOOD_EVENTS; i++) {
+        SIM_Time_t emitted = sim_now();
+        SIM_CANFrame_t frame = {
+            .id = TEST_ID(TEST_FRAMETYPE_EVENT, TEST_BUS_TRAFFIC_EVENT, TEST_FLOOD_ADDRESS, TEST_ADDRESS_BROADCAST) | 1UL << 25 | 1UL << 26,
+            .extended = true,
+            .dlc = sizeof(emitted)
+        };
+        memcpy(frame.data, &emitted, sizeof(emitted));
+        sim_can_peer_transmit(flood, &frame);
+
+        if(i % TEST_FLOOD_COMMAND_INTERVAL == TEST_FLOOD_COMMAND_INTERVAL / 2) {
+            test_peer_send(peer, TEST_FRAMETYPE_COMMAND, TEST_BUS_ECHO_COMMAND, node->address, &argument, sizeof(argument));
+        }
+        sim_run_for(TEST_FLOOD_PERIOD);
+    }
+    sim_run_for((SIM_Time_t)TEST_FLOOD_EVENTS * TEST_FLOOD_HANDLER_TIME);
+
+    TEST_ASSERT_EQUAL(TEST_FLOOD_EVENTS, node->latency_count);
+    TEST_ASSERT_EQUAL(2 * TEST_FLOOD_COMMANDS, node->command_latency_count);
+    TEST_ASSERT_EQUAL(2 * TEST_FLOOD_COMMANDS, test_peer_count(peer, TEST_FRAMETYPE_RESPONSE, TEST_BUS_ECHO_COMMAND));
+    TEST_ASSERT_EQUAL(0, node->dropped);
+
+    TEST_LatencySummary_t idle = test_summarize(command_latencies, TEST_FLOOD_COMMANDS);
+    TEST_LatencySummary_t commands = test_summarize(&command_latencies[TEST_FLOOD_COMMANDS], TEST_FLOOD_COMMANDS);
+    TEST_LatencySummary_t events = test_summarize(event_latencies, TEST_FLOOD_EVENTS);
+    printf("%18s %9s %9s\n", "dispatch latency", "p50[us]", "max[us]");
+    printf("%18s %9.1f %9.1f\n", "commands alone", idle.p50 / 1e3, idle.max / 1e3);
+    printf("%18s %9.1f %9.1f\n", "commands in flood", commands.p50 / 1e3, commands.max / 1e3);
+    printf("%18s %9.1f %9.1f\n", "events in flood", events.p50 / 1e3, events.max / 1e3);
+
+    // The events pile up behind the slow handler, which would delay the commands on a single lane.
+    // On the priority lane, a command waits for the running handler at most.
+    TEST_ASSERT(events.p50 > 4 * TEST_FLOOD_HANDLER_TIME);
+    TEST_ASSERT(commands.max < TEST_FLOOD_HANDLER_TIME + SIM_US(50));
+}
+
+static void test_stream_in_order(void) {
+    static uint8_t received[TEST_STREAM_SIZE];
+    TEST_BusNode_t configurations[2] = { { 0 }, { .stream_data = received, .stream_capacity = sizeof(received) } };
+    TEST_Peer_t* peer = test_protocol_start(2, configurations);
+    TEST_BusNode_t* sender = &test_bus_state.nodes[0];
+    TEST_BusNode_t* receiver = &test_bus_state.nodes[1];
+
+    sender->action_receiver = receiver->address;
+    sender->action_id = 7;
+    sender->action_size = TEST_STREAM_SIZE;
+    test_node_act(sender, TEST_ACTION_STREAM, SIM_MS(200));
+
+    size_t chunk_count = (TEST_STREAM_SIZE + TEST_STREAM_CHUNK_SIZE - 1) / TEST_STREAM_CHUNK_SIZE;
+    printf("%d bytes streamed in %.1f ms, %.1f kB/s\n", TEST_STREAM_SIZE, sender->action_time / 1e6,
+        TEST_STREAM_SIZE / (sender->action_time / 1e9) / 1e3);
+    TEST_ASSERT_EQUAL(0, sender->action_error);
+    TEST_ASSERT(sender->action_result);
+    TEST_ASSERT(receiver->stream_complete);
+    test_assert_stream_data(receiver, TEST_STREAM_SIZE);
+
+    // Nothing has been lost on the way, so every chunk is sent once
+    TEST_ASSERT_EQUAL(1, test_peer_count(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_OPEN));
+    TEST_ASSERT_EQUAL(chunk_count, test_peer_count(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_DATA));
+    TEST_ASSERT(!receiver->stream_abandoned);
+}
+
+static void test_stream_retransmit(void) {
+    TEST_Peer_t* peer = test_protocol_start(1, 0);
+    TEST_BusNode_t* node = &test_bus_state.nodes[0];
+    const uint16_t chunk_count = 6;
+    const uint16_t lost = 1;
+
+    node->action_receiver = TEST_PEER_ADDRESS;
+    node->action_id = 3;
+    node->action_size = chunk_count * TEST_STREAM_CHUNK_SIZE;
+    node->action = TEST_ACTION_STREAM;
+
+    TEST_StreamOpen_t open = test_peer_accept_stream(peer, node->address, TEST_STREAM_WINDOW);
+    TEST_ASSERT_EQUAL(3, open.stream_id);
+    TEST_ASSERT_EQUAL(node->action_size, open.total_size);
+
+    // The peer loses the first transmission of a chunk and reports the gap once the next one arrives
+    uint32_t received = 0;
+    uint16_t next = 0;
+    size_t transmissions = 0;
+    SIM_Time_t gap_reported = 0;
+    SIM_Time_t retransmitted = 0;
+    while(next < chunk_count) {
+        TEST_Message_t* message;
+        int32_t sequence = test_peer_receive_chunk(peer, SIM_MS(20), &message);
+        TEST_ASSERT(sequence >= 0 && sequence < chunk_count);
+        transmissions++;
+
+        if(sequence == lost && transmissions == lost + 1) continue;
+        if(sequence == lost) retransmitted = message->start;
+        received |= 1UL << sequence;
+        while(received >> next & 1) next++;
+
+        TEST_StreamAcknowledgement_t acknowledgement = { .next_sequence = next, .received_chunks = (uint16_t)(received >> (next + 1)) };
+        test_peer_send(peer, TEST_FRAMETYPE_RESPONSE, TEST_COMMAND_STREAM_DATA, node->address, &acknowledgement, sizeof(acknowledgement));
+        if(gap_reported == 0 && acknowledgement.received_chunks != 0) gap_reported = sim_now();
+    }
+    if(!sim_run_until(test_action_done, node, SIM_MS(20))) TEST_FAIL("The stream hasn't been finished.");
+
+    printf("lost chunk retransmitted %.2f ms after the gap has been reported\n", (retransmitted - gap_reported) / 1e6);
+    TEST_ASSERT(node->action_result);
+
+    // The gap triggers the retransmission long before the timeout of the chunk
+    TEST_ASSERT_EQUAL(chunk_count + 1, transmissions);
+    TEST_ASSERT(gap_reported != 0 && retransmitted > gap_reported);
+    TEST_ASSERT(retransmitted - gap_reported < SIM_MS(TEST_STREAM_RETRANSMIT_TICKS / 5));
+    TEST_ASSERT(node->action_time < SIM_MS(TEST_STREAM_RETRANSMIT_TICKS));
+
+    sim_run_for(SIM_MS(2 * TEST_STREAM_RETRANSMIT_TICKS));
+    TEST_ASSERT_EQUAL(chunk_count + 1, test_peer_count(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_DATA));
+}
+
+static void test_stream_out_of_order(void) {
+    static uint8_t received[TEST_STREAM_SIZE];
+    TEST_BusNode_t configuration = { .stream_data = received, .stream_capacity = sizeof(received) };
+    TEST_Peer_t* peer = test_protocol_start(1, &configuration);
+    TEST_BusNode_t* node = &test_bus_state.nodes[0];
+    static const uint16_t order[] = { 0, 2, 3, 1, 4, 5 };
+    const uint16_t chunk_count = sizeof(order) / sizeof(*order);
+    const uint32_t total_size = chunk_count * TEST_STREAM_CHUNK_SIZE - 10;
+
+    TEST_StreamOpen_t open = { .stream_id = 1, .total_size = total_size, .window = TEST_STREAM_WINDOW };
+    test_peer_send(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_OPEN, node->address, &open, sizeof(open));
+    TEST_Message_t* accepted = test_peer_receive(peer, TEST_FRAMETYPE_RESPONSE, TEST_COMMAND_STREAM_OPEN, SIM_MS(10));
+    TEST_ASSERT(accepted != 0);
+    TEST_ASSERT_EQUAL(1, accepted->payload_size);
+    TEST_ASSERT_EQUAL(TEST_STREAM_WINDOW, accepted->payload[0]);
+
+    for(size_t i = 0; i < chunk_count; i++) test_peer_send_chunk(peer, node->address, total_size, order[i]);
+
+    // Every chunk which overtook the missing one is reported right away
+    TEST_StreamAcknowledgement_t acknowledgement = test_peer_receive_acknowledgement(peer, SIM_MS(10));
+    TEST_ASSERT_EQUAL(1, acknowledgement.next_sequence);
+    TEST_ASSERT_EQUAL(0x1, acknowledgement.received_chunks);
+    acknowledgement = test_peer_receive_acknowledgement(peer, SIM_MS(10));
+    TEST_ASSERT_EQUAL(1, acknowledgement.next_sequence);
+    TEST_ASSERT_EQUAL(0x3, acknowledgement.received_chunks);
+
+    // The held back chunks are passed on in order once the gap has been filled, and acknowledged
+    // together with the next ones after half a window
+    acknowledgement = test_peer_receive_acknowledgement(peer, SIM_MS(10));
+    TEST_ASSERT_EQUAL(TEST_STREAM_WINDOW / 2 + 1, acknowledgement.next_sequence);
+    TEST_ASSERT_EQUAL(0, acknowledgement.received_chunks);
+    acknowledgement = test_peer_receive_acknowledgement(peer, SIM_MS(10));
+    TEST_ASSERT_EQUAL(chunk_count, acknowledgement.next_sequence);
+    TEST_ASSERT_EQUAL(0, acknowledgement.received_chunks);
+    TEST_ASSERT(node->stream_complete);
+    test_assert_stream_data(node, total_size);
+    TEST_ASSERT_EQUAL(0, node->dropped);
+}
+
+static void test_stream_stall(void) {
+    TEST_Peer_t* peer = test_protocol_start(1, 0);
+    TEST_BusNode_t* node = &test_bus_state.nodes[0];
+    const uint8_t window = 2;
+    SIM_Time_t stall_time = SIM_MS((TEST_STREAM_RETRIES + 1) * TEST_STREAM_RETRANSMIT_TICKS);
+
+    // The peer accepts the stream with a small window, but never acknowledges a chunk
+    node->action_receiver = TEST_PEER_ADDRESS;
+    node->action_id = 4;
+    node->action_size = TEST_STREAM_SIZE;
+    node->action = TEST_ACTION_STREAM;
+    test_peer_accept_stream(peer, node->address, window);
+    if(!sim_run_until(test_action_done, node, 2 * stall_time)) TEST_FAIL("The stalled stream hasn't been given up.");
+
+    printf("stalled stream given up after %.1f ms\n", node->action_time / 1e6);
+    TEST_ASSERT(!node->action_result);
+    TEST_ASSERT_EQUAL(0, node->action_error);
+    TEST_ASSERT(node->action_time >= stall_time);
+    TEST_ASSERT(node->action_time < stall_time + SIM_MS(TEST_STREAM_RETRANSMIT_TICKS));
+
+    // Only the window has been sent, and retransmitted after every stall
+    size_t transmissions = 0;
+    int32_t sequence;
+    while((sequence = test_peer_receive_chunk(peer, 0, 0)) >= 0) {
+        TEST_ASSERT(sequence < window);
+        transmissions++;
+    }
+    TEST_ASSERT_EQUAL(window * (TEST_STREAM_RETRIES + 1), transmissions);
+
+    // A receiver which doesn't answer at all is given up after the same number of attempts
+    node->action = TEST_ACTION_STREAM;
+    if(!sim_run_until(test_action_done, node, 2 * stall_time)) TEST_FAIL("The unanswered stream hasn't been given up.");
+    TEST_ASSERT(!node->action_result);
+    TEST_ASSERT(node->action_time >= stall_time);
+    TEST_ASSERT_EQUAL(1 + TEST_STREAM_RETRIES + 1, test_peer_count(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_OPEN));
+    TEST_ASSERT_EQUAL(window * (TEST_STREAM_RETRIES + 1), test_peer_count(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_DATA));
+}
+
+static void test_stream_abort(void) {
+    static uint8_t received[TEST_STREAM_SIZE];
+    const uint32_t abort_offset = 3 * TEST_STREAM_CHUNK_SIZE;
+    TEST_BusNode_t configurations[2] = {
+        { 0 },
+        { .stream_data = received, .stream_capacity = sizeof(received), .stream_abort_offset = abort_offset }
+    };
+    TEST_Peer_t* peer = test_protocol_start(2, configurations);
+    TEST_BusNode_t* sender = &test_bus_state.nodes[0];
+    TEST_BusNode_t* receiver = &test_bus_state.nodes[1];
+
+    sender->action_receiver = receiver->address;
+    sender->action_id = 5;
+    sender->action_size = TEST_STREAM_SIZE;
+    test_node_act(sender, TEST_ACTION_STREAM, SIM_MS(TEST_STREAM_RETRANSMIT_TICKS));
+
+    // The receiver tells the sender right away, which stops without waiting for a timeout
+    printf("aborted stream given up after %.1f ms\n", sender->action_time / 1e6);
+    TEST_ASSERT(!sender->action_result);
+    TEST_ASSERT(sender->action_time < SIM_MS(TEST_STREAM_RETRANSMIT_TICKS / 2));
+    TEST_ASSERT_EQUAL(abort_offset, receiver->stream_received);
+    TEST_ASSERT(!receiver->stream_complete);
+
+    // The abort is an empty acknowledgement
+    size_t aborts = 0;
+    for(size_t i = 0; i < peer->log_count; i++) {
+        const TEST_Message_t* message = &peer->log[i];
+        if(message->frame_type == TEST_FRAMETYPE_RESPONSE && message->transaction == TEST_COMMAND_STREAM_DATA && message->payload_size == 0) {
+            TEST_ASSERT_EQUAL(receiver->address, message->sender);
+            TEST_ASSERT_EQUAL(sender->address, message->receiver);
+            aborts++;
+        }
+    }
+    TEST_ASSERT(aborts >= 1);
+
+    // The consumer which aborted isn't notified again, and the chunks in flight aren't sent again
+    size_t transmissions = test_peer_count(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_DATA);
+    sim_run_for(SIM_MS(TEST_STREAM_TIMEOUT_TICKS + 2 * TEST_HOUSEKEEPING_TICKS));
+    TEST_ASSERT(!receiver->stream_abandoned);
+    TEST_ASSERT(transmissions <= abort_offset / TEST_STREAM_CHUNK_SIZE + TEST_STREAM_WINDOW);
+    TEST_ASSERT_EQUAL(transmissions, test_peer_count(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_DATA));
+}
+
+static void test_stream_timeout(void) {
+    static uint8_t received[TEST_STREAM_SIZE];
+    TEST_BusNode_t configuration = { .stream_data = received, .stream_capacity = sizeof(received) };
+    TEST_Peer_t* peer = test_protocol_start(1, &configuration);
+    TEST_BusNode_t* node = &test_bus_state.nodes[0];
+
+    TEST_StreamOpen_t open = { .stream_id = 2, .total_size = TEST_STREAM_SIZE, .window = TEST_STREAM_WINDOW };
+    test_peer_send(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_OPEN, node->address, &open, sizeof(open));
+    TEST_ASSERT(test_peer_receive(peer, TEST_FRAMETYPE_RESPONSE, TEST_COMMAND_STREAM_OPEN, SIM_MS(10)) != 0);
+    test_peer_send_chunk(peer, node->address, TEST_STREAM_SIZE, 0);
+    sim_run_for(SIM_MS(10));
+    TEST_ASSERT_EQUAL(TEST_STREAM_CHUNK_SIZE, node->stream_received);
+
+    // The sender falls silent, so the receiver gives up and notifies the consumer
+    sim_run_for(SIM_MS(TEST_STREAM_TIMEOUT_TICKS - 2 * TEST_HOUSEKEEPING_TICKS));
+    TEST_ASSERT(!node->stream_abandoned);
+    sim_run_for(SIM_MS(4 * TEST_HOUSEKEEPING_TICKS));
+    TEST_ASSERT(node->stream_abandoned);
+    TEST_ASSERT(!node->stream_complete);
+
+    // Chunks of the forgotten stream are answered with an abort
+    test_peer_send_chunk(peer, node->address, TEST_STREAM_SIZE, 1);
+    TEST_Message_t* abort = test_peer_receive(peer, TEST_FRAMETYPE_RESPONSE, TEST_COMMAND_STREAM_DATA, SIM_MS(10));
+    TEST_ASSERT(abort != 0);
+    TEST_ASSERT_EQUAL(0, abort->payload_size);
+    TEST_ASSERT_EQUAL(TEST_STREAM_CHUNK_SIZE, node->stream_received);
+}
+
+static void test_stream_polling(void) {
+    static uint8_t received[TEST_STREAM_SIZE];
+    TEST_BusNode_t configurations[2] = { { .polling = true }, { .stream_data = received, .stream_capacity = sizeof(received) } };
+    TEST_Peer_t* peer = test_protocol_start(2, configurations);
+    TEST_BusNode_t* sender = &test_bus_state.nodes[0];
+    TEST_BusNode_t* receiver = &test_bus_state.nodes[1];
+
+    // Without a dispatcher task, the sender dispatches the acknowledgements while waiting for them
+    sender->action_receiver = receiver->address;
+    sender->action_id = 6;
+    sender->action_size = TEST_STREAM_SIZE;
+    test_node_act(sender, TEST_ACTION_STREAM, SIM_MS(200));
+    printf("%d bytes streamed without a dispatcher task in %.1f ms\n", TEST_STREAM_SIZE, sender->action_time / 1e6);
+    TEST_ASSERT_EQUAL(0, sender->action_error);
+    TEST_ASSERT(sender->action_result);
+    test_assert_stream_data(receiver, TEST_STREAM_SIZE);
+
+    // A handler of such a node can't wait for the acknowledgements, so the command fails
+    uint8_t argument = 0;
+    test_peer_send(peer, TEST_FRAMETYPE_COMMAND, TEST_BUS_STREAM_COMMAND, sender->address, &argument, sizeof(argument));
+    TEST_Message_t* error = test_peer_receive(peer, TEST_FRAMETYPE_ERROR, TEST_ERR_IMPOSSIBLE, SIM_MS(10));
+    TEST_ASSERT(error != 0);
+    TEST_ASSERT_EQUAL(sender->address, error->sender);
+    TEST_ASSERT_EQUAL(1, test_peer_count(peer, TEST_FRAMETYPE_COMMAND, TEST_COMMAND_STREAM_OPEN));
+
+    // The node keeps working afterwards
+    test_node_act(sender, TEST_ACTION_STREAM, SIM_MS(200));
+    TEST_ASSERT(sender->action_result);
+    test_assert_stream_data(receiver, TEST_STREAM_SIZE);
+}
+
+/**
+ * @brief Asserts that @p error is a broadcast of @p node carrying the truncated @ref TEST_BUS_ERROR_MESSAGE.
+ */
+static void test_assert_error_frame(const TEST_Message_t* error, const TEST_BusNode_t* node) {
+    TEST_ASSERT(error != 0);
+    TEST_ASSERT_EQUAL(node->address, error->sender);
+    TEST_ASSERT_EQUAL(TEST_ADDRESS_BROADCAST, error->receiver);
+    TEST_ASSERT_EQUAL(TEST_ERROR_MESSAGE_SIZE, error->payload_size);
+    TEST_ASSERT(memcmp(error->payload, TEST_BUS_ERROR_MESSAGE, TEST_ERROR_MESSAGE_SIZE) == 0);
+}
+
+static void test_error_report(void) {
+    TEST_Peer_t* peer = test_protocol_start(1, 0);
+    TEST_BusNode_t* node = &test_bus_state.nodes[0];
+
+    // An event handler which throws is caught by the dispatcher, which broadcasts the error
+    test_peer_send(peer, TEST_FRAMETYPE_EVENT, TEST_BUS_THROW_EVENT, TEST_ADDRESS_BROADCAST, 0, 0);
+    test_assert_error_frame(test_peer_receive(peer, TEST_FRAMETYPE_ERROR, TEST_ERR_RANGE, SIM_MS(10)), node);
+
+    // Uncaught errors of several tasks are reported each with its own message, and the report
+    // buffers are released once they're sent, so the reports keep working
+    node->action_id = TEST_ERR_RUNTIME_GENERIC;
+    node->action_count = 2;
+    for(int round = 0; round < 3; round++) {
+        test_node_act(node, TEST_ACTION_THROW, SIM_MS(10));
+        test_assert_error_frame(test_peer_receive(peer, TEST_FRAMETYPE_ERROR, TEST_ERR_RUNTIME_GENERIC, SIM_MS(10)), node);
+        test_assert_error_frame(test_peer_receive(peer, TEST_FRAMETYPE_ERROR, TEST_ERR_NOT_IMPLEMENTED, SIM_MS(10)), node);
+    }
+    TEST_ASSERT_EQUAL(3, test_peer_count(peer, TEST_FRAMETYPE_ERROR, TEST_ERR_RUNTIME_GENERIC));
+    TEST_ASSERT_EQUAL(3, test_peer_count(peer, TEST_FRAMETYPE_ERROR, TEST_ERR_NOT_IMPLEMENTED));
+
+    // The dispatcher survives all of it
+    test_peer_send(peer, TEST_FRAMETYPE_EVENT, TEST_BUS_THROW_EVENT, TEST_ADDRESS_BROADCAST, 0, 0);
+    test_assert_error_frame(test_peer_receive(peer, TEST_FRAMETYPE_ERROR, TEST_ERR_RANGE, SIM_MS(10)), node);
+}
+
+static void test_fwupdate_begin(void) {
+    TEST_BusNode_t* node = test_firmware_start();
+    uint8_t* staging = node->staging_flash;
+    size_t trailer_offset = TEST_FW_FLASH_SIZE - TEST_BUS_FLASH_PAGE_SIZE;
+
+    // Nothing happens before an update has been started, chunks are ignored
+    TEST_FirmwareStatus_t status = test_firmware_query(node);
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_NOT_STARTED, status.status);
+    TEST_ASSERT_EQUAL(0, status.missing_count);
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_NOT_STARTED, test_firmware_status(node, TEST_COMMAND_FWUPDATE_FINISH, 0, 0));
+    test_firmware_send_chunk(0, TEST_FW_CHUNK_SIZE, 0);
+    test_firmware_flush();
+    TEST_ASSERT_EQUAL(0, staging[0]);
+
+    // Images which leave no page for the trailer don't fit, and malformed requests aren't answered with a status
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_TOO_LARGE, test_firmware_begin(node, trailer_offset + 1, 0));
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_NOT_STARTED, test_firmware_query(node).status);
+    TEST_ASSERT_EQUAL(0, test_firmware_command(node, TEST_COMMAND_FWUPDATE_BEGIN, "\x01", 1)->payload_size);
+
+    // Beginning erases the trailer of the previous image and the first page, and every chunk is missing
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_OK, test_firmware_begin(node, TEST_FW_IMAGE_SIZE, test_firmware_crc()));
+    for(size_t i = 0; i < TEST_BUS_FLASH_PAGE_SIZE; i++) {
+        TEST_ASSERT_EQUAL(0xFF, staging[trailer_offset + i]);
+        TEST_ASSERT_EQUAL(0xFF, staging[i]);
+    }
+
+    status = test_firmware_query(node);
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_INCOMPLETE, status.status);
+    TEST_ASSERT_EQUAL(TEST_FW_CHUNK_COUNT, status.missing_count);
+    for(uint16_t i = 0; i < status.missing_count; i++) TEST_ASSERT_EQUAL(i, status.missing[i]);
+}
+
+static void test_fwupdate_missing(void) {
+    TEST_BusNode_t* node = test_firmware_start();
+    const uint16_t last = TEST_FW_CHUNK_COUNT - 1;
+    const uint16_t lost[] = { 3, 7, last };
+
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_OK, test_firmware_begin(node, TEST_FW_IMAGE_SIZE, test_firmware_crc()));
+    for(uint16_t sequence = 0; sequence < last; sequence++) {
+        if(sequence != 3 && sequence != 7) test_firmware_send_chunk(sequence, test_firmware_chunk_size(sequence), 0);
+    }
+
+    // Repeated chunks are ignored, as well as chunks beyond the image and chunks of the wrong size
+    test_firmware_send_chunk(0, TEST_FW_CHUNK_SIZE, 0x55);
+    test_firmware_send_chunk(last + 1, TEST_FW_CHUNK_SIZE, 0);
+    test_firmware_send_chunk(UINT16_MAX, TEST_FW_CHUNK_SIZE, 0);
+    test_firmware_send_chunk(3, TEST_FW_CHUNK_SIZE - 1, 0);
+    test_firmware_send_chunk(last, test_firmware_chunk_size(last) + 1, 0);
+    test_firmware_flush();
+
+    TEST_FirmwareStatus_t status = test_firmware_query(node);
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_INCOMPLETE, status.status);
+    TEST_ASSERT_EQUAL(sizeof(lost) / sizeof(*lost), status.missing_count);
+    for(size_t i = 0; i < status.missing_count; i++) TEST_ASSERT_EQUAL(lost[i], status.missing[i]);
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_INCOMPLETE, test_firmware_status(node, TEST_COMMAND_FWUPDATE_FINISH, 0, 0));
+
+    // Repeating the missing chunks completes the image
+    for(size_t i = 0; i < sizeof(lost) / sizeof(*lost); i++) {
+        test_firmware_send_chunk(lost[i], test_firmware_chunk_size(lost[i]), 0);
+    }
+    test_firmware_flush();
+
+    status = test_firmware_query(node);
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_OK, status.status);
+    TEST_ASSERT_EQUAL(0, status.missing_count);
+    for(size_t i = 0; i < TEST_FW_IMAGE_SIZE; i++) TEST_ASSERT_EQUAL(test_bus_payload_byte(i), node->staging_flash[i]);
+}
+
+static void test_fwupdate_finish(void) {
+    TEST_BusNode_t* node = test_firmware_start();
+    const uint8_t* trailer_page = &node->staging_flash[TEST_FW_FLASH_SIZE - TEST_BUS_FLASH_PAGE_SIZE];
+    uint32_t crc = test_firmware_crc();
+
+    // An image whose checksum doesn't match isn't marked for installation
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_OK, test_firmware_begin(node, TEST_FW_IMAGE_SIZE, crc ^ 1));
+    for(uint16_t sequence = 0; sequence < TEST_FW_CHUNK_COUNT; sequence++) {
+        test_firmware_send_chunk(sequence, test_firmware_chunk_size(sequence), 0);
+    }
+    test_firmware_flush();
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_CORRUPT, test_firmware_status(node, TEST_COMMAND_FWUPDATE_FINISH, 0, 0));
+    for(size_t i = 0; i < sizeof(TEST_FirmwareTrailer_t); i++) TEST_ASSERT_EQUAL(0xFF, trailer_page[i]);
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_NOT_STARTED, test_firmware_query(node).status);
+
+    test_node_act(node, TEST_ACTION_INSTALL, SIM_MS(10));
+    TEST_ASSERT(!node->action_result);
+    for(size_t i = 0; i < TEST_FW_FLASH_SIZE; i++) TEST_ASSERT_EQUAL(0, node->application_flash[i]);
+
+    // The same image with the right checksum is marked by its trailer
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_OK, test_firmware_begin(node, TEST_FW_IMAGE_SIZE, crc));
+    for(uint16_t sequence = TEST_FW_CHUNK_COUNT; sequence-- > 0;) {
+        test_firmware_send_chunk(sequence, test_firmware_chunk_size(sequence), 0);
+    }
+    test_firmware_flush();
+    TEST_ASSERT_EQUAL(TEST_FW_STATUS_OK, test_firmware_status(node, TEST_COMMAND_FWUPDATE_FINISH, 0, 0));
+
+    TEST_FirmwareTrailer_t trailer;
+    memcpy(&trailer, trailer_page, sizeof(trailer));
+    TEST_ASSERT_EQUAL(TEST_FW_TRAILER_MAGIC, trailer.magic);
+    TEST_ASSERT_EQUAL(TEST_FW_IMAGE_SIZE, trailer.size);
+    TEST_ASSERT_EQUAL(crc, trailer.crc);
+
+    // The bootloader installs it once
+    test_node_act(node, TEST_ACTION_INSTALL, SIM_MS(10));
+    TEST_ASSERT(node->action_result);
+    for(size_t i = 0; i < TEST_FW_IMAGE_SIZE; i++) TEST_ASSERT_EQUAL(test_bus_payload_byte(i), node->application_flash[i]);
+    for(size_t i = 0; i < sizeof(trailer); i++) TEST_ASSERT_EQUAL(0xFF, trailer_page[i]);
+
+    test_node_act(node, TEST_ACTION_INSTALL, SIM_MS(10));
+    TEST_ASSERT(!node->action_result);
+}
+
+static void test_report_row(void) {
+    TEST_BusResult_t result = test_bus_simulate(test_node_count);
+    test_print_result(test_node_count, &result);
+    if(result.missing != 0) printf("      %zu of %zu deliveries missing\n", result.missing, result.messages * (test_node_count - 1));
+}
+
+/**
+ * @brief Prints a row for each of the given bus sizes, or for a range of sizes from 2 to 127.
+ */
+static int test_report(int argc, char** argv) {
+    static const size_t default_node_counts[] = { 2, 4, 8, 16, 32, 64, 96, 127 };
+    size_t default_count = sizeof(default_node_counts) / sizeof(*default_node_counts);
+    size_t row_count = argc > 0 ? (size_t)argc : default_count;
+    int failed = 0;
+
+    test_print_header();
+    for(size_t i = 0; i < row_count; i++) {
+        test_node_count = argc > 0 ? strtoul(argv[i], 0, 10) : default_node_counts[i];
+        if(test_run(&(TEST_Case_t){ "report", test_report_row }) != 0) failed++;
+    }
+    return failed != 0;
+}
+
+static const TEST_Case_t test_cases[] = {
+    TEST_CASE(nodes_2),
+    TEST_CASE(nodes_4),
+    TEST_CASE(nodes_8),
+    TEST_CASE(nodes_16),
+    TEST_CASE(command_timeout),
+    TEST_CASE(command_late_response),
+    TEST_CASE(command_large_payload),
+    TEST_CASE(transmit_throughput),
+    TEST_CASE(dispatch_latency),
+    TEST_CASE(command_flood),
+    TEST_CASE(stream_in_order),
+    TEST_CASE(stream_retransmit),
+    TEST_CASE(stream_out_of_order),
+    TEST_CASE(stream_stall),
+    TEST_CASE(stream_abort),
+    TEST_CASE(stream_timeout),
+    TEST_CASE(stream_polling),
+    TEST_CASE(error_report),
+    TEST_CASE(fwupdate_begin),
+    TEST_CASE(fwupdate_missing),
+    TEST_CASE(fwupdate_finish)
+};
+
+int main(int argc, char** argv) {
+    if(argc > 1 && strcmp(argv[1], "report") == 0) return test_report(argc - 2, argv + 2);
+    return test_main(test_cases, sizeof(test_cases) / sizeof(*test_cases), argc, argv);
+}
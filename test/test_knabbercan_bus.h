@@ -0,0 +1,184 @@
+/**
+ * @file test_knabbercan_bus.h
+ * @author Gabriel Heinzer
+ * @brief Interface between the multi-node simulation of test_knabbercan_bus.c and the firmware of
+ * its nodes, test_knabbercan_bus_node.c.
+ *
+ * The firmware is built as a shared library, of which every node loads a copy of its own. The
+ * simulation passes a @ref TEST_BusNode_t to the entry function of each node, through which the
+ * node reports its addressing result and the latencies of the messages it receives.
+ */
+
+#pragma once
+
+#include <sim.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief Name of the entry function of the node firmware, see @ref SIM_NodeEntry_t.
+#define TEST_BUS_NODE_ENTRY "test_bus_node_main"
+
+/// @brief Event ID of the messages which are exchanged once the bus has been addressed.
+#define TEST_BUS_TRAFFIC_EVENT 0x20
+
+/// @brief Event ID of the messages sent by @ref TEST_ACTION_TRANSMIT and @ref TEST_ACTION_TRANSMIT_ASYNC, which no node handles.
+#define TEST_BUS_BULK_EVENT 0x21
+
+/// @brief Event whose handler throws ``ERR_RANGE`` with @ref TEST_BUS_ERROR_MESSAGE.
+#define TEST_BUS_THROW_EVENT 0x22
+
+/// @brief Message of the errors thrown by the nodes, which is longer than the error frames carry.
+#define TEST_BUS_ERROR_MESSAGE "Thrown on purpose by the test firmware"
+
+/// @brief Command which is answered with its own payload.
+#define TEST_BUS_ECHO_COMMAND 0x40
+
+/// @brief Command whose handler tries to send a stream back to the sender of the command.
+#define TEST_BUS_STREAM_COMMAND 0x42
+
+/// @brief Page size of the flash regions in RAM of the update service, see @ref TEST_BusNode_t::staging_flash.
+#define TEST_BUS_FLASH_PAGE_SIZE 64
+
+/// @brief Maximum size of the payloads sent and recorded by the nodes.
+#define TEST_BUS_MAX_PAYLOAD 256
+
+/// @brief Number of responses recorded by a node, see @ref TEST_BusNode_t::responses.
+#define TEST_BUS_RESPONSE_COUNT 16
+
+/**
+ * @brief Operation which the simulation lets a node perform once the bus has been addressed.
+ */
+typedef enum {
+    TEST_ACTION_NONE = 0,
+    /// @brief Sends @ref TEST_BusNode_t::action_count commands to the @ref TEST_BusNode_t::action_receiver,
+    /// with the IDs counting up from @ref TEST_BusNode_t::action_id, and records their responses.
+    TEST_ACTION_COMMAND,
+    /// @brief Sends a stream of @ref TEST_BusNode_t::action_size bytes to the @ref TEST_BusNode_t::action_receiver,
+    /// see @ref test_bus_payload_byte(). The ID of the stream is @ref TEST_BusNode_t::action_id.
+    TEST_ACTION_STREAM,
+    /// @brief Broadcasts @ref TEST_BusNode_t::action_count events of @ref TEST_BusNode_t::action_size bytes
+    /// with kc_frame_transmit(), which returns once each of them is in the mailboxes.
+    TEST_ACTION_TRANSMIT,
+    /// @brief Like @ref TEST_ACTION_TRANSMIT, but queues the events with kc_frame_transmit_async().
+    TEST_ACTION_TRANSMIT_ASYNC,
+    /// @brief Installs the image of the staging region to the application region with fw_update_install(),
+    /// whose result is written to @ref TEST_BusNode_t::action_result.
+    TEST_ACTION_INSTALL,
+    /// @brief Starts @ref TEST_BusNode_t::action_count tasks, each of which throws an uncaught error with
+    /// @ref TEST_BUS_ERROR_MESSAGE. The error codes count up from @ref TEST_BusNode_t::action_id.
+    TEST_ACTION_THROW
+} TEST_BusAction_t;
+
+/**
+ * @brief Response or timeout of a command sent by a node.
+ */
+typedef struct {
+    uint8_t status;
+    uint8_t sender_address;
+    uint8_t command_id;
+    size_t payload_size;
+    /// @brief Time from sending the command to the call of the response callback.
+    SIM_Time_t time;
+} TEST_BusResponse_t;
+
+/**
+ * @brief Byte at @p offset of the payloads sent by the nodes and the simulation.
+ */
+static inline uint8_t test_bus_payload_byte(uint32_t offset) {
+    return (uint8_t)(offset * 7 + (offset >> 8) + 1);
+}
+
+/**
+ * @brief State shared between the simulation and a single node.
+ */
+typedef struct {
+    /* Set by the simulation */
+    /// @brief Tick at which the node emits its first message, once @ref traffic_enabled is set.
+    volatile uint32_t traffic_start_tick;
+    /// @brief Number of ticks between two messages of the node.
+    uint32_t traffic_period_ticks;
+    /// @brief Number of messages emitted by the node.
+    uint32_t traffic_message_count;
+    /// @brief Whether the node starts to emit its messages.
+    volatile bool traffic_enabled;
+
+    /// @brief Buffer for the latencies of the received messages, from the call to kc_event_emit() on the
+    /// sender to the dispatch of the event on this node.
+    SIM_Time_t* latencies;
+    /// @brief Buffer for the latencies from the receive interrupt to the dispatch of the same messages, as
+    /// reported by kc_get_dispatch_statistics(). Written along with @ref latencies if this isn't a null pointer.
+    SIM_Time_t* dispatch_latencies;
+    /// @brief Number of entries of @ref latencies and @ref dispatch_latencies.
+    size_t latency_capacity;
+    /// @brief CPU time which the handler of @ref TEST_BUS_TRAFFIC_EVENT spends per message, to model a slow handler.
+    SIM_Time_t traffic_handler_time;
+
+    /// @brief Buffer for the dispatch latencies of the commands answered by the node, like @ref dispatch_latencies.
+    SIM_Time_t* command_latencies;
+    size_t command_latency_capacity;
+
+    /// @brief Whether the node calls kc_process_incoming() itself instead of starting the dispatcher task.
+    bool polling;
+
+    /// @brief Buffer for the streams received by the node. Streams are rejected if this is a null pointer.
+    uint8_t* stream_data;
+    size_t stream_capacity;
+    /// @brief Offset of the chunk at which the node aborts the streams it receives, 0 to accept the whole stream.
+    uint32_t stream_abort_offset;
+
+    /// @brief Flash regions in RAM of @ref flash_size bytes each. The node starts the update service on the
+    /// staging region if this isn't a null pointer.
+    uint8_t* staging_flash;
+    uint8_t* application_flash;
+    size_t flash_size;
+
+    /// @brief Operation to perform, which the node resets to @ref TEST_ACTION_NONE once it's done.
+    volatile TEST_BusAction_t action;
+    uint8_t action_receiver;
+    uint8_t action_id;
+    uint32_t action_size;
+    uint32_t action_count;
+    uint32_t action_timeout_ticks;
+
+    /* Set by the node */
+    /// @brief Whether the node has been addressed, @ref address and @ref bus_size are valid once this is set.
+    volatile bool ready;
+    uint8_t address;
+    uint8_t bus_size;
+    /// @brief Whether the node has emitted all its messages.
+    volatile bool traffic_done;
+    /// @brief Number of entries of @ref latencies which have been written.
+    volatile size_t latency_count;
+    /// @brief Received messages which didn't fit into @ref latencies.
+    volatile size_t latency_overflows;
+    /// @brief Number of entries of @ref command_latencies which have been written.
+    volatile size_t command_latency_count;
+    /// @brief Messages dropped by the receive interrupt, the sum of all the drop counters of the receive statistics.
+    volatile uint32_t dropped;
+
+    /// @brief Responses and timeouts of the commands sent by @ref TEST_ACTION_COMMAND, in the order of the callbacks.
+    TEST_BusResponse_t responses[TEST_BUS_RESPONSE_COUNT];
+    volatile size_t response_count;
+    /// @brief Payload of the last response.
+    uint8_t response_payload[TEST_BUS_MAX_PAYLOAD];
+
+    /// @brief Outcome of the last action, e.g. the return value of kc_stream_send().
+    volatile bool action_result;
+    /// @brief Error code thrown by the last action, or 0.
+    volatile uint8_t action_error;
+    /// @brief Duration of the last action.
+    volatile SIM_Time_t action_time;
+    /// @brief Messages of @ref TEST_ACTION_TRANSMIT_ASYNC which have been handed to the CAN hardware.
+    volatile uint32_t transmit_completions;
+    /// @brief Time from the start of the last action to the last completion callback.
+    volatile SIM_Time_t transmit_completion_time;
+
+    /// @brief Bytes of the received stream which have been passed to the node in order.
+    volatile uint32_t stream_received;
+    /// @brief Chunks of the received stream which have been passed to the node at another offset than expected.
+    volatile uint32_t stream_order_errors;
+    volatile bool stream_complete;
+    /// @brief Whether the sender has abandoned the stream.
+    volatile bool stream_abandoned;
+} TEST_BusNode_t;
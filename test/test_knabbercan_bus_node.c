@@ -0,0 +1,332 @@
+/**
+ * @file test_knabbercan_bus_node.c
+ * @author Gabriel Heinzer
+ * @brief Firmware of the nodes simulated by test_knabbercan_bus.c, see @ref test_knabbercan_bus.h.
+ *
+ * The node starts like any knabberCAN firmware, takes part in the addressing and then emits
+ * @ref TEST_BUS_TRAFFIC_EVENT periodically. The payload of the event is the simulated time at
+ * which it has been emitted, from which the receivers compute the latency of the message.
+ * Afterwards, the node performs the actions requested by the simulation, see @ref TEST_BusAction_t.
+ */
+
+#include "test_knabbercan_bus.h"
+#include <knabberkiste/fwupdate.h>
+#include <knabberkiste/knabbercan.h>
+#include <knabberkiste/sys.h>
+#include <knabberkiste/util/bit_manipulation.h>
+#include <knabberkiste/util/error.h>
+#include <knabberkiste/util/varbuf.h>
+#include <string.h>
+
+#define TEST_DISPATCHER_PRIORITY 2
+
+static TEST_BusNode_t* test_node = 0;
+
+static SIM_Time_t test_dispatch_latency(KC_Context_t* ctx) {
+    // The statistics have just been updated for the message being dispatched, in cycles of the core clock
+    uint32_t cycles = kc_get_dispatch_statistics(ctx).last_latency_cycles;
+    return (SIM_Time_t)cycles * SIM_S(1) / SystemCoreClock;
+}
+
+static void test_on_traffic(KC_Received_EventFrame_t event_frame) {
+    SIM_Time_t emitted;
+    if(event_frame.payload_size != sizeof(emitted)) return;
+    memcpy(&emitted, event_frame.payload, sizeof(emitted));
+
+    if(test_node->latency_count < test_node->latency_capacity) {
+        if(test_node->dispatch_latencies != 0) {
+            test_node->dispatch_latencies[test_node->latency_count] = test_dispatch_latency(event_frame.kc_context);
+        }
+        test_node->latencies[test_node->latency_count++] = sim_now() - emitted;
+    } else {
+        test_node->latency_overflows++;
+    }
+
+    if(test_node->traffic_handler_time > 0) {
+        sim_busy_wait_cycles((uint32_t)(test_node->traffic_handler_time * SystemCoreClock / SIM_S(1)));
+    }
+}
+
+static void test_on_throw(KC_Received_EventFrame_t event_frame) {
+    (void)event_frame;
+    error_throw(ERR_RANGE, TEST_BUS_ERROR_MESSAGE);
+}
+
+static KC_Response_t test_on_echo(KC_Received_CommandFrame_t command_frame) {
+    if(test_node->command_latency_count < test_node->command_latency_capacity) {
+        test_node->command_latencies[test_node->command_latency_count++] = test_dispatch_latency(command_frame.kc_context);
+    }
+
+    KC_Response_t response = { .payload = 0, .payload_size = command_frame.payload_size };
+    if(command_frame.payload_size > 0) {
+        varbuf_push_chunk(response.payload, command_frame.payload, command_frame.payload_size);
+    }
+    return response;
+}
+
+static bool test_read_stream(uint32_t offset, uint8_t* buffer, size_t size, void* context) {
+    (void)context;
+    for(size_t i = 0; i < size; i++) buffer[i] = test_bus_payload_byte(offset + i);
+    return true;
+}
+
+static KC_Response_t test_on_stream_command(KC_Received_CommandFrame_t command_frame) {
+    // Throws, as the acknowledgements could only be dispatched from within this handler
+    kc_stream_send(command_frame.kc_context, command_frame.sender_address, 0, 1, test_read_stream, 0);
+    return (KC_Response_t){ .payload = 0 };
+}
+
+kc_handler_table_declare(kc_default_handler_table,
+    KC_EVENT_HANDLER(TEST_BUS_TRAFFIC_EVENT, test_on_traffic),
+    KC_EVENT_HANDLER(TEST_BUS_THROW_EVENT, test_on_throw),
+    KC_COMMAND_HANDLER(TEST_BUS_ECHO_COMMAND, test_on_echo),
+    KC_COMMAND_HANDLER(TEST_BUS_STREAM_COMMAND, test_on_stream_command)
+);
+
+static bool test_on_stream(KC_Received_StreamChunk_t chunk, void* context) {
+    (void)context;
+    if(chunk.aborted) {
+        test_node->stream_abandoned = true;
+        return false;
+    }
+    if(chunk.offset == 0) {
+        test_node->stream_received = 0;
+        test_node->stream_complete = false;
+    }
+    if(test_node->stream_abort_offset != 0 && chunk.offset >= test_node->stream_abort_offset) return false;
+
+    if(chunk.offset != test_node->stream_received || chunk.offset + chunk.size > test_node->stream_capacity) {
+        test_node->stream_order_errors++;
+        return true;
+    }
+    memcpy(&test_node->stream_data[chunk.offset], chunk.data, chunk.size);
+    test_node->stream_received += chunk.size;
+    test_node->stream_complete = test_node->stream_received == chunk.total_size;
+    return true;
+}
+
+static void test_update_dropped(void) {
+    KC_ReceiveStatistics_t statistics = kc_get_receive_statistics(&kc_default_context);
+
+    // All the counters but the first one count dropped frames or messages
+    test_node->dropped =
+        statistics.invalid_identifiers +
+        statistics.incomplete_transactions +
+        statistics.counter_errors +
+        statistics.missing_first_frames +
+        statistics.reassembly_overflows +
+        statistics.payload_pool_exhausted +
+        statistics.oversized_payloads +
+        statistics.receive_fifo_overruns;
+}
+
+/* Flash regions in RAM, the context is the node's region */
+static void test_flash_erase_start(size_t page, void* context) {
+    memset((uint8_t*)context + page * TEST_BUS_FLASH_PAGE_SIZE, 0xFF, TEST_BUS_FLASH_PAGE_SIZE);
+}
+
+static bool test_flash_busy(void* context) {
+    (void)context;
+    return false;
+}
+
+static void test_flash_program(size_t offset, const uint8_t* data, size_t size, void* context) {
+    // Like the real flash, programming can only clear bits
+    uint8_t* flash = context;
+    for(size_t i = 0; i < size; i++) flash[offset + i] &= data[i];
+}
+
+static void test_flash_read(size_t offset, uint8_t* data, size_t size, void* context) {
+    memcpy(data, (const uint8_t*)context + offset, size);
+}
+
+static FlashBackend_t test_staging;
+static FlashBackend_t test_application;
+
+static FlashBackend_t test_flash_backend(uint8_t* flash) {
+    return (FlashBackend_t){
+        .page_size = TEST_BUS_FLASH_PAGE_SIZE,
+        .size = test_node->flash_size,
+        .erase_start = test_flash_erase_start,
+        .busy = test_flash_busy,
+        .program = test_flash_program,
+        .read = test_flash_read,
+        .context = flash
+    };
+}
+
+/* Actions */
+// One byte more than a frame can carry, to check that such a command is refused
+static uint8_t test_payload[TEST_BUS_MAX_PAYLOAD + 1];
+static SIM_Time_t test_action_start;
+
+static void test_on_response(KC_Received_ResponseFrame_t response_frame, void* context) {
+    (void)context;
+    if(test_node->response_count >= TEST_BUS_RESPONSE_COUNT) return;
+
+    test_node->responses[test_node->response_count++] = (TEST_BusResponse_t){
+        .status = response_frame.status,
+        .sender_address = response_frame.sender_address,
+        .command_id = response_frame.command_id,
+        .payload_size = response_frame.payload_size,
+        .time = sim_now() - test_action_start
+    };
+    if(response_frame.payload_size <= TEST_BUS_MAX_PAYLOAD) {
+        memcpy(test_node->response_payload, response_frame.payload, response_frame.payload_size);
+    }
+}
+
+static void test_on_transmitted(void* context) {
+    (void)context;
+    test_node->transmit_completions++;
+    test_node->transmit_completion_time = sim_now() - test_action_start;
+}
+
+static void test_throw_task(void* parameters) {
+    // Nothing catches the error, so the task is deleted once it has been reported
+    error_throw((error_code_t)(uintptr_t)parameters, TEST_BUS_ERROR_MESSAGE);
+}
+
+static void test_run_action(void) {
+    KC_Context_t* ctx = &kc_default_context;
+    test_action_start = sim_now();
+    test_node->action_error = 0;
+
+    switch(test_node->action) {
+        case TEST_ACTION_NONE:
+            break;
+
+        case TEST_ACTION_COMMAND:
+            // The payload is only read while the commands are being transmitted
+            for(uint32_t i = 0; i < test_node->action_size; i++) test_payload[i] = test_bus_payload_byte(i);
+            error_try {
+                for(uint32_t i = 0; i < test_node->action_count; i++) {
+                    kc_command_send(
+                        ctx,
+                        test_node->action_receiver,
+                        test_node->action_id + i,
+                        test_payload,
+                        test_node->action_size,
+                        test_node->action_timeout_ticks,
+                        test_on_response,
+                        0
+                    );
+                }
+            } error_catch(error_t error) {
+                test_node->action_error = error.error_code;
+            }
+            break;
+
+        case TEST_ACTION_STREAM:
+            error_try {
+                test_node->action_result = kc_stream_send(
+                    ctx,
+                    test_node->action_receiver,
+                    test_node->action_id,
+                    test_node->action_size,
+                    test_read_stream,
+                    0
+                );
+            } error_catch(error_t error) {
+                test_node->action_result = false;
+                test_node->action_error = error.error_code;
+            }
+            break;
+
+        case TEST_ACTION_TRANSMIT:
+        case TEST_ACTION_TRANSMIT_ASYNC:
+            // The queued events all point to the same payload, which isn't changed while they're sent
+            for(uint32_t i = 0; i < test_node->action_size; i++) test_payload[i] = test_bus_payload_byte(i);
+            test_node->transmit_completions = 0;
+            for(uint32_t i = 0; i < test_node->action_count; i++) {
+                if(test_node->action == TEST_ACTION_TRANSMIT) {
+                    kc_frame_transmit(ctx, KC_FRAMETYPE_EVENT, TEST_BUS_BULK_EVENT, KC_ADDRESS_BROADCAST, test_node->action_size, test_payload);
+                } else {
+                    kc_frame_transmit_async(
+                        ctx,
+                        KC_FRAMETYPE_EVENT,
+                        TEST_BUS_BULK_EVENT,
+                        KC_ADDRESS_BROADCAST,
+                        test_node->action_size,
+                        test_payload,
+                        test_on_transmitted,
+                        0
+                    );
+                }
+            }
+            break;
+
+        case TEST_ACTION_INSTALL:
+            test_node->action_result = fw_update_install(&test_staging, &test_application);
+            break;
+
+        case TEST_ACTION_THROW:
+            // The tasks run as soon as this one idles, one after the other
+            for(uint32_t i = 0; i < test_node->action_count; i++) {
+                uintptr_t error_code = test_node->action_id + i;
+                xTaskCreate(test_throw_task, "throw", configMINIMAL_STACK_SIZE, (void*)error_code, tskIDLE_PRIORITY + 1, 0);
+            }
+            break;
+    }
+
+    test_node->action_time = sim_now() - test_action_start;
+}
+
+static void test_idle(void) {
+    if(test_node->polling) kc_process_incoming(&kc_default_context);
+    vTaskDelay(1);
+}
+
+static void test_wait_until(TickType_t tick) {
+    TickType_t current_tick = xTaskGetTickCount();
+    if((int32_t)(tick - current_tick) > 0) vTaskDelay(tick - current_tick);
+}
+
+void test_bus_node_main(void* argument) {
+    test_node = argument;
+
+    sys_init();
+    if(test_node->polling) {
+        // The dispatcher task enables the cycle counter for the latency measurement otherwise
+        SET_MASK(CoreDebug->DEMCR, CoreDebug_DEMCR_TRCENA_Msk);
+        SET_MASK(DWT->CTRL, DWT_CTRL_CYCCNTENA_Msk);
+    } else {
+        kc_dispatcher_start(&kc_default_context, TEST_DISPATCHER_PRIORITY);
+    }
+    if(test_node->stream_data != 0) kc_stream_listen(&kc_default_context, test_on_stream, 0);
+    if(test_node->staging_flash != 0) {
+        test_staging = test_flash_backend(test_node->staging_flash);
+        test_application = test_flash_backend(test_node->application_flash);
+        fw_update_service_start(&kc_default_context, &test_staging);
+    }
+
+    while(kc_get_state(&kc_default_context) != KC_STATE_READY) test_idle();
+    test_node->address = kc_get_node_address(&kc_default_context);
+    test_node->bus_size = kc_get_bus_size(&kc_default_context);
+    test_node->ready = true;
+
+    while(!test_node->traffic_enabled) test_idle();
+
+    // Spread the nodes evenly over the period instead of letting all of them emit in the same tick
+    TickType_t next_tick = test_node->traffic_start_tick +
+        (test_node->address - 1) * test_node->traffic_period_ticks / test_node->bus_size;
+
+    for(uint32_t i = 0; i < test_node->traffic_message_count; i++) {
+        test_wait_until(next_tick);
+        next_tick += test_node->traffic_period_ticks;
+
+        SIM_Time_t emitted = sim_now();
+        kc_event_emit(&kc_default_context, TEST_BUS_TRAFFIC_EVENT, &emitted, sizeof(emitted));
+        test_update_dropped();
+    }
+    test_node->traffic_done = true;
+
+    while(1) {
+        if(test_node->action != TEST_ACTION_NONE) {
+            test_run_action();
+            test_node->action = TEST_ACTION_NONE;
+        }
+        test_update_dropped();
+        test_idle();
+    }
+}
@@ -0,0 +1,174 @@
+/**
+ * @file test_knabbercan_cpp.cpp
+ * @author Gabriel Heinzer
+ * @brief Compiles the typed C++17 front end of knabbercan.hpp and runs its generated callbacks.
+ *
+ * The templates are only checked once they are instantiated, so this file instantiates every
+ * one of them, including the handler table entries, the emitters and the senders, which are
+ * compiled but not called. The trampolines are called with hand-made frames, on a simulated node,
+ * as the responses are pushed onto varbufs.
+ */
+
+#include "test.h"
+#include <knabberkiste/knabbercan.hpp>
+
+struct __attribute__((packed)) TestRequest {
+    uint8_t sensor;
+};
+
+struct __attribute__((packed)) TestTemperature {
+    int16_t centi_celsius;
+    uint8_t sensor;
+};
+
+using TestReadTemperature = kc::Command<0x20, TestRequest, TestTemperature>;
+using TestReset = kc::Command<0x21>;
+using TestTemperatureChanged = kc::Event<0x30, TestTemperature>;
+using TestHeartbeat = kc::Event<0x31>;
+
+// Payload sizes are checked at compile time
+static_assert(kc::detail::payload_size<void>::value == 0);
+static_assert(kc::detail::payload_size<TestRequest>::value == 1);
+static_assert(kc::detail::payload_size<TestTemperature>::value == 3);
+static_assert(TestReadTemperature::id == 0x20 && TestTemperatureChanged::id == 0x30);
+static_assert(std::is_void_v<TestReset::request_type> && std::is_void_v<TestReset::response_type>);
+
+static size_t test_reset_count = 0;
+static size_t test_event_count = 0;
+static size_t test_heartbeat_count = 0;
+static size_t test_response_count = 0;
+static TestTemperature test_last_temperature = {};
+static const TestTemperature* test_last_response = nullptr;
+
+static TestTemperature test_read_temperature(const KC_Received_CommandFrame_t& frame, const TestRequest& request) {
+    return TestTemperature{ (int16_t)(frame.sender_address * 100), request.sensor };
+}
+
+static void test_reset(const KC_Received_CommandFrame_t& frame) {
+    (void)frame;
+    test_reset_count++;
+}
+
+static void test_on_temperature(const KC_Received_EventFrame_t& frame, const TestTemperature& temperature) {
+    (void)frame;
+    test_event_count++;
+    test_last_temperature = temperature;
+}
+
+static void test_on_heartbeat(const KC_Received_EventFrame_t& frame) {
+    (void)frame;
+    test_heartbeat_count++;
+}
+
+static void test_on_temperature_response(const KC_Received_ResponseFrame_t& frame, const TestTemperature* response, void* context) {
+    (void)frame;
+    (void)context;
+    test_response_count++;
+    test_last_response = response;
+}
+
+static void test_on_reset_response(const KC_Received_ResponseFrame_t& frame, void* context) {
+    (void)frame;
+    (void)context;
+    test_response_count++;
+}
+
+kc_handler_table_declare(test_handlers,
+    kc::event_handler<TestTemperatureChanged, test_on_temperature>(),
+    kc::event_handler<TestHeartbeat, test_on_heartbeat>(),
+    kc::command_handler<TestReadTemperature, test_read_temperature>(),
+    kc::command_handler<TestReset, test_reset>()
+);
+
+// Instantiates the functions which need a running bus, without calling them
+__attribute__((used))
+static void test_instantiate(KC_Context_t* ctx) {
+    kc::command_define<TestReadTemperature, test_read_temperature>(ctx);
+    kc::event_define<TestHeartbeat, test_on_heartbeat>(ctx);
+    kc::emit<TestTemperatureChanged>(ctx, TestTemperature{ 2150, 1 });
+    kc::emit<TestHeartbeat>(ctx);
+    kc::send<TestReadTemperature, test_on_temperature_response>(ctx, 2, TestRequest{ 1 }, 100);
+    kc::send<TestReset, test_on_reset_response>(ctx, 2, 100);
+}
+
+/* Test cases */
+static void test_handler_table(void) {
+    TEST_ASSERT_EQUAL(4, test_handlers.count);
+    TEST_ASSERT_EQUAL(KC_FRAMETYPE_EVENT, test_handlers.handlers[1].frame_type);
+    TEST_ASSERT_EQUAL(0x31, test_handlers.handlers[1].transaction_id);
+    TEST_ASSERT(test_handlers.handlers[1].event == (&kc::detail::event_trampoline<TestHeartbeat, test_on_heartbeat>));
+    TEST_ASSERT_EQUAL(KC_FRAMETYPE_COMMAND, test_handlers.handlers[2].frame_type);
+    TEST_ASSERT_EQUAL(0x20, test_handlers.handlers[2].transaction_id);
+    TEST_ASSERT(test_handlers.handlers[2].command == (&kc::detail::command_trampoline<TestReadTemperature, test_read_temperature>));
+}
+
+static void test_trampolines_node(void) {
+    // Commands are answered with their encoded response
+    TestRequest request = { 7 };
+    KC_Received_CommandFrame_t command = {};
+    command.sender_address = 3;
+    command.command_id = TestReadTemperature::id;
+    command.payload = reinterpret_cast<uint8_t*>(&request);
+    command.payload_size = sizeof(request);
+
+    KC_Response_t response = test_handlers.handlers[2].command(command);
+    TEST_ASSERT_EQUAL(sizeof(TestTemperature), response.payload_size);
+    TestTemperature temperature;
+    memcpy(&temperature, response.payload, sizeof(temperature));
+    TEST_ASSERT_EQUAL(300, temperature.centi_celsius);
+    TEST_ASSERT_EQUAL(7, temperature.sensor);
+    // varbuf_clear() relies on the implicit conversions of C
+    _varbuf_clear(reinterpret_cast<void**>(&response.payload));
+
+    // Malformed commands are answered with an empty response
+    command.payload_size = 0;
+    response = test_handlers.handlers[2].command(command);
+    TEST_ASSERT_EQUAL(0, response.payload_size);
+    TEST_ASSERT(response.payload == nullptr);
+
+    // Commands without a payload ignore the payload
+    response = test_handlers.handlers[3].command(command);
+    TEST_ASSERT_EQUAL(1, test_reset_count);
+    TEST_ASSERT_EQUAL(0, response.payload_size);
+
+    // Events are decoded, short ones are dropped and longer ones accepted
+    uint8_t payload[8] = { 0x66, 0x08, 0x02, 0xff };
+    KC_Received_EventFrame_t event = {};
+    event.payload = payload;
+    event.payload_size = 2;
+    test_handlers.handlers[0].event(event);
+    TEST_ASSERT_EQUAL(0, test_event_count);
+    event.payload_size = sizeof(payload);
+    test_handlers.handlers[0].event(event);
+    TEST_ASSERT_EQUAL(1, test_event_count);
+    TEST_ASSERT_EQUAL(2150, test_last_temperature.centi_celsius);
+    TEST_ASSERT_EQUAL(2, test_last_temperature.sensor);
+    test_handlers.handlers[1].event(event);
+    TEST_ASSERT_EQUAL(1, test_heartbeat_count);
+
+    // Responses are decoded, timeouts are passed as a null pointer
+    KC_Received_ResponseFrame_t response_frame = {};
+    response_frame.status = KC_RESPONSE_RECEIVED;
+    response_frame.payload = payload;
+    response_frame.payload_size = sizeof(TestTemperature);
+    kc::detail::response_trampoline<TestReadTemperature, test_on_temperature_response>(response_frame, nullptr);
+    TEST_ASSERT_EQUAL(1, test_response_count);
+    TEST_ASSERT(test_last_response != nullptr);
+
+    response_frame.status = KC_RESPONSE_TIMEOUT;
+    kc::detail::response_trampoline<TestReadTemperature, test_on_temperature_response>(response_frame, nullptr);
+    TEST_ASSERT_EQUAL(2, test_response_count);
+    TEST_ASSERT(test_last_response == nullptr);
+
+    kc::detail::response_trampoline<TestReset, test_on_reset_response>(response_frame, nullptr);
+    TEST_ASSERT_EQUAL(3, test_response_count);
+}
+
+static void test_trampolines(void) {
+    test_in_node(test_trampolines_node);
+}
+
+TEST_MAIN(
+    TEST_CASE(handler_table),
+    TEST_CASE(trampolines)
+)
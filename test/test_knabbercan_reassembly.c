@@ -0,0 +1,514 @@
+/**
+ * @file test_knabbercan_reassembly.c
+ * @author Gabriel Heinzer
+ * @brief Tests the reassembly table of the knabberCAN receive interrupt.
+ *
+ * The table is internal to knabbercan.c, so the source file is included here to reach its static
+ * functions. The rest of the library is linked as usual.
+ *
+ * The recv_cost case measures the receive interrupt with up to 127 transactions open at the same
+ * time. The simulated cycles count the register accesses and critical sections, which the model
+ * charges. It doesn't charge the table lookups and the scan for the stale transactions of the
+ * sender on every FIRST frame, so these are timed with the time stamp counter of the host, on a
+ * table without payloads, whose scans don't access any registers.
+ *
+ * The copy_cost case counts the bytes of payload which are copied between the mailbox and the
+ * handler. The reads of the mailbox and the calls of memcpy() in knabbercan.c are redirected to
+ * counting functions, which only count copies from or to the payload pool and the payload buffer.
+ * The headers are included before, so the rings aren't counted.
+ */
+
+#include "test.h"
+// Before the device header, whose register qualifiers clash with the intrinsics
+#include <x86intrin.h>
+#include <string.h>
+#include <knabberkiste/knabbercan.h>
+#include <knabberkiste/hal/bxcan.h>
+#include <knabberkiste/util/fifo.h>
+#include <knabberkiste/util/error.h>
+#include <knabberkiste/util/varbuf.h>
+#include <knabberkiste/util/slab.h>
+#include <knabberkiste/util/filter_compiler.h>
+
+static uint64_t test_copied_bytes = 0;
+
+// Memory holding payloads, set by the copy_cost case
+static const uint8_t* test_payload_regions[2][2] = { { 0 } };
+
+static bool test_is_payload(const void* pointer) {
+    for(size_t i = 0; i < 2; i++) {
+        if((const uint8_t*)pointer >= test_payload_regions[i][0] && (const uint8_t*)pointer < test_payload_regions[i][1]) return true;
+    }
+    return false;
+}
+
+static inline void* test_memcpy(void* dest, const void* src, size_t size) {
+    if(test_is_payload(dest) || test_is_payload(src)) test_copied_bytes += size;
+    return memcpy(dest, src, size);
+}
+
+static inline void test_read_frame_data(const CAN_ReceivedFrame_t* frame, void* dest) {
+    test_copied_bytes += frame->frame.dlc > 8 ? 8 : frame->frame.dlc;
+    can_read_frame_data(frame, dest);
+}
+
+#define memcpy(dest, src, size) test_memcpy((void*)(dest), (const void*)(src), size)
+#define can_read_frame_data test_read_frame_data
+#include "knabbercan.c"
+#undef memcpy
+#undef can_read_frame_data
+
+#define TEST_RANDOM_OPERATIONS 200000
+#define TEST_RANDOM_KEYS 48
+
+// Every message of the receive cost benchmark consists of a FIRST, a middle and a LAST frame
+#define TEST_COST_FRAMES 3
+#define TEST_COST_ROUNDS 20
+
+static KC_Identifier_t test_key(KC_FrameType_t frame_type, KC_Address_t sender, KC_Address_t receiver, KC_TransactionID_t tid) {
+    KC_Identifier_t key = { .value = 0 };
+    key.components.frame_type = frame_type;
+    key.components.sender_address = sender;
+    key.components.receiver_address = receiver;
+    key.components.transaction_id = tid;
+    return key;
+}
+
+static size_t test_slot_index(const KC_Reassembly_Table_t* table, KC_Identifier_t key) {
+    KC_Reassembly_Slot_t* slot = kc_reassembly_find((KC_Reassembly_Table_t*)table, key);
+    if(slot == 0) TEST_FAIL("Key 0x%08x not found.", key.value);
+    return slot - table->slots;
+}
+
+static void test_check_invariant(const KC_Reassembly_Table_t* table) {
+    // Every entry is reachable from its home index without crossing a free slot
+    size_t occupied = 0;
+    for(size_t index = 0; index < KC_REASSEMBLY_TABLE_SIZE; index++) {
+        if(!table->slots[index].occupied) continue;
+        occupied++;
+
+        for(size_t probe = kc_reassembly_home_index(table->slots[index].key); probe != index; probe = (probe + 1) & KC_REASSEMBLY_TABLE_MASK) {
+            if(!table->slots[probe].occupied) TEST_FAIL("Slot %zu is cut off from its home index by slot %zu.", index, probe);
+        }
+    }
+    TEST_ASSERT_EQUAL(table->count, occupied);
+}
+
+/* Test cases */
+static void test_insert(void) {
+    static KC_Reassembly_Table_t table;
+
+    // One transaction per sender, each in its home slot
+    for(KC_Address_t sender = 1; sender < KC_REASSEMBLY_TABLE_SIZE; sender++) {
+        KC_Reassembly_Slot_t* slot = kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_COMMAND, sender, 1, sender));
+        TEST_ASSERT(slot != 0);
+        TEST_ASSERT(!slot->discarded);
+        TEST_ASSERT_EQUAL(0, slot->payload_size);
+    }
+    TEST_ASSERT_EQUAL(KC_REASSEMBLY_TABLE_SIZE - 1, table.count);
+    test_check_invariant(&table);
+
+    for(KC_Address_t sender = 1; sender < KC_REASSEMBLY_TABLE_SIZE; sender++) {
+        TEST_ASSERT_EQUAL(sender, test_slot_index(&table, test_key(KC_FRAMETYPE_COMMAND, sender, 1, sender)));
+    }
+
+    // Keys differing in any field aren't found
+    TEST_ASSERT(kc_reassembly_find(&table, test_key(KC_FRAMETYPE_EVENT, 5, 1, 5)) == 0);
+    TEST_ASSERT(kc_reassembly_find(&table, test_key(KC_FRAMETYPE_COMMAND, 5, 2, 5)) == 0);
+    TEST_ASSERT(kc_reassembly_find(&table, test_key(KC_FRAMETYPE_COMMAND, 5, 1, 6)) == 0);
+
+    // One slot always stays free, so probing terminates
+    TEST_ASSERT(kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_EVENT, 0, 0, 0)) == 0);
+    TEST_ASSERT_EQUAL(KC_REASSEMBLY_TABLE_SIZE - 1, table.count);
+}
+
+static void test_wrap_around(void) {
+    static KC_Reassembly_Table_t table;
+    KC_Address_t last = KC_REASSEMBLY_TABLE_SIZE - 2;
+
+    // Four transactions of the same sender, the last two wrap around to the start of the table
+    for(KC_TransactionID_t tid = 0; tid < 4; tid++) kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, tid));
+    kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_EVENT, 0, 0, 0));
+    kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_EVENT, 1, 0, 0));
+    test_check_invariant(&table);
+
+    TEST_ASSERT_EQUAL(last, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 0)));
+    TEST_ASSERT_EQUAL(last + 1, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 1)));
+    TEST_ASSERT_EQUAL(0, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 2)));
+    TEST_ASSERT_EQUAL(1, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 3)));
+    TEST_ASSERT_EQUAL(2, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, 0, 0, 0)));
+    TEST_ASSERT_EQUAL(3, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, 1, 0, 0)));
+}
+
+static void test_backward_shift(void) {
+    static KC_Reassembly_Table_t table;
+    KC_Address_t last = KC_REASSEMBLY_TABLE_SIZE - 2;
+
+    for(KC_TransactionID_t tid = 0; tid < 4; tid++) kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, tid));
+    kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_EVENT, 0, 0, 0));
+    kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_EVENT, 1, 0, 0));
+    kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_EVENT, 10, 0, 0));
+    kc_reassembly_insert(&table, test_key(KC_FRAMETYPE_EVENT, 11, 0, 0));
+
+    // Removing the head of the cluster shifts every following entry back, across the wrap around
+    kc_reassembly_remove(&table, kc_reassembly_find(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 0)));
+    test_check_invariant(&table);
+    TEST_ASSERT_EQUAL(7, table.count);
+    TEST_ASSERT(kc_reassembly_find(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 0)) == 0);
+    TEST_ASSERT_EQUAL(last, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 1)));
+    TEST_ASSERT_EQUAL(last + 1, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 2)));
+    TEST_ASSERT_EQUAL(0, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 3)));
+    TEST_ASSERT_EQUAL(1, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, 0, 0, 0)));
+    TEST_ASSERT_EQUAL(2, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, 1, 0, 0)));
+    TEST_ASSERT(!table.slots[3].occupied);
+
+    // Entries in their home slot stay where they are
+    kc_reassembly_remove(&table, kc_reassembly_find(&table, test_key(KC_FRAMETYPE_EVENT, 10, 0, 0)));
+    test_check_invariant(&table);
+    TEST_ASSERT(!table.slots[10].occupied);
+    TEST_ASSERT_EQUAL(11, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, 11, 0, 0)));
+
+    // Removing from the middle of the cluster shifts the rest of it
+    kc_reassembly_remove(&table, kc_reassembly_find(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 2)));
+    test_check_invariant(&table);
+    TEST_ASSERT_EQUAL(last + 1, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, last, 0, 3)));
+    TEST_ASSERT_EQUAL(0, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, 0, 0, 0)));
+    TEST_ASSERT_EQUAL(1, test_slot_index(&table, test_key(KC_FRAMETYPE_EVENT, 1, 0, 0)));
+    TEST_ASSERT(!table.slots[2].occupied);
+}
+
+static void test_random(void) {
+    static KC_Reassembly_Table_t table;
+    KC_Identifier_t keys[TEST_RANDOM_KEYS];
+    bool present[TEST_RANDOM_KEYS] = { false };
+    size_t present_count = 0;
+
+    // Few home indices around the end of the table, so the clusters are long and wrap around
+    for(size_t i = 0; i < TEST_RANDOM_KEYS; i++) {
+        KC_Address_t sender = (KC_REASSEMBLY_TABLE_SIZE - 4 + i % 8) & KC_REASSEMBLY_TABLE_MASK;
+        keys[i] = test_key(i % 4, sender, i % 3, (KC_TransactionID_t)i);
+    }
+
+    srand(1);
+    for(int operation = 0; operation < TEST_RANDOM_OPERATIONS; operation++) {
+        size_t i = rand() % TEST_RANDOM_KEYS;
+
+        if(present[i]) {
+            kc_reassembly_remove(&table, kc_reassembly_find(&table, keys[i]));
+            present[i] = false;
+            present_count--;
+        } else {
+            TEST_ASSERT(kc_reassembly_insert(&table, keys[i]) != 0);
+            present[i] = true;
+            present_count++;
+        }
+
+        TEST_ASSERT_EQUAL(present_count, table.count);
+        if(operation % 16 == 0) {
+            test_check_invariant(&table);
+            for(size_t j = 0; j < TEST_RANDOM_KEYS; j++) {
+                TEST_ASSERT_EQUAL(present[j], kc_reassembly_find(&table, keys[j]) != 0);
+            }
+        }
+    }
+}
+
+kc_context_declare_qualifier(test_context, static);
+
+static void test_evict_sender_node(void) {
+    KC_Reassembly_Table_t* table = &test_context._reassembly_tables[KC_EVENT_FIFO];
+
+    // Two transactions of sender 5, one of them already discarded, and one of sender 6 which is displaced by them
+    KC_Reassembly_Slot_t* slot = kc_reassembly_insert(table, test_key(KC_FRAMETYPE_EVENT, 5, 0, 0x20));
+    slot->payload = slab_alloc(test_context._payload_pool);
+    slot->payload_size = 8;
+    slot = kc_reassembly_insert(table, test_key(KC_FRAMETYPE_COMMAND, 5, 3, 0x40));
+    slot->discarded = true;
+    slot = kc_reassembly_insert(table, test_key(KC_FRAMETYPE_EVENT, 6, 0, 0x20));
+    slot->payload = slab_alloc(test_context._payload_pool);
+    slot->payload_size = 8;
+    TEST_ASSERT_EQUAL(7, test_slot_index(table, test_key(KC_FRAMETYPE_EVENT, 6, 0, 0x20)));
+    TEST_ASSERT_EQUAL(2, slab_get_used_count(test_context._payload_pool));
+
+    // A new first frame of sender 5 evicts both of its transactions, but only counts the one which wasn't discarded
+    TEST_ASSERT_EQUAL(1, kc_reassembly_evict_sender(&test_context, table, test_key(KC_FRAMETYPE_EVENT, 5, 0, 0x21)));
+    test_check_invariant(table);
+    TEST_ASSERT_EQUAL(1, table->count);
+    TEST_ASSERT_EQUAL(1, slab_get_used_count(test_context._payload_pool));
+    TEST_ASSERT_EQUAL(6, test_slot_index(table, test_key(KC_FRAMETYPE_EVENT, 6, 0, 0x20)));
+
+    // Senders without open transactions evict nothing
+    TEST_ASSERT_EQUAL(0, kc_reassembly_evict_sender(&test_context, table, test_key(KC_FRAMETYPE_EVENT, 5, 0, 0x21)));
+    TEST_ASSERT_EQUAL(0, kc_reassembly_evict_sender(&test_context, table, test_key(KC_FRAMETYPE_EVENT, 7, 0, 0x21)));
+    TEST_ASSERT_EQUAL(1, table->count);
+}
+
+static void test_evict_sender(void) {
+    // The payload pool enters critical sections, which requires a node
+    test_in_node(test_evict_sender_node);
+}
+
+typedef struct {
+    size_t transactions;
+    // Per frame position within the message
+    double sim_cycles[TEST_COST_FRAMES];
+    double host_cycles[TEST_COST_FRAMES];
+    // Host cycles of the scan of a FIRST frame, whose sender has an open transaction
+    double scan_cycles;
+    uint32_t overflows;
+    uint32_t exhausted;
+} TEST_CostResult_t;
+
+static TEST_CostResult_t test_recv_cost_measure(size_t transactions) {
+    TEST_CostResult_t result = { .transactions = transactions };
+    KC_ReceiveStatistics_t* statistics = &test_context._receive_statistics[KC_EVENT_FIFO];
+    uint32_t overflows = statistics->reassembly_overflows;
+    uint32_t exhausted = statistics->payload_pool_exhausted;
+
+    // Reading the cycle counter is a register access itself
+    uint32_t start = DWT->CYCCNT;
+    uint32_t read_cycles = DWT->CYCCNT - start;
+
+    for(size_t round = 0; round < TEST_COST_ROUNDS; round++) {
+        uint64_t sim_cycles[TEST_COST_FRAMES] = { 0 };
+        uint64_t host_cycles[TEST_COST_FRAMES] = { 0 };
+
+        // The messages of all the senders are interleaved frame by frame, so each of them is open
+        // until the last frames arrive
+        for(size_t position = 0; position < TEST_COST_FRAMES; position++) {
+            for(size_t sender = 1; sender <= transactions; sender++) {
+                KC_Identifier_t identifier = test_key(KC_FRAMETYPE_EVENT, sender, KC_ADDRESS_BROADCAST, 0x30);
+                identifier.components.first = position == 0;
+                identifier.components.last = position == TEST_COST_FRAMES - 1;
+                identifier.components.counter = position;
+
+                CAN_ReceivedFrame_t frame = {
+                    .frame = { .id = identifier.value, .id_extended = true, .dlc = 8 },
+                    .fifo = KC_EVENT_FIFO
+                };
+
+                uint64_t host_start = __rdtsc();
+                uint32_t sim_start = DWT->CYCCNT;
+                can_recv_callback(&frame);
+                sim_cycles[position] += DWT->CYCCNT - sim_start - read_cycles;
+                host_cycles[position] += __rdtsc() - host_start;
+
+                // The dispatcher is modelled by draining the queue, outside of the measurement
+                KC_Received_Frame_t complete_frame;
+                while(ring_get(test_context._recv_ring, complete_frame)) {
+                    kc_payload_free(&test_context, (KC_Payload_Block_t*)complete_frame.payload);
+                }
+            }
+        }
+
+        // The simulated cycles don't vary, the host cycles are the best of all the rounds
+        for(size_t position = 0; position < TEST_COST_FRAMES; position++) {
+            double host = (double)host_cycles[position] / transactions;
+            result.sim_cycles[position] = (double)sim_cycles[position] / transactions;
+            if(round == 0 || host < result.host_cycles[position]) result.host_cycles[position] = host;
+        }
+    }
+
+    TEST_ASSERT_EQUAL(0, test_context._reassembly_tables[KC_EVENT_FIFO].count);
+    TEST_ASSERT_EQUAL(0, slab_get_used_count(test_context._payload_pool));
+    result.overflows = (statistics->reassembly_overflows - overflows) / TEST_COST_ROUNDS;
+    result.exhausted = (statistics->payload_pool_exhausted - exhausted) / TEST_COST_ROUNDS;
+
+    // Every sender restarts once while the others are open, which scans the probe sequence of its
+    // home index. The slot of the restarting sender is filled again for the next one.
+    KC_Reassembly_Table_t* table = &test_context._reassembly_tables[KC_EVENT_FIFO];
+    size_t open = transactions < KC_REASSEMBLY_TABLE_SIZE ? transactions : KC_REASSEMBLY_TABLE_SIZE - 1;
+    for(size_t sender = 1; sender <= open; sender++) {
+        TEST_ASSERT(kc_reassembly_insert(table, test_key(KC_FRAMETYPE_EVENT, sender, KC_ADDRESS_BROADCAST, 0x30)) != 0);
+    }
+
+    for(size_t round = 0; round < TEST_COST_ROUNDS; round++) {
+        uint64_t cycles = 0;
+        for(size_t sender = 1; sender <= open; sender++) {
+            KC_Identifier_t restart = test_key(KC_FRAMETYPE_EVENT, sender, KC_ADDRESS_BROADCAST, 0x31);
+            uint64_t start = __rdtsc();
+            size_t evicted = kc_reassembly_evict_sender(&test_context, table, restart);
+            cycles += __rdtsc() - start;
+
+            TEST_ASSERT_EQUAL(1, evicted);
+            TEST_ASSERT(kc_reassembly_insert(table, test_key(KC_FRAMETYPE_EVENT, sender, KC_ADDRESS_BROADCAST, 0x30)) != 0);
+        }
+
+        double scan = (double)cycles / open;
+        if(round == 0 || scan < result.scan_cycles) result.scan_cycles = scan;
+    }
+
+    for(size_t sender = 1; sender <= open; sender++) {
+        kc_reassembly_remove(table, kc_reassembly_find(table, test_key(KC_FRAMETYPE_EVENT, sender, KC_ADDRESS_BROADCAST, 0x30)));
+    }
+    TEST_ASSERT_EQUAL(0, table->count);
+    return result;
+}
+
+static void test_recv_cost_node(void) {
+    static const size_t transaction_counts[] = { 1, 2, 4, 8, 16, 32, 64, 96, 127 };
+    const size_t count = sizeof(transaction_counts) / sizeof(*transaction_counts);
+    TEST_CostResult_t results[sizeof(transaction_counts) / sizeof(*transaction_counts)];
+
+    SET_MASK(CoreDebug->DEMCR, CoreDebug_DEMCR_TRCENA_Msk);
+    SET_MASK(DWT->CTRL, DWT_CTRL_CYCCNTENA_Msk);
+    kc_hardware_context = &test_context;
+
+    printf("%12s %30s %30s %10s\n", "", "simulated cycles per frame", "host cycles per frame", "host");
+    printf("%12s %10s %9s %9s %10s %9s %9s %10s %9s %9s\n", "transactions", "FIRST", "middle", "LAST",
+        "FIRST", "middle", "LAST", "scan", "overflows", "exhausted");
+    for(size_t i = 0; i < count; i++) {
+        results[i] = test_recv_cost_measure(transaction_counts[i]);
+        printf("%12zu %10.1f %9.1f %9.1f %10.1f %9.1f %9.1f %10.1f %9u %9u\n", results[i].transactions,
+            results[i].sim_cycles[0], results[i].sim_cycles[1], results[i].sim_cycles[2],
+            results[i].host_cycles[0], results[i].host_cycles[1], results[i].host_cycles[2],
+            results[i].scan_cycles, results[i].overflows, results[i].exhausted);
+    }
+    kc_hardware_context = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        size_t transactions = results[i].transactions;
+
+        // Every transaction fits into the table, and every message of up to three frames into a block
+        TEST_ASSERT_EQUAL(0, results[i].overflows);
+        size_t expected_exhausted = transactions > KC_PAYLOAD_POOL_SIZE ? transactions - KC_PAYLOAD_POOL_SIZE : 0;
+        TEST_ASSERT_EQUAL(expected_exhausted, results[i].exhausted);
+
+        // The modelled cost of a frame doesn't depend on the number of open transactions while the
+        // pool lasts. Transactions without a block are discarded, which skips reading their data.
+        for(size_t position = 0; position < TEST_COST_FRAMES; position++) {
+            if(expected_exhausted == 0) {
+                TEST_ASSERT(results[i].sim_cycles[position] == results[0].sim_cycles[position]);
+            } else {
+                TEST_ASSERT(results[i].sim_cycles[position] < results[0].sim_cycles[position]);
+            }
+        }
+    }
+}
+
+static void test_recv_cost(void) {
+    test_in_node(test_recv_cost_node);
+}
+
+/* Copies of the payload */
+#define TEST_COPY_EVENT 0x32
+
+static const void* test_delivered_payload = 0;
+static size_t test_delivered_size = 0;
+
+static void test_copy_handler(KC_Received_EventFrame_t event_frame) {
+    test_delivered_payload = event_frame.payload;
+    test_delivered_size = event_frame.payload_size;
+}
+
+typedef struct {
+    size_t payload_size;
+    double copies;
+    // Simulated cycles of the receive interrupt per frame and of the dispatch per message
+    double receive_cycles;
+    double dispatch_cycles;
+} TEST_CopyResult_t;
+
+static TEST_CopyResult_t test_copy_measure(size_t payload_size) {
+    TEST_CopyResult_t result = { .payload_size = payload_size };
+    size_t frames = (payload_size + 7) / 8;
+    uint64_t copied_bytes = 0;
+    uint64_t receive_cycles = 0;
+    uint64_t dispatch_cycles = 0;
+
+    uint32_t start = DWT->CYCCNT;
+    uint32_t read_cycles = DWT->CYCCNT - start;
+
+    for(size_t round = 0; round < TEST_COST_ROUNDS; round++) {
+        test_copied_bytes = 0;
+        test_delivered_payload = 0;
+
+        for(size_t i = 0; i < frames; i++) {
+            KC_Identifier_t identifier = test_key(KC_FRAMETYPE_EVENT, 9, KC_ADDRESS_BROADCAST, TEST_COPY_EVENT);
+            identifier.components.first = i == 0;
+            identifier.components.last = i == frames - 1;
+            identifier.components.counter = i % (KC_FRAME_COUNTER_MAX + 1);
+
+            uint8_t dlc = i == frames - 1 ? payload_size - 8 * i : 8;
+            CAN_ReceivedFrame_t frame = {
+                .frame = { .id = identifier.value, .id_extended = true, .dlc = dlc },
+                .fifo = KC_EVENT_FIFO
+            };
+
+            uint32_t sim_start = DWT->CYCCNT;
+            can_recv_callback(&frame);
+            receive_cycles += DWT->CYCCNT - sim_start - read_cycles;
+        }
+
+        uint32_t sim_start = DWT->CYCCNT;
+        TEST_ASSERT(kc_dispatch_received_frames(&test_context));
+        dispatch_cycles += DWT->CYCCNT - sim_start - read_cycles;
+        copied_bytes += test_copied_bytes;
+
+        // Payloads of a single block are lent to the handler where they have been received,
+        // larger ones are joined in the payload buffer of the context
+        TEST_ASSERT_EQUAL(payload_size, test_delivered_size);
+        if(payload_size <= KC_PAYLOAD_BLOCK_SIZE) {
+            TEST_ASSERT(test_delivered_payload != test_context._payload_buffer);
+        } else {
+            TEST_ASSERT(test_delivered_payload == test_context._payload_buffer);
+        }
+        TEST_ASSERT_EQUAL(0, slab_get_used_count(test_context._payload_pool));
+    }
+
+    result.copies = (double)copied_bytes / (payload_size * TEST_COST_ROUNDS);
+    result.receive_cycles = (double)receive_cycles / (frames * TEST_COST_ROUNDS);
+    result.dispatch_cycles = (double)dispatch_cycles / TEST_COST_ROUNDS;
+    return result;
+}
+
+static void test_copy_cost_node(void) {
+    static const size_t payload_sizes[] = { 8, 32, 64, 128, KC_MAX_PAYLOAD_SIZE };
+    const size_t count = sizeof(payload_sizes) / sizeof(*payload_sizes);
+    TEST_CopyResult_t results[sizeof(payload_sizes) / sizeof(*payload_sizes)];
+
+    SET_MASK(CoreDebug->DEMCR, CoreDebug_DEMCR_TRCENA_Msk);
+    SET_MASK(DWT->CTRL, DWT_CTRL_CYCCNTENA_Msk);
+    kc_hardware_context = &test_context;
+    test_context._overflow_handlers[0] = (KC_Handler_t)KC_EVENT_HANDLER(TEST_COPY_EVENT, test_copy_handler);
+    test_context._overflow_handler_count = 1;
+
+    const _Slab_t* pool = (const _Slab_t*)&test_context._payload_pool;
+    test_payload_regions[0][0] = pool->_buf;
+    test_payload_regions[0][1] = pool->_buf + pool->_block_size * pool->_block_count;
+    test_payload_regions[1][0] = test_context._payload_buffer;
+    test_payload_regions[1][1] = test_context._payload_buffer + sizeof(test_context._payload_buffer);
+
+    // The model doesn't charge the copies themselves, so they are counted separately
+    printf("%8s %8s %18s %20s\n", "bytes", "copies", "receive per frame", "dispatch per message");
+    for(size_t i = 0; i < count; i++) {
+        results[i] = test_copy_measure(payload_sizes[i]);
+        printf("%8zu %8.2f %18.1f %20.1f\n", results[i].payload_size, results[i].copies,
+            results[i].receive_cycles, results[i].dispatch_cycles);
+    }
+    kc_hardware_context = 0;
+
+    // The previous path copied every payload four times, from the mailbox into the received frame,
+    // into a varbuf and into and out of the receive FIFO. Now the mailbox is read straight into
+    // the payload block, and only payloads spanning several blocks are copied once more.
+    for(size_t i = 0; i < count; i++) {
+        double expected = results[i].payload_size <= KC_PAYLOAD_BLOCK_SIZE ? 1.0 : 2.0;
+        if(results[i].copies != expected) {
+            TEST_FAIL("Payloads of %zu bytes are copied %.2f times, expected %.0f.", results[i].payload_size, results[i].copies, expected);
+        }
+    }
+}
+
+static void test_copy_cost(void) {
+    test_in_node(test_copy_cost_node);
+}
+
+TEST_MAIN(
+    TEST_CASE(insert),
+    TEST_CASE(wrap_around),
+    TEST_CASE(backward_shift),
+    TEST_CASE(random),
+    TEST_CASE(evict_sender),
+    TEST_CASE(recv_cost),
+    TEST_CASE(copy_cost)
+)
@@ -0,0 +1,269 @@
+/**
+ * @file test_ring.c
+ * @author Gabriel Heinzer
+ * @brief Tests the single-producer single-consumer ring, including a producer and a consumer
+ * running on two threads at the same time.
+ *
+ * The throughput case benchmarks the ring against the FIFO, which masks the interrupts in every
+ * operation. The file defines the critical sections itself, which time how long the interrupts
+ * would be masked with the time stamp counter of the host, so it runs without the library.
+ */
+
+#include "test.h"
+#include <knabberkiste/util/ring.h>
+#include <knabberkiste/util/fifo.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <x86intrin.h>
+
+#define TEST_RING_SIZE 16
+#define TEST_CONCURRENT_ELEMENTS 2000000
+#define TEST_BENCHMARK_ELEMENTS 1000000
+#define TEST_BENCHMARK_REPETITIONS 5
+
+// Large enough that a torn copy would be noticed, and not a multiple of a word
+typedef struct {
+    uint64_t sequence;
+    uint64_t inverted;
+    uint32_t checksum;
+    uint8_t tail[5];
+} TEST_Element_t;
+
+static TEST_Element_t test_element(uint64_t sequence) {
+    TEST_Element_t element = { .sequence = sequence, .inverted = ~sequence, .checksum = (uint32_t)(sequence * 2654435761u) };
+    for(size_t i = 0; i < sizeof(element.tail); i++) element.tail[i] = (uint8_t)(sequence + i);
+    return element;
+}
+
+static bool test_element_valid(const TEST_Element_t* element, uint64_t sequence) {
+    TEST_Element_t expected = test_element(sequence);
+    return element->sequence == expected.sequence &&
+        element->inverted == expected.inverted &&
+        element->checksum == expected.checksum &&
+        memcmp(element->tail, expected.tail, sizeof(expected.tail)) == 0;
+}
+
+/* Critical sections, which record how long the interrupts would be masked */
+static uint32_t test_critical_depth = 0;
+static uint64_t test_critical_start = 0;
+static uint64_t test_critical_count = 0;
+static uint64_t test_critical_cycles = 0;
+static uint64_t test_critical_max_cycles = 0;
+
+__attribute__((noinline))
+void critical_enter() {
+    if(test_critical_depth++ == 0) test_critical_start = __rdtsc();
+}
+
+__attribute__((noinline))
+void critical_exit() {
+    if(--test_critical_depth != 0) return;
+
+    uint64_t cycles = __rdtsc() - test_critical_start;
+    test_critical_count++;
+    test_critical_cycles += cycles;
+    if(cycles > test_critical_max_cycles) test_critical_max_cycles = cycles;
+}
+
+static double test_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* Single thread */
+static void test_order(void) {
+    ring_declare_qualifier(TEST_Element_t, ring, TEST_RING_SIZE, static);
+    TEST_Element_t element;
+
+    TEST_ASSERT_EQUAL(TEST_RING_SIZE, ring_get_size(ring));
+    TEST_ASSERT(ring_empty(ring));
+    TEST_ASSERT(!ring_get(ring, element));
+
+    // Several rounds, so the indices wrap around the buffer
+    uint64_t put = 0;
+    uint64_t taken = 0;
+    for(int round = 0; round < 5; round++) {
+        while(!ring_full(ring)) {
+            element = test_element(put++);
+            TEST_ASSERT(ring_put(ring, element));
+        }
+        TEST_ASSERT_EQUAL(TEST_RING_SIZE, ring_get_element_count(ring));
+        element = test_element(put);
+        TEST_ASSERT(!ring_put(ring, element));
+
+        // Leave a few elements in the ring
+        for(int i = 0; i < TEST_RING_SIZE - 3; i++) {
+            TEST_ASSERT(ring_get(ring, element));
+            TEST_ASSERT(test_element_valid(&element, taken++));
+        }
+        TEST_ASSERT_EQUAL(3, ring_get_element_count(ring));
+    }
+
+    while(ring_get(ring, element)) TEST_ASSERT(test_element_valid(&element, taken++));
+    TEST_ASSERT_EQUAL(put, taken);
+    TEST_ASSERT(ring_empty(ring));
+}
+
+static void test_index_overflow(void) {
+    // The indices count the elements ever put and taken, so they eventually overflow
+    ring_declare_qualifier(uint32_t, ring, 4, static);
+    ring._ring._head = SIZE_MAX - 1;
+    ring._ring._tail = SIZE_MAX - 1;
+
+    uint32_t value = 0;
+    for(uint32_t i = 0; i < 4; i++) {
+        value = i;
+        TEST_ASSERT(ring_put(ring, value));
+    }
+    TEST_ASSERT(ring_full(ring));
+    TEST_ASSERT(!ring_put(ring, value));
+    TEST_ASSERT_EQUAL(4, ring_get_element_count(ring));
+
+    for(uint32_t i = 0; i < 4; i++) {
+        TEST_ASSERT(ring_get(ring, value));
+        TEST_ASSERT_EQUAL(i, value);
+    }
+    TEST_ASSERT(ring_empty(ring));
+    TEST_ASSERT_EQUAL(2, ring._ring._head);
+}
+
+/* Two threads */
+ring_declare_qualifier(TEST_Element_t, test_shared_ring, TEST_RING_SIZE, static);
+static volatile uint64_t test_full_count = 0;
+
+static void* test_producer(void* argument) {
+    uint64_t full = 0;
+
+    for(uint64_t sequence = 0; sequence < TEST_CONCURRENT_ELEMENTS; sequence++) {
+        TEST_Element_t element = test_element(sequence);
+        while(!ring_put(test_shared_ring, element)) {
+            // Let the consumer run, even if both threads share a single CPU
+            full++;
+            sched_yield();
+        }
+    }
+
+    test_full_count = full;
+    return 0;
+}
+
+static void test_concurrent(void) {
+    pthread_t producer;
+    TEST_ASSERT(pthread_create(&producer, 0, test_producer, 0) == 0);
+
+    // Consume on this thread while the producer is running
+    uint64_t empty = 0;
+    for(uint64_t sequence = 0; sequence < TEST_CONCURRENT_ELEMENTS; sequence++) {
+        TEST_Element_t element;
+        while(!ring_get(test_shared_ring, element)) {
+            empty++;
+            sched_yield();
+        }
+
+        if(!test_element_valid(&element, sequence)) {
+            TEST_FAIL("Element %llu is corrupted or out of order (sequence %llu).",
+                (unsigned long long)sequence, (unsigned long long)element.sequence);
+        }
+    }
+
+    TEST_ASSERT(pthread_join(producer, 0) == 0);
+    TEST_ASSERT(ring_empty(test_shared_ring));
+
+    // Both sides must have had to wait for the other, otherwise the threads didn't overlap
+    printf("%d elements, producer found the ring full %llu times, consumer found it empty %llu times\n",
+        TEST_CONCURRENT_ELEMENTS, (unsigned long long)test_full_count, (unsigned long long)empty);
+    TEST_ASSERT(test_full_count > 0 || empty > 0);
+}
+
+/* Benchmark */
+typedef struct {
+    double operations_per_second;
+    // Per operation, in host cycles
+    double masked_cycles;
+    uint64_t max_masked_cycles;
+} TEST_BenchmarkResult_t;
+
+static void test_benchmark_reset(void) {
+    test_critical_count = 0;
+    test_critical_cycles = 0;
+    test_critical_max_cycles = 0;
+}
+
+static TEST_BenchmarkResult_t test_benchmark_result(double seconds, const TEST_BenchmarkResult_t* best, int repetition) {
+    // A put and a get per element
+    TEST_BenchmarkResult_t result = {
+        .operations_per_second = 2.0 * TEST_BENCHMARK_ELEMENTS / seconds,
+        .masked_cycles = (double)test_critical_cycles / (2.0 * TEST_BENCHMARK_ELEMENTS),
+        .max_masked_cycles = test_critical_max_cycles
+    };
+    if(repetition == 0) return result;
+
+    // Every value of the best run, as the host preempts the benchmark every now and then
+    if(best->operations_per_second > result.operations_per_second) result.operations_per_second = best->operations_per_second;
+    if(best->masked_cycles < result.masked_cycles) result.masked_cycles = best->masked_cycles;
+    if(best->max_masked_cycles < result.max_masked_cycles) result.max_masked_cycles = best->max_masked_cycles;
+    return result;
+}
+
+static void test_throughput(void) {
+    ring_declare_qualifier(TEST_Element_t, ring, TEST_RING_SIZE, static);
+    fifo_declare_qualifier(TEST_Element_t, fifo, TEST_RING_SIZE, static);
+    TEST_BenchmarkResult_t ring_result = { 0 };
+    TEST_BenchmarkResult_t fifo_result = { 0 };
+    uint64_t ring_checksum = 0;
+    uint64_t fifo_checksum = 0;
+
+    // The best of a few runs, which is least disturbed by other processes. Half the capacity is
+    // kept filled, like a queue which the consumer drains every now and then.
+    for(int repetition = 0; repetition < TEST_BENCHMARK_REPETITIONS; repetition++) {
+        TEST_Element_t element = test_element(0);
+
+        test_benchmark_reset();
+        double start = test_seconds();
+        for(uint64_t i = 0; i < TEST_BENCHMARK_ELEMENTS; i++) {
+            element.sequence = i;
+            if(!ring_put(ring, element)) TEST_FAIL("The ring is full.");
+            if(i >= TEST_RING_SIZE / 2) {
+                ring_get(ring, element);
+                ring_checksum += element.sequence;
+            }
+        }
+        ring_result = test_benchmark_result(test_seconds() - start, &ring_result, repetition);
+        TEST_ASSERT_EQUAL(0, test_critical_count);
+        while(ring_get(ring, element)) ring_checksum += element.sequence;
+
+        test_benchmark_reset();
+        start = test_seconds();
+        for(uint64_t i = 0; i < TEST_BENCHMARK_ELEMENTS; i++) {
+            element.sequence = i;
+            if(!fifo_try_put(fifo, element)) TEST_FAIL("The FIFO is full.");
+            if(i >= TEST_RING_SIZE / 2) {
+                fifo_try_get(fifo, element);
+                fifo_checksum += element.sequence;
+            }
+        }
+        fifo_result = test_benchmark_result(test_seconds() - start, &fifo_result, repetition);
+        TEST_ASSERT_EQUAL(2 * TEST_BENCHMARK_ELEMENTS - TEST_RING_SIZE / 2, test_critical_count);
+        while(fifo_try_get(fifo, element)) fifo_checksum += element.sequence;
+    }
+
+    printf("%8s %14s %22s %22s\n", "", "Mops/s", "masked cycles per op", "longest masked cycles");
+    printf("%8s %14.1f %22.1f %22llu\n", "ring", ring_result.operations_per_second / 1e6,
+        ring_result.masked_cycles, (unsigned long long)ring_result.max_masked_cycles);
+    printf("%8s %14.1f %22.1f %22llu\n", "fifo", fifo_result.operations_per_second / 1e6,
+        fifo_result.masked_cycles, (unsigned long long)fifo_result.max_masked_cycles);
+
+    // Both queues moved the same elements, the ring without masking the interrupts and not slower
+    TEST_ASSERT_EQUAL(ring_checksum, fifo_checksum);
+    TEST_ASSERT(ring_result.masked_cycles == 0);
+    TEST_ASSERT(ring_result.operations_per_second >= fifo_result.operations_per_second * 0.95);
+}
+
+TEST_MAIN(
+    TEST_CASE(order),
+    TEST_CASE(index_overflow),
+    TEST_CASE(concurrent),
+    TEST_CASE(throughput)
+)
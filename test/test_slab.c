@@ -0,0 +1,85 @@
+/**
+ * @file test_slab.c
+ * @author Gabriel Heinzer
+ * @brief Tests the slab allocator. It enters critical sections, so the cases run on a simulated node.
+ */
+
+#include "test.h"
+#include <knabberkiste/util/slab.h>
+
+#define TEST_BLOCK_SIZE 13
+#define TEST_BLOCK_COUNT 32
+
+slab_declare_qualifier(test_slab, TEST_BLOCK_SIZE, TEST_BLOCK_COUNT, static);
+
+static uint8_t* test_blocks[TEST_BLOCK_COUNT];
+
+static void test_fill(uint8_t* block, uint8_t value) {
+    memset(block, value, TEST_BLOCK_SIZE);
+}
+
+static bool test_filled(const uint8_t* block, uint8_t value) {
+    for(size_t i = 0; i < TEST_BLOCK_SIZE; i++) {
+        if(block[i] != value) return false;
+    }
+    return true;
+}
+
+/* Test cases */
+static void test_exhaust_node(void) {
+    // Blocks are rounded up to whole pointers
+    TEST_ASSERT_EQUAL(16, slab_get_block_size(test_slab));
+    TEST_ASSERT_EQUAL(TEST_BLOCK_COUNT, slab_get_block_count(test_slab));
+    TEST_ASSERT_EQUAL(0, slab_get_used_count(test_slab));
+
+    // Allocate until exhausted, every block is aligned and doesn't overlap any other
+    for(size_t i = 0; i < TEST_BLOCK_COUNT; i++) {
+        TEST_ASSERT(!slab_exhausted(test_slab));
+        test_blocks[i] = slab_alloc(test_slab);
+        TEST_ASSERT(test_blocks[i] != 0);
+        TEST_ASSERT_EQUAL(0, (uintptr_t)test_blocks[i] % sizeof(void*));
+        test_fill(test_blocks[i], (uint8_t)i);
+        TEST_ASSERT_EQUAL(i + 1, slab_get_used_count(test_slab));
+    }
+    for(size_t i = 0; i < TEST_BLOCK_COUNT; i++) TEST_ASSERT(test_filled(test_blocks[i], (uint8_t)i));
+
+    TEST_ASSERT(slab_exhausted(test_slab));
+    TEST_ASSERT(slab_alloc(test_slab) == 0);
+    TEST_ASSERT(slab_alloc(test_slab) == 0);
+    TEST_ASSERT_EQUAL(2, slab_get_exhausted_count(test_slab));
+    TEST_ASSERT_EQUAL(TEST_BLOCK_COUNT, slab_get_used_count(test_slab));
+
+    // Free every other block, the others must stay untouched
+    for(size_t i = 0; i < TEST_BLOCK_COUNT; i += 2) slab_free(test_slab, test_blocks[i]);
+    TEST_ASSERT_EQUAL(TEST_BLOCK_COUNT / 2, slab_get_used_count(test_slab));
+    for(size_t i = 1; i < TEST_BLOCK_COUNT; i += 2) TEST_ASSERT(test_filled(test_blocks[i], (uint8_t)i));
+
+    // Null pointers are ignored
+    slab_free(test_slab, 0);
+    TEST_ASSERT_EQUAL(TEST_BLOCK_COUNT / 2, slab_get_used_count(test_slab));
+
+    // The freed blocks are handed out again, most recently freed first
+    for(size_t i = TEST_BLOCK_COUNT; i >= 2; i -= 2) {
+        uint8_t* block = slab_alloc(test_slab);
+        TEST_ASSERT(block == test_blocks[i - 2]);
+        test_fill(block, 0xA5);
+    }
+    TEST_ASSERT(slab_exhausted(test_slab));
+    TEST_ASSERT(slab_alloc(test_slab) == 0);
+    TEST_ASSERT_EQUAL(3, slab_get_exhausted_count(test_slab));
+    for(size_t i = 1; i < TEST_BLOCK_COUNT; i += 2) TEST_ASSERT(test_filled(test_blocks[i], (uint8_t)i));
+
+    // Free everything, then the whole slab can be allocated once more
+    for(size_t i = 0; i < TEST_BLOCK_COUNT; i++) slab_free(test_slab, test_blocks[i]);
+    TEST_ASSERT_EQUAL(0, slab_get_used_count(test_slab));
+    for(size_t i = 0; i < TEST_BLOCK_COUNT; i++) TEST_ASSERT(slab_alloc(test_slab) != 0);
+    TEST_ASSERT(slab_exhausted(test_slab));
+}
+
+static void test_exhaust(void) {
+    test_in_node(test_exhaust_node);
+}
+
+TEST_MAIN(
+    TEST_CASE(exhaust)
+)
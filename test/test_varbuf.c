@@ -0,0 +1,127 @@
+/**
+ * @file test_varbuf.c
+ * @author Gabriel Heinzer
+ * @brief Benchmarks pushing onto varbufs, which must take amortized constant time per element.
+ * varbufs enter critical sections, so the cases run on a simulated node.
+ */
+
+#include "test.h"
+#include <knabberkiste/util/varbuf.h>
+#include <time.h>
+
+#define TEST_GROWTH_LENGTH 100000
+#define TEST_MIN_LENGTH (1 << 10)
+#define TEST_MAX_LENGTH (1 << 20)
+#define TEST_REPETITIONS 3
+
+// A quadratic push would be slower by the ratio of the lengths, i.e. a thousand times
+#define TEST_MAX_SLOWDOWN 4.0
+
+static size_t test_log2_ceil(size_t value) {
+    size_t log = 0;
+    while(((size_t)1 << log) < value) log++;
+    return log;
+}
+
+static double test_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* Test cases */
+static void test_growth_node(void) {
+    uint32_t* buf = 0;
+    size_t reallocations = 0;
+    size_t moved = 0;
+
+    for(uint32_t i = 0; i < TEST_GROWTH_LENGTH; i++) {
+        size_t capacity = varbuf_capacity(buf);
+        varbuf_push(buf, i);
+
+        // Every change of the capacity is a reallocation, which may move all the elements
+        if(varbuf_capacity(buf) != capacity) {
+            if(capacity > 0) TEST_ASSERT(varbuf_capacity(buf) >= 2 * capacity);
+            reallocations++;
+            moved += i;
+        }
+        TEST_ASSERT(varbuf_length(buf) <= varbuf_capacity(buf));
+    }
+
+    TEST_ASSERT_EQUAL(TEST_GROWTH_LENGTH, varbuf_length(buf));
+    for(uint32_t i = 0; i < TEST_GROWTH_LENGTH; i++) TEST_ASSERT_EQUAL(i, buf[i]);
+
+    printf("%d pushes: %zu reallocations, %zu elements moved\n", TEST_GROWTH_LENGTH, reallocations, moved);
+    TEST_ASSERT(reallocations <= test_log2_ceil(TEST_GROWTH_LENGTH) + 1);
+
+    // Doubling moves fewer elements than twice the final length in total
+    TEST_ASSERT(moved < 2 * TEST_GROWTH_LENGTH);
+
+    // Alternating pushes and pops at a full buffer don't reallocate every time
+    size_t capacity = varbuf_capacity(buf);
+    while(varbuf_length(buf) < capacity) varbuf_push(buf, capacity);
+    reallocations = 0;
+    for(int i = 0; i < 100; i++) {
+        uint32_t value = i;
+        size_t before = varbuf_capacity(buf);
+        varbuf_push(buf, value);
+        varbuf_pop_end(buf, &value);
+        TEST_ASSERT_EQUAL(i, value);
+        if(varbuf_capacity(buf) != before) reallocations++;
+    }
+    TEST_ASSERT(reallocations <= 1);
+
+    // Popping everything shrinks the buffer a logarithmic number of times and frees it
+    reallocations = 0;
+    while(varbuf_length(buf) > 0) {
+        uint32_t value;
+        size_t before = varbuf_capacity(buf);
+        varbuf_pop_end(buf, &value);
+        if(varbuf_capacity(buf) != before) reallocations++;
+    }
+    TEST_ASSERT(reallocations <= test_log2_ceil(TEST_GROWTH_LENGTH) + 1);
+    TEST_ASSERT(buf == 0);
+}
+
+static void test_growth(void) {
+    test_in_node(test_growth_node);
+}
+
+static void test_amortized_node(void) {
+    double fastest = 0;
+    double slowest = 0;
+
+    printf("%10s %12s\n", "length", "ns per push");
+    for(size_t length = TEST_MIN_LENGTH; length <= TEST_MAX_LENGTH; length *= 4) {
+        double best = 0;
+
+        // The best of a few runs, which is least disturbed by other processes
+        for(int repetition = 0; repetition < TEST_REPETITIONS; repetition++) {
+            uint32_t* buf = 0;
+            double start = test_seconds();
+            for(uint32_t i = 0; i < length; i++) varbuf_push(buf, i);
+            double elapsed = test_seconds() - start;
+
+            TEST_ASSERT_EQUAL(length, varbuf_length(buf));
+            varbuf_clear(buf);
+            if(repetition == 0 || elapsed < best) best = elapsed;
+        }
+
+        double per_push = best / length;
+        printf("%10zu %12.1f\n", length, per_push * 1e9);
+        if(length == TEST_MIN_LENGTH || per_push < fastest) fastest = per_push;
+        if(length == TEST_MIN_LENGTH || per_push > slowest) slowest = per_push;
+    }
+
+    // The time per push stays flat while the length grows a thousandfold
+    TEST_ASSERT(slowest <= fastest * TEST_MAX_SLOWDOWN);
+}
+
+static void test_amortized(void) {
+    test_in_node(test_amortized_node);
+}
+
+TEST_MAIN(
+    TEST_CASE(growth),
+    TEST_CASE(amortized)
+)